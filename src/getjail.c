@@ -36,52 +36,286 @@
  *
  */
 
+#include <sys/types.h>
+#include <sys/stat.h>
+
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <unistd.h>
 #include <fcntl.h>
+#include <err.h>
 #include "getjail.h"
 
 #define 	PROC_STATUS_PATH	"/proc/%d/status"
+#define		PROC_STATUS_NAME	"status"
+
+/* Status lines are usually well under this */
+#define		STATUS_BUFF_SIZE	1024
+
+static char g_statusBuff[STATUS_BUFF_SIZE];
+
+jailstats g_jailstats = { 0, 0 };
+
+/* Result of the last scanjails() */
+static pidjail* g_map = NULL;
+static int g_mapSize = 0;
+
+/*
+ * Jail names seen so far, the map points into these. An open
+ * addressing hash set, so that a jail's processes can be counted
+ * without comparing every name against every other.
+ */
+static jailname* g_names = NULL;
+static int g_namesSize = 0;
+static int g_numNames = 0;
+
+/* Jails in the last scan, handed out by listjailnames() */
+static jailname* g_list = NULL;
+static int g_listSize = 0;
+
+/*
+ * Read a procfs status file and put the jail name, which is the
+ * last token on the line, into buff. Long lines are read in chunks
+ * keeping just the tail around.
+ */
+static int readjail(int fd, char* buff)
+{
+	size_t len = 0;
+	off_t off = 0;
+	ssize_t bytes;
+	char* end;
+	char* start;
+
+	for(;;)
+	{
+		bytes = pread(fd, g_statusBuff + len, STATUS_BUFF_SIZE - 1 - len, off);
+		g_jailstats.syscalls++;
+		if(bytes < 0)
+			return -1;
+
+		off += bytes;
+		len += bytes;
+
+		if(bytes == 0 || len < STATUS_BUFF_SIZE - 1)
+			break;
+
+		/* Full buffer, keep the tail and read some more */
+		memmove(g_statusBuff, g_statusBuff + len - JAIL_BUFF_SIZE, JAIL_BUFF_SIZE);
+		len = JAIL_BUFF_SIZE;
+	}
+
+	/* Okay now jailname should be the last token */
+	end = g_statusBuff + len;
+	while(end > g_statusBuff && isspace(end[-1]))
+		end--;
+
+	start = end;
+	while(start > g_statusBuff && !isspace(start[-1]))
+		start--;
+
+	if(start == end || end - start >= JAIL_BUFF_SIZE)
+		return -1;
+
+	memcpy(buff, start, end - start);
+	buff[end - start] = 0;
+	return 0;
+}
 
 int getpidjail(pid_t pid, char* buff)
 {
 	int fd;
-	size_t bytes;
-	off_t off;
+	int ret;
 
 	/* Format the file name */
-	if(snprintf(buff, JAIL_BUFF_SIZE, PROC_STATUS_PATH, pid))
+	snprintf(buff, JAIL_BUFF_SIZE, PROC_STATUS_PATH, pid);
+
+	/* Open the file */
+	g_jailstats.syscalls += 2;
+	if((fd = open(buff, O_RDONLY)) < 0)
+		return -1;
+
+	ret = readjail(fd, buff);
+	close(fd);
+
+	return ret;
+}
+
+static unsigned int hashName(const char* name)
+{
+	/* FNV-1a */
+	unsigned int hash = 2166136261U;
+
+	while(*name)
+	{
+		hash ^= (unsigned char)*name++;
+		hash *= 16777619U;
+	}
+
+	return hash;
+}
+
+static jailname* findName(jailname* names, int size, const char* name)
+{
+	unsigned int i = hashName(name) & (size - 1);
+
+	/* Linear probing, the table is never more than half full */
+	while(names[i].name && strcmp(names[i].name, name))
+		i = (i + 1) & (size - 1);
+
+	return names + i;
+}
+
+static const char* internJail(const char* jailName)
+{
+	jailname* names;
+	jailname* slot;
+	int size, i;
+
+	if(g_numNames * 2 >= g_namesSize)
 	{
-		/* Open the file */
-		if((fd = open(buff, O_RDONLY)) >= 0)
+		size = g_namesSize ? g_namesSize * 2 : 64;
+		names = (jailname*)calloc(size, sizeof(jailname));
+		g_jailstats.allocs++;
+		if(!names)
+			errx(1, "out of memory");
+
+		for(i = 0; i < g_namesSize; i++)
 		{
-			/* Seek to the last bit */
-			off = lseek(fd, SEEK_END, 0);
+			if(g_names[i].name)
+				*findName(names, size, g_names[i].name) = g_names[i];
+		}
+
+		free(g_names);
+		g_names = names;
+		g_namesSize = size;
+	}
 
-			if(off != -1)
-			{
-				off -= JAIL_BUFF_SIZE;
-				if(off < 0) off = 0;
-				lseek(fd, SEEK_SET, off);
+	slot = findName(g_names, g_namesSize, jailName);
+
+	if(!slot->name)
+	{
+		if((slot->name = strdup(jailName)) == NULL)
+			errx(1, "out of memory");
+		g_jailstats.allocs++;
+		g_numNames++;
+	}
+
+	slot->count++;
+	return slot->name;
+}
+
+static int comparePids(const void* a, const void* b)
+{
+	pid_t pa = ((const pidjail*)a)->pid;
+	pid_t pb = ((const pidjail*)b)->pid;
+	return pa < pb ? -1 : (pa > pb ? 1 : 0);
+}
+
+int scanjails(const char* procDir, pidjail** map)
+{
+	DIR* dir;
+	struct dirent* ent;
+	char jailName[JAIL_BUFF_SIZE];
+	char path[MAXPATHLEN];
+	int dfd, fd;
+	int count = 0;
+	int sorted = 1;
+	int ret, i;
+	char* e;
+	long pid;
+
+	/* Directory reads are buffered by libc, only count open and close */
+	g_jailstats.syscalls += 2;
+	if((dir = opendir(procDir)) == NULL)
+		return -1;
+
+	/* Counts are per scan, names stick around */
+	for(i = 0; i < g_namesSize; i++)
+		g_names[i].count = 0;
+
+	dfd = dirfd(dir);
+
+	while((ent = readdir(dir)) != NULL)
+	{
+		/* Only the numeric entries are processes */
+		pid = strtol(ent->d_name, &e, 10);
+		if(*e || e == ent->d_name || pid <= 0)
+			continue;
 
-				if((bytes = read(fd, buff, JAIL_BUFF_SIZE - 1)) > 0)
-				{
-					/* Okay now jailname should be the last token */
-					while(isspace(buff[bytes - 1]))
-						bytes--;
+		snprintf(path, sizeof(path), "%s/" PROC_STATUS_NAME, ent->d_name);
 
-					buff[bytes] = 0;
+		/* The process may be gone by now */
+		g_jailstats.syscalls++;
+		if((fd = openat(dfd, path, O_RDONLY)) < 0)
+			continue;
 
-					while(!isspace(buff[bytes - 1]))
-						bytes--;
+		ret = readjail(fd, jailName);
+		close(fd);
+		g_jailstats.syscalls++;
 
-					memmove(buff, buff + bytes, JAIL_BUFF_SIZE - bytes);
-					return 0;
+		if(ret < 0 || !strcmp(jailName, "-"))
+			continue;
 
-				}
-			}
+		if(count >= g_mapSize)
+		{
+			g_mapSize = g_mapSize ? g_mapSize * 2 : 256;
+			g_map = (pidjail*)realloc(g_map, g_mapSize * sizeof(pidjail));
+			g_jailstats.allocs++;
+			if(!g_map)
+				errx(1, "out of memory");
 		}
+
+		if(count > 0 && g_map[count - 1].pid > pid)
+			sorted = 0;
+
+		g_map[count].pid = (pid_t)pid;
+		g_map[count].jail = internJail(jailName);
+		count++;
+	}
+
+	closedir(dir);
+
+	/* procfs hands out pids in order, but don't count on it */
+	if(!sorted)
+		qsort(g_map, count, sizeof(pidjail), comparePids);
+
+	*map = g_map;
+	return count;
+}
+
+const char* lookupjail(const pidjail* map, int count, pid_t pid)
+{
+	pidjail key;
+	const pidjail* found;
+
+	key.pid = pid;
+	found = (const pidjail*)bsearch(&key, map, count, sizeof(pidjail), comparePids);
+
+	return found ? found->jail : NULL;
+}
+
+int listjailnames(jailname** names)
+{
+	int i, n;
+
+	if(g_numNames > g_listSize)
+	{
+		g_listSize = g_numNames;
+		g_list = (jailname*)realloc(g_list, g_listSize * sizeof(jailname));
+		g_jailstats.allocs++;
+		if(!g_list)
+			errx(1, "out of memory");
+	}
+
+	for(i = 0, n = 0; i < g_namesSize; i++)
+	{
+		if(g_names[i].name && g_names[i].count > 0)
+			g_list[n++] = g_names[i];
 	}
 
-	return -1;
+	*names = g_list;
+	return n;
 }
@@ -44,10 +44,52 @@
 #include <sys/param.h>
 #include <sys/types.h>
 
-#define		JAIL_BUFF_SIZE		MAXHOSTNAMELEN + 2
+#define		JAIL_BUFF_SIZE		(MAXHOSTNAMELEN + 2)
 
+#define		PROC_PATH			"/proc"
+
+/* Work done by the functions below, for reporting */
+typedef struct jailstats
+{
+	unsigned long syscalls;
+	unsigned long allocs;
+}
+jailstats;
+
+extern jailstats g_jailstats;
+
+/* A jail and how many processes it has */
+typedef struct jailname
+{
+	const char* name;
+	int count;
+}
+jailname;
+
+/* A jailed process as found by scanjails() */
+typedef struct pidjail
+{
+	pid_t pid;
+	const char* jail;
+}
+pidjail;
+
+/* Look up a single process' jail name */
 int getpidjail(pid_t pid, char* buff);
 
+/*
+ * Read the jail of every process under procDir in one pass. Returns
+ * the number of jailed processes, sorted by pid, or -1. The map is
+ * reused by the next scan.
+ */
+int scanjails(const char* procDir, pidjail** map);
+
+/* Find a process in a map from scanjails() */
+const char* lookupjail(const pidjail* map, int count, pid_t pid);
+
+/* The jails found by the last scanjails(), in no particular order */
+int listjailnames(jailname** names);
+
 
 
 #endif	/* _GETJAIL_H_ */
@@ -37,19 +37,14 @@
  */
 
 #include <sys/types.h>
-#include <sys/stat.h>
 #include <sys/param.h>
-#include <sys/sysctl.h>
-#include <sys/proc.h>
-#include <sys/user.h>
 
-#include <paths.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include <err.h>
 #include <errno.h>
-#include <kvm.h>
-#include <limits.h>
-#include <fcntl.h>
 
 #include "getjail.h"
 
@@ -57,117 +52,74 @@
 #include "../config.h"
 #endif
 
-static int listJails();
+static int listJails(int counts);
 static void usage();
 
 int main(int argc, char* argv[])
 {
-	/* Nice main :) */
-	return listJails() >= 0 ? 0 : 1;
-}
-
-
-int listJails()
-{
-	kvm_t *kd;
-	struct kinfo_proc* kp;
-	char errbuf[_POSIX2_LINE_MAX];
-	char jailName[JAIL_BUFF_SIZE];
-	int nentries, i;
-
-
-	char* jails = NULL;		/* jail list buffer */
-	size_t nextJail = 0;	/* current write positon */
-	size_t endJails = 0;	/* size of buffer */
-	int numJails = 0;		/* return value */
-
-
-	/* Open kernel interface */
-	kd = kvm_openfiles(_PATH_DEVNULL, _PATH_DEVNULL, _PATH_DEVNULL,
-					   O_RDONLY, errbuf);
-	if(kd == 0)
-		errx(1, "%s", errbuf);
+	/* Print the number of processes in each jail */
+	int counts = 0;
+	int ch;
 
-	/* Get a process listing */
-	if((kp = kvm_getprocs(kd, KERN_PROC_ALL, 0, &nentries)) == 0)
-		errx(1, "%s", kvm_geterr(kd));
-
-
-	/* Okay now loop through and look for the jails */
-	for(i = 0; i < nentries; i++)
+	while((ch = getopt(argc, argv, "c")) != -1)
 	{
-		pid_t pid;
-
-#if __FreeBSD_version > 500000
-
-		/* Check the flags first */
-		if(!(kp[i].ki_flag & P_JAILED))
-			continue;
-
-		pid = kp[i].ki_pid;
-
-#else
-
-		/* Check the flags first */
-		if(!(kp[i].kp_proc.p_flag & P_JAILED))
-			continue;
-
-		pid = kp[i].kp_proc.p_pid;
+		switch(ch)
+		{
+		case 'c':
+			counts = 1;
+			break;
 
-#endif
+		case '?':
+		default:
+			usage();
+		}
+	}
 
-		/* Get this processes jail name */
-		if(getpidjail(pid, jailName) < 0)
-			continue;
+	argc -= optind;
+	argv += optind;
 
-		if(jails)
-		{
-			char* j;
-
-			/* See if that jail name was already taken */
-			for(j = jails; *j != NULL; j += strlen(j) + 1)
-			{
-				if(!strcmp(jailName, j))
-					break;
-			}
-
-			/* Can't do this in loop above */
-			if(*j)
-				continue;
-		}
+	if(argc != 0)
+		usage();
 
+	return listJails(counts) >= 0 ? 0 : 1;
+}
 
-		/* Okay we got a jail name */
+static int compareNames(const void* a, const void* b)
+{
+	return strcmp(((const jailname*)a)->name, ((const jailname*)b)->name);
+}
 
+int listJails(int counts)
+{
+	pidjail* map;
+	jailname* jails;
+	int numJails, i;
 
-		/* Allocate if necessary enough space for it */
-		if(nextJail + strlen(jailName) + 2 > endJails)
-		{
-			endJails += (JAIL_BUFF_SIZE * 0x2);
-			jails = (char*)realloc(jails, endJails);
-			if(!jails)
-				errx(1, "out of memory");
-		}
+	/*
+	 * One pass over procfs finds every jailed process, and the jail
+	 * names come out of it already deduplicated and counted.
+	 */
+	if(scanjails(PROC_PATH, &map) < 0)
+		err(1, "couldn't read " PROC_PATH);
 
+	numJails = listjailnames(&jails);
 
-		/* Put the jail name in the buffer */
-		strcpy(jails + nextJail, jailName);
-		nextJail += strlen(jailName) + 1;
-		jails[nextJail] = 0;
-		numJails++;
+	/* Keep the output the same from run to run */
+	qsort(jails, numJails, sizeof(jailname), compareNames);
 
-		/* And print it */
-		fprintf(stdout, "%s\n", jailName);
+	for(i = 0; i < numJails; i++)
+	{
+		if(counts)
+			fprintf(stdout, "%s %d\n", jails[i].name, jails[i].count);
+		else
+			fprintf(stdout, "%s\n", jails[i].name);
 	}
 
-	kvm_close(kd);
-
 	return numJails;
 }
 
 static void usage()
 {
-	fprintf(stderr, "usage: jails\n");
+	fprintf(stderr, "usage: jails [-c]\n");
 	exit(2);
 }
-
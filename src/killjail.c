@@ -42,10 +42,17 @@
 #include <sys/sysctl.h>
 #include <sys/proc.h>
 #include <sys/user.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/wait.h>
 
 #include <paths.h>
 #include <signal.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <syslog.h>
 #include <err.h>
 #include <errno.h>
@@ -67,6 +74,11 @@ static int stopJail(char* jailName, int force);
 /* Signals the jailer for various requests */
 static int signalJail(char* jailName, int signal);
 
+/* Asks jailer over its control socket and waits for the answer */
+static int requestJail(const char* jailName, const char* request);
+static int connectJailer(const char* jailName);
+static pid_t getJailerPid(const char* jailName);
+
 static void killProcesses(pid_t* pids, int signal);
 static int getJailProcesses(const char* jailName, pid_t* pidJailer, pid_t** pids);
 
@@ -77,12 +89,48 @@ static void usage();
 #define		DEFAULT_TIMEOUT		10
 int g_timeout = DEFAULT_TIMEOUT;
 
+/* How long jailer has to say something on its control socket */
+#define		DEFAULT_WAIT		60
+int g_wait = DEFAULT_WAIT;
+
 /* To find the jailer process look for this command */
 #define		JAILER_COMMAND		"jailer"
 
+/* Where jailer listens and keeps its pid, relative to the jail root */
+#define		JAILER_SOCKET		"/var/run/jailer.sock"
+#define		JAILER_PIDFILE		"/var/run/jailer.pid"
+
+/* The jail's root directory, when given */
+char* g_jailDir = NULL;
+
 /* Supress warnings */
 int g_quiet = 0;
 
+/* Report the work done on each pass */
+int g_verbose = 0;
+
+/* Kernel interface, kept open between passes */
+static kvm_t* g_kd = NULL;
+
+/* What a previous pass found out about a jailed process */
+typedef struct pidcache
+{
+	pid_t pid;
+	struct timeval start;
+	int inJail;
+}
+pidcache;
+
+/* Sorted by pid, for the jail named in g_cacheJail */
+static pidcache* g_cache = NULL;
+static int g_cacheCount = 0;
+static const char* g_cacheJail = NULL;
+
+/* Pooled arrays, all g_poolSize long */
+static pidcache* g_nextCache = NULL;
+static pid_t* g_pids = NULL;
+static int g_poolSize = 0;
+
 int main(int argc, char* argv[])
 {
 	/* If this gets set then only signal jailer, no kill */
@@ -91,10 +139,15 @@ int main(int argc, char* argv[])
 	int force = 0;
 	int ret = 0;
 
-	while((ch = getopt(argc, argv, "fhqrt:")) != -1)
+	while((ch = getopt(argc, argv, "d:fhqrt:vw:")) != -1)
 	{
 		switch(ch)
 		{
+		/* Where the jail lives, for talking to jailer */
+		case 'd':
+			g_jailDir = optarg;
+			break;
+
 		/* Force jail to shutdown */
 		case 'f':
 			force = 1;
@@ -104,6 +157,10 @@ int main(int argc, char* argv[])
 			g_quiet = 1;
 			break;
 
+		case 'v':
+			g_verbose = 1;
+			break;
+
 		/* Send halt request to jailer */
 		case 'h':
 			signal = SIGQUIT;
@@ -121,6 +178,13 @@ int main(int argc, char* argv[])
 				errx(1, "invalid timeout argument: %s", optarg);
 			break;
 
+		/* How long to wait for each answer from jailer */
+		case 'w':
+			g_wait = atoi(optarg);
+			if(g_wait <= 0)
+				errx(1, "invalid wait argument: %s", optarg);
+			break;
+
 		case '?':
 		default:
 			usage();
@@ -134,6 +198,10 @@ int main(int argc, char* argv[])
 	if(argc == 0)
 		usage();
 
+	/* A jail directory only makes sense for one jail */
+	if(g_jailDir && argc > 1)
+		errx(1, "-d option can only be used with one jail");
+
 	/* For each jail */
 	while(argc > 0)
 	{
@@ -157,6 +225,9 @@ int main(int argc, char* argv[])
 		argv++;
 	}
 
+	if(g_kd)
+		kvm_close(g_kd);
+
 	return ret;
 }
 
@@ -164,9 +235,21 @@ int main(int argc, char* argv[])
 int signalJail(char* jailName, int signal)
 {
 	pid_t jailerPid = 0;
+	int ret;
+
+	/* If jailer has a control socket we can wait for it to finish */
+	if(g_jailDir)
+	{
+		ret = requestJail(jailName, signal == SIGHUP ? "restart" : "halt");
+		if(ret != -1)
+			return ret;
+
+		jailerPid = getJailerPid(jailName);
+	}
 
 	/* Only ask for jailer pid */
-	getJailProcesses(jailName, &jailerPid, NULL);
+	if(jailerPid == 0)
+		getJailProcesses(jailName, &jailerPid, NULL);
 
 	if(jailerPid == 0)
 	{
@@ -181,6 +264,212 @@ int signalJail(char* jailName, int signal)
 }
 
 
+/*
+ * Anything in the jail can put a symlink where the socket should be,
+ * and have us talk to some socket on the host instead. So a child
+ * chroots into the jail, connects from in there, and hands back the
+ * connection. Returns -1 when jailer isn't listening.
+ */
+int connectJailer(const char* jailName)
+{
+	struct sockaddr_un addr;
+	struct msghdr msg;
+	struct cmsghdr* cmsg;
+	struct iovec iov;
+	struct stat sb;
+	char control[CMSG_SPACE(sizeof(int))];
+	int pair[2];
+	int root;
+	int fd = -1;
+	int error = 0;
+	int status;
+	pid_t pid;
+
+	/* Only a real directory, which nobody in a jail can make */
+	if((root = open(g_jailDir, O_RDONLY)) < 0 || fstat(root, &sb) < 0 ||
+	   !S_ISDIR(sb.st_mode) || sb.st_uid != 0)
+	{
+		if(!g_quiet)
+			warnx("%s: not a jail directory: %s", jailName, g_jailDir);
+		if(root >= 0)
+			close(root);
+		return -1;
+	}
+
+	if(socketpair(AF_UNIX, SOCK_STREAM, 0, pair) < 0)
+		err(1, "couldn't create socket");
+
+	switch(pid = fork())
+	{
+	case -1:
+		err(1, "couldn't fork");
+
+	case 0:
+		close(pair[0]);
+
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", JAILER_SOCKET);
+
+		if(fchdir(root) < 0 || chroot(".") < 0 ||
+		   (fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+		   connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+			error = errno;
+
+		memset(&msg, 0, sizeof(msg));
+		iov.iov_base = &error;
+		iov.iov_len = sizeof(error);
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+
+		if(!error)
+		{
+			msg.msg_control = control;
+			msg.msg_controllen = sizeof(control);
+			cmsg = CMSG_FIRSTHDR(&msg);
+			cmsg->cmsg_level = SOL_SOCKET;
+			cmsg->cmsg_type = SCM_RIGHTS;
+			cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+			memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+		}
+
+		_exit(sendmsg(pair[1], &msg, 0) < 0 ? 1 : 0);
+	}
+
+	close(root);
+	close(pair[1]);
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = &error;
+	iov.iov_len = sizeof(error);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	if(recvmsg(pair[0], &msg, 0) != sizeof(error))
+		error = EIO;
+
+	close(pair[0]);
+	waitpid(pid, &status, 0);
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if(!error && cmsg && cmsg->cmsg_level == SOL_SOCKET &&
+	   cmsg->cmsg_type == SCM_RIGHTS)
+		memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+	else if(!error)
+		error = EIO;
+
+	if(error)
+	{
+		/* Not there, or an older jailer. Just use signals */
+		if(error != ENOENT && error != ECONNREFUSED && !g_quiet)
+			warnx("%s: couldn't connect to jailer: %s", jailName, strerror(error));
+		return -1;
+	}
+
+	return fd;
+}
+
+/*
+ * The control socket protocol is line based. We send one of 'stop',
+ * 'halt' or 'restart'. jailer answers 'ack' once it has taken the
+ * request, 'phase <what>' as it moves along, and finally 'ok' or
+ * 'fail <reason>'. Returns -1 when jailer isn't listening.
+ */
+int requestJail(const char* jailName, const char* request)
+{
+	struct timeval tv;
+	char line[256];
+	FILE* f;
+	int fd;
+
+	if((fd = connectJailer(jailName)) < 0)
+		return -1;
+
+	/* A jailer that's stuck shouldn't leave us stuck too */
+	tv.tv_sec = g_wait;
+	tv.tv_usec = 0;
+	if(setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0 ||
+	   setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) < 0)
+		err(1, "couldn't set socket timeout");
+
+	if((f = fdopen(fd, "r+")) == NULL)
+		err(1, "couldn't open socket");
+
+	fprintf(f, "%s\n", request);
+	fflush(f);
+
+	/* No polling, jailer tells us when it's done */
+	while(fgets(line, sizeof(line), f) != NULL)
+	{
+		line[strcspn(line, "\r\n")] = 0;
+
+		if(!strcmp(line, "ok"))
+		{
+			fclose(f);
+			return 0;
+		}
+
+		else if(!strncmp(line, "fail", 4))
+		{
+			if(!g_quiet)
+				warnx("%s: jailer couldn't %s: %s", jailName, request,
+					  line[4] ? line + 5 : "unknown error");
+
+			fclose(f);
+			return 1;
+		}
+
+		else if(g_verbose)
+		{
+			if(!strcmp(line, "ack"))
+				warnx("%s: jailer accepted %s request", jailName, request);
+			else if(!strncmp(line, "phase ", 6))
+				warnx("%s: %s", jailName, line + 6);
+		}
+	}
+
+	if(!g_quiet)
+	{
+		if(ferror(f) && errno == EAGAIN)
+			warnx("%s: jailer said nothing for %d seconds during %s",
+				  jailName, g_wait, request);
+		else
+			warnx("%s: jailer went away before finishing %s", jailName, request);
+	}
+
+	fclose(f);
+	return 1;
+}
+
+/* Read jailer's pid file instead of going through every process */
+pid_t getJailerPid(const char* jailName)
+{
+	char path[MAXPATHLEN];
+	char pidJail[JAIL_BUFF_SIZE];
+	FILE* f;
+	int pid = 0;
+
+	snprintf(path, sizeof(path), "%s%s", g_jailDir, JAILER_PIDFILE);
+
+	if((f = fopen(path, "r")) == NULL)
+		return 0;
+
+	if(fscanf(f, "%d", &pid) != 1)
+		pid = 0;
+
+	fclose(f);
+
+	/* A stale pid file could point anywhere, so check the jail */
+	if(pid <= 0 || getpidjail(pid, pidJail) < 0 ||
+	   strcmp(pidJail, jailName))
+		return 0;
+
+	return (pid_t)pid;
+}
+
+
 int stopJail(char* jailName, int force)
 {
 	pid_t jailerPid = 0;
@@ -212,6 +501,13 @@ int stopJail(char* jailName, int force)
 			/* First pass is killing the jailer */
 			case 0:
 
+				/* jailer tells us when it's done, nothing to wait for */
+				if(g_jailDir && requestJail(jailName, "stop") == 0)
+					break;
+
+				if(jailerPid == 0 && g_jailDir)
+					jailerPid = getJailerPid(jailName);
+
 				if(jailerPid == 0)
 				{
 					/* No jailer */
@@ -274,9 +570,6 @@ int stopJail(char* jailName, int force)
 			pass++;
 		}
 
-		if(jailProcesses)
-			free(jailProcesses);
-
 	}
 
 	if(pass == 0)
@@ -308,43 +601,72 @@ void killProcesses(pid_t* pids, int signal)
 	}
 }
 
+static int compareCache(const void* a, const void* b)
+{
+	pid_t pa = ((const pidcache*)a)->pid;
+	pid_t pb = ((const pidcache*)b)->pid;
+	return pa < pb ? -1 : (pa > pb ? 1 : 0);
+}
+
 int getJailProcesses(const char* jailName, pid_t* pidJailer, pid_t** pids)
 {
-	kvm_t *kd;
 	struct kinfo_proc* kp;
 	char errbuf[_POSIX2_LINE_MAX];
 	char pidJail[JAIL_BUFF_SIZE];
-	int nentries, i, j;
-
-	/* Open the kernel interface */
-	kd = kvm_openfiles(_PATH_DEVNULL, _PATH_DEVNULL, _PATH_DEVNULL,
-					   O_RDONLY, errbuf);
-	if(kd == 0)
-		errx(1, "%s", errbuf);
+	const char* name;
+	pidjail* map = NULL;
+	pidcache* cached;
+	pidcache* swap;
+	pidcache key;
+	jailstats before = g_jailstats;
+	int nentries, nmap = 0, lookups = 0, i, j, n;
+
+	/* Open the kernel interface, once for all passes */
+	if(g_kd == NULL)
+	{
+		g_kd = kvm_openfiles(_PATH_DEVNULL, _PATH_DEVNULL, _PATH_DEVNULL,
+							 O_RDONLY, errbuf);
+		if(g_kd == 0)
+			errx(1, "%s", errbuf);
+	}
 
 	/* Get a process listing */
-	if((kp = kvm_getprocs(kd, KERN_PROC_ALL, 0, &nentries)) == 0)
-		errx(1, "%s", kvm_geterr(kd));
+	g_jailstats.syscalls++;
+	if((kp = kvm_getprocs(g_kd, KERN_PROC_ALL, 0, &nentries)) == 0)
+		errx(1, "%s", kvm_geterr(g_kd));
 
-	/* Allocate memory */
-	if(pids)
+	/* What we know about processes only holds for one jail */
+	if(g_cacheJail == NULL || strcmp(g_cacheJail, jailName))
 	{
-		if((*pids = (pid_t*)malloc((nentries + 1) * sizeof(pid_t))) == NULL)
-			err(1, "out of memory");
+		g_cacheJail = jailName;
+		g_cacheCount = 0;
 	}
 
-	/* Okay now loop and look at each process' jail */
-	for(i = 0, j = 0; i < nentries; i++)
+	/* Memory is pooled across passes, and only ever grows */
+	if(nentries + 1 > g_poolSize)
 	{
-		pid_t pid;
+		g_poolSize = nentries + 1 + nentries / 4;
+
+		g_pids = (pid_t*)realloc(g_pids, g_poolSize * sizeof(pid_t));
+		g_cache = (pidcache*)realloc(g_cache, g_poolSize * sizeof(pidcache));
+		g_nextCache = (pidcache*)realloc(g_nextCache, g_poolSize * sizeof(pidcache));
+		g_jailstats.allocs += 3;
+
+		if(!g_pids || !g_cache || !g_nextCache)
+			errx(1, "out of memory");
+	}
 
+	/* Okay now loop and look at each process' jail */
+	for(i = 0, j = 0, n = 0; i < nentries; i++)
+	{
 #if __FreeBSD_version > 500000
 
 		/* Check the flags first */
 		if(!(kp[i].ki_flag & P_JAILED))
 			continue;
 
-		pid = kp[i].ki_pid;
+		key.pid = kp[i].ki_pid;
+		key.start = kp[i].ki_start;
 
 #else
 
@@ -352,20 +674,50 @@ int getJailProcesses(const char* jailName, pid_t* pidJailer, pid_t** pids)
 		if(!(kp[i].kp_proc.p_flag & P_JAILED))
 			continue;
 
-		pid = kp[i].kp_proc.p_pid;
+		key.pid = kp[i].kp_proc.p_pid;
+		key.start = kp[i].kp_eproc.e_stats.p_start;
 
 #endif
 
-		/* Now actually get the jail name */
-		if(getpidjail(pid, pidJail) < 0)
-			continue;
+		/*
+		 * A process we saw last pass is still in the same jail. The
+		 * start time makes sure the pid wasn't reused in between.
+		 */
+		cached = (pidcache*)bsearch(&key, g_cache, g_cacheCount,
+									sizeof(pidcache), compareCache);
 
-		if(strcmp(pidJail, jailName))
+		if(cached && timercmp(&cached->start, &key.start, ==))
+		{
+			key.inJail = cached->inJail;
+		}
+
+		/* Nothing known yet, one pass over procfs beats lots of lookups */
+		else if(g_cacheCount == 0)
+		{
+			if(map == NULL && (nmap = scanjails(PROC_PATH, &map)) < 0)
+				err(1, "couldn't read " PROC_PATH);
+
+			name = lookupjail(map, nmap, key.pid);
+			key.inJail = name && !strcmp(name, jailName);
+			lookups++;
+		}
+
+		/* Just a few new processes, look at them one by one */
+		else
+		{
+			key.inJail = getpidjail(key.pid, pidJail) == 0 &&
+						 !strcmp(pidJail, jailName);
+			lookups++;
+		}
+
+		g_nextCache[n++] = key;
+
+		if(!key.inJail)
 			continue;
 
 		/* Copy the PID over */
 		if(pids)
-			(*pids)[j++] = pid;
+			g_pids[j++] = key.pid;
 
 		/* If it's the jailer then copy that */
 		if(pidJailer)
@@ -375,16 +727,30 @@ int getJailProcesses(const char* jailName, pid_t* pidJailer, pid_t** pids)
 #else
 			if(strstr(kp[i].kp_proc.p_comm, JAILER_COMMAND))
 #endif
-				*pidJailer = pid;
+				*pidJailer = key.pid;
 		}
 
 	}
 
 	/* Null terminate pids array */
 	if(pids)
-		(*pids)[j] = 0;
+	{
+		g_pids[j] = 0;
+		*pids = g_pids;
+	}
+
+	/* This pass' processes are what the next one checks against */
+	qsort(g_nextCache, n, sizeof(pidcache), compareCache);
+	swap = g_cache;
+	g_cache = g_nextCache;
+	g_nextCache = swap;
+	g_cacheCount = n;
 
-	kvm_close(kd);
+	if(g_verbose)
+		warnx("%s: %d processes, %d in jail, %d looked up, %lu syscalls, %lu allocations",
+			  jailName, nentries, j, lookups,
+			  g_jailstats.syscalls - before.syscalls,
+			  g_jailstats.allocs - before.allocs);
 
 	return j == 0 ? 0 : 1;
 }
@@ -393,7 +759,7 @@ int getJailProcesses(const char* jailName, pid_t* pidJailer, pid_t** pids)
 
 static void usage()
 {
-	fprintf(stderr, "usage: killjail [ -h | -r ] [ -t timeout ] [ -qf ] jailname ...\n");
+	fprintf(stderr, "usage: killjail [ -h | -r ] [ -t timeout ] [ -w wait ] [ -qfv ] [ -d jaildir ] jailname ...\n");
 	exit(2);
 }
 
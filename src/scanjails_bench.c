@@ -0,0 +1,276 @@
+/*
+ * Copyright (c) 2004, Stefan Walter
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above
+ *       copyright notice, this list of conditions and the
+ *       following disclaimer.
+ *     * Redistributions in binary form must reproduce the
+ *       above copyright notice, this list of conditions and
+ *       the following disclaimer in the documentation and/or
+ *       other materials provided with the distribution.
+ *     * The names of contributors to this software may not be
+ *       used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ *
+ *
+ * CONTRIBUTORS
+ *  Stef Walter <stef@memberwebs.com>
+ *
+ */
+
+/*
+ * Benchmark for scanjails(). Builds a procfs-like tree with lots of
+ * processes spread over a number of jails, scans it a few times and
+ * checks that every process was put in the right jail.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <err.h>
+#include "getjail.h"
+
+#define		BENCH_ENTRIES		100000
+#define		BENCH_JAILS			64
+#define		BENCH_PASSES		5
+
+/* Leaves room for the entries under it */
+static char g_procDir[MAXPATHLEN / 2];
+
+static void usage();
+
+/* Every so many processes aren't jailed, and a few have huge lines */
+static int isJailed(int pid)		{ return pid % 10 != 0; }
+static int isLong(int pid)			{ return pid % 1000 == 1; }
+
+static void jailName(int pid, int jails, char* buff)
+{
+	snprintf(buff, JAIL_BUFF_SIZE, "jail%d.example.com", pid % jails);
+}
+
+static void writeStatus(int pid, int jails)
+{
+	char path[MAXPATHLEN];
+	char name[JAIL_BUFF_SIZE];
+	FILE* f;
+	int i;
+
+	snprintf(path, sizeof(path), "%s/%d", g_procDir, pid);
+	if(mkdir(path, 0755) < 0)
+		err(1, "couldn't create: %s", path);
+
+	snprintf(path, sizeof(path), "%s/%d/status", g_procDir, pid);
+	if((f = fopen(path, "w")) == NULL)
+		err(1, "couldn't create: %s", path);
+
+	if(isJailed(pid))
+		jailName(pid, jails, name);
+	else
+		strcpy(name, "-");
+
+	/* The same layout as FreeBSD's procfs */
+	fprintf(f, "sh %d 1 %d %d - ctty 1100000000,0 0,100 0,200 pause 0 0 0 0", pid, pid, pid);
+
+	/* Lots of groups, longer than a read */
+	if(isLong(pid))
+	{
+		for(i = 0; i < 400; i++)
+			fprintf(f, ",%d", 1000 + i);
+	}
+
+	fprintf(f, " %s\n", name);
+	fclose(f);
+}
+
+static void makeTree(int entries, int jails)
+{
+	char path[MAXPATHLEN];
+	int pid;
+
+	snprintf(g_procDir, sizeof(g_procDir), "%s/scanjails.XXXXXX",
+			 getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp");
+	if(mkdtemp(g_procDir) == NULL)
+		err(1, "couldn't create: %s", g_procDir);
+
+	for(pid = 1; pid <= entries; pid++)
+		writeStatus(pid, jails);
+
+	/* Things in procfs that aren't processes */
+	snprintf(path, sizeof(path), "%s/curproc", g_procDir);
+	if(mkdir(path, 0755) < 0)
+		err(1, "couldn't create: %s", path);
+}
+
+static void removeTree(int entries)
+{
+	char path[MAXPATHLEN];
+	int pid;
+
+	for(pid = 1; pid <= entries; pid++)
+	{
+		snprintf(path, sizeof(path), "%s/%d/status", g_procDir, pid);
+		unlink(path);
+		snprintf(path, sizeof(path), "%s/%d", g_procDir, pid);
+		rmdir(path);
+	}
+
+	snprintf(path, sizeof(path), "%s/curproc", g_procDir);
+	rmdir(path);
+	rmdir(g_procDir);
+}
+
+static double elapsed(struct timeval* start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) * 1000.0 +
+		   (now.tv_usec - start->tv_usec) / 1000.0;
+}
+
+static int checkScan(pidjail* map, int count, int entries, int jails)
+{
+	char name[JAIL_BUFF_SIZE];
+	jailname* names;
+	const char* found;
+	char* seen;
+	int expected = 0;
+	int expectedJails = 0;
+	int pid, n;
+
+	if((seen = (char*)calloc(jails, 1)) == NULL)
+		errx(1, "out of memory");
+
+	for(pid = 1; pid <= entries; pid++)
+	{
+		found = lookupjail(map, count, pid);
+
+		if(!isJailed(pid))
+		{
+			if(found != NULL)
+			{
+				warnx("process %d isn't jailed, found in: %s", pid, found);
+				free(seen);
+				return -1;
+			}
+			continue;
+		}
+
+		jailName(pid, jails, name);
+		if(found == NULL || strcmp(found, name))
+		{
+			warnx("process %d should be in %s, found in: %s", pid, name,
+				  found ? found : "nothing");
+			free(seen);
+			return -1;
+		}
+
+		if(!seen[pid % jails])
+			expectedJails++;
+		seen[pid % jails] = 1;
+		expected++;
+	}
+
+	free(seen);
+
+	if(count != expected)
+	{
+		warnx("found %d jailed processes, expected %d", count, expected);
+		return -1;
+	}
+
+	n = listjailnames(&names);
+	if(n != expectedJails)
+	{
+		warnx("found %d jails, expected %d", n, expectedJails);
+		return -1;
+	}
+
+	return 0;
+}
+
+int main(int argc, char* argv[])
+{
+	struct timeval start;
+	jailstats before;
+	pidjail* map;
+	int entries = BENCH_ENTRIES;
+	int jails = BENCH_JAILS;
+	int count, pass, ret = 0;
+	double ms, best = 0;
+
+	if(argc > 3)
+		usage();
+	if(argc > 1 && (entries = atoi(argv[1])) <= 0)
+		usage();
+	if(argc > 2 && (jails = atoi(argv[2])) <= 0)
+		usage();
+
+	gettimeofday(&start, NULL);
+	makeTree(entries, jails);
+	printf("created %d entries in %d jails: %.0f ms\n", entries, jails, elapsed(&start));
+
+	for(pass = 0; pass < BENCH_PASSES; pass++)
+	{
+		before = g_jailstats;
+		gettimeofday(&start, NULL);
+
+		count = scanjails(g_procDir, &map);
+
+		ms = elapsed(&start);
+		if(pass == 0 || ms < best)
+			best = ms;
+
+		printf("pass %d: %d jailed, %.1f ms, %lu syscalls, %lu allocs\n",
+			   pass + 1, count, ms, g_jailstats.syscalls - before.syscalls,
+			   g_jailstats.allocs - before.allocs);
+
+		if(count < 0)
+		{
+			warn("couldn't scan: %s", g_procDir);
+			ret = 1;
+			break;
+		}
+
+		if(checkScan(map, count, entries, jails) < 0)
+		{
+			ret = 1;
+			break;
+		}
+	}
+
+	if(ret == 0)
+		printf("best: %.1f ms, %.2f us per entry\n", best, best * 1000.0 / entries);
+
+	removeTree(entries);
+	return ret;
+}
+
+static void usage()
+{
+	fprintf(stderr, "usage: scanjails_bench [entries [jails]]\n");
+	exit(2);
+}
@@ -0,0 +1,279 @@
+/*
+ * Copyright (c) 2004, Stef Walter
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above
+ *       copyright notice, this list of conditions and the
+ *       following disclaimer.
+ *     * Redistributions in binary form must reproduce the
+ *       above copyright notice, this list of conditions and
+ *       the following disclaimer in the documentation and/or
+ *       other materials provided with the distribution.
+ *     * The names of contributors to this software may not be
+ *       used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ *
+ *
+ * CONTRIBUTORS
+ *  Stef Walter <stef@memberwebs.com>
+ *
+ */
+
+/*
+ * Benchmark for jail_addresses() with a jail carrying lots of
+ * addresses, read from an @file the way jstart does. Checks that
+ * they come out sorted and without duplicates, and creates the jail
+ * with them on the fixture backend.
+ */
+
+#include <sys/types.h>
+#include <sys/time.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <stdio.h>
+#include <err.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "util.h"
+#include "backend.h"
+
+#ifdef HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+#define BENCH_ADDRESSES     10000
+#define BENCH_PASSES        5
+
+/* Every 10th address is IPv6, when we have it */
+#ifdef HAVE_INET6
+#define IS_IP6(i)           ((i) % 10 == 5)
+#else
+#define IS_IP6(i)           0
+#endif
+
+static void usage();
+
+/* The addresses the file should give, in the order the kernel wants */
+static unsigned int g_expect4 = 0;
+static unsigned int g_expect6 = 0;
+
+/*
+ * 10.x.y.z in a scrambled order, with every 20th a duplicate of an
+ * earlier one. The first stays first.
+ */
+static char* write_addresses(const char* file, int count)
+{
+    char buf[INET6_ADDRSTRLEN];
+    unsigned int n, v4 = 0, v6 = 0, dups = 0;
+    char* arg;
+    size_t len = 0;
+    FILE* f;
+    int i;
+
+    if((f = fopen(file, "w")) == NULL)
+        err(1, "couldn't create: %s", file);
+
+    /* The same addresses comma separated, like on the command line */
+    if((arg = (char*)malloc(count * INET6_ADDRSTRLEN + 1)) == NULL)
+        errx(1, "out of memory");
+    arg[0] = 0;
+
+    for(i = 0; i < count; i++)
+    {
+        n = i;
+
+        /* Some earlier IPv4 address that isn't a duplicate itself */
+        if(i > 0 && i % 20 == 0)
+        {
+            n = (i * 7919U) % i;
+            if(IS_IP6(n) || (n > 0 && n % 20 == 0))
+                n--;
+            dups++;
+        }
+
+        if(IS_IP6(i))
+        {
+            snprintf(buf, sizeof(buf), "fd00::%x:%x", (n * 2654435761U) >> 16, n);
+            v6++;
+        }
+        else
+        {
+            /* Multiplying by an odd number scrambles without repeating */
+            n = n * 2654435761U & 0xffffff;
+            snprintf(buf, sizeof(buf), "10.%u.%u.%u", n >> 16, (n >> 8) & 0xff, n & 0xff);
+            v4++;
+        }
+
+        fprintf(f, "%s%s", buf, i % 8 == 7 ? "\n" : " ");
+        len += snprintf(arg + len, INET6_ADDRSTRLEN + 1, "%s%s", i ? "," : "", buf);
+    }
+
+    fclose(f);
+
+    g_expect4 = v4 - dups;
+    g_expect6 = v6;
+    return arg;
+}
+
+static double elapsed(struct timeval* start)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return (now.tv_sec - start->tv_sec) * 1000.0 +
+           (now.tv_usec - start->tv_usec) / 1000.0;
+}
+
+static int check_addresses(jail_spec* j)
+{
+    unsigned int i;
+
+#ifdef HAVE_INET6
+    if(j->ip4s != g_expect4 || j->ip6s != g_expect6)
+#else
+    if(j->ip4s != g_expect4)
+#endif
+    {
+        warnx("got %u ipv4 and %u ipv6 addresses, expected %u and %u",
+              j->ip4s, j->ip6s, g_expect4, g_expect6);
+        return -1;
+    }
+
+    for(i = 2; i < j->ip4s; i++)
+    {
+        if(memcmp(j->ip4 + i - 1, j->ip4 + i, sizeof(struct in_addr)) >= 0)
+        {
+            warnx("addresses aren't sorted and unique at %u", i);
+            return -1;
+        }
+    }
+
+#ifdef HAVE_INET6
+    for(i = 2; i < j->ip6s; i++)
+    {
+        if(memcmp(j->ip6 + i - 1, j->ip6 + i, sizeof(struct in6_addr)) >= 0)
+        {
+            warnx("addresses aren't sorted and unique at %u", i);
+            return -1;
+        }
+    }
+#endif
+
+    return 0;
+}
+
+static double run_pass(const char* how, char* arg, jail_spec* j, int pass)
+{
+    struct timeval start;
+    double ms;
+
+    gettimeofday(&start, NULL);
+    jail_addresses(arg, j);
+    ms = elapsed(&start);
+
+    printf("%s pass %d: %u ipv4, %u ipv6, %.2f ms\n", how, pass + 1,
+           j->ip4s, j->ip6s, ms);
+    return ms;
+}
+
+int main(int argc, char* argv[])
+{
+    char file[] = "/tmp/addresses.XXXXXX";
+    char fileArg[sizeof(file) + 1];
+    struct timeval start;
+    jail_spec j;
+    char* list;
+    char* arg;
+    double ms, best = 0;
+    int count = BENCH_ADDRESSES;
+    int pass, fd, jid, ret = 0;
+
+    if(argc > 2)
+        usage();
+    if(argc > 1 && (count = atoi(argv[1])) <= 0)
+        usage();
+
+    if((fd = mkstemp(file)) == -1)
+        err(1, "couldn't create: %s", file);
+    close(fd);
+
+    list = write_addresses(file, count);
+    snprintf(fileArg, sizeof(fileArg), "@%s", file);
+
+    for(pass = 0; pass < BENCH_PASSES && ret == 0; pass++)
+    {
+        /* jail_addresses() writes to its argument */
+        if((arg = strdup(list)) == NULL)
+            errx(1, "out of memory");
+
+        run_pass("argument", arg, &j, pass);
+        free(arg);
+
+        ret = check_addresses(&j);
+        jail_addresses_free(&j);
+    }
+
+    for(pass = 0; pass < BENCH_PASSES && ret == 0; pass++)
+    {
+        ms = run_pass("file", fileArg, &j, pass);
+        if(pass == 0 || ms < best)
+            best = ms;
+
+        ret = check_addresses(&j);
+
+        /* All the way into a jail on the last one, like jstart */
+        if(ret == 0 && pass == BENCH_PASSES - 1)
+        {
+            setenv("JAILUTILS_BACKEND", "fixture", 1);
+            j.path = "/";
+            j.hostname = "addresses.example.com";
+
+            gettimeofday(&start, NULL);
+            if((jid = jail_backend_get()->create(&j)) == -1)
+            {
+                warn("couldn't create jail");
+                ret = 1;
+            }
+            else
+            {
+                printf("created jail %d: %.2f ms\n", jid, elapsed(&start));
+            }
+        }
+
+        jail_addresses_free(&j);
+    }
+
+    if(ret == 0)
+        printf("best: %.2f ms for %d addresses\n", best, count);
+
+    unlink(file);
+    free(list);
+    return ret;
+}
+
+static void usage()
+{
+    fprintf(stderr, "usage: addresses_bench [count]\n");
+    exit(2);
+}
@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2004, Stefan Walter
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above
+ *       copyright notice, this list of conditions and the
+ *       following disclaimer.
+ *     * Redistributions in binary form must reproduce the
+ *       above copyright notice, this list of conditions and
+ *       the following disclaimer in the documentation and/or
+ *       other materials provided with the distribution.
+ *     * The names of contributors to this software may not be
+ *       used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ *
+ *
+ * CONTRIBUTORS
+ *  Stef Walter <stef@memberwebs.com>
+ *  James E. Quick <jq@quick.com>
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+
+#include <err.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "backend.h"
+
+#define BACKEND_ENV     "JAILUTILS_BACKEND"
+
+static const jail_backend* g_backends[] =
+{
+#ifdef HAVE_JAIL_ATTACH
+    &jail_backend_freebsd,
+#endif
+#if defined(__linux__) && defined(HAVE_SETNS)
+    &jail_backend_linux,
+#endif
+    &jail_backend_fixture,
+    NULL
+};
+
+static const jail_backend* g_backend = NULL;
+
+const jail_backend* jail_backend_get()
+{
+    const jail_backend** jb;
+    const char* name;
+
+    if(g_backend != NULL)
+        return g_backend;
+
+    /* The first one is the native one for this system */
+    name = getenv(BACKEND_ENV);
+    if(name == NULL || !*name)
+    {
+        g_backend = g_backends[0];
+        return g_backend;
+    }
+
+    for(jb = g_backends; *jb != NULL; jb++)
+    {
+        if(strcmp((*jb)->name, name) == 0)
+        {
+            g_backend = *jb;
+            return g_backend;
+        }
+    }
+
+    errx(2, "unknown %s: %s", BACKEND_ENV, name);
+    return NULL;
+}
@@ -0,0 +1,209 @@
+/*
+ * Copyright (c) 2004, Stefan Walter
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above
+ *       copyright notice, this list of conditions and the
+ *       following disclaimer.
+ *     * Redistributions in binary form must reproduce the
+ *       above copyright notice, this list of conditions and
+ *       the following disclaimer in the documentation and/or
+ *       other materials provided with the distribution.
+ *     * The names of contributors to this software may not be
+ *       used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ *
+ *
+ * CONTRIBUTORS
+ *  Stef Walter <stef@memberwebs.com>
+ *
+ */
+#ifndef __BACKEND_H__
+#define __BACKEND_H__
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+/*
+ * Everything that touches the kernel's idea of jails goes through
+ * one of these backends. The tools don't know which one they're
+ * talking to.
+ */
+
+#define JAIL_HOST_LEN   (MAXHOSTNAMELEN + 1)
+#define JAIL_PATH_LEN   (MAXPATHLEN + 1)
+#define JAIL_COMM_LEN   20
+
+typedef struct jail_info
+{
+    int jid;
+    char host[JAIL_HOST_LEN];
+    char path[JAIL_PATH_LEN];
+}
+jail_info;
+
+typedef struct jail_proc
+{
+    pid_t pid;
+    char comm[JAIL_COMM_LEN];
+}
+jail_proc;
+
+#define JAIL_MAX_CPUS       1024
+#define JAIL_MAX_DOMAINS    64
+#define JAIL_MASK_BITS      (8 * sizeof(unsigned long))
+
+/*
+ * Which CPUs a jail runs on, and which memory domains it allocates
+ * from. No domains means any of them.
+ */
+typedef struct jail_place
+{
+    unsigned long cpus[JAIL_MAX_CPUS / (8 * sizeof(unsigned long))];
+    unsigned long domains[JAIL_MAX_DOMAINS / (8 * sizeof(unsigned long))];
+}
+jail_place;
+
+/* Caps on what a jail can use, 0 for no cap */
+typedef struct jail_limits
+{
+    unsigned long long memory;  /* Bytes */
+    int cpu;                    /* Percent of one CPU */
+    long procs;
+    long files;                 /* Open files */
+}
+jail_limits;
+
+/* What a jail is using */
+typedef struct jail_usage
+{
+    unsigned long long memory;
+    unsigned long long cputime; /* Microseconds so far */
+    long procs;
+    long files;
+}
+jail_usage;
+
+/* What jstart asks for when creating a jail */
+typedef struct jail_spec
+{
+    const char* path;
+    const char* hostname;
+    struct in_addr* ip4;
+    unsigned int ip4s;
+    struct in6_addr* ip6;
+    unsigned int ip6s;
+}
+jail_spec;
+
+#define JAIL_BACKEND_SIMULATED  0x00000001  /* Not real jails, don't run their commands */
+#define JAIL_BACKEND_INIT       0x00000002  /* Jails end with their first process, which must be an init */
+
+typedef struct jail_backend
+{
+    const char* name;
+    int flags;
+
+    /* 1 if we're in a jail, 0 if not, -1 if we can't tell */
+    int (*jailed)(void);
+
+    /* Id of the jail we're in, 0 on the host, -1 if we can't tell */
+    int (*jail_id)(void);
+
+    /*
+     * Open any kernel handles ahead of time, so that they're still
+     * around after attaching to a jail.
+     */
+    int (*open)(void);
+
+    /* Fills in an allocated array which the caller frees */
+    int (*list_jails)(jail_info** list, size_t* count);
+
+    /*
+     * All the processes we can see, which is just the jail's once
+     * we're attached. The array belongs to the backend and is only
+     * valid until the next call.
+     */
+    int (*list_procs)(jail_proc** list, size_t* count);
+
+    int (*attach)(const jail_info* ji);
+    int (*signal)(pid_t pid, int sig);
+
+    /* Creates the jail and puts us in it, returns the jail id */
+    int (*create)(const jail_spec* spec);
+
+    /*
+     * Signals every process in the jail we're attached to, except
+     * us. Optional, for backends that can do better than listing
+     * processes and signalling them one by one.
+     */
+    int (*kill_all)(int sig);
+
+    /*
+     * Gives a running jail a new host name and addresses. Optional,
+     * for kernels that can change those after the jail is created.
+     */
+    int (*rebind)(const jail_info* ji, const jail_spec* spec);
+
+    /*
+     * The CPUs in a memory domain, or all of them for domain -1.
+     * Fails with ENOENT past the last domain. This and the two below
+     * are optional, for kernels that can pin jails.
+     */
+    int (*domain_cpus)(int domain, jail_place* pl);
+
+    /* Pins the jail we just created, before anything runs in it */
+    int (*place)(int jid, const jail_place* pl);
+
+    /* Where a running jail is pinned */
+    int (*placement)(const jail_info* ji, jail_place* pl);
+
+    /*
+     * Caps the jail we just created, before anything runs in it.
+     * Optional, along with usage.
+     */
+    int (*limit)(int jid, const jail_limits* lim);
+
+    /* What a running jail uses, and its limits */
+    int (*usage)(const jail_info* ji, jail_usage* use, jail_limits* lim);
+
+    /*
+     * A copy of the socket a process in the jail is listening on at
+     * this address, from outside the jail. Optional, for kernels that
+     * let us take another process' descriptors.
+     */
+    int (*take_listener)(const jail_info* ji, const struct sockaddr* addr,
+                         socklen_t addrlen);
+}
+jail_backend;
+
+/*
+ * The backend is picked at build time, and can be overridden by
+ * setting JAILUTILS_BACKEND in the environment.
+ */
+const jail_backend* jail_backend_get();
+
+extern const jail_backend jail_backend_freebsd;
+extern const jail_backend jail_backend_fixture;
+extern const jail_backend jail_backend_linux;
+
+#endif /* __BACKEND_H__ */
@@ -0,0 +1,585 @@
+/*
+ * Copyright (c) 2004, Stefan Walter
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above
+ *       copyright notice, this list of conditions and the
+ *       following disclaimer.
+ *     * Redistributions in binary form must reproduce the
+ *       above copyright notice, this list of conditions and
+ *       the following disclaimer in the documentation and/or
+ *       other materials provided with the distribution.
+ *     * The names of contributors to this software may not be
+ *       used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ *
+ *
+ * CONTRIBUTORS
+ *  Stef Walter <stef@memberwebs.com>
+ *  James E. Quick <jq@quick.com>
+ */
+
+/*
+ * An in-memory backend with made up jails and processes, for timing
+ * and trying out the tools away from a real jail host. Select it by
+ * setting JAILUTILS_BACKEND=fixture, and describe the fixture with
+ * comma separated settings in JAILUTILS_FIXTURE:
+ *
+ *   jails=N        number of jails (default 8)
+ *   procs=N        processes in each jail (default 16)
+ *   latency=MS     time a process takes to exit after SIGTERM (default 10)
+ *   stubborn=PCT   percentage of processes that ignore SIGTERM (default 0)
+ *   seed=N         seed for spreading out the latencies (default 1)
+ *   jailed=JID     start out inside this jail
+ *   cpus=N         CPUs to pin jails to (default 8)
+ *   domains=N      memory domains the CPUs are split between (default 2)
+ *   placed=N       pin the first N jails, one CPU each in turn (default 0)
+ *
+ * Each process uses 4MB and 8 files, and each jail between 10% and
+ * 40% of a CPU.
+ *
+ * The same settings always give the same jails and processes.
+ */
+
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/param.h>
+
+#include <err.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "util.h"
+#include "backend.h"
+#include "placement.h"
+
+#define FIXTURE_ENV         "JAILUTILS_FIXTURE"
+
+/* Fixture pids start here, and are an index into the process table */
+#define FIXTURE_PID_BASE    100
+
+#define FIXTURE_PROC_MEMORY (4 * 1024 * 1024)
+#define FIXTURE_PROC_FILES  8
+
+typedef struct fixture_proc
+{
+    int jid;
+    int stubborn;               /* Ignores SIGTERM */
+    long latency;               /* Milliseconds to exit after SIGTERM */
+    long dies;                  /* When it exits, 0 if not dying */
+    int dead;
+    const char* comm;
+}
+fixture_proc;
+
+static int g_ready = 0;
+
+static int g_jails = 8;
+static int g_procs = 16;
+static long g_latency = 10;
+static int g_stubborn = 0;
+static unsigned long g_seed = 1;
+static int g_current = 0;
+static int g_cpus = 8;
+static int g_domains = 2;
+static int g_placed = 0;
+static long g_started = 0;
+
+static jail_info* g_jailinfo = NULL;
+static size_t g_njails = 0;
+static size_t g_jailcap = 0;
+static jail_place* g_places = NULL;
+static jail_limits* g_limits = NULL;
+
+static fixture_proc* g_proctab = NULL;
+static size_t g_nproctab = 0;
+static size_t g_proccap = 0;
+
+/* What list_procs hands out */
+static jail_proc* g_visible = NULL;
+static size_t g_visiblecap = 0;
+
+static const char* g_comms[] =
+{
+    "init", "syslogd", "cron", "sshd", "sendmail", "httpd", "sh", "getty"
+};
+
+static unsigned long fixture_random()
+{
+    /* Plain LCG, all we need is the same sequence every time */
+    g_seed = g_seed * 1103515245UL + 12345UL;
+    return (g_seed >> 16) & 0x7fff;
+}
+
+static long fixture_now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1000L) + (ts.tv_nsec / 1000000L);
+}
+
+/* Each domain gets an equal share of the CPUs, the last one any left over */
+static int fixture_domain_of(int cpu)
+{
+    int per = g_cpus / g_domains;
+    return cpu / per < g_domains ? cpu / per : g_domains - 1;
+}
+
+static void fixture_place_jail(jail_place* pl, int index)
+{
+    int i;
+
+    memset(pl, 0, sizeof(*pl));
+
+    if(index < g_placed)
+    {
+        PLACEMENT_SET(pl->cpus, index % g_cpus);
+        PLACEMENT_SET(pl->domains, fixture_domain_of(index % g_cpus));
+        return;
+    }
+
+    for(i = 0; i < g_cpus; i++)
+        PLACEMENT_SET(pl->cpus, i);
+}
+
+static void fixture_add_procs(int jid)
+{
+    fixture_proc* fp;
+    int i;
+
+    if(g_nproctab + g_procs > g_proccap)
+    {
+        g_proccap = (g_nproctab + g_procs) * 2;
+        g_proctab = (fixture_proc*)realloc(g_proctab, sizeof(fixture_proc) * g_proccap);
+        if(g_proctab == NULL)
+            errx(1, "out of memory");
+    }
+
+    for(i = 0; i < g_procs; i++)
+    {
+        fp = &(g_proctab[g_nproctab++]);
+        memset(fp, 0, sizeof(*fp));
+        fp->jid = jid;
+        fp->comm = g_comms[i % (sizeof(g_comms) / sizeof(g_comms[0]))];
+
+        /* Somewhere between half and one and a half times the latency */
+        fp->latency = g_latency / 2 + (g_latency > 0 ? fixture_random() % (g_latency + 1) : 0);
+        fp->stubborn = (int)(fixture_random() % 100) < g_stubborn;
+    }
+}
+
+static int fixture_add_jail(const char* host, const char* path)
+{
+    jail_info* ji;
+
+    if(g_njails >= g_jailcap)
+    {
+        g_jailcap = g_jailcap ? g_jailcap * 2 : 16;
+        g_jailinfo = (jail_info*)realloc(g_jailinfo, sizeof(jail_info) * g_jailcap);
+        g_places = (jail_place*)realloc(g_places, sizeof(jail_place) * g_jailcap);
+        g_limits = (jail_limits*)realloc(g_limits, sizeof(jail_limits) * g_jailcap);
+        if(g_jailinfo == NULL || g_places == NULL || g_limits == NULL)
+            errx(1, "out of memory");
+    }
+
+    fixture_place_jail(&(g_places[g_njails]), (int)g_njails);
+    memset(&(g_limits[g_njails]), 0, sizeof(jail_limits));
+
+    ji = &(g_jailinfo[g_njails]);
+    memset(ji, 0, sizeof(*ji));
+    ji->jid = (int)++g_njails;
+
+    if(host)
+        strlcpy(ji->host, host, sizeof(ji->host));
+    else
+        snprintf(ji->host, sizeof(ji->host), "fixture%d.example.com", ji->jid);
+
+    if(path)
+        strlcpy(ji->path, path, sizeof(ji->path));
+    else
+        snprintf(ji->path, sizeof(ji->path), "/fixture/%d", ji->jid);
+
+    fixture_add_procs(ji->jid);
+    return ji->jid;
+}
+
+static void fixture_init()
+{
+    char* env;
+    char* opt;
+    char* val;
+    int i;
+
+    if(g_ready)
+        return;
+    g_ready = 1;
+    g_started = fixture_now();
+
+    env = getenv(FIXTURE_ENV);
+    env = env ? strdup(env) : NULL;
+
+    for(opt = env ? strtok(env, ",") : NULL; opt; opt = strtok(NULL, ","))
+    {
+        val = strchr(opt, '=');
+        if(val == NULL)
+            errx(2, "invalid %s setting: %s", FIXTURE_ENV, opt);
+        *(val++) = 0;
+
+        if(strcmp(opt, "jails") == 0)
+            g_jails = atoi(val);
+        else if(strcmp(opt, "procs") == 0)
+            g_procs = atoi(val);
+        else if(strcmp(opt, "latency") == 0)
+            g_latency = atol(val);
+        else if(strcmp(opt, "stubborn") == 0)
+            g_stubborn = atoi(val);
+        else if(strcmp(opt, "seed") == 0)
+            g_seed = strtoul(val, NULL, 10);
+        else if(strcmp(opt, "jailed") == 0)
+            g_current = atoi(val);
+        else if(strcmp(opt, "cpus") == 0)
+            g_cpus = atoi(val);
+        else if(strcmp(opt, "domains") == 0)
+            g_domains = atoi(val);
+        else if(strcmp(opt, "placed") == 0)
+            g_placed = atoi(val);
+        else
+            errx(2, "unknown %s setting: %s", FIXTURE_ENV, opt);
+    }
+
+    free(env);
+
+    if(g_jails < 0 || g_procs < 0 || g_latency < 0 ||
+       g_stubborn < 0 || g_stubborn > 100 || g_placed < 0 ||
+       g_cpus <= 0 || g_cpus > JAIL_MAX_CPUS || g_domains <= 0 ||
+       g_domains > g_cpus || g_domains > JAIL_MAX_DOMAINS)
+        errx(2, "invalid %s settings", FIXTURE_ENV);
+
+    for(i = 0; i < g_jails; i++)
+        fixture_add_jail(NULL, NULL);
+
+    if(g_current < 0 || (size_t)g_current > g_njails)
+        errx(2, "invalid %s jailed setting: %d", FIXTURE_ENV, g_current);
+}
+
+static int fixture_visible(fixture_proc* fp, long now)
+{
+    /* Exiting processes go away once their time is up */
+    if(fp->dies && fp->dies <= now)
+        fp->dead = 1;
+
+    /* Processes in other jails are invisible */
+    return !fp->dead && (g_current == 0 || fp->jid == g_current);
+}
+
+static fixture_proc* fixture_find_proc(pid_t pid)
+{
+    size_t i;
+
+    if(pid < FIXTURE_PID_BASE)
+        return NULL;
+
+    i = pid - FIXTURE_PID_BASE;
+    if(i >= g_nproctab || !fixture_visible(&(g_proctab[i]), fixture_now()))
+        return NULL;
+
+    return &(g_proctab[i]);
+}
+
+static int fixture_jailed()
+{
+    fixture_init();
+    return g_current != 0 ? 1 : 0;
+}
+
+static int fixture_jail_id()
+{
+    fixture_init();
+    return g_current;
+}
+
+static int fixture_open()
+{
+    fixture_init();
+    return 0;
+}
+
+static int fixture_list_jails(jail_info** list, size_t* count)
+{
+    fixture_init();
+
+    *list = NULL;
+    *count = 0;
+
+    /* Jails can't see any others */
+    if(g_current != 0 || g_njails == 0)
+        return 0;
+
+    *list = (jail_info*)malloc(sizeof(jail_info) * g_njails);
+    if(*list == NULL)
+        errx(1, "out of memory");
+
+    memcpy(*list, g_jailinfo, sizeof(jail_info) * g_njails);
+    *count = g_njails;
+    return 0;
+}
+
+static int fixture_list_procs(jail_proc** list, size_t* count)
+{
+    fixture_proc* fp;
+    size_t i, n;
+    long now;
+
+    fixture_init();
+    now = fixture_now();
+
+    if(g_nproctab > g_visiblecap)
+    {
+        g_visiblecap = g_nproctab;
+        g_visible = (jail_proc*)realloc(g_visible, sizeof(jail_proc) * g_visiblecap);
+        if(g_visible == NULL)
+            errx(1, "out of memory");
+    }
+
+    for(i = 0, n = 0; i < g_nproctab; i++)
+    {
+        fp = &(g_proctab[i]);
+        if(!fixture_visible(fp, now))
+            continue;
+
+        g_visible[n].pid = FIXTURE_PID_BASE + i;
+        strlcpy(g_visible[n].comm, fp->comm, sizeof(g_visible[n].comm));
+        n++;
+    }
+
+    *list = g_visible;
+    *count = n;
+    return 0;
+}
+
+static int fixture_attach(const jail_info* ji)
+{
+    fixture_init();
+
+    if(g_current != 0 || ji->jid <= 0 || (size_t)ji->jid > g_njails)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    g_current = ji->jid;
+    return 0;
+}
+
+static int fixture_signal(pid_t pid, int sig)
+{
+    fixture_proc* fp;
+
+    fixture_init();
+
+    fp = fixture_find_proc(pid);
+    if(fp == NULL)
+    {
+        errno = ESRCH;
+        return -1;
+    }
+
+    switch(sig)
+    {
+    case 0:
+        break;
+
+    case SIGKILL:
+        fp->dead = 1;
+        break;
+
+    case SIGTERM:
+    case SIGINT:
+    case SIGHUP:
+    case SIGQUIT:
+        if(!fp->stubborn && !fp->dies)
+            fp->dies = fixture_now() + fp->latency;
+        break;
+
+    default:
+        break;
+    }
+
+    return 0;
+}
+
+static int fixture_create(const jail_spec* spec)
+{
+    fixture_init();
+
+    if(g_current != 0)
+    {
+        errno = EPERM;
+        return -1;
+    }
+
+    g_current = fixture_add_jail(spec->hostname, spec->path);
+    return g_current;
+}
+
+static int fixture_rebind(const jail_info* ji, const jail_spec* spec)
+{
+    size_t i;
+
+    fixture_init();
+
+    for(i = 0; i < g_njails; i++)
+    {
+        if(g_jailinfo[i].jid == ji->jid)
+        {
+            strlcpy(g_jailinfo[i].host, spec->hostname, sizeof(g_jailinfo[i].host));
+            return 0;
+        }
+    }
+
+    errno = ESRCH;
+    return -1;
+}
+
+static int fixture_domain_cpus(int domain, jail_place* pl)
+{
+    int i;
+
+    fixture_init();
+    memset(pl, 0, sizeof(*pl));
+
+    if(domain >= g_domains)
+    {
+        errno = ENOENT;
+        return -1;
+    }
+
+    for(i = 0; i < g_cpus; i++)
+    {
+        if(domain < 0 || fixture_domain_of(i) == domain)
+            PLACEMENT_SET(pl->cpus, i);
+    }
+
+    if(domain >= 0)
+        PLACEMENT_SET(pl->domains, domain);
+
+    return 0;
+}
+
+static int fixture_place(int jid, const jail_place* pl)
+{
+    fixture_init();
+
+    if(jid <= 0 || (size_t)jid > g_njails)
+    {
+        errno = ESRCH;
+        return -1;
+    }
+
+    memcpy(&(g_places[jid - 1]), pl, sizeof(*pl));
+    return 0;
+}
+
+static int fixture_placement(const jail_info* ji, jail_place* pl)
+{
+    fixture_init();
+
+    if(ji->jid <= 0 || (size_t)ji->jid > g_njails)
+    {
+        errno = ESRCH;
+        return -1;
+    }
+
+    memcpy(pl, &(g_places[ji->jid - 1]), sizeof(*pl));
+    return 0;
+}
+
+static int fixture_limit(int jid, const jail_limits* lim)
+{
+    fixture_init();
+
+    if(jid <= 0 || (size_t)jid > g_njails)
+    {
+        errno = ESRCH;
+        return -1;
+    }
+
+    memcpy(&(g_limits[jid - 1]), lim, sizeof(*lim));
+    return 0;
+}
+
+static int fixture_usage(const jail_info* ji, jail_usage* use, jail_limits* lim)
+{
+    long now;
+    size_t i;
+
+    fixture_init();
+    now = fixture_now();
+
+    if(ji->jid <= 0 || (size_t)ji->jid > g_njails)
+    {
+        errno = ESRCH;
+        return -1;
+    }
+
+    memset(use, 0, sizeof(*use));
+    for(i = 0; i < g_nproctab; i++)
+    {
+        if(g_proctab[i].jid == ji->jid && !g_proctab[i].dead &&
+           (!g_proctab[i].dies || g_proctab[i].dies > now))
+            use->procs++;
+    }
+
+    use->memory = (unsigned long long)use->procs * FIXTURE_PROC_MEMORY;
+    use->files = use->procs * FIXTURE_PROC_FILES;
+    use->cputime = (unsigned long long)(now - g_started) * 1000 * (ji->jid % 4 + 1) / 10;
+
+    memcpy(lim, &(g_limits[ji->jid - 1]), sizeof(*lim));
+    return 0;
+}
+
+const jail_backend jail_backend_fixture =
+{
+    "fixture",
+    JAIL_BACKEND_SIMULATED,
+    fixture_jailed,
+    fixture_jail_id,
+    fixture_open,
+    fixture_list_jails,
+    fixture_list_procs,
+    fixture_attach,
+    fixture_signal,
+    fixture_create,
+    NULL,
+    fixture_rebind,
+    fixture_domain_cpus,
+    fixture_place,
+    fixture_placement,
+    fixture_limit,
+    fixture_usage,
+    NULL
+};
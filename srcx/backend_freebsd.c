@@ -0,0 +1,749 @@
+/*
+ * Copyright (c) 2004, Stefan Walter
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above
+ *       copyright notice, this list of conditions and the
+ *       following disclaimer.
+ *     * Redistributions in binary form must reproduce the
+ *       above copyright notice, this list of conditions and
+ *       the following disclaimer in the documentation and/or
+ *       other materials provided with the distribution.
+ *     * The names of contributors to this software may not be
+ *       used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ *
+ *
+ * CONTRIBUTORS
+ *  Stef Walter <stef@memberwebs.com>
+ *  James E. Quick <jq@quick.com>
+ */
+
+#include "config.h"
+
+#ifdef HAVE_JAIL_ATTACH
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/proc.h>
+#include <sys/user.h>
+#include <sys/stat.h>
+#include <sys/jail.h>
+#include <sys/sysctl.h>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#ifdef HAVE_CPUSET_SETAFFINITY
+#include <sys/cpuset.h>
+#endif
+#ifdef HAVE_CPUSET_SETDOMAIN
+#include <sys/domainset.h>
+#endif
+#ifdef HAVE_RCTL_ADD_RULE
+#include <sys/rctl.h>
+#endif
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <kvm.h>
+#include <paths.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "util.h"
+#include "backend.h"
+#include "placement.h"
+
+/* Kept open between calls, and across jail_attach() */
+static kvm_t* g_kd = NULL;
+
+static jail_proc* g_procs = NULL;
+static size_t g_nprocs = 0;
+
+static int freebsd_open()
+{
+    char errbuf[_POSIX2_LINE_MAX];
+
+    if(g_kd != NULL)
+        return 0;
+
+    g_kd = kvm_openfiles(_PATH_DEVNULL, _PATH_DEVNULL, NULL, O_RDONLY, errbuf);
+    if(g_kd == NULL)
+        errx(1, "couldn't connect to kernel: %s", errbuf);
+
+    return 0;
+}
+
+/*
+ * in_jail
+ * This code was written by James E. Quick mailto:jq@quick.com
+ * The code may be freely re-used under the terms of the BSD copyright,
+ * as long as this comment remains intact.
+ */
+
+static int running_in_jail_kvm()
+{
+    int count;
+    kvm_t* kd = 0;
+    struct kinfo_proc* kp;
+    int  result = -1;
+
+    kd = kvm_open(_PATH_DEVNULL, _PATH_DEVNULL, NULL, O_RDONLY, NULL);
+    if(kd == NULL)
+        return -1;
+
+    kp = kvm_getprocs(kd, KERN_PROC_PID, getpid(), &count);
+
+    if(kp == NULL)
+        result = -1;
+    else
+        result = (kp->ki_flag & P_JAILED) ? 1 : 0;
+
+    kvm_close(kd);
+
+    return result;
+}
+
+static int freebsd_jailed()
+{
+    size_t len;
+    int jailed;
+
+    /* A single sysctl, falling back to kvm on older kernels */
+    len = sizeof(jailed);
+    if(sysctlbyname("security.jail.jailed", &jailed, &len, NULL, 0) == 0)
+        return jailed ? 1 : 0;
+
+    return running_in_jail_kvm();
+}
+
+static int freebsd_jail_id()
+{
+#ifdef HAVE_KINFO_PROC_KI_JID
+    struct kinfo_proc kp;
+    size_t len;
+    int mib[4];
+
+    mib[0] = CTL_KERN;
+    mib[1] = KERN_PROC;
+    mib[2] = KERN_PROC_PID;
+    mib[3] = getpid();
+
+    len = sizeof(kp);
+    if(sysctl(mib, 4, &kp, &len, NULL, 0) == -1 || len < sizeof(kp))
+        return -1;
+
+    return kp.ki_jid;
+#else
+    return -1;
+#endif
+}
+
+static struct xprison* next_xprison(struct xprison* xp)
+{
+    unsigned char *data;
+
+    switch(xp->pr_version)
+    {
+    case 1:
+    case 2:
+        return xp + 1;
+#ifdef JAIL_MULTIADDR
+    case 3:
+        data = (unsigned char*)(xp + 1);
+        data += (xp->pr_ip4s * sizeof(struct in_addr));
+        data += (xp->pr_ip6s * sizeof(struct in6_addr));
+        return (struct xprison*)data;
+#endif
+    default:
+        errx(1, "unknown version of jail structure: %d", xp->pr_version);
+        return NULL;
+    }
+}
+
+static int freebsd_list_jails(jail_info** list, size_t* count)
+{
+    struct xprison *xp;
+    unsigned char *data, *end;
+    jail_info* ji;
+    size_t length, n;
+
+    *list = NULL;
+    *count = 0;
+
+    if(sysctlbyname("security.jail.list", NULL, &length, NULL, 0) == -1)
+        err(1, "couldn't list jails");
+
+retry:
+
+    if(length <= 0)
+        return 0;
+
+    data = calloc(length, 1);
+    if(data == NULL)
+        err(1, "out of memory");
+
+    if(sysctlbyname("security.jail.list", data, &length, NULL, 0) == -1)
+    {
+        if(errno == ENOMEM)
+        {
+            free(data);
+            goto retry;
+        }
+
+        err(1, "couldn't list jails");
+    }
+
+    xp = (struct xprison*)data;
+    if(length < sizeof(*xp) || xp->pr_version != XPRISON_VERSION)
+        errx(1, "kernel and userland out of sync");
+
+    /* There can't be more jails than this */
+    ji = (jail_info*)calloc(length / sizeof(*xp), sizeof(jail_info));
+    if(ji == NULL)
+        err(1, "out of memory");
+
+    end = data + length;
+    for(n = 0; (unsigned char*)(xp + 1) <= end; xp = next_xprison(xp), n++)
+    {
+        if(xp->pr_version != XPRISON_VERSION)
+            errx(1, "kernel and userland out of sync");
+
+        ji[n].jid = xp->pr_id;
+        strlcpy(ji[n].host, xp->pr_host, sizeof(ji[n].host));
+        strlcpy(ji[n].path, xp->pr_path, sizeof(ji[n].path));
+    }
+
+    memset(data, 0, length);
+    free(data);
+
+    *list = ji;
+    *count = n;
+    return 0;
+}
+
+static int freebsd_list_procs(jail_proc** list, size_t* count)
+{
+    struct kinfo_proc* kp;
+    int nentries, i;
+
+    freebsd_open();
+
+    /* Get a process listing */
+    if((kp = kvm_getprocs(g_kd, KERN_PROC_ALL, 0, &nentries)) == 0)
+        errx(1, "couldn't list processes: %s", kvm_geterr(g_kd));
+
+    if((size_t)nentries > g_nprocs)
+    {
+        g_procs = (jail_proc*)realloc(g_procs, sizeof(jail_proc) * nentries);
+        if(g_procs == NULL)
+            errx(1, "out of memory");
+        g_nprocs = nentries;
+    }
+
+    for(i = 0; i < nentries; i++)
+    {
+        g_procs[i].pid = kp[i].ki_pid;
+        strlcpy(g_procs[i].comm, kp[i].ki_comm, sizeof(g_procs[i].comm));
+    }
+
+    *list = g_procs;
+    *count = nentries;
+    return 0;
+}
+
+static int kvm_prepare_jail(const jail_info* ji)
+{
+    /*
+     * Basically the kvm routines won't work in a jail unless there's
+     * a /dev/null device for us to use as the file names. If it's
+     * missing we have to create it.
+     */
+
+    struct stat sb;
+    char* path;
+    int nodir = 0;
+    int nonull = 0;
+
+    path = (char*)alloca(strlen(_PATH_DEVNULL) + 2 + strlen(ji->path));
+
+    strcpy(path, ji->path);
+    strcat(path, _PATH_DEVNULL);
+
+    if(stat(path, &sb) == -1)
+    {
+        if(errno == ENOTDIR)
+        {
+            nodir = 1;
+            nonull = 1;
+        }
+
+        else if(errno == ENOENT)
+        {
+            nonull = 1;
+        }
+
+        else
+        {
+            err(1, "couldn't stat file: %s", path);
+        }
+    }
+
+    if(nodir)
+    {
+        strcpy(path, ji->path);
+        strcat(path, _PATH_DEV);
+
+        if(mkdir(path, 0) == -1 ||
+           chmod(path, S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) == -1)
+        {
+            warn("couldn't create %s directory", path);
+            return -1;
+        }
+    }
+
+    if(nonull)
+    {
+        mode_t mode = 0666 | S_IFCHR;
+        dev_t dev = makedev(2, 2);
+
+        strcpy(path, ji->path);
+        strcat(path, _PATH_DEVNULL);
+
+        warnx("creating %s device in jail.", path);
+
+        if(mknod(path, mode, dev) == -1)
+        {
+            warn("couldn't create %s device", path);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int freebsd_attach(const jail_info* ji)
+{
+    /* This makes sure we can use kvm funcs in jail */
+    kvm_prepare_jail(ji);
+
+    return jail_attach(ji->jid);
+}
+
+static int freebsd_signal(pid_t pid, int sig)
+{
+    return kill(pid, sig);
+}
+
+/* Jail structure with multi address patch */
+#if defined(JAIL_MULTIPATCH)
+
+static int freebsd_create(const jail_spec* spec)
+{
+    struct jail j;
+    unsigned int i;
+    int jid;
+
+    if(spec->ip6s > 0)
+        errx(1, "this kernel doesn't support IPv6 jail addresses");
+
+    memset(&j, 0, sizeof(j));
+    j.version = 1;
+    j.path = (char*)spec->path;
+    j.hostname = (char*)spec->hostname;
+
+    if((j.ips = (u_int32_t*)malloc(sizeof(u_int32_t) * (spec->ip4s + 1))) == NULL)
+        errx(1, "out of memory");
+
+    for(i = 0; i < spec->ip4s; i++)
+        j.ips[i] = ntohl(spec->ip4[i].s_addr);
+    j.nips = spec->ip4s;
+
+    jid = jail(&j);
+
+    free(j.ips);
+    return jid;
+}
+
+/* Jail structure with multi address (FreeBSD 7.2+) */
+#elif defined(JAIL_MULTIADDR)
+
+static int freebsd_create(const jail_spec* spec)
+{
+    struct jail j;
+
+    memset(&j, 0, sizeof(j));
+    j.version = JAIL_API_VERSION;
+    j.path = (char*)spec->path;
+    j.hostname = (char*)spec->hostname;
+    j.ip4s = spec->ip4s;
+    j.ip4 = spec->ip4;
+    j.ip6s = spec->ip6s;
+    j.ip6 = spec->ip6;
+
+    return jail(&j);
+}
+
+/* No jail multi addrs */
+#else
+
+static int freebsd_create(const jail_spec* spec)
+{
+    struct jail j;
+
+    if(spec->ip4s != 1 || spec->ip6s != 0)
+        errx(1, "this kernel only supports one IPv4 address per jail");
+
+    memset(&j, 0, sizeof(j));
+    j.version = 0;
+    j.path = (char*)spec->path;
+    j.hostname = (char*)spec->hostname;
+    j.ip_number = ntohl(spec->ip4[0].s_addr);
+
+    return jail(&j);
+}
+
+#endif /* !JAIL_MULTIPATCH */
+
+#ifdef HAVE_JAIL_SET
+
+#define SET_PARAM(n, v, l)                  \
+    iov[niov].iov_base = (void*)(n);        \
+    iov[niov++].iov_len = strlen(n) + 1;    \
+    iov[niov].iov_base = (void*)(v);        \
+    iov[niov++].iov_len = (l);
+
+/* jail_set(2) can change parameters of a running jail */
+static int freebsd_rebind(const jail_info* ji, const jail_spec* spec)
+{
+    struct iovec iov[8];
+    unsigned int niov = 0;
+    int jid = ji->jid;
+
+    SET_PARAM("jid", &jid, sizeof(jid));
+    SET_PARAM("host.hostname", spec->hostname, strlen(spec->hostname) + 1);
+
+    if(spec->ip4s > 0)
+    {
+        SET_PARAM("ip4.addr", spec->ip4, sizeof(struct in_addr) * spec->ip4s);
+    }
+
+    if(spec->ip6s > 0)
+    {
+        SET_PARAM("ip6.addr", spec->ip6, sizeof(struct in6_addr) * spec->ip6s);
+    }
+
+    return jail_set(iov, niov, JAIL_UPDATE) == -1 ? -1 : 0;
+}
+
+#define FREEBSD_REBIND  freebsd_rebind
+
+#else
+
+#define FREEBSD_REBIND  NULL
+
+#endif /* HAVE_JAIL_SET */
+
+#ifdef HAVE_CPUSET_SETAFFINITY
+
+/* Memory domains came along with cpuset_setdomain() */
+static int freebsd_domains()
+{
+#ifdef HAVE_CPUSET_SETDOMAIN
+    size_t len;
+    int n;
+
+    len = sizeof(n);
+    if(sysctlbyname("vm.ndomains", &n, &len, NULL, 0) == 0 && n > 0)
+        return n;
+#endif
+    return 1;
+}
+
+static int freebsd_domain_cpus(int domain, jail_place* pl)
+{
+    cpuset_t set;
+    int i, r;
+
+    memset(pl, 0, sizeof(*pl));
+
+    if(domain >= freebsd_domains())
+    {
+        errno = ENOENT;
+        return -1;
+    }
+
+#ifdef HAVE_CPUSET_SETDOMAIN
+    if(domain >= 0)
+        r = cpuset_getaffinity(CPU_LEVEL_WHICH, CPU_WHICH_DOMAIN, domain,
+                               sizeof(set), &set);
+    else
+#endif
+        r = cpuset_getaffinity(CPU_LEVEL_ROOT, CPU_WHICH_PID, -1,
+                               sizeof(set), &set);
+    if(r == -1)
+        return -1;
+
+    for(i = 0; i < JAIL_MAX_CPUS && i < CPU_SETSIZE; i++)
+    {
+        if(CPU_ISSET(i, &set))
+            PLACEMENT_SET(pl->cpus, i);
+    }
+
+    if(domain >= 0)
+        PLACEMENT_SET(pl->domains, domain);
+
+    return 0;
+}
+
+static int freebsd_place(int jid, const jail_place* pl)
+{
+    cpuset_t set;
+    int i;
+#ifdef HAVE_CPUSET_SETDOMAIN
+    domainset_t domains;
+    int n = 0;
+#endif
+
+    CPU_ZERO(&set);
+    for(i = 0; i < JAIL_MAX_CPUS && i < CPU_SETSIZE; i++)
+    {
+        if(PLACEMENT_ISSET(pl->cpus, i))
+            CPU_SET(i, &set);
+    }
+
+    if(cpuset_setaffinity(CPU_LEVEL_WHICH, CPU_WHICH_JAIL, jid,
+                          sizeof(set), &set) == -1)
+        return -1;
+
+#ifdef HAVE_CPUSET_SETDOMAIN
+    DOMAINSET_ZERO(&domains);
+    for(i = 0; i < JAIL_MAX_DOMAINS && i < DOMAINSET_SETSIZE; i++)
+    {
+        if(PLACEMENT_ISSET(pl->domains, i))
+        {
+            DOMAINSET_SET(i, &domains);
+            n++;
+        }
+    }
+
+    /* Prefer only works with a single domain */
+    if(n > 0 && cpuset_setdomain(CPU_LEVEL_WHICH, CPU_WHICH_JAIL, jid,
+                                 sizeof(domains), &domains,
+                                 n == 1 ? DOMAINSET_POLICY_PREFER :
+                                 DOMAINSET_POLICY_ROUNDROBIN) == -1)
+        return -1;
+#endif
+
+    return 0;
+}
+
+static int freebsd_placement(const jail_info* ji, jail_place* pl)
+{
+    cpuset_t set;
+    int i;
+#ifdef HAVE_CPUSET_SETDOMAIN
+    domainset_t domains;
+    int policy, n = 0;
+#endif
+
+    memset(pl, 0, sizeof(*pl));
+
+    if(cpuset_getaffinity(CPU_LEVEL_WHICH, CPU_WHICH_JAIL, ji->jid,
+                          sizeof(set), &set) == -1)
+        return -1;
+
+    for(i = 0; i < JAIL_MAX_CPUS && i < CPU_SETSIZE; i++)
+    {
+        if(CPU_ISSET(i, &set))
+            PLACEMENT_SET(pl->cpus, i);
+    }
+
+#ifdef HAVE_CPUSET_SETDOMAIN
+    if(cpuset_getdomain(CPU_LEVEL_WHICH, CPU_WHICH_JAIL, ji->jid,
+                        sizeof(domains), &domains, &policy) == -1)
+        return -1;
+
+    for(i = 0; i < JAIL_MAX_DOMAINS && i < DOMAINSET_SETSIZE; i++)
+        n += DOMAINSET_ISSET(i, &domains);
+
+    /* All of them is the same as not being pinned */
+    if(n < freebsd_domains() || policy == DOMAINSET_POLICY_PREFER)
+    {
+        for(i = 0; i < JAIL_MAX_DOMAINS && i < DOMAINSET_SETSIZE; i++)
+        {
+            if(DOMAINSET_ISSET(i, &domains))
+                PLACEMENT_SET(pl->domains, i);
+        }
+    }
+#endif
+
+    return 0;
+}
+
+#define FREEBSD_DOMAIN_CPUS freebsd_domain_cpus
+#define FREEBSD_PLACE       freebsd_place
+#define FREEBSD_PLACEMENT   freebsd_placement
+
+#else
+
+#define FREEBSD_DOMAIN_CPUS NULL
+#define FREEBSD_PLACE       NULL
+#define FREEBSD_PLACEMENT   NULL
+
+#endif /* HAVE_CPUSET_SETAFFINITY */
+
+#ifdef HAVE_RCTL_ADD_RULE
+
+/*
+ * Rules go by the jail's name, which is its id since we never give
+ * it another. Needs kern.racct.enable set at boot.
+ */
+static int add_rule(int jid, const char* resource, unsigned long long amount)
+{
+    char rule[128];
+
+    snprintf(rule, sizeof(rule), "jail:%d:%s:deny=%llu", jid, resource, amount);
+    return rctl_add_rule(rule, strlen(rule) + 1, NULL, 0);
+}
+
+static int freebsd_limit(int jid, const jail_limits* lim)
+{
+    if((lim->memory && add_rule(jid, "memoryuse", lim->memory) == -1) ||
+       (lim->cpu && add_rule(jid, "pcpu", lim->cpu) == -1) ||
+       (lim->procs && add_rule(jid, "maxproc", lim->procs) == -1) ||
+       (lim->files && add_rule(jid, "openfiles", lim->files) == -1))
+        return -1;
+
+    return 0;
+}
+
+static void set_resource(const char* name, unsigned long long val,
+                         jail_usage* use, jail_limits* lim)
+{
+    if(strcmp(name, "memoryuse") == 0)
+    {
+        if(use)
+            use->memory = val;
+        else
+            lim->memory = val;
+    }
+    else if(strcmp(name, "maxproc") == 0)
+    {
+        if(use)
+            use->procs = (long)val;
+        else
+            lim->procs = (long)val;
+    }
+    else if(strcmp(name, "openfiles") == 0)
+    {
+        if(use)
+            use->files = (long)val;
+        else
+            lim->files = (long)val;
+    }
+    else if(strcmp(name, "cputime") == 0 && use)
+    {
+        use->cputime = val * 1000000ULL;
+    }
+    else if(strcmp(name, "pcpu") == 0 && lim)
+    {
+        lim->cpu = (int)val;
+    }
+}
+
+static int freebsd_usage(const jail_info* ji, jail_usage* use, jail_limits* lim)
+{
+    unsigned long long val;
+    char filter[64];
+    char buf[4096];
+    char name[64];
+    char* t;
+
+    memset(use, 0, sizeof(*use));
+    memset(lim, 0, sizeof(*lim));
+
+    snprintf(filter, sizeof(filter), "jail:%d", ji->jid);
+
+    /* Comes as resource=amount,... */
+    if(rctl_get_racct(filter, strlen(filter) + 1, buf, sizeof(buf)) == -1)
+        return -1;
+
+    for(t = strtok(buf, ","); t; t = strtok(NULL, ","))
+    {
+        if(sscanf(t, "%63[^=]=%llu", name, &val) == 2)
+            set_resource(name, val, use, NULL);
+    }
+
+    /* And the rules as jail:jid:resource:deny=amount,... */
+    if(rctl_get_rules(filter, strlen(filter) + 1, buf, sizeof(buf)) == -1)
+        return -1;
+
+    for(t = strtok(buf, ","); t; t = strtok(NULL, ","))
+    {
+        if(sscanf(t, "%*[^:]:%*[^:]:%63[^:]:deny=%llu", name, &val) == 2)
+            set_resource(name, val, NULL, lim);
+    }
+
+    return 0;
+}
+
+#define FREEBSD_LIMIT       freebsd_limit
+#define FREEBSD_USAGE       freebsd_usage
+
+#else
+
+#define FREEBSD_LIMIT       NULL
+#define FREEBSD_USAGE       NULL
+
+#endif /* HAVE_RCTL_ADD_RULE */
+
+const jail_backend jail_backend_freebsd =
+{
+    "freebsd",
+    0,
+    freebsd_jailed,
+    freebsd_jail_id,
+    freebsd_open,
+    freebsd_list_jails,
+    freebsd_list_procs,
+    freebsd_attach,
+    freebsd_signal,
+    freebsd_create,
+    NULL,
+    FREEBSD_REBIND,
+    FREEBSD_DOMAIN_CPUS,
+    FREEBSD_PLACE,
+    FREEBSD_PLACEMENT,
+    FREEBSD_LIMIT,
+    FREEBSD_USAGE,
+    NULL
+};
+
+#endif /* HAVE_JAIL_ATTACH */
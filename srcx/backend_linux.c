@@ -0,0 +1,1149 @@
+/*
+ * Copyright (c) 2004, Stefan Walter
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above
+ *       copyright notice, this list of conditions and the
+ *       following disclaimer.
+ *     * Redistributions in binary form must reproduce the
+ *       above copyright notice, this list of conditions and
+ *       the following disclaimer in the documentation and/or
+ *       other materials provided with the distribution.
+ *     * The names of contributors to this software may not be
+ *       used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ *
+ *
+ * CONTRIBUTORS
+ *  Stef Walter <stef@memberwebs.com>
+ *  James E. Quick <jq@quick.com>
+ */
+
+/*
+ * Linux has no jails, but PID, mount, UTS and IPC namespaces together
+ * with a cgroup v2 group for each jail come close. Jails are the
+ * directories under one cgroup subtree, 'jails' below wherever cgroup2
+ * is mounted unless JAILUTILS_CGROUP says otherwise. The directory is named after the
+ * jail's host name, and its inode number is the jail id.
+ *
+ * The first process forked after creating a jail is pid 1 in its pid
+ * namespace, and when it exits the kernel kills everything else in
+ * the jail. So that's always our init, see init.h, rather than rc.
+ *
+ * Jails share the host's network. Addresses given to jstart are
+ * accepted but not applied. Jails can't be given a new host name
+ * later, since cgroup v2 directories can't be renamed.
+ *
+ * Jails are pinned with the cgroup's cpuset controller when it can be
+ * handed down to the jails subtree, and otherwise with plain CPU
+ * affinity, which everything in the jail inherits. Limits need the
+ * memory, cpu and pids controllers, except for open files which can
+ * only be limited per process.
+ */
+
+#include "config.h"
+
+#if defined(__linux__) && defined(HAVE_SETNS)
+
+/* For setns() and friends */
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/mount.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include <dirent.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "util.h"
+#include "backend.h"
+#include "placement.h"
+
+#define CGROUP_ENV          "JAILUTILS_CGROUP"
+#define CGROUP_SUBTREE      "jails"
+#define CGROUP_MOUNT        "/sys/fs/cgroup"
+
+#define NODE_CPULIST        "/sys/devices/system/node/node%d/cpulist"
+#define ONLINE_CPUS         "/sys/devices/system/cpu/online"
+
+/* Long enough for every other CPU out of JAIL_MAX_CPUS */
+#define CPULIST_LEN         (JAIL_MAX_CPUS * 3)
+
+/* In microseconds, for cpu.max */
+#define CPU_PERIOD          100000
+
+/* What a cgroup left behind by an earlier jail gets put back to */
+static const struct
+{
+    const char* name;
+    const char* value;
+}
+g_resets[] =
+{
+    { "cpuset.cpus", "\n" },
+    { "cpuset.mems", "\n" },
+    { "memory.max", "max" },
+    { "cpu.max", "max" },
+    { "pids.max", "max" }
+};
+
+#define NUM_RESETS      (sizeof(g_resets) / sizeof(g_resets[0]))
+
+/* The namespaces that make up a jail, and how to join them */
+static const struct
+{
+    const char* name;
+    int type;
+}
+g_namespaces[] =
+{
+    { "ipc", CLONE_NEWIPC },
+    { "uts", CLONE_NEWUTS },
+    { "pid", CLONE_NEWPID },
+    { "mnt", CLONE_NEWNS }
+};
+
+#define NUM_NAMESPACES  (sizeof(g_namespaces) / sizeof(g_namespaces[0]))
+
+/* Open after attaching, so we can still get at the jail's cgroup */
+static int g_jailfd = -1;
+static int g_rootfd = -1;
+
+static jail_proc* g_procs = NULL;
+static size_t g_procscap = 0;
+
+/* Where the unified hierarchy is mounted, usually /sys/fs/cgroup */
+static const char* cgroup_mount()
+{
+    static char mount[MAXPATHLEN];
+    char line[MAXPATHLEN * 2];
+    char dir[MAXPATHLEN];
+    char type[64];
+    FILE* f;
+
+    if(mount[0])
+        return mount;
+
+    strlcpy(mount, CGROUP_MOUNT, sizeof(mount));
+
+    f = fopen("/proc/self/mounts", "r");
+    if(f == NULL)
+        return mount;
+
+    while(fgets(line, sizeof(line), f) != NULL)
+    {
+        if(sscanf(line, "%*s %1023s %63s", dir, type) == 2 &&
+           strcmp(type, "cgroup2") == 0)
+        {
+            strlcpy(mount, dir, sizeof(mount));
+            break;
+        }
+    }
+
+    fclose(f);
+    return mount;
+}
+
+static const char* cgroup_root()
+{
+    static char root[MAXPATHLEN + sizeof(CGROUP_SUBTREE) + 1];
+    const char* env = getenv(CGROUP_ENV);
+
+    if(env && *env)
+        return env;
+
+    if(!root[0])
+        snprintf(root, sizeof(root), "%s/%s", cgroup_mount(), CGROUP_SUBTREE);
+    return root;
+}
+
+static int cgroup_jid(int dirfd)
+{
+    struct stat sb;
+
+    if(fstat(dirfd, &sb) == -1)
+        return -1;
+
+    return (int)(sb.st_ino & INT_MAX);
+}
+
+static ssize_t read_file_at(int dirfd, const char* name, char* buf, size_t len)
+{
+    ssize_t r, total = 0;
+    int fd;
+
+    fd = openat(dirfd, name, O_RDONLY);
+    if(fd == -1)
+        return -1;
+
+    while(total < (ssize_t)len - 1 &&
+          (r = read(fd, buf + total, len - 1 - total)) > 0)
+        total += r;
+
+    close(fd);
+    buf[total] = 0;
+    return total;
+}
+
+static int write_file_at(int dirfd, const char* name, const char* data)
+{
+    ssize_t len = strlen(data);
+    int fd, r;
+
+    fd = openat(dirfd, name, O_WRONLY);
+    if(fd == -1)
+        return -1;
+
+    r = write(fd, data, len) == len ? 0 : -1;
+    close(fd);
+    return r;
+}
+
+static int join_cgroup(int dirfd)
+{
+    char buf[32];
+
+    snprintf(buf, sizeof(buf), "%d", (int)getpid());
+    return write_file_at(dirfd, "cgroup.procs", buf);
+}
+
+/*
+ * Reads the pids in a cgroup into our reused array. The kernel shows
+ * them as seen from our own pid namespace, even after setns().
+ */
+static int read_cgroup_procs(int dirfd, jail_proc** list, size_t* count)
+{
+    char path[32];
+    char line[32];
+    FILE* f;
+    size_t n = 0;
+    int fd;
+
+    fd = openat(dirfd, "cgroup.procs", O_RDONLY);
+    if(fd == -1 || (f = fdopen(fd, "r")) == NULL)
+        return -1;
+
+    while(fgets(line, sizeof(line), f) != NULL)
+    {
+        if(n >= g_procscap)
+        {
+            g_procscap = g_procscap ? g_procscap * 2 : 64;
+            g_procs = (jail_proc*)realloc(g_procs, sizeof(jail_proc) * g_procscap);
+            if(g_procs == NULL)
+                errx(1, "out of memory");
+        }
+
+        g_procs[n].pid = (pid_t)atoi(line);
+        g_procs[n].comm[0] = 0;
+
+        snprintf(path, sizeof(path), "/proc/%d/comm", (int)g_procs[n].pid);
+        if(read_file_at(AT_FDCWD, path, g_procs[n].comm, sizeof(g_procs[n].comm)) > 0)
+            g_procs[n].comm[strcspn(g_procs[n].comm, "\n")] = 0;
+
+        n++;
+    }
+
+    fclose(f);
+
+    *list = g_procs;
+    *count = n;
+    return 0;
+}
+
+/* A process in the jail, whose namespaces we can join */
+static pid_t jail_member(int dirfd)
+{
+    struct stat ours, theirs;
+    char path[64];
+    jail_proc* procs;
+    size_t nprocs, i;
+
+    if(read_cgroup_procs(dirfd, &procs, &nprocs) == -1 || nprocs == 0)
+        return -1;
+
+    /*
+     * jstart itself sits in the cgroup without being in the pid
+     * namespace, so look for something that is.
+     */
+    if(stat("/proc/self/ns/pid", &ours) == -1)
+        return procs[0].pid;
+
+    for(i = 0; i < nprocs; i++)
+    {
+        snprintf(path, sizeof(path), "/proc/%d/ns/pid", (int)procs[i].pid);
+        if(stat(path, &theirs) == 0 && theirs.st_ino != ours.st_ino)
+            return procs[i].pid;
+    }
+
+    return procs[0].pid;
+}
+
+static int linux_jailed()
+{
+    char buf[MAXPATHLEN];
+    const char* mount;
+    const char* root;
+    const char* rel;
+    char* line;
+
+    /*
+     * We're in a jail when our cgroup is under the jails subtree.
+     * The unified hierarchy shows up as '0::/path'.
+     */
+    if(read_file_at(AT_FDCWD, "/proc/self/cgroup", buf, sizeof(buf)) <= 0)
+        return -1;
+
+    root = cgroup_root();
+    mount = cgroup_mount();
+    if(strncmp(root, mount, strlen(mount)) != 0)
+        return -1;
+    rel = root + strlen(mount);
+
+    for(line = strtok(buf, "\n"); line; line = strtok(NULL, "\n"))
+    {
+        if(strncmp(line, "0::", 3) != 0)
+            continue;
+
+        line += 3;
+        return (strncmp(line, rel, strlen(rel)) == 0 &&
+                line[strlen(rel)] == '/') ? 1 : 0;
+    }
+
+    return 0;
+}
+
+static int linux_jail_id()
+{
+    char buf[MAXPATHLEN];
+    char path[MAXPATHLEN * 2];
+    int fd, jid;
+
+    /* Otherwise it'd be the id of whatever cgroup the host put us in */
+    jid = linux_jailed();
+    if(jid != 1)
+        return jid;
+
+    if(read_file_at(AT_FDCWD, "/proc/self/cgroup", buf, sizeof(buf)) <= 0 ||
+       strncmp(buf, "0::", 3) != 0)
+        return -1;
+
+    buf[strcspn(buf, "\n")] = 0;
+    snprintf(path, sizeof(path), "%s%s", cgroup_mount(), buf + 3);
+
+    fd = open(path, O_RDONLY | O_DIRECTORY);
+    if(fd == -1)
+        return -1;
+
+    jid = cgroup_jid(fd);
+    close(fd);
+    return jid;
+}
+
+static int linux_open()
+{
+    return 0;
+}
+
+static int linux_list_jails(jail_info** list, size_t* count)
+{
+    struct dirent* de;
+    char path[64];
+    jail_info* ji = NULL;
+    size_t n = 0, cap = 0;
+    ssize_t len;
+    DIR* dir;
+    int fd;
+    pid_t pid;
+
+    *list = NULL;
+    *count = 0;
+
+    dir = opendir(cgroup_root());
+    if(dir == NULL)
+        return errno == ENOENT ? 0 : -1;
+
+    while((de = readdir(dir)) != NULL)
+    {
+        if(de->d_name[0] == '.')
+            continue;
+
+        fd = openat(dirfd(dir), de->d_name, O_RDONLY | O_DIRECTORY);
+        if(fd == -1)
+            continue;
+
+        if(n >= cap)
+        {
+            cap = cap ? cap * 2 : 16;
+            ji = (jail_info*)realloc(ji, sizeof(jail_info) * cap);
+            if(ji == NULL)
+                errx(1, "out of memory");
+        }
+
+        /* A jail with no processes has stopped */
+        pid = jail_member(fd);
+        if(pid <= 0)
+        {
+            close(fd);
+            continue;
+        }
+
+        memset(&(ji[n]), 0, sizeof(jail_info));
+        ji[n].jid = cgroup_jid(fd);
+        strlcpy(ji[n].host, de->d_name, sizeof(ji[n].host));
+
+        /* The root of the jail is wherever its processes are chrooted */
+        snprintf(path, sizeof(path), "/proc/%d/root", (int)pid);
+        len = readlink(path, ji[n].path, sizeof(ji[n].path) - 1);
+        if(len > 0)
+            ji[n].path[len] = 0;
+
+        close(fd);
+        n++;
+    }
+
+    closedir(dir);
+
+    *list = ji;
+    *count = n;
+    return 0;
+}
+
+static int linux_list_procs(jail_proc** list, size_t* count)
+{
+    struct dirent* de;
+    size_t n = 0;
+    DIR* dir;
+
+    /* In a jail, the cgroup has exactly the processes we want */
+    if(g_jailfd != -1)
+        return read_cgroup_procs(g_jailfd, list, count);
+
+    dir = opendir("/proc");
+    if(dir == NULL)
+        return -1;
+
+    while((de = readdir(dir)) != NULL)
+    {
+        if(de->d_name[0] < '0' || de->d_name[0] > '9')
+            continue;
+
+        if(n >= g_procscap)
+        {
+            g_procscap = g_procscap ? g_procscap * 2 : 256;
+            g_procs = (jail_proc*)realloc(g_procs, sizeof(jail_proc) * g_procscap);
+            if(g_procs == NULL)
+                errx(1, "out of memory");
+        }
+
+        g_procs[n].pid = (pid_t)atoi(de->d_name);
+        g_procs[n].comm[0] = 0;
+        n++;
+    }
+
+    closedir(dir);
+
+    *list = g_procs;
+    *count = n;
+    return 0;
+}
+
+static int linux_attach(const jail_info* ji)
+{
+    int nsfd[NUM_NAMESPACES];
+    char path[64];
+    int fd, rootfd = -1;
+    int ret = -1;
+    pid_t pid;
+    size_t i;
+
+    for(i = 0; i < NUM_NAMESPACES; i++)
+        nsfd[i] = -1;
+
+    if(g_rootfd == -1)
+        g_rootfd = open(cgroup_root(), O_RDONLY | O_DIRECTORY);
+    if(g_rootfd == -1)
+        return -1;
+
+    fd = openat(g_rootfd, ji->host, O_RDONLY | O_DIRECTORY);
+    if(fd == -1 || cgroup_jid(fd) != ji->jid)
+    {
+        errno = EINVAL;
+        goto done;
+    }
+
+    pid = jail_member(fd);
+    if(pid <= 0)
+    {
+        errno = ESRCH;
+        goto done;
+    }
+
+    /* Open everything first, /proc goes away with the mount namespace */
+    for(i = 0; i < NUM_NAMESPACES; i++)
+    {
+        snprintf(path, sizeof(path), "/proc/%d/ns/%s", (int)pid, g_namespaces[i].name);
+        nsfd[i] = open(path, O_RDONLY);
+        if(nsfd[i] == -1)
+            goto done;
+    }
+
+    snprintf(path, sizeof(path), "/proc/%d/root", (int)pid);
+    rootfd = open(path, O_RDONLY | O_DIRECTORY);
+    if(rootfd == -1)
+        goto done;
+
+    /* Our children should end up in the jail's cgroup */
+    if(join_cgroup(fd) == -1)
+        goto done;
+
+    for(i = 0; i < NUM_NAMESPACES; i++)
+    {
+        if(setns(nsfd[i], g_namespaces[i].type) == -1)
+            goto done;
+    }
+
+    if(fchdir(rootfd) == -1 || chroot(".") == -1 || chdir("/") == -1)
+        goto done;
+
+    g_jailfd = fd;
+    fd = -1;
+    ret = 0;
+
+done:
+    for(i = 0; i < NUM_NAMESPACES; i++)
+    {
+        if(nsfd[i] != -1)
+            close(nsfd[i]);
+    }
+
+    if(rootfd != -1)
+        close(rootfd);
+    if(fd != -1)
+        close(fd);
+
+    return ret;
+}
+
+static int linux_signal(pid_t pid, int sig)
+{
+    return kill(pid, sig);
+}
+
+static int linux_kill_all(int sig)
+{
+    jail_proc* procs;
+    size_t nprocs, i;
+    pid_t cur = getpid();
+
+    if(g_jailfd == -1)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /*
+     * cgroup.kill takes out the whole jail in one go, but would take
+     * us with it. Step out of the cgroup and back in again after.
+     */
+    if(sig == SIGKILL && faccessat(g_jailfd, "cgroup.kill", W_OK, 0) == 0)
+    {
+        if(join_cgroup(g_rootfd) == 0)
+        {
+            if(write_file_at(g_jailfd, "cgroup.kill", "1") == -1)
+                warn("couldn't kill jail cgroup");
+
+            if(join_cgroup(g_jailfd) == -1)
+                return -1;
+
+            return 0;
+        }
+    }
+
+    if(read_cgroup_procs(g_jailfd, &procs, &nprocs) == -1)
+        return -1;
+
+    for(i = 0; i < nprocs; i++)
+    {
+        if(procs[i].pid == cur)
+            continue;
+
+        if(kill(procs[i].pid, sig) == -1 && errno != ESRCH)
+            return -1;
+    }
+
+    return 0;
+}
+
+static int linux_create(const jail_spec* spec)
+{
+    size_t i;
+    int jid;
+
+    if(spec->ip4s > 0 || spec->ip6s > 0)
+        warnx("%s: jail addresses aren't supported, sharing the host's network",
+              spec->hostname);
+
+    if(strchr(spec->hostname, '/') != NULL || spec->hostname[0] == '.')
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    g_rootfd = open(cgroup_root(), O_RDONLY | O_DIRECTORY);
+    if(g_rootfd == -1)
+    {
+        if(errno != ENOENT || mkdir(cgroup_root(), 0755) == -1)
+            return -1;
+        g_rootfd = open(cgroup_root(), O_RDONLY | O_DIRECTORY);
+        if(g_rootfd == -1)
+            return -1;
+    }
+
+    if(mkdirat(g_rootfd, spec->hostname, 0755) == -1 && errno != EEXIST)
+        return -1;
+
+    g_jailfd = openat(g_rootfd, spec->hostname, O_RDONLY | O_DIRECTORY);
+    if(g_jailfd == -1)
+        return -1;
+
+    /* Stopped jails leave their cgroup behind, running ones don't count */
+    if(jail_member(g_jailfd) > 0)
+    {
+        errno = EEXIST;
+        return -1;
+    }
+
+    if(join_cgroup(g_jailfd) == -1)
+        return -1;
+
+    jid = cgroup_jid(g_jailfd);
+
+    /*
+     * The next process we fork is the jail's init, which must stay
+     * until the jail stops. The mounts must be private so that nothing
+     * we do leaks back to the host.
+     */
+    if(unshare(CLONE_NEWNS | CLONE_NEWUTS | CLONE_NEWIPC | CLONE_NEWPID) == -1)
+        return -1;
+
+    /* A cgroup left behind by an earlier jail may still be pinned or limited */
+    for(i = 0; i < NUM_RESETS; i++)
+    {
+        if(faccessat(g_jailfd, g_resets[i].name, W_OK, 0) == 0)
+            write_file_at(g_jailfd, g_resets[i].name, g_resets[i].value);
+    }
+
+    if(mount(NULL, "/", NULL, MS_REC | MS_PRIVATE, NULL) == -1)
+        return -1;
+
+    if(sethostname(spec->hostname, strlen(spec->hostname)) == -1)
+        return -1;
+
+    if(chroot(spec->path) == -1 || chdir("/") == -1)
+        return -1;
+
+    return jid;
+}
+
+static int linux_domain_cpus(int domain, jail_place* pl)
+{
+    char path[64];
+    char buf[CPULIST_LEN];
+
+    memset(pl, 0, sizeof(*pl));
+    snprintf(path, sizeof(path), NODE_CPULIST, domain);
+
+    /* Without NUMA there are no nodes, and domain 0 is everything */
+    if(domain < 0 || read_file_at(AT_FDCWD, path, buf, sizeof(buf)) == -1)
+    {
+        if(domain > 0 || (domain == 0 && errno != ENOENT))
+            return -1;
+        if(read_file_at(AT_FDCWD, ONLINE_CPUS, buf, sizeof(buf)) == -1)
+            return -1;
+    }
+
+    if(domain >= 0)
+        PLACEMENT_SET(pl->domains, domain);
+
+    return placement_parse_list(buf, pl->cpus, JAIL_MAX_CPUS);
+}
+
+static int has_controller(int dirfd, const char* name)
+{
+    char buf[256];
+    char* t;
+
+    if(read_file_at(dirfd, "cgroup.controllers", buf, sizeof(buf)) <= 0)
+        return 0;
+
+    for(t = strtok(buf, " \n"); t; t = strtok(NULL, " \n"))
+    {
+        if(strcmp(t, name) == 0)
+            return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Controllers are handed down one level at a time, from wherever
+ * the jails subtree hangs off.
+ */
+static int enable_controller(const char* name)
+{
+    char buf[32];
+    int fd, r;
+
+    if(has_controller(g_jailfd, name))
+        return 0;
+
+    fd = openat(g_rootfd, "..", O_RDONLY | O_DIRECTORY);
+    if(fd == -1)
+        return -1;
+
+    snprintf(buf, sizeof(buf), "+%s", name);
+    r = write_file_at(fd, "cgroup.subtree_control", buf);
+    close(fd);
+
+    if(r == 0)
+        r = write_file_at(g_rootfd, "cgroup.subtree_control", buf);
+
+    return r;
+}
+
+/* The cgroup of a running jail, checking it's still the same jail */
+static int open_jail_cgroup(const jail_info* ji)
+{
+    int rootfd, fd;
+
+    rootfd = open(cgroup_root(), O_RDONLY | O_DIRECTORY);
+    if(rootfd == -1)
+        return -1;
+
+    fd = openat(rootfd, ji->host, O_RDONLY | O_DIRECTORY);
+    close(rootfd);
+
+    if(fd != -1 && cgroup_jid(fd) != ji->jid)
+    {
+        close(fd);
+        fd = -1;
+    }
+
+    if(fd == -1)
+        errno = ESRCH;
+
+    return fd;
+}
+
+/* Placing and limiting only work on the jail we just created */
+static int created_jail(int jid)
+{
+    if(g_jailfd == -1 || cgroup_jid(g_jailfd) != jid)
+    {
+        errno = ESRCH;
+        return 0;
+    }
+
+    return 1;
+}
+
+static int linux_place(int jid, const jail_place* pl)
+{
+    char buf[CPULIST_LEN];
+    cpu_set_t set;
+    int i, domains = 0;
+
+    if(!created_jail(jid))
+        return -1;
+
+    for(i = 0; i < JAIL_MAX_DOMAINS; i++)
+        domains += PLACEMENT_ISSET(pl->domains, i);
+
+    if(enable_controller("cpuset") == 0)
+    {
+        placement_format_list(pl->cpus, JAIL_MAX_CPUS, buf, sizeof(buf));
+        if(write_file_at(g_jailfd, "cpuset.cpus", buf) == -1)
+            return -1;
+
+        if(domains)
+        {
+            placement_format_list(pl->domains, JAIL_MAX_DOMAINS, buf, sizeof(buf));
+            if(write_file_at(g_jailfd, "cpuset.mems", buf) == -1)
+                return -1;
+        }
+
+        return 0;
+    }
+
+    if(domains)
+        warnx("memory domains need the cgroup cpuset controller, only pinning CPUs");
+
+    CPU_ZERO(&set);
+    for(i = 0; i < JAIL_MAX_CPUS && i < CPU_SETSIZE; i++)
+    {
+        if(PLACEMENT_ISSET(pl->cpus, i))
+            CPU_SET(i, &set);
+    }
+
+    return sched_setaffinity(0, sizeof(set), &set);
+}
+
+static int linux_placement(const jail_info* ji, jail_place* pl)
+{
+    char buf[CPULIST_LEN];
+    jail_proc* procs;
+    size_t nprocs;
+    cpu_set_t set;
+    int fd, i, r = -1;
+
+    memset(pl, 0, sizeof(*pl));
+
+    fd = open_jail_cgroup(ji);
+    if(fd == -1)
+        return -1;
+
+    if(read_file_at(fd, "cpuset.cpus.effective", buf, sizeof(buf)) > 0)
+    {
+        r = placement_parse_list(buf, pl->cpus, JAIL_MAX_CPUS);
+
+        /* Only what was asked for, the effective ones are all of them */
+        if(r == 0 && read_file_at(fd, "cpuset.mems", buf, sizeof(buf)) > 0)
+            r = placement_parse_list(buf, pl->domains, JAIL_MAX_DOMAINS);
+    }
+
+    /* Otherwise whatever affinity the processes in it have */
+    else if(read_cgroup_procs(fd, &procs, &nprocs) == 0 && nprocs > 0 &&
+            sched_getaffinity(procs[0].pid, sizeof(set), &set) == 0)
+    {
+        for(i = 0; i < JAIL_MAX_CPUS && i < CPU_SETSIZE; i++)
+        {
+            if(CPU_ISSET(i, &set))
+                PLACEMENT_SET(pl->cpus, i);
+        }
+
+        r = 0;
+    }
+
+    close(fd);
+    return r;
+}
+
+static int limit_controller(const char* name, const char* file, const char* value)
+{
+    if(enable_controller(name) == -1)
+    {
+        warnx("the cgroup %s controller isn't available", name);
+        errno = EOPNOTSUPP;
+        return -1;
+    }
+
+    return write_file_at(g_jailfd, file, value);
+}
+
+static int linux_limit(int jid, const jail_limits* lim)
+{
+    struct rlimit rl;
+    char buf[64];
+
+    if(!created_jail(jid))
+        return -1;
+
+    if(lim->memory)
+    {
+        snprintf(buf, sizeof(buf), "%llu", lim->memory);
+        if(limit_controller("memory", "memory.max", buf) == -1)
+            return -1;
+    }
+
+    if(lim->cpu)
+    {
+        snprintf(buf, sizeof(buf), "%ld %d", (long)lim->cpu * CPU_PERIOD / 100, CPU_PERIOD);
+        if(limit_controller("cpu", "cpu.max", buf) == -1)
+            return -1;
+    }
+
+    if(lim->procs)
+    {
+        snprintf(buf, sizeof(buf), "%ld", lim->procs);
+        if(limit_controller("pids", "pids.max", buf) == -1)
+            return -1;
+    }
+
+    /* Everything started in the jail inherits this */
+    if(lim->files)
+    {
+        rl.rlim_cur = rl.rlim_max = lim->files;
+        if(setrlimit(RLIMIT_NOFILE, &rl) == -1)
+            return -1;
+    }
+
+    return 0;
+}
+
+/* A number from a cgroup file, or 0 for none or 'max' */
+static unsigned long long read_cgroup_number(int dirfd, const char* name, int* found)
+{
+    char buf[64];
+
+    *found = read_file_at(dirfd, name, buf, sizeof(buf)) > 0;
+    return *found ? strtoull(buf, NULL, 10) : 0;
+}
+
+static int linux_usage(const jail_info* ji, jail_usage* use, jail_limits* lim)
+{
+    char path[64];
+    char buf[256];
+    jail_proc* procs;
+    struct dirent* de;
+    size_t nprocs, i;
+    long quota, period;
+    unsigned long rss;
+    char* t;
+    DIR* dir;
+    int fd, found, memory;
+
+    memset(use, 0, sizeof(*use));
+    memset(lim, 0, sizeof(*lim));
+
+    fd = open_jail_cgroup(ji);
+    if(fd == -1)
+        return -1;
+
+    if(read_cgroup_procs(fd, &procs, &nprocs) == -1)
+    {
+        close(fd);
+        return -1;
+    }
+
+    /* cpu.stat is there even without the cpu controller */
+    if(read_file_at(fd, "cpu.stat", buf, sizeof(buf)) > 0 &&
+       (t = strstr(buf, "usage_usec ")) != NULL)
+        use->cputime = strtoull(t + 11, NULL, 10);
+
+    lim->memory = read_cgroup_number(fd, "memory.max", &found);
+    use->memory = read_cgroup_number(fd, "memory.current", &memory);
+    lim->procs = (long)read_cgroup_number(fd, "pids.max", &found);
+    use->procs = (long)read_cgroup_number(fd, "pids.current", &found);
+    if(!found)
+        use->procs = (long)nprocs;
+
+    if(read_file_at(fd, "cpu.max", buf, sizeof(buf)) > 0 &&
+       sscanf(buf, "%ld %ld", &quota, &period) == 2 && period > 0)
+        lim->cpu = (int)(quota * 100 / period);
+
+    for(i = 0; i < nprocs; i++)
+    {
+        /* Without the memory controller, add up what's resident */
+        if(!memory)
+        {
+            snprintf(path, sizeof(path), "/proc/%d/statm", (int)procs[i].pid);
+            if(read_file_at(AT_FDCWD, path, buf, sizeof(buf)) > 0 &&
+               sscanf(buf, "%*s %lu", &rss) == 1)
+                use->memory += (unsigned long long)rss * getpagesize();
+        }
+
+        snprintf(path, sizeof(path), "/proc/%d/fd", (int)procs[i].pid);
+        if((dir = opendir(path)) == NULL)
+            continue;
+
+        while((de = readdir(dir)) != NULL)
+        {
+            if(de->d_name[0] != '.')
+                use->files++;
+        }
+
+        closedir(dir);
+    }
+
+    close(fd);
+    return 0;
+}
+
+/*
+ * The inode of a socket listening on the address, as seen from the
+ * process' network namespace. The kernel prints addresses as the raw
+ * 32 bit words, in our byte order, and the port the normal way.
+ */
+static unsigned long listener_inode(pid_t pid, const struct sockaddr* addr)
+{
+    u_int32_t want[4], words[4];
+    char path[64];
+    char line[512];
+    char hex[40];
+    unsigned int port, p, state;
+    unsigned long inode = 0, ino;
+    int nwords, i;
+    FILE* f;
+
+    if(addr->sa_family == AF_INET)
+    {
+        want[0] = ((const struct sockaddr_in*)addr)->sin_addr.s_addr;
+        port = ntohs(((const struct sockaddr_in*)addr)->sin_port);
+        nwords = 1;
+    }
+    else
+    {
+        memcpy(want, &((const struct sockaddr_in6*)addr)->sin6_addr, sizeof(want));
+        port = ntohs(((const struct sockaddr_in6*)addr)->sin6_port);
+        nwords = 4;
+    }
+
+    snprintf(path, sizeof(path), "/proc/%d/net/%s", (int)pid,
+             nwords == 1 ? "tcp" : "tcp6");
+    if((f = fopen(path, "r")) == NULL)
+        return 0;
+
+    while(inode == 0 && fgets(line, sizeof(line), f) != NULL)
+    {
+        /* Listening is state 0A */
+        if(sscanf(line, " %*d: %39[0-9A-Fa-f]:%x %*s %x %*s %*s %*s %*d %*d %lu",
+                  hex, &p, &state, &ino) != 4 || p != port || state != 0x0A ||
+           strlen(hex) != (size_t)nwords * 8)
+            continue;
+
+        for(i = nwords - 1; i >= 0; i--)
+        {
+            hex[(i + 1) * 8] = 0;
+            words[i] = (u_int32_t)strtoul(hex + i * 8, NULL, 16);
+        }
+
+        if(memcmp(words, want, nwords * sizeof(u_int32_t)) == 0)
+            inode = ino;
+    }
+
+    fclose(f);
+    return inode;
+}
+
+static int linux_take_listener(const jail_info* ji, const struct sockaddr* addr,
+                               socklen_t addrlen)
+{
+#if defined(SYS_pidfd_open) && defined(SYS_pidfd_getfd)
+    char path[64];
+    char link[64];
+    char want[64];
+    jail_proc* procs;
+    struct dirent* de;
+    size_t nprocs, i;
+    unsigned long inode;
+    ssize_t len;
+    int fd, pidfd, got = -1;
+    DIR* dir;
+
+    if((addr->sa_family != AF_INET || addrlen < sizeof(struct sockaddr_in)) &&
+       (addr->sa_family != AF_INET6 || addrlen < sizeof(struct sockaddr_in6)))
+    {
+        errno = EAFNOSUPPORT;
+        return -1;
+    }
+
+    fd = open_jail_cgroup(ji);
+    if(fd == -1)
+        return -1;
+
+    if(read_cgroup_procs(fd, &procs, &nprocs) == -1 || nprocs == 0)
+    {
+        close(fd);
+        errno = ESRCH;
+        return -1;
+    }
+
+    close(fd);
+
+    inode = listener_inode(procs[0].pid, addr);
+    if(inode == 0)
+    {
+        errno = ENOENT;
+        return -1;
+    }
+
+    snprintf(want, sizeof(want), "socket:[%lu]", inode);
+
+    for(i = 0; got == -1 && i < nprocs; i++)
+    {
+        snprintf(path, sizeof(path), "/proc/%d/fd", (int)procs[i].pid);
+        if((dir = opendir(path)) == NULL)
+            continue;
+
+        while(got == -1 && (de = readdir(dir)) != NULL)
+        {
+            len = readlinkat(dirfd(dir), de->d_name, link, sizeof(link) - 1);
+            if(len <= 0)
+                continue;
+            link[len] = 0;
+
+            if(strcmp(link, want) != 0)
+                continue;
+
+            /* The very same socket, so its queue carries on when they close theirs */
+            pidfd = syscall(SYS_pidfd_open, procs[i].pid, 0);
+            if(pidfd == -1)
+                continue;
+            got = syscall(SYS_pidfd_getfd, pidfd, atoi(de->d_name), 0);
+            close(pidfd);
+        }
+
+        closedir(dir);
+    }
+
+    if(got == -1)
+        errno = ENOENT;
+    return got;
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+const jail_backend jail_backend_linux =
+{
+    "linux",
+    JAIL_BACKEND_INIT,
+    linux_jailed,
+    linux_jail_id,
+    linux_open,
+    linux_list_jails,
+    linux_list_procs,
+    linux_attach,
+    linux_signal,
+    linux_create,
+    linux_kill_all,
+    NULL,
+    linux_domain_cpus,
+    linux_place,
+    linux_placement,
+    linux_limit,
+    linux_usage,
+    linux_take_listener
+};
+
+#endif /* __linux__ && HAVE_SETNS */
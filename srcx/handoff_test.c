@@ -0,0 +1,198 @@
+/*
+ * Copyright (c) 2004, Stef Walter
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above
+ *       copyright notice, this list of conditions and the
+ *       following disclaimer.
+ *     * Redistributions in binary form must reproduce the
+ *       above copyright notice, this list of conditions and
+ *       the following disclaimer in the documentation and/or
+ *       other materials provided with the distribution.
+ *     * The names of contributors to this software may not be
+ *       used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ *
+ *
+ * CONTRIBUTORS
+ *  Stef Walter <stef@memberwebs.com>
+ *
+ */
+
+/*
+ * A service for the listening socket handoff test. It listens on the
+ * socket passed in LISTEN_FDS when it's meant for us, or binds its own,
+ * and answers each connection with a single byte. In 'hammer' mode it
+ * connects over and over and counts the connections that failed.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <signal.h>
+#include <stdio.h>
+#include <err.h>
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+
+static volatile sig_atomic_t g_quit = 0;
+
+static void usage();
+
+static void on_quit(int sig)
+{
+    g_quit = 1;
+}
+
+static int parse_addr(const char* host, const char* port, struct sockaddr_in* sin)
+{
+    memset(sin, 0, sizeof(*sin));
+    sin->sin_family = AF_INET;
+    sin->sin_port = htons(atoi(port));
+    return inet_pton(AF_INET, host, &(sin->sin_addr)) == 1 ? 0 : -1;
+}
+
+static int listen_fd()
+{
+    const char* t;
+
+    /* Same convention as systemd socket activation */
+    t = getenv("LISTEN_PID");
+    if(t == NULL || atoi(t) != getpid())
+        return -1;
+
+    t = getenv("LISTEN_FDS");
+    if(t == NULL || atoi(t) < 1)
+        return -1;
+
+    return 3;
+}
+
+static int serve(struct sockaddr_in* sin)
+{
+    struct sigaction sa;
+    int fd, on = 1;
+    int c;
+
+    if((fd = listen_fd()) == -1)
+    {
+        if((fd = socket(AF_INET, SOCK_STREAM, 0)) == -1)
+            err(1, "couldn't create socket");
+
+        /* No SO_REUSEPORT, jkill has to do without it */
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+        if(bind(fd, (struct sockaddr*)sin, sizeof(*sin)) == -1 ||
+           listen(fd, 128) == -1)
+            err(1, "couldn't listen");
+    }
+
+    if(daemon(0, 0) == -1)
+        err(1, "couldn't daemonize");
+
+    /* Only quit between connections, so none are dropped by us */
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_quit;
+    sigaction(SIGTERM, &sa, NULL);
+
+    while(!g_quit)
+    {
+        if((c = accept(fd, NULL, NULL)) == -1)
+        {
+            if(errno == EINTR)
+                continue;
+            err(1, "couldn't accept");
+        }
+
+        write(c, "+", 1);
+        close(c);
+    }
+
+    return 0;
+}
+
+static int hammer(struct sockaddr_in* sin, int seconds)
+{
+    struct timeval tv, end;
+    int total = 0, refused = 0, dropped = 0;
+    char ch;
+    int fd;
+
+    gettimeofday(&end, NULL);
+    end.tv_sec += seconds;
+
+    for(;;)
+    {
+        gettimeofday(&tv, NULL);
+        if(timercmp(&tv, &end, >))
+            break;
+
+        if((fd = socket(AF_INET, SOCK_STREAM, 0)) == -1)
+            err(1, "couldn't create socket");
+
+        total++;
+
+        if(connect(fd, (struct sockaddr*)sin, sizeof(*sin)) == -1)
+        {
+            if(errno != ECONNREFUSED)
+                err(1, "couldn't connect");
+            refused++;
+        }
+
+        /* Queued while the jail was down, then closed unanswered */
+        else if(read(fd, &ch, 1) != 1)
+            dropped++;
+
+        close(fd);
+    }
+
+    printf("%d connections, %d refused, %d dropped\n", total, refused, dropped);
+    return (refused || dropped) ? 1 : 0;
+}
+
+int main(int argc, char* argv[])
+{
+    struct sockaddr_in sin;
+
+    if(argc < 4 || parse_addr(argv[2], argv[3], &sin) == -1)
+        usage();
+
+    if(strcmp(argv[1], "serve") == 0 && argc == 4)
+        return serve(&sin);
+
+    if(strcmp(argv[1], "hammer") == 0 && argc == 5)
+        return hammer(&sin, atoi(argv[4]));
+
+    usage();
+    return 2;
+}
+
+static void usage()
+{
+    fprintf(stderr, "usage: handoff_test serve addr port\n");
+    fprintf(stderr, "       handoff_test hammer addr port seconds\n");
+    exit(2);
+}
@@ -0,0 +1,54 @@
+#!/bin/sh
+#
+# Restarts a jail with 'jkill -r -l' while connecting to a service in
+# it over and over, and fails if any connection is refused or dropped.
+# Needs root and Linux, where the jail shares the host's loopback.
+#
+
+PORT=${HANDOFF_PORT:-17219}
+ADDR=127.0.0.1
+NAME=handoff-test
+
+if [ "`uname -s`" != "Linux" ] || [ "`id -u`" != "0" ]; then
+    echo "handoff test needs root on Linux, skipping"
+    exit 77
+fi
+
+JAILUTILS=`pwd`/jailutils
+SERVICE=`pwd`/handoff_test
+ROOT=`mktemp -d /tmp/handoff-test.XXXXXX` || exit 1
+
+cleanup()
+{
+    $JAILUTILS jkill -k $NAME > /dev/null 2>&1
+    rmdir /sys/fs/cgroup/jails/$NAME /sys/fs/cgroup/*/jails/$NAME 2> /dev/null
+    rm -rf $ROOT
+}
+
+trap cleanup EXIT
+
+# A jail root with just a shell, the service and their libraries
+mkdir -p $ROOT/bin $ROOT/etc $ROOT/dev $ROOT/proc $ROOT/tmp $ROOT/var/run
+mknod $ROOT/dev/null c 1 3 && chmod 666 $ROOT/dev/null || exit 1
+cp /bin/sh $SERVICE $ROOT/bin/ || exit 1
+for lib in `ldd /bin/sh $SERVICE | sed -n 's/.*[ 	]\(\/[^ ]*\) (.*/\1/p' | sort -u`; do
+    mkdir -p $ROOT`dirname $lib`
+    cp $lib $ROOT$lib || exit 1
+done
+
+cat > $ROOT/etc/rc <<RC
+#!/bin/sh
+exec /bin/handoff_test serve $ADDR $PORT
+RC
+printf '#!/bin/sh\n' > $ROOT/etc/rc.shutdown
+chmod 755 $ROOT/etc/rc $ROOT/etc/rc.shutdown
+
+$JAILUTILS jstart $ROOT $NAME $ADDR || exit 1
+
+./handoff_test hammer $ADDR $PORT 3 &
+HAMMER=$!
+
+sleep 1
+$JAILUTILS jkill -r -l $ADDR:$PORT $NAME || exit 1
+
+wait $HAMMER
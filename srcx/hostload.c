@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2004, Stef Walter
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above
+ *       copyright notice, this list of conditions and the
+ *       following disclaimer.
+ *     * Redistributions in binary form must reproduce the
+ *       above copyright notice, this list of conditions and
+ *       the following disclaimer in the documentation and/or
+ *       other materials provided with the distribution.
+ *     * The names of contributors to this software may not be
+ *       used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ *
+ *
+ * CONTRIBUTORS
+ *  Stef Walter <stef@memberwebs.com>
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/param.h>
+
+#ifdef __FreeBSD__
+#include <sys/sysctl.h>
+#include <sys/vmmeter.h>
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "hostload.h"
+
+#ifdef HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+static int online_cpus()
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
+
+#if defined(__linux__)
+
+#define PROC_STAT   "/proc/stat"
+
+int host_load_sample(host_load* hl)
+{
+    char line[256];
+    long running = 0, blocked = 0;
+    FILE* f;
+
+    f = fopen(PROC_STAT, "r");
+    if(f == NULL)
+        return -1;
+
+    /* These come after the per CPU lines */
+    while(fgets(line, sizeof(line), f) != NULL)
+    {
+        if(strncmp(line, "procs_running ", 14) == 0)
+            running = strtol(line + 14, NULL, 10);
+        else if(strncmp(line, "procs_blocked ", 14) == 0)
+            blocked = strtol(line + 14, NULL, 10);
+    }
+
+    fclose(f);
+
+    /* Not counting us, reading this */
+    if(running > 0)
+        running--;
+
+    hl->runnable = (double)running / online_cpus();
+    hl->blocked = (double)blocked / online_cpus();
+    return 0;
+}
+
+#elif defined(__FreeBSD__)
+
+int host_load_sample(host_load* hl)
+{
+    struct vmtotal vmt;
+    size_t len = sizeof(vmt);
+    int running;
+
+    if(sysctlbyname("vm.vmtotal", &vmt, &len, NULL, 0) == -1)
+        return -1;
+
+    /* Not counting us */
+    running = vmt.t_rq > 0 ? vmt.t_rq - 1 : 0;
+
+    hl->runnable = (double)running / online_cpus();
+    hl->blocked = (double)vmt.t_dw / online_cpus();
+    return 0;
+}
+
+#else
+
+int host_load_sample(host_load* hl)
+{
+    errno = ENOTSUP;
+    return -1;
+}
+
+#endif
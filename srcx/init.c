@@ -0,0 +1,1273 @@
+/*
+ * Copyright (c) 2004, Stef Walter
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above
+ *       copyright notice, this list of conditions and the
+ *       following disclaimer.
+ *     * Redistributions in binary form must reproduce the
+ *       above copyright notice, this list of conditions and
+ *       the following disclaimer in the documentation and/or
+ *       other materials provided with the distribution.
+ *     * The names of contributors to this software may not be
+ *       used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ *
+ *
+ * CONTRIBUTORS
+ *  Stef Walter <stef@memberwebs.com>
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#ifdef HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+#ifdef HAVE_PROCCTL
+#include <sys/procctl.h>
+#endif
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <paths.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "util.h"
+#include "timeline.h"
+#include "init.h"
+
+/* Signals that are passed on to everything in the jail */
+static const int FORWARD_SIGNALS[] = { SIGHUP, SIGINT, SIGTERM, SIGUSR1, SIGUSR2 };
+#define NUM_FORWARD (sizeof(FORWARD_SIGNALS) / sizeof(FORWARD_SIGNALS[0]))
+
+/* How often to look while waiting for processes to go, in msecs */
+#define STOP_POLL   100
+
+/*
+ * A client that connects and says nothing doesn't hold us up, and
+ * only so many can be sending their requests at once.
+ */
+#define CLIENT_WAIT 2
+#define MAX_CLIENTS 8
+
+/*
+ * Nor does an init that's still starting the jail hold up a client.
+ * Once stopping, it says how it's going every second.
+ */
+#define INIT_WAIT   5
+
+/*
+ * A supervised command is started again straight away the first time
+ * it exits, then after a delay that doubles each time, unless it ran
+ * long enough to count as having worked. After too many quick exits
+ * in a row it's left alone.
+ */
+#define BACKOFF_FIRST   100
+#define BACKOFF_MOST    30000
+#define STABLE_MSECS    10000
+#define CRASH_LOOP      10
+
+/*
+ * Commands run on request. A client that goes away before its command
+ * is done takes the command with it, after a grace period in msecs.
+ */
+#define MAX_RUNS        64
+#define MAX_REQUEST     4096
+#define MAX_ARGS        256
+#define RUN_GRACE       1000
+
+/* The longest line of a command's output, before it's split */
+#define RUN_LINE        1024
+
+/* Same as jrun, so the two can't be told apart */
+#define EXIT_NOCOMMAND  127
+
+/* A client still sending its request */
+typedef struct _init_client
+{
+    int fd;
+    int passed;         /* A descriptor that came along with it */
+    long since;
+    size_t len;
+    char buf[MAX_REQUEST + 1];
+}
+init_client;
+
+typedef struct _agent_run
+{
+    pid_t pid;
+    int fd;             /* The client, told when it's done */
+    long hungup;        /* When the client went away, -1 once killed */
+}
+agent_run;
+
+static int g_initfd = -1;
+static int g_sigpipe[2] = { -1, -1 };
+static int g_terminating = 0;
+static pid_t g_reaper = 0;
+
+/* Stopping the jail happens in a child, so that we keep reaping */
+static pid_t g_stopper = 0;
+static int g_stopstay = 0;
+
+static init_client g_clients[MAX_CLIENTS];
+static int g_nclients = 0;
+
+/* The supervised command */
+static const char* g_host = NULL;
+static char** g_argv = NULL;
+static int g_opts = 0;
+static int g_supervising = 0;
+static pid_t g_main = 0;
+static long g_started = 0;
+static long g_exited = 0;
+static long g_init_restart = -1;
+static long g_backoff = 0;
+static int g_crashes = 0;
+
+/* Commands run for clients */
+static agent_run g_runs[MAX_RUNS];
+static int g_nruns = 0;
+
+static void on_signal(int sig)
+{
+    unsigned char c = (unsigned char)sig;
+    int e = errno;
+
+    write(g_sigpipe[1], &c, 1);
+    errno = e;
+}
+
+static long now_msecs()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+/* Output goes to the jail's console, not whatever started us */
+static void detach()
+{
+    int fd;
+
+    fd = open(_PATH_CONSOLE, O_WRONLY | O_NOCTTY);
+    if(fd == -1)
+        fd = open(_PATH_DEVNULL, O_RDWR);
+    if(fd == -1)
+        return;
+
+    dup2(fd, 1);
+    dup2(fd, 2);
+    if(fd > 2)
+        close(fd);
+
+    fd = open(_PATH_DEVNULL, O_RDONLY);
+    if(fd != -1 && fd != 0)
+    {
+        dup2(fd, 0);
+        close(fd);
+    }
+}
+
+static void start_main()
+{
+    size_t i;
+    pid_t pid;
+
+    switch(pid = fork())
+    {
+    case -1:
+        warn("%s: couldn't start %s", g_host, g_argv[0]);
+        g_init_restart = now_msecs() + BACKOFF_MOST;
+        return;
+
+    case 0:
+        for(i = 0; i < NUM_FORWARD; i++)
+            signal(FORWARD_SIGNALS[i], SIG_DFL);
+        signal(SIGCHLD, SIG_DFL);
+        signal(SIGPIPE, SIG_DFL);
+
+        /* A resident command's output would swamp the timeline */
+        timeline_close();
+        detach();
+
+        exit(run_jail_command(NULL, g_argv[0], g_argv, g_opts) ? 0 : 1);
+    }
+
+    g_main = pid;
+    g_started = now_msecs();
+    g_init_restart = -1;
+    timeline_event("main-start", "pid %d", (int)pid);
+}
+
+static void main_exited(int status)
+{
+    char how[64];
+    long ran;
+
+    g_main = 0;
+    g_exited = now_msecs();
+    ran = g_exited - g_started;
+
+    /* run_jail_command() has already said how it failed */
+    if(WIFSIGNALED(status))
+        snprintf(how, sizeof(how), "killed by signal %d", WTERMSIG(status));
+    else
+        strlcpy(how, WEXITSTATUS(status) ? "failed" : "exited", sizeof(how));
+
+    timeline_event("main-exit", "%s after %ldms", how, ran);
+
+    if(!g_supervising)
+        return;
+
+    if(ran >= STABLE_MSECS)
+    {
+        g_backoff = 0;
+        g_crashes = 0;
+    }
+
+    if(++g_crashes > CRASH_LOOP)
+    {
+        warnx("%s: %s keeps exiting, giving up after %d restarts",
+              g_host, g_argv[0], CRASH_LOOP);
+        timeline_event("crash-loop", "%d restarts", CRASH_LOOP);
+        g_supervising = 0;
+        return;
+    }
+
+    warnx("%s: %s %s after %ldms, restarting in %ldms",
+          g_host, g_argv[0], how, ran, g_backoff);
+
+    g_init_restart = g_exited + g_backoff;
+    g_backoff = g_backoff ? g_backoff * 2 : BACKOFF_FIRST;
+    if(g_backoff > BACKOFF_MOST)
+        g_backoff = BACKOFF_MOST;
+}
+
+static void report(int fd, const char* fmt, ...);
+static void stop_done(int status);
+
+static void run_exited(int i, int status)
+{
+    report(g_runs[i].fd, "exit %d", status);
+    close(g_runs[i].fd);
+    g_runs[i] = g_runs[--g_nruns];
+}
+
+static void reap()
+{
+    int status, i;
+    pid_t pid;
+
+    while((pid = waitpid(-1, &status, WNOHANG)) > 0)
+    {
+        if(pid == g_main)
+        {
+            main_exited(status);
+            continue;
+        }
+
+        if(pid == g_stopper)
+        {
+            stop_done(status);
+            continue;
+        }
+
+        for(i = 0; i < g_nruns; i++)
+        {
+            if(g_runs[i].pid == pid)
+            {
+                run_exited(i, status);
+                break;
+            }
+        }
+    }
+}
+
+static void restart_main()
+{
+    long recovered;
+
+    /* When the fork fails, start_main() has already put off another try */
+    start_main();
+    if(g_main == 0)
+        return;
+
+    recovered = now_msecs() - g_exited;
+    warnx("%s: restarted %s, recovered in %ldms", g_host, g_argv[0], recovered);
+    timeline_event("recovered", "%ldms", recovered);
+}
+
+/*
+ * How many processes are left in the jail, besides us, and besides
+ * the init when we're the one stopping the jail. Returns -1 when
+ * there are some, but we can't tell how many.
+ */
+static int descendants()
+{
+#ifdef HAVE_PROCCTL
+    struct procctl_reaper_status rs;
+
+    if(procctl(P_PID, g_reaper, PROC_REAP_STATUS, &rs) == -1)
+        return -1;
+    return rs.rs_descendants - (getpid() == g_reaper ? 0 : 1);
+#else
+    /* As pid 1 or not, this is everything else in the namespace */
+    return (kill(-1, 0) == 0 || errno == EPERM) ? -1 : 0;
+#endif
+}
+
+static void signal_all(int sig)
+{
+#ifdef HAVE_PROCCTL
+    struct procctl_reaper_kill rk;
+    struct procctl_reaper_status rs;
+    struct procctl_reaper_pids rp;
+    u_int i;
+
+    if(getpid() == g_reaper)
+    {
+        memset(&rk, 0, sizeof(rk));
+        rk.rk_sig = sig;
+        procctl(P_PID, g_reaper, PROC_REAP_KILL, &rk);
+        return;
+    }
+
+    /* The one stopping the jail is in there too, so leaves itself out */
+    if(procctl(P_PID, g_reaper, PROC_REAP_STATUS, &rs) == -1)
+        return;
+
+    memset(&rp, 0, sizeof(rp));
+    rp.rp_count = rs.rs_descendants + 16;
+    rp.rp_pids = (struct procctl_reaper_pidinfo*)calloc(rp.rp_count,
+                                                        sizeof(*rp.rp_pids));
+    if(rp.rp_pids == NULL)
+        return;
+
+    if(procctl(P_PID, g_reaper, PROC_REAP_GETPIDS, &rp) == 0)
+    {
+        for(i = 0; i < rp.rp_count; i++)
+        {
+            if((rp.rp_pids[i].pi_flags & REAPER_PIDINFO_VALID) &&
+               rp.rp_pids[i].pi_pid != getpid())
+                kill(rp.rp_pids[i].pi_pid, sig);
+        }
+    }
+
+    free(rp.rp_pids);
+#else
+    /* Which never includes pid 1 or ourselves */
+    kill(-1, sig);
+#endif
+}
+
+static const char* processes(int n, char* buf, size_t len)
+{
+    if(n < 0)
+        return "processes";
+    snprintf(buf, len, "%d process%s", n, n == 1 ? "" : "es");
+    return buf;
+}
+
+static void report(int fd, const char* fmt, ...)
+{
+    char buf[256];
+    va_list ap;
+    int len;
+
+    va_start(ap, fmt);
+    len = vsnprintf(buf, sizeof(buf) - 1, fmt, ap);
+    va_end(ap);
+
+    if(len < 0)
+        return;
+    if(len > (int)sizeof(buf) - 2)
+        len = sizeof(buf) - 2;
+
+    buf[len++] = '\n';
+
+    /* The client may have given up, which is fine */
+    write(fd, buf, len);
+}
+
+static int wait_all(int fd, int secs)
+{
+    char buf[32];
+    int left = -1;
+    int i;
+
+    for(i = 1; i <= secs * (1000 / STOP_POLL); i++)
+    {
+        usleep(STOP_POLL * 1000);
+
+        left = descendants();
+        if(left == 0)
+            break;
+
+        if(i % (1000 / STOP_POLL) == 0)
+            report(fd, "waiting on %s after %ds", processes(left, buf, sizeof(buf)),
+                   i / (1000 / STOP_POLL));
+    }
+
+    return left;
+}
+
+static int stop_all(int fd, int wait, int force)
+{
+    struct timespec begin, now;
+    char buf[32];
+    int left;
+
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+
+    left = descendants();
+    if(left == 0)
+        return 0;
+
+    report(fd, "stopping %s", processes(left, buf, sizeof(buf)));
+    signal_all(SIGTERM);
+    left = wait_all(fd, wait);
+
+    if(left != 0 && force)
+    {
+        report(fd, "killing %s", processes(left, buf, sizeof(buf)));
+        signal_all(SIGKILL);
+        left = wait_all(fd, force);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    if(left == 0)
+        report(fd, "stopped in %ldms", (now.tv_sec - begin.tv_sec) * 1000L +
+               (now.tv_nsec - begin.tv_nsec) / 1000000L);
+    else
+        report(fd, "couldn't stop %s", processes(left, buf, sizeof(buf)));
+
+    return left < 0 ? 1 : left;
+}
+
+/* Reads a request, and the descriptor that may come along with it */
+static ssize_t read_request(int fd, char* buf, size_t len, int* passed)
+{
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr* cmsg;
+    char control[CMSG_SPACE(sizeof(int))];
+    ssize_t ret;
+    int got;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = buf;
+    iov.iov_len = len;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ret = recvmsg(fd, &msg, 0);
+    if(ret <= 0)
+        return ret;
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if(cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+       cmsg->cmsg_len == CMSG_LEN(sizeof(int)))
+    {
+        /* Only the first one counts */
+        memcpy(&got, CMSG_DATA(cmsg), sizeof(int));
+        if(*passed == -1)
+            *passed = got;
+        else
+            close(got);
+    }
+
+    return ret;
+}
+
+/* Jails can share a directory, and with it the socket */
+static int this_jail(const char* name)
+{
+    char host[MAXHOSTNAMELEN];
+
+    return gethostname(host, sizeof(host)) == 0 && strcmp(host, name) == 0;
+}
+
+/* Closes what a child of ours has no business with */
+static void close_clients(int keep)
+{
+    int i;
+
+    close(g_initfd);
+    for(i = 0; i < g_nclients; i++)
+    {
+        if(g_clients[i].fd != keep)
+            close(g_clients[i].fd);
+        if(g_clients[i].passed != -1 && g_clients[i].passed != keep)
+            close(g_clients[i].passed);
+    }
+
+    for(i = 0; i < g_nruns; i++)
+        close(g_runs[i].fd);
+}
+
+static void serve_stop(int fd, char* line)
+{
+    int wait, force, stay;
+    int left, off = 0;
+    size_t i;
+    pid_t pid;
+
+    line[strcspn(line, "\n")] = 0;
+
+    if(sscanf(line, "stop %d %d %d %n", &wait, &force, &stay, &off) != 3 ||
+       off == 0 || wait < 0 || force < 0)
+    {
+        report(fd, "invalid request");
+        return;
+    }
+
+    if(!this_jail(line + off))
+    {
+        report(fd, "not this jail");
+        return;
+    }
+
+    if(g_stopper)
+    {
+        report(fd, "busy");
+        return;
+    }
+
+    /* Being stopped isn't something to recover from */
+    g_supervising = 0;
+    g_init_restart = -1;
+
+    switch(pid = fork())
+    {
+    case -1:
+        report(fd, "couldn't fork");
+        return;
+
+    case 0:
+        /* Whatever we pass on mustn't stop us, nor come back to the init */
+        for(i = 0; i < NUM_FORWARD; i++)
+            signal(FORWARD_SIGNALS[i], SIG_IGN);
+        signal(SIGCHLD, SIG_DFL);
+        close_clients(fd);
+
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) & ~O_NONBLOCK);
+
+        left = stop_all(fd, wait, force);
+        report(fd, "done %d", left);
+        _exit(MIN(left, 255));
+    }
+
+    g_stopper = pid;
+    g_stopstay = stay;
+}
+
+static void stop_done(int status)
+{
+    int left;
+
+    g_stopper = 0;
+    left = WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+
+    /* Going with some left would take them with us on Linux */
+    if(!g_stopstay && left == 0)
+        exit(0);
+
+    /* Staying means the jail is starting again, and so does the command */
+    if(g_stopstay && g_argv && left == 0)
+    {
+        g_supervising = 1;
+        g_crashes = 0;
+        g_backoff = 0;
+        start_main();
+    }
+}
+
+/* In the child, never returns */
+static void run_command(char** argv, int out)
+{
+    size_t i;
+    int fd;
+
+    for(i = 0; i < NUM_FORWARD; i++)
+        signal(FORWARD_SIGNALS[i], SIG_DFL);
+    signal(SIGCHLD, SIG_DFL);
+    signal(SIGPIPE, SIG_DFL);
+
+    /* Only the one we're told to write to */
+    close_clients(out);
+
+    /* The client going away takes out all of it */
+    setpgid(0, 0);
+
+    fd = open(_PATH_DEVNULL, O_RDONLY);
+    if(fd != -1 && fd != 0)
+    {
+        dup2(fd, 0);
+        close(fd);
+    }
+
+    dup2(out, 1);
+    dup2(out, 2);
+    if(out > 2)
+        close(out);
+
+    if(!check_jail_command(NULL, argv[0]))
+        _exit(EXIT_NOCOMMAND);
+
+    run_jail_command(NULL, argv[0], argv, JAIL_RUN_NOFORK);
+    _exit(EXIT_NOCOMMAND);
+}
+
+/* Returns 1 when the command started, and the client is kept */
+static int serve_run(int fd, char* buf, size_t have, int out)
+{
+    char* argv[MAX_ARGS + 1];
+    char* args;
+    char* end;
+    unsigned long need;
+    int argc, off = 0;
+    pid_t pid;
+
+    end = memchr(buf, '\n', have);
+    if(end == NULL || out == -1 ||
+       sscanf(buf, "run %lu %n", &need, &off) != 1 ||
+       off == 0 || need != have - (end + 1 - buf))
+    {
+        report(fd, "invalid request");
+        return 0;
+    }
+
+    *end = 0;
+    if(!this_jail(buf + off))
+    {
+        report(fd, "not this jail");
+        return 0;
+    }
+
+    args = end + 1;
+    for(argc = 0, end = args; end < args + need && argc < MAX_ARGS; argc++)
+    {
+        argv[argc] = end;
+        end = memchr(end, 0, args + need - end);
+        if(end == NULL)
+            break;
+        end++;
+    }
+
+    argv[argc] = NULL;
+    if(argc == 0 || end == NULL || argv[0][0] != '/')
+    {
+        report(fd, "invalid request");
+        return 0;
+    }
+
+    if(g_stopper)
+    {
+        report(fd, "stopping");
+        return 0;
+    }
+
+    if(g_nruns == MAX_RUNS)
+    {
+        report(fd, "busy");
+        return 0;
+    }
+
+    switch(pid = fork())
+    {
+    case -1:
+        report(fd, "couldn't fork");
+        return 0;
+
+    case 0:
+        run_command(argv, out);
+        break;
+    }
+
+    g_runs[g_nruns].pid = pid;
+    g_runs[g_nruns].fd = fd;
+    g_runs[g_nruns].hungup = 0;
+    g_nruns++;
+
+    report(fd, "started %d", (int)pid);
+    return 1;
+}
+
+/* Whether there's enough of a request to answer it */
+static int request_done(init_client* ic)
+{
+    unsigned long need;
+    char* end;
+
+    end = memchr(ic->buf, '\n', ic->len);
+    if(end == NULL)
+        return ic->len == MAX_REQUEST;
+
+    /* A run request has its arguments after the line */
+    if(sscanf(ic->buf, "run %lu", &need) != 1 ||
+       need > (unsigned long)(MAX_REQUEST - (end + 1 - ic->buf)))
+        return 1;
+
+    return ic->len >= (end + 1 - ic->buf) + need;
+}
+
+static void drop_client(int i)
+{
+    if(g_clients[i].passed != -1)
+        close(g_clients[i].passed);
+    g_clients[i] = g_clients[--g_nclients];
+}
+
+/* Answers a client once its request is all in */
+static void serve_client(int i)
+{
+    init_client* ic = &g_clients[i];
+    int kept = 0;
+
+    ic->buf[ic->len] = 0;
+
+    if(strncmp(ic->buf, "stop ", 5) == 0)
+        serve_stop(ic->fd, ic->buf);
+    else if(strncmp(ic->buf, "run ", 4) == 0)
+        kept = serve_run(ic->fd, ic->buf, ic->len, ic->passed);
+    else
+        report(ic->fd, "invalid request");
+
+    if(!kept)
+        close(ic->fd);
+    drop_client(i);
+}
+
+static void read_client(int i)
+{
+    init_client* ic = &g_clients[i];
+    ssize_t r;
+
+    r = read_request(ic->fd, ic->buf + ic->len, MAX_REQUEST - ic->len, &ic->passed);
+    if(r == -1 && (errno == EAGAIN || errno == EINTR))
+        return;
+
+    if(r <= 0)
+    {
+        close(ic->fd);
+        drop_client(i);
+        return;
+    }
+
+    ic->len += r;
+    if(request_done(ic))
+        serve_client(i);
+}
+
+static void accept_client()
+{
+    init_client* ic;
+    int fd;
+
+    fd = accept(g_initfd, NULL, NULL);
+    if(fd == -1)
+        return;
+
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+
+    if(g_nclients == MAX_CLIENTS)
+    {
+        report(fd, "busy");
+        close(fd);
+        return;
+    }
+
+    ic = &g_clients[g_nclients++];
+    ic->fd = fd;
+    ic->passed = -1;
+    ic->since = now_msecs();
+    ic->len = 0;
+}
+
+/* The client went away, so does what it was running */
+static void run_hungup(agent_run* ar)
+{
+    if(ar->hungup == 0)
+    {
+        kill(-ar->pid, SIGTERM);
+        ar->hungup = now_msecs();
+    }
+    else if(ar->hungup != -1 && now_msecs() - ar->hungup >= RUN_GRACE)
+    {
+        kill(-ar->pid, SIGKILL);
+        ar->hungup = -1;
+    }
+}
+
+void init_begin()
+{
+    struct sockaddr_un sun;
+
+    g_reaper = getpid();
+
+#ifdef HAVE_PROCCTL
+    if(procctl(P_PID, getpid(), PROC_REAP_ACQUIRE, NULL) == -1)
+        err(1, "couldn't become the jail's reaper");
+#else
+    /* Only pid 1 in the jail's own namespace gets the orphans */
+    if(getpid() != 1)
+        errx(1, "can't run an init in this kind of jail");
+#endif
+
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    strlcpy(sun.sun_path, INIT_SOCKET, sizeof(sun.sun_path));
+
+    /* Without it we still reap, just can't be asked to stop */
+    g_initfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(g_initfd == -1)
+    {
+        warn("couldn't create init socket");
+        return;
+    }
+
+    unlink(INIT_SOCKET);
+
+    if(bind(g_initfd, (struct sockaddr*)&sun, sizeof(sun)) == -1 ||
+       chmod(INIT_SOCKET, 0600) == -1 || listen(g_initfd, 4) == -1)
+    {
+        warn("couldn't listen on %s", INIT_SOCKET);
+        close(g_initfd);
+        g_initfd = -1;
+        return;
+    }
+
+    /* Nothing we run should get hold of it */
+    fcntl(g_initfd, F_SETFD, FD_CLOEXEC);
+}
+
+void init_supervise(const char* host, char** argv, int opts)
+{
+    g_host = host;
+    g_argv = argv;
+
+    /* Nobody is waiting around to read it */
+    g_opts = opts & ~(JAIL_RUN_STDOUT | JAIL_RUN_STDERR);
+
+    g_supervising = 1;
+    start_main();
+}
+
+void init_serve()
+{
+    struct sigaction sa;
+    struct pollfd pfd[2 + MAX_CLIENTS + MAX_RUNS];
+    unsigned char c;
+    size_t i;
+    int timeout, nclients, nruns, r;
+    ssize_t got;
+    long wait;
+
+    if(pipe(g_sigpipe) == -1)
+        err(1, "couldn't create pipe");
+
+    for(i = 0; i < 2; i++)
+    {
+        fcntl(g_sigpipe[i], F_SETFD, FD_CLOEXEC);
+        fcntl(g_sigpipe[i], F_SETFL, fcntl(g_sigpipe[i], F_GETFL, 0) | O_NONBLOCK);
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+
+    sigaction(SIGCHLD, &sa, NULL);
+    for(i = 0; i < NUM_FORWARD; i++)
+        sigaction(FORWARD_SIGNALS[i], &sa, NULL);
+
+    signal(SIGPIPE, SIG_IGN);
+
+    /* Don't hold on to whatever started us */
+    setsid();
+    detach();
+
+    for(;;)
+    {
+        reap();
+
+        /* Once told to go, we go when everything else has */
+        if(g_terminating && descendants() == 0)
+            exit(0);
+
+        if(g_init_restart != -1 && now_msecs() >= g_init_restart)
+            restart_main();
+
+        timeout = -1;
+        if(g_terminating)
+            timeout = STOP_POLL;
+        else if(g_init_restart != -1)
+            timeout = MAX(0, (int)(g_init_restart - now_msecs()));
+
+        pfd[0].fd = g_sigpipe[0];
+        pfd[0].events = POLLIN;
+        pfd[1].fd = g_initfd;
+        pfd[1].events = POLLIN;
+        pfd[1].revents = 0;
+
+        /* Clients that are too slow with their requests go */
+        for(r = g_nclients - 1; r >= 0; r--)
+        {
+            wait = g_clients[r].since + CLIENT_WAIT * 1000 - now_msecs();
+            if(wait <= 0)
+            {
+                close(g_clients[r].fd);
+                drop_client(r);
+            }
+            else if(timeout == -1 || wait < timeout)
+            {
+                timeout = (int)wait;
+            }
+        }
+
+        nclients = g_nclients;
+        for(r = 0; r < nclients; r++)
+        {
+            pfd[2 + r].fd = g_clients[r].fd;
+            pfd[2 + r].events = POLLIN;
+            pfd[2 + r].revents = 0;
+        }
+
+        /* Clients say nothing more, so anything readable is a hangup */
+        nruns = g_nruns;
+        for(r = 0; r < nruns; r++)
+        {
+            if(g_runs[r].hungup)
+            {
+                run_hungup(&g_runs[r]);
+                timeout = STOP_POLL;
+            }
+
+            pfd[2 + nclients + r].fd = g_runs[r].hungup ? -1 : g_runs[r].fd;
+            pfd[2 + nclients + r].events = POLLIN;
+            pfd[2 + nclients + r].revents = 0;
+        }
+
+        if(poll(pfd, 2 + nclients + nruns, timeout) == -1 && errno != EINTR)
+            err(1, "couldn't wait");
+
+        for(r = 0; r < nruns; r++)
+        {
+            if(!(pfd[2 + nclients + r].revents & (POLLIN | POLLHUP | POLLERR)))
+                continue;
+
+            got = read(g_runs[r].fd, &c, 1);
+            if(got == 0 || (got == -1 && errno != EAGAIN && errno != EINTR))
+                run_hungup(&g_runs[r]);
+        }
+
+        /* Backwards, since answering one takes it off the list */
+        for(r = nclients - 1; r >= 0; r--)
+        {
+            if(pfd[2 + r].revents & (POLLIN | POLLHUP | POLLERR))
+                read_client(r);
+        }
+
+        while(read(g_sigpipe[0], &c, 1) == 1)
+        {
+            if(c == SIGCHLD)
+                continue;
+
+            signal_all(c);
+            if(c == SIGTERM || c == SIGINT)
+            {
+                g_terminating = 1;
+                g_supervising = 0;
+                g_init_restart = -1;
+            }
+        }
+
+        if(pfd[1].revents & POLLIN)
+            accept_client();
+    }
+}
+
+int init_stop(int wait, int kill, int stay, init_progress progress, void* arg)
+{
+    struct sockaddr_un sun;
+    struct timeval tv;
+    char host[MAXHOSTNAMELEN];
+    char line[256];
+    FILE* f;
+    int fd, left;
+
+    if(gethostname(host, sizeof(host)) == -1)
+        return -1;
+
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    strlcpy(sun.sun_path, INIT_SOCKET, sizeof(sun.sun_path));
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd == -1)
+        return -1;
+
+    if(connect(fd, (struct sockaddr*)&sun, sizeof(sun)) == -1 ||
+       (f = fdopen(fd, "r+")) == NULL)
+    {
+        close(fd);
+        return -1;
+    }
+
+    tv.tv_sec = INIT_WAIT;
+    tv.tv_usec = 0;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    fprintf(f, "stop %d %d %d %s\n", wait, kill, stay, host);
+    fflush(f);
+
+    while(fgets(line, sizeof(line), f) != NULL)
+    {
+        line[strcspn(line, "\n")] = 0;
+
+        if(sscanf(line, "done %d", &left) == 1)
+        {
+            fclose(f);
+            return left;
+        }
+
+        if(progress)
+            progress(line, arg);
+    }
+
+    /* It went away without an answer, or is busy with something else */
+    fclose(f);
+    return -1;
+}
+
+/* Whole lines to stdout, so output from several jails doesn't get mixed */
+static void copy_lines(char* line, size_t* len, size_t prefixlen,
+                       const char* buf, size_t n)
+{
+    size_t i;
+
+    for(i = 0; i < n; i++)
+    {
+        line[(*len)++] = buf[i];
+
+        if(buf[i] == '\n' || *len >= RUN_LINE - 1)
+        {
+            if(line[*len - 1] != '\n')
+                line[(*len)++] = '\n';
+
+            write(STDOUT_FILENO, line, *len);
+            *len = prefixlen;
+        }
+    }
+}
+
+int init_run(const char* host, char** argv, int* status, long* spawn)
+{
+    struct sockaddr_un sun;
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr* cmsg;
+    struct pollfd pfd[2];
+    struct timespec begin, now;
+    char control[CMSG_SPACE(sizeof(int))];
+    char buf[MAX_REQUEST];
+    char line[RUN_LINE];
+    char reply[256];
+    size_t len, arg, replen = 0;
+    size_t linelen, prefixlen;
+    ssize_t r;
+    char* end;
+    int out[2];
+    int fd, i, pid;
+    int started = 0, done = 0, refused = 0;
+
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+    strlcpy(sun.sun_path, INIT_SOCKET, sizeof(sun.sun_path));
+
+    /* The request and all the arguments go in one go */
+    len = snprintf(buf, sizeof(buf), "run ");
+    for(arg = 0, i = 0; argv[i] != NULL; i++)
+        arg += strlen(argv[i]) + 1;
+    len += snprintf(buf + len, sizeof(buf) - len, "%lu %s\n",
+                    (unsigned long)arg, host);
+    if(i > MAX_ARGS || len + arg > sizeof(buf))
+        return -1;
+
+    for(i = 0; argv[i] != NULL; i++)
+    {
+        arg = strlen(argv[i]) + 1;
+        memcpy(buf + len, argv[i], arg);
+        len += arg;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd == -1)
+        return -1;
+
+    if(connect(fd, (struct sockaddr*)&sun, sizeof(sun)) == -1 ||
+       pipe(out) == -1)
+    {
+        close(fd);
+        return -1;
+    }
+
+    /*
+     * The command only gets a pipe, which we copy from, never anything
+     * of ours. Whatever is listening here is in the jail.
+     */
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = buf;
+    iov.iov_len = len;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &out[1], sizeof(int));
+
+    r = sendmsg(fd, &msg, 0);
+    close(out[1]);
+
+    if(r != (ssize_t)len)
+    {
+        close(out[0]);
+        close(fd);
+        return -1;
+    }
+
+    fcntl(out[0], F_SETFL, fcntl(out[0], F_GETFL, 0) | O_NONBLOCK);
+
+    prefixlen = linelen = snprintf(line, RUN_LINE / 2, "%s: ", host);
+
+    while(!done)
+    {
+        pfd[0].fd = fd;
+        pfd[0].events = POLLIN;
+        pfd[1].fd = out[0];
+        pfd[1].events = POLLIN;
+
+        /* An init that doesn't start it soon won't */
+        r = poll(pfd, 2, started ? -1 : INIT_WAIT * 1000);
+        if(r == 0)
+            break;
+        if(r == -1)
+        {
+            if(errno == EINTR)
+                continue;
+            break;
+        }
+
+        if(pfd[1].revents)
+        {
+            r = read(out[0], buf, sizeof(buf));
+            if(r > 0)
+                copy_lines(line, &linelen, prefixlen, buf, r);
+            else if(r == 0 || errno != EAGAIN)
+            {
+                close(out[0]);
+                out[0] = -1;
+            }
+        }
+
+        if(!pfd[0].revents)
+            continue;
+
+        r = read(fd, reply + replen, sizeof(reply) - 1 - replen);
+        if(r <= 0)
+            break;
+        replen += r;
+        reply[replen] = 0;
+
+        while(!done && (end = strchr(reply, '\n')) != NULL)
+        {
+            *end = 0;
+
+            if(!started && sscanf(reply, "started %d", &pid) == 1)
+            {
+                clock_gettime(CLOCK_MONOTONIC, &now);
+                if(spawn)
+                    *spawn = (now.tv_sec - begin.tv_sec) * 1000000L +
+                             (now.tv_nsec - begin.tv_nsec) / 1000L;
+                started = 1;
+            }
+            else if(started && sscanf(reply, "exit %d", status) == 1)
+            {
+                done = 1;
+            }
+            else
+            {
+                /* Busy, or not the jail we thought */
+                refused = 1;
+                break;
+            }
+
+            replen -= (end + 1) - reply;
+            memmove(reply, end + 1, replen + 1);
+        }
+
+        if(refused || replen == sizeof(reply) - 1)
+            break;
+    }
+
+    /* What it wrote before it exited is all there */
+    if(out[0] != -1)
+    {
+        while((r = read(out[0], buf, sizeof(buf))) > 0)
+            copy_lines(line, &linelen, prefixlen, buf, r);
+        close(out[0]);
+    }
+
+    if(linelen > prefixlen)
+        copy_lines(line, &linelen, prefixlen, "\n", 1);
+
+    close(fd);
+
+    if(done)
+        return 1;
+    return started ? 0 : -1;
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2004, Stef Walter
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above
+ *       copyright notice, this list of conditions and the
+ *       following disclaimer.
+ *     * Redistributions in binary form must reproduce the
+ *       above copyright notice, this list of conditions and
+ *       the following disclaimer in the documentation and/or
+ *       other materials provided with the distribution.
+ *     * The names of contributors to this software may not be
+ *       used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ *
+ *
+ * CONTRIBUTORS
+ *  Stef Walter <stef@memberwebs.com>
+ *
+ */
+
+#ifndef __INIT_H__
+#define __INIT_H__
+
+/* Where the init in a jail listens, as seen from inside it */
+#define INIT_SOCKET     _PATH_VARRUN "jinit.sock"
+
+/*
+ * Makes this process the jail's init. It must be the first process
+ * in the jail, and everything started afterwards that loses its
+ * parent comes to us. Exits if that can't be done.
+ */
+void init_begin();
+
+/*
+ * Starts the command with run_jail_command(), and again each time it
+ * exits, backing off when it keeps on exiting. Its output only goes
+ * to the jail's console.
+ */
+void init_supervise(const char* host, char** argv, int opts);
+
+/*
+ * Detaches, and from then on reaps orphans, passes signals on to
+ * everything in the jail, runs commands for init_run() and stops the
+ * jail when asked. Never returns.
+ */
+void init_serve();
+
+typedef void (*init_progress)(const char* msg, void* arg);
+
+/*
+ * From inside the jail, asks its init to stop everything in it. The
+ * processes get wait seconds after SIGTERM, and kill more after a
+ * SIGKILL if not zero. With stay the init keeps running afterwards,
+ * otherwise it exits, and the jail with it. Returns how many are left,
+ * or -1 when there's no init to ask or it didn't answer.
+ */
+int init_stop(int wait, int kill, int stay, init_progress progress, void* arg);
+
+/*
+ * Once attached to the jail, asks its init to run a command, instead
+ * of setting it up ourselves. The output comes back through a pipe
+ * and goes to stdout a line at a time, prefixed with the host name.
+ * Returns 1 with the command's wait status once it's done, 0 when it
+ * started but the init went away, or -1 when there's no init to ask
+ * or it wouldn't. The time until the command was started goes in
+ * spawn, in usecs.
+ */
+int init_run(const char* host, char** argv, int* status, long* spawn);
+
+#endif /* __INIT_H__ */
@@ -39,9 +39,11 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <unistd.h>
 #include <err.h>
 
 #include "util.h"
+#include "jailutils.h"
 
 #ifdef HAVE_CONFIG_H
 #include "../config.h"
@@ -49,13 +51,33 @@
 
 static void usage();
 
-int main(int argc, char* argv[])
+int injail_main(int argc, char* argv[])
 {
-    int r;
+    const char* name;
+    int printjid = 0;
+    int printname = 0;
+    int ch, r;
 
-	/* Remove the program name */
-	argc--;
-	argv++;
+    while((ch = getopt(argc, argv, "in")) != -1)
+    {
+        switch(ch)
+        {
+        case 'i':
+            printjid = 1;
+            break;
+
+        case 'n':
+            printname = 1;
+            break;
+
+        case '?':
+        default:
+            usage();
+        }
+    }
+
+    argc -= optind;
+    argv += optind;
 
 	if(argc != 0)
 		usage();
@@ -63,11 +85,25 @@ int main(int argc, char* argv[])
 	if((r = running_in_jail()) == -1)
 		errx(1, "couldn't determine jail status");
 
+    if(r && printjid)
+    {
+        if(current_jail_id() == -1)
+            errx(1, "couldn't determine jail id");
+        printf("%d\n", current_jail_id());
+    }
+
+    if(r && printname)
+    {
+        if((name = current_jail_name()) == NULL)
+            errx(1, "couldn't determine jail host name");
+        printf("%s\n", name);
+    }
+
     return r ? 0 : 1;
 }
 
 static void usage()
 {
-	fprintf(stderr, "usage: injail\n");
+	fprintf(stderr, "usage: injail [-in]\n");
 	exit(2);
 }
@@ -38,55 +38,197 @@
 
 #include <sys/types.h>
 #include <sys/param.h>
-#include <sys/jail.h>
-#include <sys/sysctl.h>
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
-#include <kvm.h>
 #include <paths.h>
 #include <errno.h>
 #include <err.h>
 
 #include "util.h"
+#include "jailutils.h"
+#include "backend.h"
+#include "placement.h"
+#include "profile.h"
 
 #ifdef HAVE_CONFIG_H
 #include "../config.h"
 #endif
 
+/* How long to watch CPU use for */
+#define USAGE_INTERVAL	250
+
 static void usage();
-static void list_jails();
+static void list_jails(int placement);
+static void list_usage();
 
-int main(int argc, char* argv[])
+int jails_main(int argc, char* argv[])
 {
-	if(argc > 1)
+	int ch;
+	int placement = 0;
+	int showusage = 0;
+
+	while((ch = getopt(argc, argv, "pu")) != -1)
+	{
+		switch(ch)
+		{
+		/* Show where each jail is pinned */
+		case 'p':
+			placement = 1;
+			break;
+
+		/* Show what each jail is using, against its limits */
+		case 'u':
+			showusage = 1;
+			break;
+
+		case '?':
+		default:
+			usage();
+		}
+	}
+
+	if(argc > optind || (placement && showusage))
 		usage();
 
 	if(running_in_jail() != 0)
 		errx(1, "can't run from inside jail");
 
-	list_jails();
+	if(placement && jail_backend_get()->placement == NULL)
+		errx(1, "the %s backend can't pin jails to CPUs", jail_backend_get()->name);
+
+	if(showusage && jail_backend_get()->usage == NULL)
+		errx(1, "the %s backend can't show jail usage", jail_backend_get()->name);
+
+	if(showusage)
+		list_usage();
+	else
+		list_jails(placement);
 	return 0;
 }
 
 static void usage()
 {
-	fprintf(stderr, "usage: jails \n");
+	fprintf(stderr, "usage: jails [-p | -u]\n");
 	exit(2);
 }
 
-static void list_jails()
+static void list_jails(int placement)
 {
-	struct xprison* xp;
-	size_t len, i;
+	jail_info* ji;
+	jail_place pl;
+	char buf[256];
 	jails jls;
 
 	/* ... otherwise it's a name */
 	jails_load(&jls);
 
-	while((xp = jails_next(&jls)) != NULL)
-		printf("%s\n", xp->pr_host);
+	while((ji = jails_next(&jls)) != NULL)
+	{
+		if(!placement)
+		{
+			printf("%s\n", ji->host);
+			continue;
+		}
+
+		if(jail_backend_get()->placement(ji, &pl) == -1)
+			strlcpy(buf, "-", sizeof(buf));
+		else
+			placement_format(&pl, buf, sizeof(buf));
+
+		printf("%s\t%s\n", ji->host, buf);
+	}
+
+	jails_done(&jls);
+}
+
+static long elapsed_usecs(struct timespec* start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000000L +
+	       (now.tv_nsec - start->tv_nsec) / 1000L;
+}
+
+static void print_used(const char* sep, const char* what, const char* used,
+		       const char* limit, int capped)
+{
+	if(capped)
+		printf("%s%s %s/%s", sep, what, used, limit);
+	else
+		printf("%s%s %s", sep, what, used);
+}
+
+/*
+ * CPU use is the CPU time a jail used between two looks at it, as a
+ * percentage of one CPU.
+ */
+static void list_usage()
+{
+	const jail_backend* jb = jail_backend_get();
+	jail_usage* first;
+	jail_usage use;
+	jail_limits lim;
+	struct timespec start;
+	char used[32];
+	char limit[32];
+	long usecs;
+	size_t i;
+	jails jls;
+
+	jails_load(&jls);
+
+	first = (jail_usage*)calloc(jls.count + 1, sizeof(jail_usage));
+	if(first == NULL)
+		errx(1, "out of memory");
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for(i = 0; i < jls.count; i++)
+	{
+		if(jb->usage(&(jls.list[i]), &(first[i]), &lim) == -1)
+			first[i].cputime = (unsigned long long)-1;
+	}
+
+	usleep(USAGE_INTERVAL * 1000);
+	usecs = elapsed_usecs(&start);
+
+	for(i = 0; i < jls.count; i++)
+	{
+		printf("%s", jls.list[i].host);
+
+		/* It's gone, or we can't see it */
+		if(first[i].cputime == (unsigned long long)-1 ||
+		   jb->usage(&(jls.list[i]), &use, &lim) == -1)
+		{
+			printf("\t-\n");
+			continue;
+		}
+
+		profile_format_size(use.memory, used, sizeof(used));
+		profile_format_size(lim.memory, limit, sizeof(limit));
+		print_used("\t", "memory", used, limit, lim.memory != 0);
+
+		snprintf(used, sizeof(used), "%d%%", usecs > 0 ?
+			 (int)((use.cputime - first[i].cputime) * 100 / usecs) : 0);
+		snprintf(limit, sizeof(limit), "%d%%", lim.cpu);
+		print_used(" ", "cpu", used, limit, lim.cpu != 0);
+
+		snprintf(used, sizeof(used), "%ld", use.procs);
+		snprintf(limit, sizeof(limit), "%ld", lim.procs);
+		print_used(" ", "procs", used, limit, lim.procs != 0);
+
+		snprintf(used, sizeof(used), "%ld", use.files);
+		snprintf(limit, sizeof(limit), "%ld", lim.files);
+		print_used(" ", "files", used, limit, lim.files != 0);
+
+		printf("\n");
+	}
 
+	free(first);
 	jails_done(&jls);
 }
@@ -0,0 +1,198 @@
+/*
+ * Copyright (c) 2004, Stef Walter
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above
+ *       copyright notice, this list of conditions and the
+ *       following disclaimer.
+ *     * Redistributions in binary form must reproduce the
+ *       above copyright notice, this list of conditions and
+ *       the following disclaimer in the documentation and/or
+ *       other materials provided with the distribution.
+ *     * The names of contributors to this software may not be
+ *       used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ *
+ *
+ * CONTRIBUTORS
+ *  Stef Walter <stef@memberwebs.com>
+ *
+ */
+
+/*
+ * Benchmark for jails_load() and jails_find() with thousands of jails
+ * on the fixture backend. Looks up every jail by host name and by id,
+ * and some that aren't there, and checks each one comes back right.
+ */
+
+#include <sys/types.h>
+#include <sys/time.h>
+
+#include <stdio.h>
+#include <err.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "util.h"
+#include "backend.h"
+
+#ifdef HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+#define BENCH_JAILS         5000
+#define BENCH_PASSES        5
+
+static void usage();
+
+static double elapsed(struct timeval* start)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return (now.tv_sec - start->tv_sec) * 1000.0 +
+           (now.tv_usec - start->tv_usec) / 1000.0;
+}
+
+static int check_load(jails* jls, int count)
+{
+    char host[JAIL_HOST_LEN];
+    size_t i;
+
+    if(jls->count != (size_t)count)
+    {
+        warnx("loaded %d jails, expected %d", (int)jls->count, count);
+        return -1;
+    }
+
+    for(i = 0; i < jls->count; i++)
+    {
+        snprintf(host, sizeof(host), "fixture%d.example.com", (int)i + 1);
+        if(jls->list[i].jid != (int)i + 1 || strcmp(jls->list[i].host, host) != 0)
+        {
+            warnx("jail %d came back as %d %s", (int)i + 1,
+                  jls->list[i].jid, jls->list[i].host);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* Every jail by host name or by id, and as many that aren't there */
+static int find_all(jails* jls, int count, int byid)
+{
+    char name[JAIL_HOST_LEN];
+    jail_info* ji;
+    int i;
+
+    for(i = 1; i <= count * 2; i++)
+    {
+        if(byid)
+            snprintf(name, sizeof(name), "%d", i);
+        else
+            snprintf(name, sizeof(name), "fixture%d.example.com", i);
+
+        ji = jails_find(jls, name);
+
+        if(i > count && ji != NULL)
+        {
+            warnx("found %s, which isn't there", name);
+            return -1;
+        }
+
+        if(i <= count && (ji == NULL || ji->jid != i))
+        {
+            warnx("couldn't find %s", name);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static double run_find(const char* how, jails* jls, int count, int byid, int* ret)
+{
+    struct timeval start;
+    double ms;
+
+    gettimeofday(&start, NULL);
+    *ret = find_all(jls, count, byid);
+    ms = elapsed(&start);
+
+    printf("find by %s: %d lookups, %.2f ms, %.2f us each\n", how,
+           count * 2, ms, ms * 1000.0 / (count * 2));
+    return ms;
+}
+
+int main(int argc, char* argv[])
+{
+    char fixture[64];
+    struct timeval start;
+    jails jls;
+    double ms, best = 0;
+    int count = BENCH_JAILS;
+    int pass, ret = 0;
+
+    if(argc > 2)
+        usage();
+    if(argc > 1 && (count = atoi(argv[1])) <= 0)
+        usage();
+
+    /* Before anything asks for the backend */
+    snprintf(fixture, sizeof(fixture), "jails=%d,procs=1", count);
+    setenv("JAILUTILS_BACKEND", "fixture", 1);
+    setenv("JAILUTILS_FIXTURE", fixture, 1);
+
+    for(pass = 0; pass < BENCH_PASSES && ret == 0; pass++)
+    {
+        gettimeofday(&start, NULL);
+        jails_load(&jls);
+        ms = elapsed(&start);
+
+        if(pass == 0 || ms < best)
+            best = ms;
+
+        printf("load pass %d: %d jails, %.2f ms\n", pass + 1, (int)jls.count, ms);
+
+        ret = check_load(&jls, count);
+        jails_done(&jls);
+    }
+
+    if(ret == 0)
+    {
+        printf("best load: %.2f ms\n", best);
+
+        jails_load(&jls);
+        run_find("host", &jls, count, 0, &ret);
+        if(ret == 0)
+            run_find("id", &jls, count, 1, &ret);
+        jails_done(&jls);
+    }
+
+    return ret == 0 ? 0 : 1;
+}
+
+static void usage()
+{
+    fprintf(stderr, "usage: jails_bench [count]\n");
+    exit(2);
+}
@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2004, Stefan Walter
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above
+ *       copyright notice, this list of conditions and the
+ *       following disclaimer.
+ *     * Redistributions in binary form must reproduce the
+ *       above copyright notice, this list of conditions and
+ *       the following disclaimer in the documentation and/or
+ *       other materials provided with the distribution.
+ *     * The names of contributors to this software may not be
+ *       used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ *
+ *
+ * CONTRIBUTORS
+ *  Stef Walter <stef@memberwebs.com>
+ *  James E. Quick <jq@quick.com>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jailutils.h"
+
+#ifdef HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+typedef struct command
+{
+    const char* name;
+    int (*main)(int argc, char* argv[]);
+}
+command;
+
+static const command g_commands[] =
+{
+    { "injail",     injail_main },
+    { "jails",      jails_main },
+    { "jid",        jid_main },
+    { "jkill",      jkill_main },
+    { "jkilld",     jkilld_main },
+    { "jpoold",     jpoold_main },
+    { "jps",        jps_main },
+    { "jrun",       jrun_main },
+    { "jstart",     jstart_main },
+
+    /* jkill does these when run inside a jail */
+    { "halt",       jkill_main },
+    { "reboot",     jkill_main },
+    { "restart",    jkill_main },
+
+    /* Compatibility with the old utilities */
+    { "killjail",   jkill_main },
+
+    { NULL,         NULL }
+};
+
+static const command* find_command(const char* name);
+static void usage();
+
+int main(int argc, char* argv[])
+{
+    const command* cmd;
+    const char* t;
+
+    t = strrchr(argv[0], '/');
+    t = t ? t + 1 : argv[0];
+
+    /* Called through a link with the name of a utility */
+    if((cmd = find_command(t)) != NULL)
+        return (cmd->main)(argc, argv);
+
+    /* Or as 'jailutils utility args ...' */
+    if(argc < 2 || (cmd = find_command(argv[1])) == NULL)
+        usage();
+
+    return (cmd->main)(argc - 1, argv + 1);
+}
+
+static const command* find_command(const char* name)
+{
+    const command* cmd;
+
+    for(cmd = g_commands; cmd->name != NULL; cmd++)
+    {
+        if(strcmp(cmd->name, name) == 0)
+            return cmd;
+    }
+
+    return NULL;
+}
+
+static void usage()
+{
+    const command* cmd;
+
+    fprintf(stderr, "usage: jailutils command [args ...]\n");
+    fprintf(stderr, "commands:");
+
+    for(cmd = g_commands; cmd->name != NULL; cmd++)
+        fprintf(stderr, " %s", cmd->name);
+
+    fputc('\n', stderr);
+    exit(2);
+}
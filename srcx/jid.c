@@ -38,7 +38,6 @@
 
 #include <sys/types.h>
 #include <sys/param.h>
-#include <sys/jail.h>
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -46,6 +45,8 @@
 #include <err.h>
 
 #include "util.h"
+#include "jailutils.h"
+#include "backend.h"
 
 #ifdef HAVE_CONFIG_H
 #include "../config.h"
@@ -53,10 +54,9 @@
 
 static void usage();
 
-int main(int argc, char* argv[])
+int jid_main(int argc, char* argv[])
 {
-	struct xprison* xp = NULL;
-	size_t len;
+	jail_info* ji = NULL;
 	jails jls;
 	char* e;
 
@@ -71,26 +71,26 @@ int main(int argc, char* argv[])
 		errx(1, "can't run from inside jail");
 
 	jails_load(&jls);
-	xp = jails_find(&jls, argv[0]);
+	ji = jails_find(&jls, argv[0]);
 
 	strtol(argv[0], &e, 10);
 
 	/* If it was all a number ... */
 	if(!*e)
 	{
-		if(xp == NULL)
+		if(ji == NULL)
 			errx(1, "unknown jail id: %s", argv[0]);
 
-		printf("%s\n", xp->pr_host);
+		printf("%s\n", ji->host);
 	}
 
 	/* otherwise it's a host name */
 	else
 	{
-		if(xp == NULL)
+		if(ji == NULL)
 			errx(1, "unknown jail host name: %s", argv[0]);
 
-		printf("%d\n", xp->pr_id);
+		printf("%d\n", ji->jid);
 	}
 
 	jails_done(&jls);
@@ -39,11 +39,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/param.h>
-#include <sys/sysctl.h>
-#include <sys/proc.h>
-#include <sys/user.h>
 #include <sys/wait.h>
-#include <sys/jail.h>
 
 #include <paths.h>
 #include <signal.h>
@@ -53,32 +49,20 @@
 #include <errno.h>
 #include <stdarg.h>
 #include <unistd.h>
-#include <kvm.h>
 #include <limits.h>
 #include <fcntl.h>
 #include <string.h>
 #include <stdlib.h>
 
 #include "util.h"
+#include "jailutils.h"
+#include "stop.h"
+#include "backend.h"
 
 #ifdef HAVE_CONFIG_H
 #include "../config.h"
 #endif
 
-/* The timeout to wait between kills */
-#define        DEFAULT_TIMEOUT        3
-int g_timeout = DEFAULT_TIMEOUT;
-
-int g_quiet = 0;        /* Supress warnings */
-int g_verbose = 0;      /* Print output from scripts */
-int g_force = 0;        /* Use SIGKILL after if processes don't exit */
-int g_usescripts = 1;   /* Call startup and shutdown scripts */
-int g_restart = 0;      /* Restart jail after stop */
-
-static int kill_jail(const char* jail);
-static void kill_jail_processes(kvm_t* kd, int sig);
-static int check_running_processes(kvm_t* kd);
-
 static void parse_jail_opts(int argc, char* argv[]);
 static void parse_host_opts(int argc, char* argv[]);
 
@@ -86,15 +70,15 @@ static void usage();
 static void usage_jail();
 static void usage_hr(const char* name);
 
-int main(int argc, char* argv[])
+int jkill_main(int argc, char* argv[])
 {
-    struct xprison* xp = NULL;
+    jail_info* ji = NULL;
+    jail_info jail;
     jails jls;
-    size_t len;
-    int jid, r, ret = 0;
+    int r, ret = 0;
     pid_t child;
 
-    if(getuid() != 0)
+    if(!have_privileges())
         errx(1, "must run as root");
 
     /*
@@ -115,7 +99,7 @@ int main(int argc, char* argv[])
     	/* Ignore these signals as all sorts of crazy stuff happens around our process */
         ignore_signals ();
 
-        r = kill_jail(argv[0]);
+        r = stop_jail(argv[0]);
         exit(r);
     }
 
@@ -131,18 +115,15 @@ int main(int argc, char* argv[])
         /* For each jail */
         for(; argc > 0; argc--, argv++)
         {
-            xp = jails_find(&jls, argv[0]);
+            ji = jails_find(&jls, argv[0]);
 
-            if(xp == NULL)
+            if(ji == NULL)
             {
                 warnx("unknown jail host name: %s", argv[0]);
                 ret = 1;
                 continue;
             }
 
-            /* This makes sure we can use kvm funcs in jail */
-            kvm_prepare_jail(xp);
-
             /*
              * We fork and the child goes into the jail and
              * does the dirty work. Unless in debug mode where
@@ -159,15 +140,19 @@ int main(int argc, char* argv[])
             /* The child */
             case 0:
 #endif
-                jid = xp->pr_id;
+                jail = *ji;
 
                 /* Always free jail info before going into jail */
                 jails_done(&jls);
 
-                if(jail_attach(jid) == -1)
+                /* Sockets are held from out here, where they outlive the jail */
+                if(g_restart)
+                    stop_jail_hold(&jail);
+
+                if(jail_backend_get()->attach(&jail) == -1)
                     err(1, "couldn't attach to jail");
 
-                 r = kill_jail(argv[0]);
+                 r = stop_jail(argv[0]);
                  exit(r);
 #ifdef _DEBUG
                  break;
@@ -221,10 +206,21 @@ static void parse_jail_opts(int argc, char* argv[])
     /* Options for jkill */
     if(!ishr)
     {
-        while((ch = getopt(argc, argv, "rt:")) != -1)
+        while((ch = getopt(argc, argv, "l:P:rt:")) != -1)
         {
             switch(ch)
             {
+            case 'l':
+                stop_jail_listen(optarg);
+                break;
+
+            /* Run rc.d scripts ourselves, several at a time */
+            case 'P':
+                g_parallel = atoi(optarg);
+                if(g_parallel <= 0)
+                    errx(2, "invalid number of rc.d scripts: %s", optarg);
+                break;
+
             case 'r':
                 g_restart = 1;
                 break;
@@ -273,6 +269,9 @@ static void parse_jail_opts(int argc, char* argv[])
     argc -= optind;
     argv += optind;
 
+    if(g_listen && !g_restart)
+        usage_jail();
+
     if(argc > 0)
     {
         if(ishr)
@@ -286,7 +285,7 @@ static void parse_host_opts(int argc, char* argv[])
 {
     int ch;
 
-    while((ch = getopt(argc, argv, "fhkqrt:v")) != -1)
+    while((ch = getopt(argc, argv, "fhkl:P:qrt:v")) != -1)
     {
         switch(ch)
         {
@@ -294,6 +293,18 @@ static void parse_host_opts(int argc, char* argv[])
             g_force = 1;
             break;
 
+        /* Run rc.d scripts ourselves, several at a time */
+        case 'P':
+            g_parallel = atoi(optarg);
+            if(g_parallel <= 0)
+                errx(2, "invalid number of rc.d scripts: %s", optarg);
+            break;
+
+        /* Hold these listening addresses across the restart */
+        case 'l':
+            stop_jail_listen(optarg);
+            break;
+
         case 'h':
             /* dummy for compatibility with killjail */
             warnx("the '-h' option has been depreciated");
@@ -334,6 +345,9 @@ static void parse_host_opts(int argc, char* argv[])
     if(!g_usescripts && g_restart)
         usage();
 
+    if(g_listen && !g_restart)
+        usage();
+
     argc -= optind;
     argv += optind;
 
@@ -341,173 +355,16 @@ static void parse_host_opts(int argc, char* argv[])
         usage();
 }
 
-#define SHUTDOWN_SCRIPT "/etc/rc.shutdown"
-static char* SHUTDOWN_ARGS[] = { _PATH_BSHELL, SHUTDOWN_SCRIPT, NULL };
-
-#define START_SCRIPT "/etc/rc"
-static char* START_ARGS[] = { _PATH_BSHELL, START_SCRIPT, NULL };
-
-static int kill_jail(const char* jail)
-{
-    kvm_t* kd = NULL;
-    char errbuf[_POSIX2_LINE_MAX];
-    int pass = 0;
-    int timeout = 0;
-    int ret = 0;
-    int cmdargs = JAIL_RUN_CONSOLE;
-
-    /* Open the kernel interface */
-    kd = kvm_openfiles(_PATH_DEVNULL, _PATH_DEVNULL, NULL, O_RDONLY, errbuf);
-    if(kd == NULL)
-        errx(1, "couldn't connect to kernel: %s", errbuf);
-
-    if(g_verbose)
-        cmdargs |= JAIL_RUN_STDERR;
-
-    /*
-     * Multiple passes are used to do different things.
-     * Each time the jails processes are listed.
-     */
-    while(1)
-    {
-        while(timeout > 0)
-        {
-            sleep(1);
-            timeout--;
-
-            if(!check_running_processes(kd))
-                goto done;
-        }
-
-        switch(pass)
-        {
-        /* First pass is an orderly shutdown */
-        case 0:
-
-            /* Check if we have an executable shutdown script */
-            if(g_usescripts && check_jail_command(jail, SHUTDOWN_SCRIPT))
-                run_jail_command(jail, SHUTDOWN_ARGS[0], SHUTDOWN_ARGS, cmdargs);
-
-            break;
-
-        /* Okay now quit all processes in jail */
-        case 1:
-            kill_jail_processes(kd, SIGTERM);
-            timeout = g_timeout;
-            break;
-
-        /* ... and again ... */
-        case 2:
-            kill_jail_processes(kd, SIGTERM);
-            timeout = g_timeout;
-            break;
-
-        /* Okay now we force kill the processes if necessary */
-        case 3:
-
-            if(g_force)
-            {
-                /* If we get here, jailer looks like it's really irresponsive */
-                if(!g_quiet)
-                    warnx("%s: jail won't stop. forcing jail termination...", jail);
-
-                kill_jail_processes(kd, SIGKILL);
-                timeout = g_timeout;
-            }
-
-            break;
-
-        case 4:
-
-            /* And if that didn't do it, well then give up */
-            if(!g_quiet)
-                warnx("%s: couldn't stop jail, processes wouldn't die", jail);
-
-            ret = 1;
-            goto done;
-        }
-
-        pass++;
-
-        if(!check_running_processes(kd))
-            goto done;
-    }
-
-done:
-    if(g_restart)
-    {
-        /* Check if we have an executable shutdown script */
-        if(check_jail_command(jail, START_SCRIPT))
-            run_jail_command(jail, START_ARGS[0], START_ARGS, cmdargs);
-    }
-
-    if(kd != NULL)
-        kvm_close(kd);
-
-    return ret;
-}
-
-static void kill_jail_processes(kvm_t* kd, int sig)
-{
-    struct kinfo_proc* kp;
-    int nentries, i;
-    pid_t cur;
-
-    cur = getpid();
-
-    /* Get a process listing */
-    if((kp = kvm_getprocs(kd, KERN_PROC_ALL, 0, &nentries)) == 0)
-        errx(1, "couldn't list processes: %s", kvm_geterr(kd));
-
-    /* Okay now loop and look at each process' jail */
-    for(i = 0; i < nentries; i++)
-    {
-        if(kp[i].ki_pid == cur)
-            continue;
-
-        if(kill(kp[i].ki_pid, sig) == -1)
-        {
-            if(errno != ESRCH)
-                errx(1, "couldn't signal process: %d", (int)kp[i].ki_pid);
-        }
-    }
-}
-
-static int check_running_processes(kvm_t* kd)
-{
-    struct kinfo_proc* kp;
-    int nentries, i;
-    pid_t cur;
-
-    cur = getpid();
-
-    /* Get a process listing */
-    if((kp = kvm_getprocs(kd, KERN_PROC_ALL, 0, &nentries)) == 0)
-        errx(1, "couldn't list processes: %s", kvm_geterr(kd));
-
-    if(nentries != 1)
-        return 1;
-
-    /* Okay now loop and look at each process' jail */
-    for(i = 0; i < nentries; i++)
-    {
-        if(kp[i].ki_pid != cur)
-            return 1;
-    }
-
-    return 0;
-}
-
 static void usage()
 {
-    fprintf(stderr, "usage: jkill [-fkqv] [-t timeout] jail ...\n");
-    fprintf(stderr, "       jkill -r [-fqv] [-t timeout] jail ...\n");
+    fprintf(stderr, "usage: jkill [-fkqv] [-P width] [-t timeout] jail ...\n");
+    fprintf(stderr, "       jkill -r [-fqv] [-l [name=]addr:port,...] [-P width] [-t timeout] jail ...\n");
     exit(2);
 }
 
 static void usage_jail()
 {
-    fprintf(stderr, "usage: jkill [-r] [-t timeout]\n");
+    fprintf(stderr, "usage: jkill [-r] [-l [name=]addr:port,...] [-P width] [-t timeout]\n");
     exit(2);
 }
 
@@ -0,0 +1,466 @@
+/*
+ * Copyright (c) 2004, Stef Walter
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above
+ *       copyright notice, this list of conditions and the
+ *       following disclaimer.
+ *     * Redistributions in binary form must reproduce the
+ *       above copyright notice, this list of conditions and
+ *       the following disclaimer in the documentation and/or
+ *       other materials provided with the distribution.
+ *     * The names of contributors to this software may not be
+ *       used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ *
+ *
+ * CONTRIBUTORS
+ *  Stef Walter <stef@memberwebs.com>
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include <paths.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <err.h>
+#include <errno.h>
+#include <unistd.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "util.h"
+#include "jailutils.h"
+#include "stop.h"
+#include "backend.h"
+#include "server.h"
+
+#ifdef HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+/*
+ * jkilld keeps a kernel handle and a jail listing around and runs
+ * stop, restart and status requests from a UNIX socket. Requests are
+ * lines of the form:
+ *
+ *   <tag> stop|restart|status <jail>
+ *
+ * and each gets one reply line, in whatever order they complete:
+ *
+ *   <tag> ok|fail|busy|unknown <usecs> [detail]
+ */
+
+#define DEFAULT_SOCKET      "/var/run/jkilld.sock"
+#define DEFAULT_JOBS        16
+
+typedef struct request
+{
+    char tag[64];
+    char verb[16];
+    jail_info jail;
+    int cl;                     /* Index of client, -1 if it went away */
+    pid_t pid;                  /* Child doing the work, 0 if queued */
+    struct timespec start;
+    struct request* next;
+}
+request;
+
+static int g_jobs = DEFAULT_JOBS;
+static int g_running = 0;
+
+static request* g_requests = NULL;
+
+static jails g_jls;
+static int g_sigpipe[2] = { -1, -1 };
+
+static void handle_line(int cl, char* line);
+static void client_gone(int cl);
+static void run_requests();
+static void reap_requests();
+static int find_jail(const char* name, jail_info* jail);
+static void on_sigchld(int sig);
+
+static void usage();
+
+int jkilld_main(int argc, char* argv[])
+{
+    struct pollfd pfd[SERVER_MAX_CLIENTS + 2];
+    const char* path = DEFAULT_SOCKET;
+    int foreground = 0;
+    int ch, n;
+
+    while((ch = getopt(argc, argv, "dfkj:qs:t:v")) != -1)
+    {
+        switch(ch)
+        {
+        case 'd':
+            foreground = 1;
+            break;
+
+        case 'f':
+            g_force = 1;
+            break;
+
+        case 'k':
+            g_usescripts = 0;
+            break;
+
+        /* Number of jails to work on at once */
+        case 'j':
+            g_jobs = atoi(optarg);
+            if(g_jobs <= 0)
+                errx(2, "invalid jobs argument: %s", optarg);
+            break;
+
+        case 'q':
+            g_quiet = 1;
+            g_verbose = 0;
+            break;
+
+        case 's':
+            path = optarg;
+            break;
+
+        /* Timeout to use between kills */
+        case 't':
+            g_timeout = atoi(optarg);
+            if(g_timeout <= 0)
+                errx(2, "invalid timeout argument: %s", optarg);
+            break;
+
+        case 'v':
+            g_verbose = 1;
+            g_quiet = 0;
+            break;
+
+        case '?':
+        default:
+            usage();
+            break;
+        }
+    }
+
+    argc -= optind;
+    argv += optind;
+
+    if(argc > 0)
+        usage();
+
+    if(!have_privileges())
+        errx(1, "must run as root");
+
+    if(running_in_jail() != 0)
+        errx(1, "can't run from inside jail");
+
+    /*
+     * The kernel handle stays valid across attaching to a jail in
+     * our children, so they don't have to open their own.
+     */
+    if(jail_backend_get()->open() == -1)
+        err(1, "couldn't connect to kernel");
+
+    jails_load(&g_jls);
+
+    /* Children finishing wake up the poll below */
+    if(pipe(g_sigpipe) == -1)
+        err(1, "couldn't create pipe");
+    fcntl(g_sigpipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(g_sigpipe[1], F_SETFL, O_NONBLOCK);
+    fcntl(g_sigpipe[0], F_SETFD, FD_CLOEXEC);
+    fcntl(g_sigpipe[1], F_SETFD, FD_CLOEXEC);
+
+    server_listen(path, handle_line, client_gone);
+
+    if(!foreground && daemon(0, g_verbose) == -1)
+        err(1, "couldn't disconnect from console");
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGCHLD, on_sigchld);
+
+    for(;;)
+    {
+        pfd[0].fd = g_sigpipe[0];
+        pfd[0].events = POLLIN;
+        n = 1 + server_poll(pfd + 1);
+
+        if(poll(pfd, n, -1) == -1)
+        {
+            if(errno == EINTR)
+                continue;
+            err(1, "couldn't poll");
+        }
+
+        if(pfd[0].revents)
+        {
+            char buf[64];
+            while(read(g_sigpipe[0], buf, sizeof(buf)) > 0)
+                ;
+            reap_requests();
+        }
+
+        server_process(pfd + 1, n - 1);
+        run_requests();
+    }
+
+    /* Not reached */
+    return 0;
+}
+
+static void on_sigchld(int sig)
+{
+    unsigned char c = (unsigned char)sig;
+    int e = errno;
+
+    write(g_sigpipe[1], &c, 1);
+    errno = e;
+}
+
+static void client_gone(int cl)
+{
+    request* rq;
+
+    /* Running requests carry on, but nobody hears about them */
+    for(rq = g_requests; rq; rq = rq->next)
+    {
+        if(rq->cl == cl)
+            rq->cl = -1;
+    }
+}
+
+static void handle_line(int cl, char* line)
+{
+    struct timespec start;
+    char detail[JAIL_HOST_LEN + 32];
+    jail_info ji;
+    request* rq;
+    char* tag;
+    char* verb;
+    char* jail;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    tag = strtok(line, " \t");
+    verb = strtok(NULL, " \t");
+    jail = strtok(NULL, " \t");
+
+    /* Blank lines are fine */
+    if(tag == NULL)
+        return;
+
+    if(verb == NULL || jail == NULL || strtok(NULL, " \t") != NULL ||
+       strlen(tag) >= sizeof(rq->tag))
+    {
+        server_reply(cl, tag, "fail", &start, "invalid request");
+        return;
+    }
+
+    if(strcmp(verb, "stop") != 0 && strcmp(verb, "restart") != 0 &&
+       strcmp(verb, "status") != 0)
+    {
+        server_reply(cl, tag, "fail", &start, "unknown command");
+        return;
+    }
+
+    find_jail(jail, &ji);
+
+    if(strcmp(verb, "status") == 0)
+    {
+        if(ji.jid == -1)
+        {
+            server_reply(cl, tag, "unknown", &start, NULL);
+        }
+        else
+        {
+            for(rq = g_requests; rq; rq = rq->next)
+            {
+                if(rq->jail.jid == ji.jid)
+                    break;
+            }
+
+            snprintf(detail, sizeof(detail), "%d %s %s", ji.jid, ji.host,
+                     rq ? rq->verb : "running");
+            server_reply(cl, tag, "ok", &start, detail);
+        }
+
+        return;
+    }
+
+    if(ji.jid == -1)
+    {
+        server_reply(cl, tag, "unknown", &start, NULL);
+        return;
+    }
+
+    /* Only one thing at a time for each jail */
+    for(rq = g_requests; rq; rq = rq->next)
+    {
+        if(rq->jail.jid == ji.jid)
+        {
+            server_reply(cl, tag, "busy", &start, rq->verb);
+            return;
+        }
+    }
+
+    rq = (request*)calloc(1, sizeof(request));
+    if(rq == NULL)
+        errx(1, "out of memory");
+
+    strcpy(rq->tag, tag);
+    strlcpy(rq->verb, verb, sizeof(rq->verb));
+    rq->jail = ji;
+    rq->cl = cl;
+    rq->start = start;
+
+    /* Keep them in order of arrival */
+    if(g_requests == NULL)
+    {
+        g_requests = rq;
+    }
+    else
+    {
+        request* last = g_requests;
+        while(last->next)
+            last = last->next;
+        last->next = rq;
+    }
+}
+
+static int find_jail(const char* name, jail_info* jail)
+{
+    jail_info* ji;
+
+    /*
+     * Look in our snapshot first, only going back to the kernel
+     * when a jail isn't there. Jails come and go all the time.
+     */
+    ji = jails_find(&g_jls, name);
+    if(ji == NULL)
+    {
+        jails_done(&g_jls);
+        jails_load(&g_jls);
+        ji = jails_find(&g_jls, name);
+    }
+
+    if(ji == NULL)
+    {
+        jail->jid = -1;
+        return -1;
+    }
+
+    *jail = *ji;
+    return 0;
+}
+
+static void run_requests()
+{
+    request* rq;
+    int r;
+
+    for(rq = g_requests; rq && g_running < g_jobs; rq = rq->next)
+    {
+        if(rq->pid != 0)
+            continue;
+
+        switch((rq->pid = fork()))
+        {
+        case -1:
+            err(1, "couldn't fork child process");
+            break;
+
+        /* The child goes into the jail and does the work */
+        case 0:
+            signal(SIGCHLD, SIG_DFL);
+            signal(SIGPIPE, SIG_DFL);
+
+            server_close_fds();
+
+            /* Ignore these signals as all sorts of crazy stuff happens around our process */
+            ignore_signals();
+
+            /* Always free jail info before going into jail */
+            jails_done(&g_jls);
+
+            if(jail_backend_get()->attach(&(rq->jail)) == -1)
+                err(1, "couldn't attach to jail");
+
+            g_restart = (strcmp(rq->verb, "restart") == 0);
+
+            r = stop_jail(rq->jail.host);
+            _exit(r);
+            break;
+
+        default:
+            g_running++;
+            break;
+        }
+    }
+}
+
+static void reap_requests()
+{
+    request** prq;
+    request* rq;
+    pid_t pid;
+    int status;
+
+    while((pid = waitpid(-1, &status, WNOHANG)) > 0)
+    {
+        for(prq = &g_requests; *prq; prq = &((*prq)->next))
+        {
+            if((*prq)->pid == pid)
+                break;
+        }
+
+        rq = *prq;
+        if(rq == NULL)
+            continue;
+
+        *prq = rq->next;
+        g_running--;
+
+        if(rq->cl != -1)
+        {
+            server_reply(rq->cl, rq->tag,
+                         WIFEXITED(status) && WEXITSTATUS(status) == 0 ? "ok" : "fail",
+                         &(rq->start), NULL);
+        }
+
+        free(rq);
+    }
+
+    /* Jails we stopped are gone, get a fresh listing next time */
+    jails_done(&g_jls);
+    jails_load(&g_jls);
+}
+
+static void usage()
+{
+    fprintf(stderr, "usage: jkilld [-dfkqv] [-j jobs] [-s socket] [-t timeout]\n");
+    exit(2);
+}
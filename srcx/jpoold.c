@@ -0,0 +1,1063 @@
+/*
+ * Copyright (c) 2004, Stef Walter
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above
+ *       copyright notice, this list of conditions and the
+ *       following disclaimer.
+ *     * Redistributions in binary form must reproduce the
+ *       above copyright notice, this list of conditions and
+ *       the following disclaimer in the documentation and/or
+ *       other materials provided with the distribution.
+ *     * The names of contributors to this software may not be
+ *       used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ *
+ *
+ * CONTRIBUTORS
+ *  Stef Walter <stef@memberwebs.com>
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include <paths.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <err.h>
+#include <errno.h>
+#include <unistd.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "util.h"
+#include "jailutils.h"
+#include "stop.h"
+#include "start.h"
+#include "provision.h"
+#include "backend.h"
+#include "server.h"
+
+#ifdef HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+/*
+ * jpoold keeps pools of jails that have already been started, so
+ * that handing one out takes hardly any time at all. Each pool comes
+ * from a template, one per line in the pools file:
+ *
+ *   name path size ip[,ip...] [command ...]
+ *
+ * Requests are lines on a UNIX socket, like with jkilld:
+ *
+ *   <tag> acquire <pool> [hostname [ip[,ip...]]]
+ *   <tag> release <jail>
+ *   <tag> stats [pool]
+ *
+ * and each gets one reply line:
+ *
+ *   <tag> ok|fail|unknown <usecs> [detail]
+ *
+ * Each jail gets a root of its own, built from the pool's path as a
+ * template, and removed again once the jail is stopped. Jails that
+ * are released are stopped, and fresh ones started in their place.
+ * They're never handed out twice.
+ */
+
+#define DEFAULT_SOCKET      "/var/run/jpoold.sock"
+#define DEFAULT_POOLS       "/usr/local/etc/jpoold.conf"
+#define DEFAULT_ROOTS       "/var/db/jpoold"
+#define DEFAULT_JOBS        8
+
+/* Longest to wait before trying again to start a pool's jails */
+#define MAX_BACKOFF         60
+
+#define JAIL_STARTING       0
+#define JAIL_IDLE           1
+#define JAIL_BUSY           2
+#define JAIL_STOPPING       3
+
+typedef struct pool_jail
+{
+    int state;
+    pid_t pid;                  /* Child starting or stopping it, 0 if none */
+    jail_info jail;             /* The jid is -1 until it's started */
+    char root[JAIL_PATH_LEN];   /* Built for it, and removed with it */
+    struct pool_jail* next;
+}
+pool_jail;
+
+/* An acquire waiting for a jail */
+typedef struct waiter
+{
+    char tag[64];
+    char host[JAIL_HOST_LEN];   /* Empty to keep the pool's name */
+    jail_spec addrs;            /* Only addresses, none to keep the pool's */
+    int cl;                     /* Index of client, -1 if it went away */
+    int hit;                    /* There was a jail ready when it came in */
+    struct timespec start;
+    struct waiter* next;
+}
+waiter;
+
+typedef struct pool
+{
+    char* name;
+    jail_spec spec;             /* What each jail starts out with */
+    char** argv;                /* NULL for /etc/rc */
+    int size;
+
+    pool_jail* jails;
+    waiter* waiters;
+
+    int failures;               /* Jails that failed to start in a row */
+    time_t retry;               /* Don't start more until then */
+
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long long usecs;   /* Total time taken to hand out jails */
+    long maxusecs;
+
+    struct pool* next;
+}
+pool;
+
+static int g_jobs = DEFAULT_JOBS;
+static int g_running = 0;
+static const char* g_roots = DEFAULT_ROOTS;
+static int g_quit = 0;
+static unsigned int g_serial = 0;
+
+static pool* g_pools = NULL;
+
+static jails g_jls;
+static int g_sigpipe[2] = { -1, -1 };
+
+static void load_pools(const char* file);
+static void handle_line(int cl, char* line);
+static void client_gone(int cl);
+static void fill_pools();
+static void free_waiter(waiter* w);
+static void serve_waiters();
+static void run_stops();
+static void reap_jails();
+static int pools_done();
+static int find_jail(const char* name, jail_info* jail);
+static void on_sigchld(int sig);
+static void on_sigterm(int sig);
+
+static void usage();
+
+int jpoold_main(int argc, char* argv[])
+{
+    struct pollfd pfd[SERVER_MAX_CLIENTS + 2];
+    const char* path = DEFAULT_SOCKET;
+    const char* file = DEFAULT_POOLS;
+    int foreground = 0;
+    int ch, n;
+    int timeout;
+    pool* p;
+
+    /* Used jails aren't worth waiting for */
+    g_force = 1;
+
+    while((ch = getopt(argc, argv, "dD:f:j:kM:P:qs:t:v")) != -1)
+    {
+        switch(ch)
+        {
+        case 'd':
+            foreground = 1;
+            break;
+
+        /* Where the jails' roots go */
+        case 'D':
+            g_roots = optarg;
+            break;
+
+        case 'f':
+            file = optarg;
+            break;
+
+        /* Number of jails to start or stop at once */
+        case 'j':
+            g_jobs = atoi(optarg);
+            if(g_jobs <= 0)
+                errx(2, "invalid jobs argument: %s", optarg);
+            break;
+
+        case 'k':
+            g_usescripts = 0;
+            break;
+
+        /* Run rc.d scripts ourselves, several at a time */
+        /* How to build the roots from the templates */
+        case 'M':
+            g_provision = provision_method(optarg);
+            if(g_provision == -1)
+                errx(2, "invalid provisioning method: %s", optarg);
+            break;
+
+        case 'P':
+            g_rcwidth = g_parallel = atoi(optarg);
+            if(g_rcwidth <= 0)
+                errx(2, "invalid number of rc.d scripts: %s", optarg);
+            break;
+
+        case 'q':
+            g_quiet = 1;
+            g_verbose = 0;
+            break;
+
+        case 's':
+            path = optarg;
+            break;
+
+        /* Timeout to use between kills */
+        case 't':
+            g_timeout = atoi(optarg);
+            if(g_timeout <= 0)
+                errx(2, "invalid timeout argument: %s", optarg);
+            break;
+
+        case 'v':
+            g_verbose = 1;
+            g_quiet = 0;
+            break;
+
+        case '?':
+        default:
+            usage();
+            break;
+        }
+    }
+
+    argc -= optind;
+    argv += optind;
+
+    if(argc > 0)
+        usage();
+
+    if(!have_privileges())
+        errx(1, "must run as root");
+
+    if(running_in_jail() != 0)
+        errx(1, "can't run from inside jail");
+
+    load_pools(file);
+
+    if(mkdir(g_roots, 0700) == -1 && errno != EEXIST)
+        err(1, "couldn't create directory for jail roots: %s", g_roots);
+
+    if(jail_backend_get()->open() == -1)
+        err(1, "couldn't connect to kernel");
+
+    jails_load(&g_jls);
+
+    /* Children finishing wake up the poll below */
+    if(pipe(g_sigpipe) == -1)
+        err(1, "couldn't create pipe");
+    fcntl(g_sigpipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(g_sigpipe[1], F_SETFL, O_NONBLOCK);
+    fcntl(g_sigpipe[0], F_SETFD, FD_CLOEXEC);
+    fcntl(g_sigpipe[1], F_SETFD, FD_CLOEXEC);
+
+    server_listen(path, handle_line, client_gone);
+
+    if(!foreground && daemon(0, g_verbose) == -1)
+        err(1, "couldn't disconnect from console");
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGCHLD, on_sigchld);
+    signal(SIGTERM, on_sigterm);
+    signal(SIGINT, on_sigterm);
+
+    fill_pools();
+
+    for(;;)
+    {
+        pfd[0].fd = g_sigpipe[0];
+        pfd[0].events = POLLIN;
+        n = 1 + server_poll(pfd + 1);
+
+        /* Wake up for pools that are waiting to try again */
+        timeout = -1;
+        for(p = g_pools; p; p = p->next)
+        {
+            if(p->retry)
+                timeout = 1000;
+        }
+
+        if(poll(pfd, n, timeout) == -1)
+        {
+            if(errno != EINTR)
+                err(1, "couldn't poll");
+            continue;
+        }
+
+        if(pfd[0].revents)
+        {
+            char buf[64];
+            while(read(g_sigpipe[0], buf, sizeof(buf)) > 0)
+                ;
+            reap_jails();
+        }
+
+        /* No new clients once we're on the way out */
+        if(g_quit)
+            server_unlisten();
+
+        server_process(pfd + 1, n - 1);
+
+        if(g_quit && pools_done())
+            break;
+
+        serve_waiters();
+        fill_pools();
+        run_stops();
+    }
+
+    return 0;
+}
+
+static void on_sigchld(int sig)
+{
+    unsigned char c = (unsigned char)sig;
+    int e = errno;
+
+    write(g_sigpipe[1], &c, 1);
+    errno = e;
+}
+
+static void on_sigterm(int sig)
+{
+    unsigned char c = (unsigned char)sig;
+    int e = errno;
+
+    g_quit = 1;
+    write(g_sigpipe[1], &c, 1);
+    errno = e;
+}
+
+static void load_pools(const char* file)
+{
+    char line[SERVER_MAX_LINE * 2];
+    char** argv;
+    char* t;
+    char* w;
+    pool* p;
+    pool** last = &g_pools;
+    int lineno = 0;
+    int n;
+    FILE* f;
+
+    f = fopen(file, "r");
+    if(f == NULL)
+        err(1, "couldn't open pools file: %s", file);
+
+    while(fgets(line, sizeof(line), f) != NULL)
+    {
+        lineno++;
+
+        if((t = strchr(line, '#')) != NULL)
+            *t = 0;
+
+        /* Can't be more words than this */
+        n = strlen(line) / 2 + 2;
+
+        if((w = strtok(line, " \t\r\n")) == NULL)
+            continue;
+
+        p = (pool*)calloc(1, sizeof(pool));
+        argv = (char**)calloc(n, sizeof(char*));
+        if(p == NULL || argv == NULL || (p->name = strdup(w)) == NULL)
+            errx(1, "out of memory");
+
+        for(n = 0; (w = strtok(NULL, " \t\r\n")) != NULL; n++)
+        {
+            if((argv[n] = strdup(w)) == NULL)
+                errx(1, "out of memory");
+        }
+
+        if(n < 3)
+            errx(1, "%s:%d: expected name, path, size and addresses", file, lineno);
+
+        p->spec.path = argv[0];
+        p->size = atoi(argv[1]);
+        if(p->size <= 0)
+            errx(1, "%s:%d: invalid pool size: %s", file, lineno, argv[1]);
+
+        jail_addresses(argv[2], &(p->spec));
+        p->argv = n > 3 ? argv + 3 : NULL;
+
+        *last = p;
+        last = &(p->next);
+    }
+
+    if(ferror(f))
+        err(1, "couldn't read pools file: %s", file);
+
+    fclose(f);
+
+    if(g_pools == NULL)
+        errx(1, "no pools in file: %s", file);
+}
+
+static pool* find_pool(const char* name)
+{
+    pool* p;
+
+    for(p = g_pools; p; p = p->next)
+    {
+        if(strcmp(p->name, name) == 0)
+            return p;
+    }
+
+    return NULL;
+}
+
+static pool_jail* find_pool_jail(pool* p, int state)
+{
+    pool_jail* pj;
+
+    for(pj = p->jails; pj; pj = pj->next)
+    {
+        if(pj->state == state)
+            return pj;
+    }
+
+    return NULL;
+}
+
+static int count_pool_jails(pool* p, int state)
+{
+    pool_jail* pj;
+    int n = 0;
+
+    for(pj = p->jails; pj; pj = pj->next)
+    {
+        if(pj->state == state)
+            n++;
+    }
+
+    return n;
+}
+
+static void remove_pool_jail(pool* p, pool_jail* pj)
+{
+    pool_jail** ppj;
+
+    for(ppj = &(p->jails); *ppj; ppj = &((*ppj)->next))
+    {
+        if(*ppj == pj)
+        {
+            *ppj = pj->next;
+            free(pj);
+            return;
+        }
+    }
+}
+
+static void close_fds()
+{
+    signal(SIGCHLD, SIG_DFL);
+    signal(SIGPIPE, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGINT, SIG_DFL);
+
+    server_close_fds();
+}
+
+static void start_pool_jail(pool* p)
+{
+    pool_jail* pj;
+    jail_spec spec;
+    struct stat sb;
+
+    pj = (pool_jail*)calloc(1, sizeof(pool_jail));
+    if(pj == NULL)
+        errx(1, "out of memory");
+
+    pj->state = JAIL_STARTING;
+    pj->jail.jid = -1;
+
+    /* The root gets removed with the jail, so it can't be anyone else's */
+    do
+    {
+        snprintf(pj->jail.host, sizeof(pj->jail.host), "%s-%d-%u", p->name,
+                 (int)getpid(), ++g_serial);
+        if(snprintf(pj->root, sizeof(pj->root), "%s/%s", g_roots,
+                    pj->jail.host) >= (int)sizeof(pj->root))
+            errx(1, "jail root path too long: %s", g_roots);
+    }
+    while(lstat(pj->root, &sb) == 0);
+
+    strlcpy(pj->jail.path, pj->root, sizeof(pj->jail.path));
+
+    switch((pj->pid = fork()))
+    {
+    case -1:
+        err(1, "couldn't fork child process");
+        break;
+
+    /* The child starts the jail, and is done once it has booted */
+    case 0:
+        close_fds();
+
+        spec = p->spec;
+        spec.path = pj->root;
+        spec.hostname = pj->jail.host;
+        g_template = p->spec.path;
+
+        _exit(start_jail(&spec, p->argv, 0, JAIL_RUN_CONSOLE |
+                         (g_verbose ? JAIL_RUN_STDERR : 0)));
+        break;
+
+    default:
+        g_running++;
+        break;
+    }
+
+    pj->next = p->jails;
+    p->jails = pj;
+}
+
+/* Starts jails until each pool has enough ready or on the way */
+static void fill_pools()
+{
+    pool* p;
+    pool_jail* pj;
+    waiter* w;
+    int want, have;
+
+    for(p = g_pools; p; p = p->next)
+    {
+        if(g_quit)
+        {
+            /* Nobody is going to get these now */
+            while((w = p->waiters) != NULL)
+            {
+                if(w->cl != -1)
+                    server_reply(w->cl, w->tag, "fail", &(w->start), "shutting down");
+                p->waiters = w->next;
+                free_waiter(w);
+            }
+
+            for(pj = p->jails; pj; pj = pj->next)
+            {
+                if(pj->state == JAIL_IDLE)
+                    pj->state = JAIL_STOPPING;
+            }
+
+            continue;
+        }
+
+        if(p->retry)
+        {
+            if(time(NULL) < p->retry)
+                continue;
+            p->retry = 0;
+        }
+
+        want = p->size;
+        for(w = p->waiters; w; w = w->next)
+            want++;
+
+        have = count_pool_jails(p, JAIL_STARTING) + count_pool_jails(p, JAIL_IDLE);
+
+        while(have < want && g_running < g_jobs)
+        {
+            start_pool_jail(p);
+            have++;
+        }
+    }
+}
+
+/* In a child, stops the jail if there is one and removes its root */
+static int stop_pool_jail(pool_jail* pj)
+{
+    pid_t pid;
+    int status = 0;
+
+    if(pj->jail.jid != -1)
+    {
+        switch((pid = fork()))
+        {
+        case -1:
+            err(1, "couldn't fork child process");
+            break;
+
+        /* Going into the jail, and the root is only reachable from out here */
+        case 0:
+            /* Ignore these signals as all sorts of crazy stuff happens around our process */
+            ignore_signals();
+
+            /* Always free jail info before going into jail */
+            jails_done(&g_jls);
+
+            if(jail_backend_get()->attach(&(pj->jail)) == -1)
+                err(1, "couldn't attach to jail");
+
+            g_restart = 0;
+            _exit(stop_jail(pj->jail.host));
+            break;
+        }
+
+        if(waitpid(pid, &status, 0) == -1)
+            err(1, "couldn't wait for child process");
+
+        /* Something may still be using the root */
+        if(!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            return 1;
+    }
+
+    if(provision_destroy(pj->root, g_provision) == -1)
+    {
+        warn("%s: couldn't remove jail root: %s", pj->jail.host, pj->root);
+        return 1;
+    }
+
+    return 0;
+}
+
+/* Stops released jails, as many at a time as we're allowed */
+static void run_stops()
+{
+    pool* p;
+    pool_jail* pj;
+
+    for(p = g_pools; p; p = p->next)
+    {
+        for(pj = p->jails; pj && g_running < g_jobs; pj = pj->next)
+        {
+            if(pj->state != JAIL_STOPPING || pj->pid != 0)
+                continue;
+
+            switch((pj->pid = fork()))
+            {
+            case -1:
+                err(1, "couldn't fork child process");
+                break;
+
+            case 0:
+                close_fds();
+                _exit(stop_pool_jail(pj));
+                break;
+
+            default:
+                g_running++;
+                break;
+            }
+        }
+    }
+}
+
+static void reap_jails()
+{
+    pool* p;
+    pool_jail* pj = NULL;
+    jail_info ji;
+    pid_t pid;
+    int status;
+
+    while((pid = waitpid(-1, &status, WNOHANG)) > 0)
+    {
+        for(p = g_pools; p; p = p->next)
+        {
+            for(pj = p->jails; pj; pj = pj->next)
+            {
+                if(pj->pid == pid)
+                    break;
+            }
+
+            if(pj)
+                break;
+        }
+
+        if(pj == NULL)
+            continue;
+
+        g_running--;
+        pj->pid = 0;
+
+        /* Whether it worked or not, there's nothing more to do with it */
+        if(pj->state == JAIL_STOPPING)
+        {
+            if(!(WIFEXITED(status) && WEXITSTATUS(status) == 0) && !g_quiet)
+                warnx("%s: couldn't stop pool jail and remove its root", pj->jail.host);
+            remove_pool_jail(p, pj);
+            continue;
+        }
+
+        if(WIFEXITED(status) && WEXITSTATUS(status) == 0 &&
+           find_jail(pj->jail.host, &ji) == 0)
+        {
+            pj->jail = ji;
+            pj->state = JAIL_IDLE;
+            p->failures = 0;
+            continue;
+        }
+
+        /* Back off, so a broken template doesn't keep us busy */
+        if(!g_quiet)
+            warnx("%s: couldn't start pool jail", pj->jail.host);
+
+        p->failures++;
+        p->retry = time(NULL) + (p->failures < MAX_BACKOFF ? p->failures : MAX_BACKOFF);
+
+        /* Whatever is left of it has to go, its root at least */
+        if(find_jail(pj->jail.host, &ji) == 0)
+            pj->jail = ji;
+        pj->state = JAIL_STOPPING;
+    }
+}
+
+/* When quitting, we're done once the pools have nothing going on */
+static int pools_done()
+{
+    pool* p;
+    pool_jail* pj;
+
+    for(p = g_pools; p; p = p->next)
+    {
+        for(pj = p->jails; pj; pj = pj->next)
+        {
+            if(pj->state != JAIL_BUSY)
+                return 0;
+        }
+    }
+
+    return 1;
+}
+
+static void free_waiter(waiter* w)
+{
+    jail_addresses_free(&(w->addrs));
+    free(w);
+}
+
+/* Gives the waiter the jail, returns -1 if the jail is no good */
+static int hand_out(pool* p, waiter* w, pool_jail* pj)
+{
+    const jail_backend* jb = jail_backend_get();
+    char detail[JAIL_HOST_LEN + 32];
+    struct timespec now;
+    jail_spec spec;
+    jail_info ji;
+    long usecs;
+    int r;
+
+    /* Idle jails can die by themselves, check it's still around */
+    if(find_jail(pj->jail.host, &ji) == -1 || ji.jid != pj->jail.jid)
+    {
+        if(!g_quiet)
+            warnx("%s: pool jail went away", pj->jail.host);
+        pj->jail.jid = -1;
+        pj->state = JAIL_STOPPING;
+        return -1;
+    }
+
+    if(w->host[0] || w->addrs.ip4)
+    {
+        if(jb->rebind == NULL)
+        {
+            server_reply(w->cl, w->tag, "fail", &(w->start), "can't rebind jails on this system");
+            return 0;
+        }
+
+        spec = p->spec;
+        spec.hostname = w->host[0] ? w->host : pj->jail.host;
+
+        if(w->addrs.ip4)
+        {
+            spec.ip4 = w->addrs.ip4;
+            spec.ip4s = w->addrs.ip4s;
+            spec.ip6 = w->addrs.ip6;
+            spec.ip6s = w->addrs.ip6s;
+        }
+
+        r = jb->rebind(&(pj->jail), &spec);
+
+        /* Can't tell what state it's in, so it's no good to anyone */
+        if(r == -1)
+        {
+            snprintf(detail, sizeof(detail), "couldn't rebind jail: %s", strerror(errno));
+            server_reply(w->cl, w->tag, "fail", &(w->start), detail);
+            pj->state = JAIL_STOPPING;
+            return 0;
+        }
+
+        strlcpy(pj->jail.host, spec.hostname, sizeof(pj->jail.host));
+    }
+
+    pj->state = JAIL_BUSY;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    usecs = (now.tv_sec - w->start.tv_sec) * 1000000L +
+            (now.tv_nsec - w->start.tv_nsec) / 1000L;
+
+    if(w->hit)
+        p->hits++;
+    else
+        p->misses++;
+    p->usecs += usecs;
+    if(usecs > p->maxusecs)
+        p->maxusecs = usecs;
+
+    snprintf(detail, sizeof(detail), "%d %s %s", pj->jail.jid, pj->jail.host,
+             w->hit ? "hit" : "miss");
+    server_reply(w->cl, w->tag, "ok", &(w->start), detail);
+    return 0;
+}
+
+static void serve_waiters()
+{
+    pool* p;
+    pool_jail* pj;
+    waiter* w;
+
+    for(p = g_pools; p; p = p->next)
+    {
+        while((w = p->waiters) != NULL)
+        {
+            /* Nobody to give it to any more */
+            if(w->cl == -1)
+            {
+                p->waiters = w->next;
+                free_waiter(w);
+                continue;
+            }
+
+            if((pj = find_pool_jail(p, JAIL_IDLE)) == NULL)
+                break;
+
+            if(hand_out(p, w, pj) == -1)
+                continue;
+
+            p->waiters = w->next;
+            free_waiter(w);
+        }
+    }
+}
+
+static void pool_stats(pool* p, char* buf, size_t len)
+{
+    unsigned long count = p->hits + p->misses;
+
+    snprintf(buf, len, "%s idle=%d busy=%d starting=%d hits=%lu misses=%lu avg=%ld max=%ld",
+             p->name, count_pool_jails(p, JAIL_IDLE), count_pool_jails(p, JAIL_BUSY),
+             count_pool_jails(p, JAIL_STARTING), p->hits, p->misses,
+             count ? (long)(p->usecs / count) : 0L, p->maxusecs);
+}
+
+static void handle_line(int cl, char* line)
+{
+    struct timespec start;
+    char detail[SERVER_MAX_LINE];
+    size_t len;
+    waiter* w;
+    waiter** pw;
+    pool_jail* pj = NULL;
+    pool* p;
+    char* tag;
+    char* verb;
+    char* arg;
+    char* host;
+    char* addrs;
+    int ahead;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    tag = strtok(line, " \t");
+    verb = strtok(NULL, " \t");
+    arg = strtok(NULL, " \t");
+    host = strtok(NULL, " \t");
+    addrs = strtok(NULL, " \t");
+
+    /* Blank lines are fine */
+    if(tag == NULL)
+        return;
+
+    if(verb == NULL || strtok(NULL, " \t") != NULL || strlen(tag) >= sizeof(w->tag))
+    {
+        server_reply(cl, tag, "fail", &start, "invalid request");
+        return;
+    }
+
+    if(strcmp(verb, "stats") == 0)
+    {
+        if(host != NULL)
+        {
+            server_reply(cl, tag, "fail", &start, "invalid request");
+            return;
+        }
+
+        detail[0] = 0;
+        for(p = g_pools; p; p = p->next)
+        {
+            if(arg && strcmp(arg, p->name) != 0)
+                continue;
+
+            len = strlen(detail);
+            if(len > 0 && len < sizeof(detail) - 1)
+                detail[len++] = ' ';
+            pool_stats(p, detail + len, sizeof(detail) - len);
+        }
+
+        server_reply(cl, tag, detail[0] ? "ok" : "unknown", &start, detail[0] ? detail : NULL);
+        return;
+    }
+
+    if(arg == NULL)
+    {
+        server_reply(cl, tag, "fail", &start, "invalid request");
+        return;
+    }
+
+    if(strcmp(verb, "release") == 0)
+    {
+        if(host != NULL)
+        {
+            server_reply(cl, tag, "fail", &start, "invalid request");
+            return;
+        }
+
+        /* By jail id or host name, but only jails we've handed out */
+        for(p = g_pools; p && !pj; p = p->next)
+        {
+            for(pj = p->jails; pj; pj = pj->next)
+            {
+                if(pj->state == JAIL_BUSY &&
+                   (strcmp(pj->jail.host, arg) == 0 || pj->jail.jid == atoi(arg)))
+                    break;
+            }
+        }
+
+        if(pj == NULL)
+        {
+            server_reply(cl, tag, "unknown", &start, NULL);
+            return;
+        }
+
+        /* It gets stopped in the background */
+        pj->state = JAIL_STOPPING;
+        server_reply(cl, tag, "ok", &start, NULL);
+        return;
+    }
+
+    if(strcmp(verb, "acquire") != 0)
+    {
+        server_reply(cl, tag, "fail", &start, "unknown command");
+        return;
+    }
+
+    if((p = find_pool(arg)) == NULL)
+    {
+        server_reply(cl, tag, "unknown", &start, NULL);
+        return;
+    }
+
+    if(host && (strlen(host) >= sizeof(w->host) || strcmp(host, "-") == 0))
+    {
+        server_reply(cl, tag, "fail", &start, "invalid host name");
+        return;
+    }
+
+    if(g_quit)
+    {
+        server_reply(cl, tag, "fail", &start, "shutting down");
+        return;
+    }
+
+    w = (waiter*)calloc(1, sizeof(waiter));
+    if(w == NULL)
+        errx(1, "out of memory");
+
+    /* Checked now, the daemon can't go exiting over a client's typo */
+    if(addrs && jail_addresses_parse(addrs, &(w->addrs)) == -1)
+    {
+        free(w);
+        server_reply(cl, tag, "fail", &start, "invalid address");
+        return;
+    }
+
+    strcpy(w->tag, tag);
+    if(host)
+        strcpy(w->host, host);
+    w->cl = cl;
+    w->start = start;
+
+    /* Only a hit if there's a jail for it, after those ahead of it */
+    ahead = 0;
+    for(pw = &(p->waiters); *pw; pw = &((*pw)->next))
+        ahead++;
+    *pw = w;
+
+    w->hit = count_pool_jails(p, JAIL_IDLE) > ahead;
+}
+
+static void client_gone(int cl)
+{
+    pool* p;
+    waiter* w;
+
+    /* Its waiters get dropped, jails it has stay with it */
+    for(p = g_pools; p; p = p->next)
+    {
+        for(w = p->waiters; w; w = w->next)
+        {
+            if(w->cl == cl)
+                w->cl = -1;
+        }
+    }
+}
+
+static int find_jail(const char* name, jail_info* jail)
+{
+    jail_info* ji;
+
+    /* Pool jails come and go all the time, always look afresh */
+    jails_done(&g_jls);
+    jails_load(&g_jls);
+
+    ji = jails_find(&g_jls, name);
+    if(ji == NULL)
+    {
+        jail->jid = -1;
+        return -1;
+    }
+
+    *jail = *ji;
+    return 0;
+}
+
+static void usage()
+{
+    fprintf(stderr, "usage: jpoold [-dkqv] [-D roots] [-f pools] [-j jobs] [-M method] [-P width] [-s socket] [-t timeout]\n");
+    exit(2);
+}
@@ -38,35 +38,37 @@
 
 #include <sys/types.h>
 #include <sys/param.h>
-#include <sys/sysctl.h>
-#include <sys/user.h>
-#include <sys/jail.h>
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
-#include <kvm.h>
 #include <paths.h>
 #include <limits.h>
 #include <err.h>
 
 #include "util.h"
+#include "jailutils.h"
+#include "backend.h"
 
 #ifdef HAVE_CONFIG_H
 #include "../config.h"
 #endif
 
+#ifdef HAVE_ALLOCA_H
+#include <alloca.h>
+#endif
+
 static void usage();
 static void print_jail_ids();
 static void run_jail_ps(int argc, char* argv[]);
 
-int main(int argc, char* argv[])
+int jps_main(int argc, char* argv[])
 {
-    struct xprison* xp = NULL;
+    jail_info* ji = NULL;
+    jail_info jail;
     jails jls;
-    size_t len;
-    int jid, ch = 0;
+    int ch = 0;
     int simple = 0;
 
     while((ch = getopt(argc, argv, "i")) != -1)
@@ -95,24 +97,21 @@ int main(int argc, char* argv[])
 
     /* Translate the jail name into an id if neccessary */
     jails_load(&jls);
-    xp = jails_find(&jls, argv[0]);
+    ji = jails_find(&jls, argv[0]);
 
-    if(xp == NULL)
+    if(ji == NULL)
         errx(1, "unknown jail host name: %s", argv[0]);
 
     argc--;
     argv++;
 
-    /* This makes sure we can use kvm funcs in jail */
-    kvm_prepare_jail(xp);
-
-    jid = xp->pr_id;
+    jail = *ji;
 
     /* Always free jail info before going into jail */
     jails_done(&jls);
 
     /* Go into the jail */
-    if(jail_attach(jid) == -1)
+    if(jail_backend_get()->attach(&jail) == -1)
         err(1, "couldn't attach to jail");
 
     if(simple)
@@ -165,26 +164,18 @@ static void run_jail_ps(int argc, char* argv[])
 
 static void print_jail_ids()
 {
-    kvm_t* kd;
-    int nentries, i;
-    struct kinfo_proc* kp;
-    char errbuf[_POSIX2_LINE_MAX];
-
-    /* Open kernel interface */
-    kd = kvm_openfiles(_PATH_DEVNULL, _PATH_DEVNULL, NULL, O_RDONLY, errbuf);
-    if(kd == NULL)
-        errx(1, "couldn't connect to kernel: %s", errbuf);
+    jail_proc* procs;
+    size_t nprocs, i;
 
     /* Get all processes and print the pids */
-    if((kp = kvm_getprocs(kd, KERN_PROC_ALL, 0, &nentries)) == 0)
-        errx(1, "couldn't list processes: %s", kvm_geterr(kd));
+    if(jail_backend_get()->list_procs(&procs, &nprocs) == -1)
+        err(1, "couldn't list processes");
 
-    for(i = 0; i < nentries; i++)
+    for(i = 0; i < nprocs; i++)
     {
-        if(kp[i].ki_pid != getpid())
-            printf("%d ", (int)(kp[i].ki_pid));
+        if(procs[i].pid != getpid())
+            printf("%d ", (int)(procs[i].pid));
     }
 
     fputc('\n', stdout);
-    kvm_close(kd);
 }
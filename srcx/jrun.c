@@ -0,0 +1,438 @@
+/*
+ * Copyright (c) 2004, Stef Walter
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above
+ *       copyright notice, this list of conditions and the
+ *       following disclaimer.
+ *     * Redistributions in binary form must reproduce the
+ *       above copyright notice, this list of conditions and
+ *       the following disclaimer in the documentation and/or
+ *       other materials provided with the distribution.
+ *     * The names of contributors to this software may not be
+ *       used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ *
+ *
+ * CONTRIBUTORS
+ *  Stef Walter <stef@memberwebs.com>
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include <err.h>
+#include <errno.h>
+#include <fnmatch.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "util.h"
+#include "jailutils.h"
+#include "backend.h"
+#include "init.h"
+
+#ifdef HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+/* How many jails to run the command in at once */
+#define DEFAULT_JOBS    8
+
+/* A jail past its deadline gets this long after SIGTERM before SIGKILL */
+#define KILL_GRACE      1000
+
+/* How often to look at the deadlines, when there are some */
+#define DEADLINE_TICK   10
+
+/* Exit codes for what went wrong before the command ran */
+#define EXIT_NOATTACH   126
+#define EXIT_NOCOMMAND  127
+
+#define RUN_PENDING     0
+#define RUN_RUNNING     1
+#define RUN_DONE        2
+
+typedef struct run_state
+{
+    jail_info jail;
+    int state;
+    pid_t pid;
+    int status;
+    int killed;
+    long started;
+    long msecs;
+    long* spawn;        /* Shared, filled in by the child */
+}
+run_state;
+
+/* Ask the init in each jail to run the command, where there is one */
+static int g_agent = 0;
+
+static long now_msecs();
+static int select_jails(jails* jls, int all, const char* pattern,
+                        char* names, run_state** list);
+static void run_in_jail(run_state* rs, char* argv[]);
+static void print_result(run_state* rs);
+static void usage();
+
+int jrun_main(int argc, char* argv[])
+{
+    run_state* list;
+    run_state* rs;
+    long* spawns;
+    const char* pattern = NULL;
+    jails jls;
+    int all = 0;
+    int quiet = 0;
+    int jobs = DEFAULT_JOBS;
+    long timeout = 0;
+    long begin, now;
+    int count, done = 0, running = 0;
+    int ok = 0, failed = 0, timedout = 0;
+    int ch, i, status;
+    pid_t pid;
+
+    while((ch = getopt(argc, argv, "aIg:j:qt:")) != -1)
+    {
+        switch(ch)
+        {
+        /* Every jail there is */
+        case 'a':
+            all = 1;
+            break;
+
+        case 'I':
+            g_agent = 1;
+            break;
+
+        /* Or the ones whose host names match */
+        case 'g':
+            pattern = optarg;
+            break;
+
+        case 'j':
+            jobs = atoi(optarg);
+            if(jobs <= 0)
+                errx(2, "invalid number of jobs: %s", optarg);
+            break;
+
+        /* Only print the totals */
+        case 'q':
+            quiet = 1;
+            break;
+
+        /* How long each jail gets */
+        case 't':
+            timeout = atol(optarg) * 1000L;
+            if(timeout <= 0)
+                errx(2, "invalid timeout argument: %s", optarg);
+            break;
+
+        case '?':
+        default:
+            usage();
+        }
+    }
+
+    argc -= optind;
+    argv += optind;
+
+    if(all && pattern)
+        usage();
+
+    /* Without -a or -g the jails come first */
+    if(argc < ((all || pattern) ? 1 : 2))
+        usage();
+
+    if(!have_privileges())
+        errx(1, "must be run as root");
+
+    if(running_in_jail() != 0)
+        errx(1, "can't run from inside jail");
+
+    if(argv[(all || pattern) ? 0 : 1][0] != '/')
+        errx(2, "the command must be a full path: %s", argv[(all || pattern) ? 0 : 1]);
+
+    jails_load(&jls);
+    count = select_jails(&jls, all, pattern, (all || pattern) ? NULL : argv[0], &list);
+    jails_done(&jls);
+
+    if(!all && !pattern)
+        argv++;
+
+    /* How long each took to start, as seen from the children */
+    spawns = (long*)mmap(NULL, sizeof(long) * count, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_ANON, -1, 0);
+    if(spawns == MAP_FAILED)
+        err(1, "couldn't allocate memory");
+
+    for(i = 0; i < count; i++)
+    {
+        spawns[i] = 0;
+        list[i].spawn = spawns + i;
+    }
+
+    begin = now_msecs();
+
+    while(done < count)
+    {
+        /* Start as many as we're allowed */
+        for(i = 0; i < count && running < jobs; i++)
+        {
+            rs = list + i;
+            if(rs->state != RUN_PENDING)
+                continue;
+
+            fflush(stdout);
+            rs->started = now_msecs();
+
+            switch(rs->pid = fork())
+            {
+            case -1:
+                err(1, "couldn't fork");
+
+            case 0:
+                run_in_jail(rs, argv);
+                break;
+            }
+
+            rs->state = RUN_RUNNING;
+            running++;
+        }
+
+        /* Deadlines need looking at every so often, otherwise just wait */
+        if(timeout)
+        {
+            pid = waitpid(-1, &status, WNOHANG);
+            if(pid == 0)
+            {
+                now = now_msecs();
+
+                for(i = 0; i < count; i++)
+                {
+                    rs = list + i;
+                    if(rs->state != RUN_RUNNING)
+                        continue;
+
+                    /* The whole process group, that's the command too */
+                    if(rs->killed == 0 && now - rs->started >= timeout)
+                    {
+                        kill(-rs->pid, SIGTERM);
+                        rs->killed = 1;
+                    }
+                    else if(rs->killed == 1 && now - rs->started >= timeout + KILL_GRACE)
+                    {
+                        kill(-rs->pid, SIGKILL);
+                        rs->killed = 2;
+                    }
+                }
+
+                usleep(DEADLINE_TICK * 1000);
+                continue;
+            }
+        }
+        else
+        {
+            pid = wait(&status);
+        }
+
+        if(pid == -1)
+            err(1, "couldn't wait for jail");
+
+        for(i = 0; i < count; i++)
+        {
+            if(list[i].state == RUN_RUNNING && list[i].pid == pid)
+                break;
+        }
+
+        /* Not one of ours */
+        if(i == count)
+            continue;
+
+        rs = list + i;
+        rs->state = RUN_DONE;
+        rs->msecs = now_msecs() - rs->started;
+        rs->status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+        running--;
+        done++;
+    }
+
+    fflush(stdout);
+
+    /* In the order they were given, once all the output is out of the way */
+    for(i = 0; i < count; i++)
+    {
+        rs = list + i;
+
+        if(rs->killed)
+            timedout++;
+        else if(rs->status == 0)
+            ok++;
+        else
+            failed++;
+
+        if(!quiet)
+            print_result(rs);
+    }
+
+    printf("%d jails, %d ok, %d failed, %d timed out in %ldms\n",
+           count, ok, failed, timedout, now_msecs() - begin);
+
+    munmap(spawns, sizeof(long) * count);
+    free(list);
+    return (ok == count && count > 0) ? 0 : 1;
+}
+
+static long now_msecs()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+static run_state* add_jail(run_state** list, int* count, const jail_info* ji)
+{
+    run_state* rs;
+
+    *list = (run_state*)realloc(*list, sizeof(run_state) * (*count + 1));
+    if(*list == NULL)
+        errx(1, "out of memory");
+
+    rs = *list + (*count)++;
+    memset(rs, 0, sizeof(*rs));
+    rs->jail = *ji;
+    return rs;
+}
+
+static int select_jails(jails* jls, int all, const char* pattern,
+                        char* names, run_state** list)
+{
+    jail_info* ji;
+    char* name;
+    int count = 0;
+
+    *list = NULL;
+
+    if(names == NULL)
+    {
+        while((ji = jails_next(jls)) != NULL)
+        {
+            if(all || fnmatch(pattern, ji->host, 0) == 0)
+                add_jail(list, &count, ji);
+        }
+
+        if(count == 0)
+            errx(1, all ? "no jails running" : "no jails match: %s", pattern);
+
+        return count;
+    }
+
+    for(name = strtok(names, ","); name; name = strtok(NULL, ","))
+    {
+        ji = jails_find(jls, name);
+        if(ji == NULL)
+            errx(1, "unknown jail host name: %s", name);
+        add_jail(list, &count, ji);
+    }
+
+    return count;
+}
+
+/* In the child, never returns */
+static void run_in_jail(run_state* rs, char* argv[])
+{
+    int status;
+    int r;
+
+    /*
+     * So that a deadline takes out the command along with us. We only
+     * go when it does, or at SIGKILL if it won't.
+     */
+    setpgid(0, 0);
+
+    /* Even the init's socket is only looked for from inside the jail */
+    if(jail_backend_get()->attach(&rs->jail) == -1)
+    {
+        warn("%s: couldn't attach to jail", rs->jail.host);
+        exit(EXIT_NOATTACH);
+    }
+
+    /*
+     * The init is already in the jail, with the command's environment
+     * set up. Here a deadline only needs to take us out, the init sees
+     * us go and does the rest.
+     */
+    if(g_agent)
+    {
+        r = init_run(rs->jail.host, argv, &status, rs->spawn);
+        if(r == 1)
+            exit(WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status));
+
+        if(r == 0)
+        {
+            warnx("%s: the jail's init went away", rs->jail.host);
+            exit(EXIT_NOATTACH);
+        }
+    }
+
+    ignore_signals();
+
+    if(!check_jail_command(rs->jail.host, argv[0]))
+        exit(EXIT_NOCOMMAND);
+
+    /* Whole lines go out in one write, so jails don't get mixed up */
+    prefix_jail_output(rs->jail.host);
+    run_jail_command(rs->jail.host, argv[0], argv, JAIL_RUN_STDOUT);
+
+    status = jail_command_status();
+    exit(WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status));
+}
+
+static void print_result(run_state* rs)
+{
+    if(rs->killed)
+        printf("%s: timed out after %ldms\n", rs->jail.host, rs->msecs);
+    else if(rs->status == EXIT_NOATTACH)
+        printf("%s: couldn't attach after %ldms\n", rs->jail.host, rs->msecs);
+    else if(rs->status == EXIT_NOCOMMAND)
+        printf("%s: couldn't run command after %ldms\n", rs->jail.host, rs->msecs);
+    else if(*rs->spawn)
+        printf("%s: exited with %d after %ldms, started in %ldus\n", rs->jail.host,
+               rs->status, rs->msecs, *rs->spawn);
+    else
+        printf("%s: exited with %d after %ldms\n", rs->jail.host, rs->status, rs->msecs);
+}
+
+static void usage()
+{
+    fprintf(stderr, "usage: jrun [-Iq] [-j jobs] [-t timeout] jail[,jail...] command [arg ...]\n");
+    fprintf(stderr, "       jrun [-Iq] [-j jobs] [-t timeout] -a command [arg ...]\n");
+    fprintf(stderr, "       jrun [-Iq] [-j jobs] [-t timeout] -g pattern command [arg ...]\n");
+    exit(2);
+}
@@ -43,8 +43,8 @@
 
 #include <sys/types.h>
 #include <sys/param.h>
-#include <sys/jail.h>
 #include <sys/socket.h>
+#include <sys/wait.h>
 
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -57,155 +57,173 @@
 #include <unistd.h>
 #include <limits.h>
 #include <string.h>
+#include <time.h>
 
 #include "util.h"
+#include "jailutils.h"
+#include "backend.h"
+#include "manifest.h"
+#include "provision.h"
+#include "hostload.h"
+#include "ready.h"
+#include "start.h"
 
 #ifdef HAVE_CONFIG_H
 #include "../config.h"
 #endif
 
-#define START_SCRIPT "/etc/rc"
-static char* START_ARGS[] = { _PATH_BSHELL, START_SCRIPT, NULL };
+/* How many jails to start at once from a manifest */
+#define DEFAULT_JOBS 8
 
-static void usage();
+/* How often to look at the host again, while jails wait to start */
+#define ADMIT_INTERVAL 50
 
-/* Jail structure with multi address patch */
-#if defined(JAIL_MULTIPATCH)
+/* Where a jail from the manifest is at */
+#define STATE_PENDING   0
+#define STATE_QUEUED    1
+#define STATE_RUNNING   2
+#define STATE_STARTED   3
+#define STATE_FAILED    4
+#define STATE_SKIPPED   5
 
-static void allocate_address(char* arg, struct jail* j)
+typedef struct start_state
 {
-    struct in_addr in;
-    char *ip;
-    int i = 0;
+    int state;
+    pid_t pid;
+    struct timespec start;
+    long queued;                /* When it was queued, then for how long */
+    long eligible;              /* Not before this, with jitter */
+}
+start_state;
 
-    /* Count number of ips */
-    for(i = 1, ip = arg; *ip; ip++)
-    {
-        if(*ip == ',')
-            i++;
-    }
+/* Host load per CPU to admit more jails below, 0 to not look */
+static double g_runnable = 0;
+static double g_blocked = 0;
 
-    /* Allocate memory */
-    if((j->ips = (u_int32_t*)malloc(sizeof(u_int32_t) * i)) == NULL)
-        errx(1, "out of memory");
+/* Up to this many milliseconds random delay before each jail */
+static long g_jitter = 0;
 
-    for(i = 0, ip = strtok(arg, ","); ip; i++, ip = strtok(NULL, ","))
-    {
-        if(inet_aton(ip, &in) == 0)
-            errx(1, "invalid ip address: %s", ip);
-        j->ips[i] = ntohl(in.s_addr);
-    }
+static int start_manifest(const char* file, int jobs, int printjid, int opts);
+static int compile_manifest(const char* file);
 
-    j->nips = i;
-    j->version = 1;
-}
+static void usage();
 
-static void free_address(struct jail* j)
+int jstart_main(int argc, char* argv[])
 {
-    free(j->ips);
-}
+    int ch;
+    int printjid = 0;
+    int jobs = DEFAULT_JOBS;
+    int verbose = 0;
+    int compile = 0;
+    int ret;
+    char* file = NULL;
+    char* t;
+    jail_spec j;
+
+    while((ch = getopt(argc, argv, "A:cf:iIj:J:l:L:M:p:P:R:ST:vw:W:")) != -1)
+    {
+        switch(ch)
+        {
+        /* Only start more jails while the host isn't too busy */
+        case 'A':
+            g_runnable = strtod(optarg, &t);
+            g_blocked = (*t == ',') ? strtod(t + 1, &t) : g_runnable;
+            if(*t || g_runnable <= 0 || g_blocked <= 0)
+                errx(1, "invalid host load: %s", optarg);
+            break;
 
-/* Jail structure with multi address (FreeBSD 7.2+) */
-#elif defined(JAIL_MULTIADDR)
+        /* Only compile the manifest */
+        case 'c':
+            compile = 1;
+            break;
 
-static void add_addresses(struct jail *j, struct addrinfo *all)
-{
-    struct addrinfo *res;
-    void *mem;
+        /* Start all the jails in a manifest */
+        case 'f':
+            file = optarg;
+            break;
 
-    for(res = all; res; res = res->ai_next)
-    {
-        switch(res->ai_family)
-        {
-        case AF_INET:
-            j->ip4 = realloc(j->ip4, sizeof (*(j->ip4)) * (j->ip4s + 1));
-            if(j->ip4 == NULL)
-                errx(1, "out of memory");
-            memcpy(j->ip4 + j->ip4s, &((struct sockaddr_in*)res->ai_addr)->sin_addr, sizeof (*(j->ip4)));
-            ++j->ip4s;
+        case 'i':
+            printjid = 1;
             break;
-#ifdef HAVE_INET6
-        case AF_INET6:
-            j->ip6 = realloc(j->ip6, sizeof (*(j->ip6)) * (j->ip6s + 1));
-            if(j->ip6 == NULL)
-                errx(1, "out of memory");
-            memcpy(j->ip6 + j->ip6s, &((struct sockaddr_in6*)res->ai_addr)->sin6_addr, sizeof (*(j->ip6)));
-            ++j->ip6s;
+
+        /* Run an init in the jail to reap and stop it */
+        case 'I':
+            g_init = 1;
             break;
-#endif /* HAVE_INET6 */
-        default:
-            errx(1, "Address family %d not supported", res->ai_family);
-        }
-    }
-}
 
-static void allocate_address(char* arg, struct jail* j)
-{
-    struct addrinfo hints, *res;
-    struct in_addr in;
-    char *ip;
-    int error, i = 0;
-
-    j->version = JAIL_API_VERSION;
-    j->ip4s = j->ip6s = 0;
-    j->ip4 = NULL;
-    j->ip6 = NULL;
-
-    memset(&hints, 0, sizeof(hints));
-    hints.ai_protocol = IPPROTO_TCP;
-    hints.ai_socktype = SOCK_STREAM;
-    hints.ai_family = PF_UNSPEC;
-    hints.ai_flags = AI_NUMERICHOST;
-
-    for(i = 0, ip = strtok(arg, ","); ip; i++, ip = strtok(NULL, ","))
-    {
-        error = getaddrinfo(ip, NULL, &hints, &res);
-        if(error != 0)
-            errx(1, "invalid ip address: %s", ip);
-        add_addresses(j, res);
-        freeaddrinfo(res);
-    }
-}
+        case 'j':
+            jobs = atoi(optarg);
+            if(jobs <= 0)
+                errx(1, "invalid number of jobs: %s", optarg);
+            break;
 
-static void free_address(struct jail* j)
-{
-    free(j->ip4);
-    free(j->ip6);
-}
+        /* Spread out the jails' starts a little */
+        case 'J':
+            g_jitter = atol(optarg);
+            if(g_jitter <= 0)
+                errx(1, "invalid jitter: %s", optarg);
+            break;
 
-/* No jail multi addrs */
-#else
+        /* Limit the jail with a profile */
+        case 'l':
+            g_profile = optarg;
+            break;
 
-static void allocate_address(char* arg, struct jail* j)
-{
-    struct in_addr in;
+        /* Where the profiles are */
+        case 'L':
+            g_profiles = optarg;
+            break;
 
-    if(inet_aton(arg, &in) != 1)
-        errx(1, "invalid ip address: %s", arg);
-    j->ip_number = ntohl(in.s_addr);
-    j->version = 0;
-}
+        /* How to provision from the template */
+        case 'M':
+            g_provision = provision_method(optarg);
+            if(g_provision == -1)
+                errx(1, "invalid provisioning method: %s", optarg);
+            break;
 
-static void free_address(struct jail* j)
-{
-    /* Nothing to do */
-}
+        /* Pin the jail to some CPUs */
+        case 'p':
+            g_place = optarg;
+            break;
 
-#endif /* !JAIL_MULTIPATCH */
+        /* Run the rc.d scripts ourselves, several at a time */
+        case 'P':
+            g_rcwidth = atoi(optarg);
+            if(g_rcwidth <= 0)
+                errx(1, "invalid number of rc.d scripts: %s", optarg);
+            break;
 
+        /* Build the jail directory from a template */
+        case 'R':
+            g_template = optarg;
+            break;
 
-int main(int argc, char* argv[])
-{
-    int ch, jid;
-    struct jail j;
-    int printjid = 0;
+        /* Restart the jail's command when it exits */
+        case 'S':
+            g_supervise = 1;
+            g_init = 1;
+            break;
 
-    while((ch = getopt(argc, argv, "i")) != -1)
-    {
-        switch(ch)
-        {
-        case 'i':
-            printjid = 1;
+        /* Trace each line of output, and how long services take */
+        case 'T':
+            g_trace = optarg;
+            break;
+
+        /* Show the output from every jail when starting many */
+        case 'v':
+            verbose = 1;
+            break;
+
+        /* Wait until the jail is actually ready */
+        case 'w':
+            ready_add(optarg);
+            break;
+
+        /* But not forever */
+        case 'W':
+            g_readywait = atoi(optarg);
+            if(g_readywait <= 0)
+                errx(1, "invalid time to wait: %s", optarg);
             break;
 
         case '?':
@@ -217,65 +235,334 @@ int main(int argc, char* argv[])
     argc -= optind;
     argv += optind;
 
-    if(argc < 3)
+    if(file ? argc != 0 : argc < 3 || compile)
         usage();
 
-    if(getuid() != 0)
+    /* Otherwise it's rc, which starts things and exits */
+    if(g_supervise && !file && argc < 4)
+        errx(1, "nothing to supervise without a command");
+
+    if(compile)
+        return compile_manifest(file);
+
+    if(!have_privileges())
         errx(1, "must be run as root");
 
-    if(chdir(argv[0]) != 0)
-        err(1, "couldn't change to jail directory: %s", argv[0]);
+    /* Output from lots of jails at once would be a jumble */
+    if(file)
+        return start_manifest(file, jobs, printjid, JAIL_RUN_CONSOLE |
+                              (verbose ? JAIL_RUN_STDOUT : 0));
 
     memset(&j, 0, sizeof(j));
     j.path = argv[0];
     j.hostname = argv[1];
+    jail_addresses(argv[2], &j);
+
+    ret = start_jail(&j, argc > 3 ? argv + 3 : NULL, printjid ? 1 : 0,
+                     JAIL_RUN_CONSOLE | JAIL_RUN_STDOUT);
 
-    allocate_address(argv[2], &j);
+    jail_addresses_free(&j);
+    return ret;
+}
+
+static long elapsed_msecs(struct timespec* start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000L +
+           (now.tv_nsec - start->tv_nsec) / 1000000L;
+}
+
+/* Admit another jail when the host is no busier than this, per CPU */
+static int host_ready(host_load* smooth)
+{
+    host_load now;
+
+    if(g_runnable == 0 || host_load_sample(&now) == -1)
+        return 1;
 
-    /* Here's where we actually go into the jail */
-    jid = jail(&j);
-    if(jid == -1)
-        err(1, "couldn't create jail");
+    /* Evened out a little, one look can catch a spike */
+    smooth->runnable = (smooth->runnable + now.runnable) / 2;
+    smooth->blocked = (smooth->blocked + now.blocked) / 2;
 
-    free_address(&j);
+    return smooth->runnable <= g_runnable && smooth->blocked <= g_blocked;
+}
+
+/* The next jail to start: the highest priority, then manifest order */
+static size_t next_admit(manifest* mf, start_state* states, long now)
+{
+    size_t i, best = mf->count;
 
-    if(printjid)
+    for(i = 0; i < mf->count; i++)
     {
-        printf("%d\n", jid);
-        fflush(stdout);
+        if(states[i].state != STATE_QUEUED || states[i].eligible > now)
+            continue;
+
+        if(best == mf->count || mf->entries[i].priority < mf->entries[best].priority)
+            best = i;
     }
 
-    argc -= 3;
-    argv += 3;
+    return best;
+}
 
-    if(argc == 0)
-    {
-        if(!check_jail_command(NULL, START_SCRIPT))
-            exit(1);
+/*
+ * Start every jail in the manifest, each in its own process. A jail
+ * waits until the jails it depends on have finished starting. When
+ * one of those fails, it isn't started at all.
+ *
+ * Once it can start a jail is queued, and admitted when there's a
+ * free job and the host isn't too busy. With nothing starting at all
+ * the next jail is admitted regardless, so a host that's busy with
+ * other things still gets its jails.
+ */
+static int start_manifest(const char* file, int jobs, int printjid, int opts)
+{
+    manifest mf;
+    jail_entry* je;
+    jail_spec spec;
+    start_state* states;
+    start_state* st;
+    struct timespec begin;
+    host_load load;
+    size_t i, k, done = 0;
+    size_t counts[STATE_SKIPPED + 1];
+    long now, queued, queuedmax = 0, queuedall = 0;
+    int running = 0, waiting;
+    int progress, ready, status;
+    pid_t pid;
+
+    manifest_open(file, &mf);
+
+    states = (start_state*)calloc(mf.count + 1, sizeof(start_state));
+    if(states == NULL)
+        errx(1, "out of memory");
 
-        run_jail_command(NULL, START_ARGS[0], START_ARGS,
-                         JAIL_RUN_CONSOLE | JAIL_RUN_STDOUT);
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    srandom((unsigned int)(begin.tv_nsec ^ getpid()));
+    memset(&load, 0, sizeof(load));
+
+    if(g_runnable != 0 && host_load_sample(&load) == -1)
+    {
+        warn("can't tell how busy the host is, not waiting for it");
+        g_runnable = 0;
     }
 
-    else
+    while(done < mf.count)
     {
-        if(!check_jail_command(NULL, argv[0]))
-            exit(1);
+        progress = 0;
+        now = elapsed_msecs(&begin);
+
+        /* Queue up the jails whose dependencies are done */
+        for(i = 0; i < mf.count; i++)
+        {
+            je = mf.entries + i;
+            st = states + i;
+
+            if(st->state != STATE_PENDING)
+                continue;
+
+            ready = 1;
+
+            for(k = 0; k < je->ndepends; k++)
+            {
+                switch(states[je->depends[k]].state)
+                {
+                case STATE_STARTED:
+                    break;
+
+                case STATE_FAILED:
+                case STATE_SKIPPED:
+                    st->state = STATE_SKIPPED;
+                    warnx("%s: not started, %s didn't start", je->hostname,
+                          mf.entries[je->depends[k]].hostname);
+                    /* fall through */
+
+                default:
+                    ready = 0;
+                    break;
+                }
+
+                if(!ready)
+                    break;
+            }
+
+            if(st->state == STATE_SKIPPED)
+            {
+                done++;
+                progress = 1;
+                continue;
+            }
+
+            if(!ready)
+                continue;
+
+            st->state = STATE_QUEUED;
+            st->queued = now;
+            st->eligible = now + (g_jitter ? random() % (g_jitter + 1) : 0);
+            progress = 1;
+        }
+
+        /* And start as many of those as we're allowed */
+        while(running < jobs)
+        {
+            i = next_admit(&mf, states, now);
+            if(i == mf.count || (running > 0 && !host_ready(&load)))
+                break;
+
+            je = mf.entries + i;
+            st = states + i;
+
+            fflush(stdout);
+            clock_gettime(CLOCK_MONOTONIC, &st->start);
+            st->queued = elapsed_msecs(&begin) - st->queued;
+
+            switch(pid = fork())
+            {
+            case -1:
+                err(1, "couldn't fork");
+
+            case 0:
+                memset(&spec, 0, sizeof(spec));
+                spec.path = je->path;
+                spec.hostname = je->hostname;
+                spec.ip4 = je->ip4;
+                spec.ip4s = je->ip4s;
+                spec.ip6 = je->ip6;
+                spec.ip6s = je->ip6s;
+
+                exit(start_jail(&spec, je->argv, printjid ? 2 : 0, opts));
+
+            default:
+                st->pid = pid;
+                st->state = STATE_RUNNING;
+                running++;
+                progress = 1;
+                break;
+            }
+        }
 
-        run_jail_command(NULL, argv[0], argv,
-                         JAIL_RUN_CONSOLE | JAIL_RUN_STDOUT);
+        for(i = 0, waiting = 0; i < mf.count; i++)
+            waiting += (states[i].state == STATE_QUEUED);
+
+        if(running == 0 && !waiting)
+        {
+            if(progress)
+                continue;
+
+            /* Nothing running, and nothing can run */
+            for(i = 0; i < mf.count; i++)
+            {
+                if(states[i].state == STATE_PENDING)
+                {
+                    states[i].state = STATE_SKIPPED;
+                    warnx("%s: not started, dependency loop", mf.entries[i].hostname);
+                    done++;
+                }
+            }
+
+            break;
+        }
+
+        /* Jails waiting their turn need another look every so often */
+        if(waiting)
+        {
+            pid = running ? waitpid(-1, &status, WNOHANG) : 0;
+            if(pid == 0)
+            {
+                usleep(ADMIT_INTERVAL * 1000);
+                continue;
+            }
+        }
+        else
+        {
+            pid = wait(&status);
+        }
+
+        if(pid == -1)
+            err(1, "couldn't wait for jail");
+
+        for(i = 0; i < mf.count; i++)
+        {
+            if(states[i].state == STATE_RUNNING && states[i].pid == pid)
+                break;
+        }
+
+        /* Not one of ours */
+        if(i == mf.count)
+            continue;
+
+        je = mf.entries + i;
+        st = states + i;
+        running--;
+        done++;
+
+        queued = st->queued;
+        queuedall += queued;
+        if(queued > queuedmax)
+            queuedmax = queued;
+
+        if(WIFEXITED(status) && WEXITSTATUS(status) == 0)
+        {
+            st->state = STATE_STARTED;
+            printf("%s: started in %ldms, queued %ldms\n", je->hostname,
+                   elapsed_msecs(&st->start), queued);
+        }
+        else
+        {
+            st->state = STATE_FAILED;
+            warnx("%s: failed to start after %ldms, queued %ldms", je->hostname,
+                  elapsed_msecs(&st->start), queued);
+        }
+
+        fflush(stdout);
     }
 
+    memset(counts, 0, sizeof(counts));
+    for(i = 0; i < mf.count; i++)
+        counts[states[i].state]++;
+
+    printf("%u started, %u failed, %u skipped in %ldms\n",
+           (unsigned int)counts[STATE_STARTED], (unsigned int)counts[STATE_FAILED],
+           (unsigned int)counts[STATE_SKIPPED], elapsed_msecs(&begin));
+
+    k = counts[STATE_STARTED] + counts[STATE_FAILED];
+    if(k > 0)
+        printf("queued %ldms on average, %ldms at most\n",
+               queuedall / (long)k, queuedmax);
+
+    free(states);
+    manifest_done(&mf);
+
+    return counts[STATE_STARTED] == mf.count ? 0 : 1;
+}
+
+/* Parse the manifest and write out its compiled image */
+static int compile_manifest(const char* file)
+{
+    char image[MAXPATHLEN];
+    manifest mf;
+
+    snprintf(image, sizeof(image), "%s%s", file, MANIFEST_CACHE_SUFFIX);
+
+    manifest_load(file, &mf);
+
+    if(manifest_compile(&mf, image) == -1)
+        err(1, "couldn't write compiled manifest: %s", image);
+
+    manifest_done(&mf);
     return 0;
 }
 
 static void usage()
 {
 #ifdef JAIL_MULTIPATCH
-    fprintf(stderr, "usage: jstart [-i] path hostname ip[,ip...] [command ...]\n");
+    fprintf(stderr, "usage: jstart [-iI] [-l profile] [-L profiles] [-M method] [-p placement] [-P width] [-R template] [-S] [-T trace] [-w check] [-W wait] path hostname ip[,ip...] [command ...]\n");
 #else
-    fprintf(stderr, "usage: jstart [-i] path hostname ip-number [command ...]\n");
+    fprintf(stderr, "usage: jstart [-iI] [-l profile] [-L profiles] [-M method] [-p placement] [-P width] [-R template] [-S] [-T trace] [-w check] [-W wait] path hostname ip-number [command ...]\n");
 #endif
+    fprintf(stderr, "       jstart [-iIv] [-A load] [-j jobs] [-J jitter] [-l profile] [-L profiles] [-M method] [-p placement] [-P width] [-R template] [-S] [-T trace] [-w check] [-W wait] -f manifest\n");
+    fprintf(stderr, "       jstart -c -f manifest\n");
     exit(2);
 }
 
@@ -0,0 +1,734 @@
+/*
+ * Copyright (c) 2004, Stef Walter
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above
+ *       copyright notice, this list of conditions and the
+ *       following disclaimer.
+ *     * Redistributions in binary form must reproduce the
+ *       above copyright notice, this list of conditions and
+ *       the following disclaimer in the documentation and/or
+ *       other materials provided with the distribution.
+ *     * The names of contributors to this software may not be
+ *       used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ *
+ *
+ * CONTRIBUTORS
+ *  Stef Walter <stef@memberwebs.com>
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <err.h>
+
+#include "util.h"
+#include "backend.h"
+#include "manifest.h"
+
+#ifdef HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+/*
+ * A compiled image is a header, then the entries, the addresses,
+ * the depends and argv indexes, the address files and the strings,
+ * each section 8 byte aligned. Everything is in host byte order, an image from another
+ * machine fails the magic check and gets rebuilt.
+ */
+
+#define IMAGE_MAGIC     0x4a4d4631      /* JMF1 */
+#define IMAGE_VERSION   3
+
+#define IMAGE_ALIGN(x)  (((x) + 7) & ~((size_t)7))
+
+typedef struct image_header
+{
+    u_int32_t magic;
+    u_int32_t version;
+    u_int64_t length;           /* Of the whole image */
+
+    /* The source it was compiled from */
+    u_int64_t mtime;
+    u_int64_t size;
+    u_int64_t hash;
+
+    /* Offset and number of items in each section */
+    u_int32_t entries;
+    u_int32_t nentries;
+    u_int32_t ip4;
+    u_int32_t nip4;
+    u_int32_t ip6;
+    u_int32_t nip6;
+    u_int32_t indexes;
+    u_int32_t nindexes;
+    u_int32_t sources;
+    u_int32_t nsources;
+    u_int32_t strings;
+    u_int32_t nstrings;         /* In bytes */
+}
+image_header;
+
+typedef struct image_entry
+{
+    u_int32_t path;             /* Offsets into the strings */
+    u_int32_t hostname;
+    u_int32_t ip4;              /* First address, and how many */
+    u_int32_t ip4s;
+    u_int32_t ip6;
+    u_int32_t ip6s;
+    u_int32_t depends;          /* First index, and how many */
+    u_int32_t ndepends;
+    u_int32_t argv;             /* First index of the string offsets */
+    u_int32_t argc;             /* 0 for /etc/rc */
+    u_int32_t priority;
+    u_int32_t line;
+}
+image_entry;
+
+typedef struct image_source
+{
+    u_int64_t mtime;
+    u_int64_t size;
+    u_int32_t path;             /* Offset into the strings */
+    u_int32_t unused;
+}
+image_source;
+
+/* FNV-1a, the image is rebuilt when this changes */
+static u_int64_t hash_data(const char* data, size_t len)
+{
+    u_int64_t hash = 14695981039346656037ULL;
+    size_t i;
+
+    for(i = 0; i < len; i++)
+    {
+        hash ^= (unsigned char)data[i];
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+/* Whole seconds miss a quick edit that keeps the size */
+static u_int64_t file_mtime(const struct stat* sb)
+{
+    return (u_int64_t)sb->st_mtim.tv_sec * 1000000000ULL + sb->st_mtim.tv_nsec;
+}
+
+/* Remember an @file, before it's read so a change after still shows */
+static void add_source(manifest* mf, const char* file, int lineno,
+                       const char* path)
+{
+    manifest_source* src;
+    struct stat sb;
+    size_t i;
+
+    /* Some files are shared by lots of jails */
+    for(i = 0; i < mf->nsources; i++)
+    {
+        if(strcmp(mf->sources[i].path, path) == 0)
+            return;
+    }
+
+    if(stat(path, &sb) == -1)
+        err(1, "%s:%d: couldn't open address file: %s", file, lineno, path);
+
+    src = (manifest_source*)realloc(mf->sources,
+                                    (mf->nsources + 1) * sizeof(manifest_source));
+    if(src == NULL)
+        errx(1, "out of memory");
+
+    mf->sources = src;
+    src += mf->nsources++;
+    src->path = path;
+    src->mtime = file_mtime(&sb);
+    src->size = sb.st_size;
+}
+
+/* Reads the whole file, with a terminating null */
+static char* read_file(const char* file, struct stat* sb, size_t* len)
+{
+    char* data;
+    FILE* f;
+
+    if((f = fopen(file, "r")) == NULL)
+        err(1, "couldn't open manifest: %s", file);
+
+    if(fstat(fileno(f), sb) == -1)
+        err(1, "couldn't stat manifest: %s", file);
+
+    if((data = (char*)malloc(sb->st_size + 1)) == NULL)
+        errx(1, "out of memory");
+
+    *len = fread(data, 1, sb->st_size, f);
+    if(ferror(f))
+        err(1, "couldn't read manifest: %s", file);
+
+    fclose(f);
+    data[*len] = 0;
+    return data;
+}
+
+/*
+ * Split off the next whitespace separated word, in place. A word
+ * in double quotes can contain spaces.
+ */
+static char* next_word(char** p)
+{
+    char* word;
+
+    while(**p && isspace((unsigned char)**p))
+        (*p)++;
+
+    if(!**p)
+        return NULL;
+
+    if(**p == '"')
+    {
+        word = ++(*p);
+
+        while(**p && **p != '"')
+            (*p)++;
+
+        if(**p)
+            *(*p)++ = 0;
+
+        return word;
+    }
+
+    word = *p;
+
+    while(**p && !isspace((unsigned char)**p))
+        (*p)++;
+
+    if(**p)
+        *(*p)++ = 0;
+
+    return word;
+}
+
+void manifest_open(const char* file, manifest* mf)
+{
+    char image[MAXPATHLEN];
+
+    snprintf(image, sizeof(image), "%s%s", file, MANIFEST_CACHE_SUFFIX);
+
+    if(manifest_map(file, image, mf) == 0)
+    {
+        /* Touched but not changed, save hashing it next time */
+        if(mf->mtime != ((image_header*)mf->image)->mtime)
+            manifest_compile(mf, image);
+        return;
+    }
+
+    manifest_load(file, mf);
+
+    /* Not being able to write it just means parsing again next time */
+    manifest_compile(mf, image);
+}
+
+void manifest_load(const char* file, manifest* mf)
+{
+    struct stat sb;
+    jail_spec spec;
+    jail_entry* je;
+    jail_entry* dep;
+    char** names;
+    char** strs;
+    u_int32_t* idx;
+    char* line;
+    char* next;
+    char* word;
+    char* deps;
+    char* addresses;
+    size_t len, nlines, nwords, i, j;
+    int lineno;
+
+    memset(mf, 0, sizeof(*mf));
+
+    mf->data = read_file(file, &sb, &len);
+    mf->mtime = sb.st_mtime;
+    mf->size = len;
+    mf->hash = hash_data(mf->data, len);
+
+    /*
+     * Size everything up front. Each word takes at least two bytes,
+     * and each line has two lists to terminate.
+     */
+    for(i = 0, nlines = 1; i < len; i++)
+    {
+        if(mf->data[i] == '\n')
+            nlines++;
+    }
+
+    nwords = (len + 1) / 2 + nlines * 2 + 1;
+
+    mf->entries = (jail_entry*)calloc(nlines, sizeof(jail_entry));
+    mf->strings = (char**)calloc(nwords, sizeof(char*));
+    mf->indexes = (u_int32_t*)calloc(nwords, sizeof(u_int32_t));
+    names = (char**)calloc(nwords, sizeof(char*));
+    if(!mf->entries || !mf->strings || !mf->indexes || !names)
+        errx(1, "out of memory");
+
+    strs = mf->strings;
+    idx = mf->indexes;
+
+    for(line = mf->data, lineno = 1; line; line = next, lineno++)
+    {
+        if((next = strchr(line, '\n')) != NULL)
+            *next++ = 0;
+
+        word = next_word(&line);
+        if(word == NULL || word[0] == '#')
+            continue;
+
+        je = mf->entries + mf->count;
+        je->line = lineno;
+        je->path = word;
+        je->hostname = next_word(&line);
+        addresses = next_word(&line);
+
+        if((deps = next_word(&line)) == NULL)
+            errx(1, "%s:%d: expected path, hostname, addresses and depends",
+                 file, lineno);
+
+        /* Stdin is gone by the time the image is used again */
+        if(addresses[0] == '@')
+        {
+            if(strcmp(addresses, "@-") == 0)
+                errx(1, "%s:%d: addresses can't come from stdin in a manifest",
+                     file, lineno);
+            add_source(mf, file, lineno, addresses + 1);
+        }
+
+        memset(&spec, 0, sizeof(spec));
+        jail_addresses(addresses, &spec);
+        je->ip4 = spec.ip4;
+        je->ip4s = spec.ip4s;
+        je->ip6 = spec.ip6;
+        je->ip6s = spec.ip6s;
+
+        /* Names for now, they're turned into indexes below */
+        je->depends = idx;
+        je->priority = PRIORITY_NORMAL;
+
+        if(strcmp(deps, "-") != 0)
+        {
+            while((word = strsep(&deps, ",")) != NULL)
+            {
+                if(word[0] == '@')
+                {
+                    if(strcmp(word, "@high") == 0)
+                        je->priority = PRIORITY_HIGH;
+                    else if(strcmp(word, "@low") == 0)
+                        je->priority = PRIORITY_LOW;
+                    else if(strcmp(word, "@normal") != 0)
+                        errx(1, "%s:%d: unknown priority class: %s",
+                             file, lineno, word);
+                }
+                else if(*word)
+                {
+                    names[idx - mf->indexes] = word;
+                    idx++;
+                    je->ndepends++;
+                }
+            }
+        }
+
+        /* The rest of the line is the command */
+        if((word = next_word(&line)) != NULL)
+        {
+            je->argv = strs;
+
+            do
+                *strs++ = word;
+            while((word = next_word(&line)) != NULL);
+
+            *strs++ = NULL;
+        }
+
+        mf->count++;
+    }
+
+    /* Check the hostnames and dependencies make sense */
+    for(i = 0; i < mf->count; i++)
+    {
+        je = mf->entries + i;
+
+        for(j = 0; j < i; j++)
+        {
+            if(strcmp(mf->entries[j].hostname, je->hostname) == 0)
+                errx(1, "%s:%d: jail already listed on line %d: %s", file,
+                     je->line, mf->entries[j].line, je->hostname);
+        }
+
+        for(j = 0; j < je->ndepends; j++)
+        {
+            idx = (u_int32_t*)je->depends + j;
+            word = names[idx - mf->indexes];
+
+            if(strcmp(word, je->hostname) == 0)
+                errx(1, "%s:%d: jail depends on itself: %s", file,
+                     je->line, je->hostname);
+
+            if((dep = manifest_find(mf, word)) == NULL)
+                errx(1, "%s:%d: unknown jail in depends: %s", file,
+                     je->line, word);
+
+            *idx = dep - mf->entries;
+        }
+    }
+
+    free(names);
+}
+
+/* Copy a string into the image, returning its offset */
+static u_int32_t put_string(char** str, char* strings, const char* s)
+{
+    size_t len = strlen(s) + 1;
+    char* at = *str;
+
+    memcpy(at, s, len);
+    *str += len;
+    return at - strings;
+}
+
+int manifest_compile(manifest* mf, const char* image)
+{
+    image_header hdr;
+    image_entry* ie;
+    image_source* is;
+    jail_entry* je;
+    char tmp[MAXPATHLEN];
+    char* buf;
+    char* str;
+    u_int32_t* idx;
+    struct in_addr* ip4;
+    struct in6_addr* ip6;
+    size_t i, k;
+    int fd, r;
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = IMAGE_MAGIC;
+    hdr.version = IMAGE_VERSION;
+    hdr.mtime = mf->mtime;
+    hdr.size = mf->size;
+    hdr.hash = mf->hash;
+    hdr.nentries = mf->count;
+    hdr.nsources = mf->nsources;
+
+    /* Work out how big everything is */
+    for(i = 0; i < mf->count; i++)
+    {
+        je = mf->entries + i;
+        hdr.nip4 += je->ip4s;
+        hdr.nip6 += je->ip6s;
+        hdr.nindexes += je->ndepends;
+        hdr.nstrings += strlen(je->path) + strlen(je->hostname) + 2;
+
+        for(k = 0; je->argv && je->argv[k]; k++)
+        {
+            hdr.nindexes++;
+            hdr.nstrings += strlen(je->argv[k]) + 1;
+        }
+    }
+
+    for(i = 0; i < mf->nsources; i++)
+        hdr.nstrings += strlen(mf->sources[i].path) + 1;
+
+    hdr.entries = IMAGE_ALIGN(sizeof(hdr));
+    hdr.ip4 = IMAGE_ALIGN(hdr.entries + hdr.nentries * sizeof(image_entry));
+    hdr.ip6 = IMAGE_ALIGN(hdr.ip4 + hdr.nip4 * sizeof(struct in_addr));
+    hdr.indexes = IMAGE_ALIGN(hdr.ip6 + hdr.nip6 * sizeof(struct in6_addr));
+    hdr.sources = IMAGE_ALIGN(hdr.indexes + hdr.nindexes * sizeof(u_int32_t));
+    hdr.strings = IMAGE_ALIGN(hdr.sources + hdr.nsources * sizeof(image_source));
+    hdr.length = hdr.strings + hdr.nstrings;
+
+    if((buf = (char*)calloc(1, hdr.length)) == NULL)
+        errx(1, "out of memory");
+
+    memcpy(buf, &hdr, sizeof(hdr));
+    ie = (image_entry*)(buf + hdr.entries);
+    ip4 = (struct in_addr*)(buf + hdr.ip4);
+    ip6 = (struct in6_addr*)(buf + hdr.ip6);
+    idx = (u_int32_t*)(buf + hdr.indexes);
+    is = (image_source*)(buf + hdr.sources);
+    str = buf + hdr.strings;
+
+    for(i = 0; i < mf->count; i++, ie++)
+    {
+        je = mf->entries + i;
+        ie->line = je->line;
+        ie->priority = je->priority;
+        ie->path = put_string(&str, buf + hdr.strings, je->path);
+        ie->hostname = put_string(&str, buf + hdr.strings, je->hostname);
+
+        ie->ip4 = ip4 - (struct in_addr*)(buf + hdr.ip4);
+        ie->ip4s = je->ip4s;
+        memcpy(ip4, je->ip4, je->ip4s * sizeof(struct in_addr));
+        ip4 += je->ip4s;
+
+        ie->ip6 = ip6 - (struct in6_addr*)(buf + hdr.ip6);
+        ie->ip6s = je->ip6s;
+        memcpy(ip6, je->ip6, je->ip6s * sizeof(struct in6_addr));
+        ip6 += je->ip6s;
+
+        ie->depends = idx - (u_int32_t*)(buf + hdr.indexes);
+        ie->ndepends = je->ndepends;
+        memcpy(idx, je->depends, je->ndepends * sizeof(u_int32_t));
+        idx += je->ndepends;
+
+        ie->argv = idx - (u_int32_t*)(buf + hdr.indexes);
+        for(k = 0; je->argv && je->argv[k]; k++)
+            *idx++ = put_string(&str, buf + hdr.strings, je->argv[k]);
+        ie->argc = k;
+    }
+
+    for(i = 0; i < mf->nsources; i++, is++)
+    {
+        is->mtime = mf->sources[i].mtime;
+        is->size = mf->sources[i].size;
+        is->path = put_string(&str, buf + hdr.strings, mf->sources[i].path);
+    }
+
+    /* Write it somewhere else first, so nobody maps half an image */
+    snprintf(tmp, sizeof(tmp), "%s.XXXXXX", image);
+
+    if((fd = mkstemp(tmp)) == -1)
+    {
+        free(buf);
+        return -1;
+    }
+
+    r = write(fd, buf, hdr.length) == (ssize_t)hdr.length &&
+        fchmod(fd, 0644) == 0 && close(fd) == 0 &&
+        rename(tmp, image) == 0 ? 0 : -1;
+
+    if(r == -1)
+    {
+        i = errno;
+        close(fd);
+        unlink(tmp);
+        errno = i;
+    }
+
+    free(buf);
+    return r;
+}
+
+int manifest_map(const char* file, const char* image, manifest* mf)
+{
+    const image_header* hdr;
+    const image_entry* ie;
+    const image_source* is;
+    const u_int32_t* idx;
+    struct stat sb;
+    jail_entry* je;
+    char* base;
+    char* data;
+    char** strs;
+    size_t i, k, len;
+    int fd;
+
+    memset(mf, 0, sizeof(*mf));
+
+    if((fd = open(image, O_RDONLY)) == -1)
+        return -1;
+
+    if(fstat(fd, &sb) == -1 || sb.st_size < (off_t)sizeof(image_header))
+    {
+        close(fd);
+        return -1;
+    }
+
+    base = (char*)mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if(base == MAP_FAILED)
+        return -1;
+
+    mf->image = base;
+    mf->imagelen = sb.st_size;
+    hdr = (const image_header*)base;
+
+    /* Make sure all the sections are where they should be */
+    if(hdr->magic != IMAGE_MAGIC || hdr->version != IMAGE_VERSION ||
+       hdr->length != (u_int64_t)sb.st_size ||
+       hdr->entries + (u_int64_t)hdr->nentries * sizeof(image_entry) > hdr->ip4 ||
+       hdr->ip4 + (u_int64_t)hdr->nip4 * sizeof(struct in_addr) > hdr->ip6 ||
+       hdr->ip6 + (u_int64_t)hdr->nip6 * sizeof(struct in6_addr) > hdr->indexes ||
+       hdr->indexes + (u_int64_t)hdr->nindexes * sizeof(u_int32_t) > hdr->sources ||
+       hdr->sources + (u_int64_t)hdr->nsources * sizeof(image_source) > hdr->strings ||
+       hdr->strings + (u_int64_t)hdr->nstrings != hdr->length ||
+       hdr->nstrings == 0 || base[hdr->length - 1] != 0)
+        goto invalid;
+
+    /* Is it still what the source says? */
+    if(stat(file, &sb) == -1)
+        goto invalid;
+
+    if((u_int64_t)sb.st_mtime != hdr->mtime || (u_int64_t)sb.st_size != hdr->size)
+    {
+        /* Maybe just touched */
+        data = read_file(file, &sb, &len);
+        k = hash_data(data, len) == hdr->hash && len == hdr->size;
+        free(data);
+
+        if(!k)
+            goto invalid;
+    }
+
+    mf->mtime = sb.st_mtime;
+    mf->size = hdr->size;
+    mf->hash = hdr->hash;
+
+#define IMAGE_STRING(off) \
+    ((off) < hdr->nstrings ? base + hdr->strings + (off) : NULL)
+
+    /* And the address files it read? They're kept for the next compile */
+    mf->sources = (manifest_source*)calloc(hdr->nsources + 1, sizeof(manifest_source));
+    if(!mf->sources)
+        errx(1, "out of memory");
+
+    is = (const image_source*)(base + hdr->sources);
+
+    for(i = 0; i < hdr->nsources; i++, is++)
+    {
+        if((mf->sources[i].path = IMAGE_STRING(is->path)) == NULL ||
+           stat(mf->sources[i].path, &sb) == -1 ||
+           file_mtime(&sb) != is->mtime || (u_int64_t)sb.st_size != is->size)
+            goto invalid;
+
+        mf->sources[i].mtime = is->mtime;
+        mf->sources[i].size = is->size;
+        mf->nsources++;
+    }
+
+    mf->entries = (jail_entry*)calloc(hdr->nentries + 1, sizeof(jail_entry));
+    mf->strings = (char**)calloc(hdr->nindexes + hdr->nentries + 1, sizeof(char*));
+    if(!mf->entries || !mf->strings)
+        errx(1, "out of memory");
+
+    ie = (const image_entry*)(base + hdr->entries);
+    idx = (const u_int32_t*)(base + hdr->indexes);
+    strs = mf->strings;
+
+    /* Nothing to parse, just point at the right places */
+    for(i = 0; i < hdr->nentries; i++, ie++)
+    {
+        je = mf->entries + i;
+        je->line = ie->line;
+        je->priority = ie->priority;
+        je->path = IMAGE_STRING(ie->path);
+        je->hostname = IMAGE_STRING(ie->hostname);
+
+        if(!je->path || !je->hostname || ie->priority > PRIORITY_LOW ||
+           (u_int64_t)ie->ip4 + ie->ip4s > hdr->nip4 ||
+           (u_int64_t)ie->ip6 + ie->ip6s > hdr->nip6 ||
+           (u_int64_t)ie->depends + ie->ndepends > hdr->nindexes ||
+           (u_int64_t)ie->argv + ie->argc > hdr->nindexes)
+            goto invalid;
+
+        je->ip4 = (struct in_addr*)(base + hdr->ip4) + ie->ip4;
+        je->ip4s = ie->ip4s;
+        je->ip6 = (struct in6_addr*)(base + hdr->ip6) + ie->ip6;
+        je->ip6s = ie->ip6s;
+
+        je->depends = idx + ie->depends;
+        je->ndepends = ie->ndepends;
+
+        for(k = 0; k < je->ndepends; k++)
+        {
+            if(je->depends[k] >= hdr->nentries)
+                goto invalid;
+        }
+
+        if(ie->argc > 0)
+        {
+            je->argv = strs;
+
+            for(k = 0; k < ie->argc; k++)
+            {
+                if((*strs++ = IMAGE_STRING(idx[ie->argv + k])) == NULL)
+                    goto invalid;
+            }
+
+            *strs++ = NULL;
+        }
+    }
+
+#undef IMAGE_STRING
+
+    mf->count = hdr->nentries;
+    return 0;
+
+invalid:
+    manifest_done(mf);
+    return -1;
+}
+
+jail_entry* manifest_find(manifest* mf, const char* hostname)
+{
+    size_t i;
+
+    for(i = 0; i < mf->count; i++)
+    {
+        if(strcmp(mf->entries[i].hostname, hostname) == 0)
+            return mf->entries + i;
+    }
+
+    return NULL;
+}
+
+void manifest_done(manifest* mf)
+{
+    size_t i;
+
+    /* Addresses only belong to us when we parsed them */
+    if(mf->image)
+        munmap(mf->image, mf->imagelen);
+    else if(mf->entries)
+    {
+        for(i = 0; i < mf->count; i++)
+        {
+            free(mf->entries[i].ip4);
+            free(mf->entries[i].ip6);
+        }
+    }
+
+    free(mf->entries);
+    free(mf->sources);
+    free(mf->strings);
+    free(mf->indexes);
+    free(mf->data);
+    memset(mf, 0, sizeof(*mf));
+}
@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2004, Stef Walter
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above
+ *       copyright notice, this list of conditions and the
+ *       following disclaimer.
+ *     * Redistributions in binary form must reproduce the
+ *       above copyright notice, this list of conditions and
+ *       the following disclaimer in the documentation and/or
+ *       other materials provided with the distribution.
+ *     * The names of contributors to this software may not be
+ *       used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ *
+ *
+ * CONTRIBUTORS
+ *  Stef Walter <stef@memberwebs.com>
+ *
+ */
+
+#ifndef __MANIFEST_H__
+#define __MANIFEST_H__
+
+#include <sys/types.h>
+#include <netinet/in.h>
+
+/*
+ * A manifest lists jails to start, one per line:
+ *
+ *   path hostname ip[,ip...] depends[,depends...] [command ...]
+ *
+ * A depends of '-' means none. Words with spaces go in double
+ * quotes. Blank lines and lines starting with '#' are ignored.
+ * A depends of @high or @low puts the jail in that priority class,
+ * instead of the normal one.
+ *
+ * Parsing is only done when the manifest, or an @file it reads
+ * addresses from, changes. The result is compiled into an image next
+ * to it, which later runs map.
+ */
+
+#define MANIFEST_CACHE_SUFFIX   ".cache"
+
+/* Priority classes, the lower ones start first */
+#define PRIORITY_HIGH       0
+#define PRIORITY_NORMAL     1
+#define PRIORITY_LOW        2
+
+/* An @file the addresses came from, the image goes stale with it */
+typedef struct manifest_source
+{
+    const char* path;
+    u_int64_t mtime;            /* In nanoseconds */
+    u_int64_t size;
+}
+manifest_source;
+
+typedef struct jail_entry
+{
+    const char* path;
+    const char* hostname;
+    struct in_addr* ip4;
+    unsigned int ip4s;
+    struct in6_addr* ip6;
+    unsigned int ip6s;
+    const u_int32_t* depends;   /* Indexes of other entries */
+    unsigned int ndepends;
+    char** argv;                /* NULL terminated, or NULL for /etc/rc */
+    int priority;
+    int line;
+}
+jail_entry;
+
+typedef struct manifest
+{
+    jail_entry* entries;
+    size_t count;
+
+    /* The source file when it was read */
+    u_int64_t mtime;
+    u_int64_t size;
+    u_int64_t hash;
+
+    manifest_source* sources;
+    size_t nsources;
+
+    /* What the entries point into */
+    void* image;                /* Mapped compiled image, or NULL */
+    size_t imagelen;
+    char* data;                 /* Or the source text */
+    char** strings;             /* argv lists */
+    u_int32_t* indexes;         /* depends lists */
+}
+manifest;
+
+/* Uses the compiled image when it's current, otherwise compiles it */
+void manifest_open(const char* file, manifest* mf);
+
+/* Parses the source, exits on errors with the file and line */
+void manifest_load(const char* file, manifest* mf);
+
+/* Writes a compiled image, -1 and errno on failure */
+int manifest_compile(manifest* mf, const char* image);
+
+/* Maps a compiled image, -1 if it's missing, invalid or out of date */
+int manifest_map(const char* file, const char* image, manifest* mf);
+
+jail_entry* manifest_find(manifest* mf, const char* hostname);
+void manifest_done(manifest* mf);
+
+#endif /* __MANIFEST_H__ */
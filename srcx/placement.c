@@ -0,0 +1,401 @@
+/*
+ * Copyright (c) 2004, Stef Walter
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above
+ *       copyright notice, this list of conditions and the
+ *       following disclaimer.
+ *     * Redistributions in binary form must reproduce the
+ *       above copyright notice, this list of conditions and
+ *       the following disclaimer in the documentation and/or
+ *       other materials provided with the distribution.
+ *     * The names of contributors to this software may not be
+ *       used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ *
+ *
+ * CONTRIBUTORS
+ *  Stef Walter <stef@memberwebs.com>
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/file.h>
+
+#include <ctype.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <paths.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "util.h"
+#include "backend.h"
+#include "placement.h"
+
+#ifdef HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+/* Serializes auto placement, so jails started together spread out */
+#define PLACEMENT_LOCK  _PATH_VARRUN "jailutils.place"
+
+#define AUTO_SPEC       "auto"
+#define DOMAIN_SPEC     "domain:"
+
+static int g_lockfd = -1;
+
+int placement_parse_list(const char* str, unsigned long* mask, int max)
+{
+    char* end;
+    long lo, hi;
+
+    memset(mask, 0, (max / JAIL_MASK_BITS) * sizeof(unsigned long));
+
+    /* Linux lists end in a newline */
+    while(*str && !isspace((unsigned char)*str))
+    {
+        lo = hi = strtol(str, &end, 10);
+        if(end == str)
+            break;
+
+        if(*end == '-')
+        {
+            str = end + 1;
+            hi = strtol(str, &end, 10);
+            if(end == str)
+                break;
+        }
+
+        if(lo < 0 || hi < lo || hi >= max)
+            break;
+
+        for(; lo <= hi; lo++)
+            PLACEMENT_SET(mask, lo);
+
+        str = end;
+        if(*str == ',')
+            str++;
+        else if(*str && !isspace((unsigned char)*str))
+            break;
+    }
+
+    if(*str && !isspace((unsigned char)*str))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return 0;
+}
+
+void placement_format_list(const unsigned long* mask, int max, char* buf, size_t len)
+{
+    size_t at = 0;
+    int lo, hi;
+
+    buf[0] = 0;
+
+    for(lo = 0; lo < max; lo = hi + 1)
+    {
+        if(!PLACEMENT_ISSET(mask, lo))
+        {
+            hi = lo;
+            continue;
+        }
+
+        for(hi = lo; hi + 1 < max && PLACEMENT_ISSET(mask, hi + 1); hi++)
+            ;
+
+        if(hi == lo)
+            at += snprintf(buf + at, len - at, "%s%d", at ? "," : "", lo);
+        else
+            at += snprintf(buf + at, len - at, "%s%d-%d", at ? "," : "", lo, hi);
+
+        if(at >= len)
+        {
+            buf[len - 1] = 0;
+            return;
+        }
+    }
+}
+
+static int mask_empty(const unsigned long* mask, int max)
+{
+    int i;
+
+    for(i = 0; i < max / (int)JAIL_MASK_BITS; i++)
+    {
+        if(mask[i])
+            return 0;
+    }
+
+    return 1;
+}
+
+static int count_cpus(const unsigned long* mask)
+{
+    int i, n;
+
+    for(i = 0, n = 0; i < JAIL_MAX_CPUS; i++)
+        n += PLACEMENT_ISSET(mask, i);
+
+    return n;
+}
+
+static const jail_backend* placement_backend()
+{
+    const jail_backend* jb = jail_backend_get();
+
+    if(jb->domain_cpus == NULL || jb->place == NULL || jb->placement == NULL)
+        errx(1, "the %s backend can't pin jails to CPUs", jb->name);
+
+    return jb;
+}
+
+static void domain_placement(const char* list, jail_place* pl)
+{
+    const jail_backend* jb = placement_backend();
+    unsigned long domains[JAIL_MAX_DOMAINS / (8 * sizeof(unsigned long))];
+    jail_place dp;
+    int d, i;
+
+    if(placement_parse_list(list, domains, JAIL_MAX_DOMAINS) == -1 ||
+       mask_empty(domains, JAIL_MAX_DOMAINS))
+        errx(1, "invalid memory domains: %s", list);
+
+    for(d = 0; d < JAIL_MAX_DOMAINS; d++)
+    {
+        if(!PLACEMENT_ISSET(domains, d))
+            continue;
+
+        if(jb->domain_cpus(d, &dp) == -1)
+            err(1, "couldn't get the CPUs in memory domain %d", d);
+
+        for(i = 0; i < (int)(JAIL_MAX_CPUS / JAIL_MASK_BITS); i++)
+            pl->cpus[i] |= dp.cpus[i];
+        PLACEMENT_SET(pl->domains, d);
+    }
+}
+
+/*
+ * Picks the memory domain with the fewest jails pinned to it, and in
+ * that the ncpus CPUs with the fewest jails, or all of them for 0.
+ * Jails that aren't pinned at all don't count against anything.
+ */
+static void auto_placement(int ncpus, jail_place* pl)
+{
+    const jail_backend* jb = placement_backend();
+    static jail_place doms[JAIL_MAX_DOMAINS];
+    static int load[JAIL_MAX_CPUS];
+    int domload[JAIL_MAX_DOMAINS];
+    jail_place all, jp;
+    jail_info* ji;
+    jails jls;
+    int ndoms, dom, d, i, n, best;
+
+    if(jb->domain_cpus(-1, &all) == -1)
+        err(1, "couldn't get the CPUs");
+
+    for(ndoms = 0; ndoms < JAIL_MAX_DOMAINS; ndoms++)
+    {
+        if(jb->domain_cpus(ndoms, &doms[ndoms]) == -1)
+        {
+            if(errno != ENOENT)
+                err(1, "couldn't get the CPUs in memory domain %d", ndoms);
+            break;
+        }
+    }
+
+    if(ndoms == 0)
+        errx(1, "couldn't find any memory domains");
+
+    /* Hold off other jails being placed until we've been pinned */
+    g_lockfd = open(PLACEMENT_LOCK, O_RDWR | O_CREAT, 0600);
+    if(g_lockfd != -1 && flock(g_lockfd, LOCK_EX) == -1)
+        err(1, "couldn't lock %s", PLACEMENT_LOCK);
+
+    memset(load, 0, sizeof(load));
+    memset(domload, 0, sizeof(domload));
+
+    jails_load(&jls);
+
+    while((ji = jails_next(&jls)) != NULL)
+    {
+        if(jb->placement(ji, &jp) == -1 ||
+           memcmp(jp.cpus, all.cpus, sizeof(jp.cpus)) == 0)
+            continue;
+
+        for(i = 0; i < JAIL_MAX_CPUS; i++)
+            load[i] += PLACEMENT_ISSET(jp.cpus, i);
+
+        for(d = 0; d < ndoms; d++)
+        {
+            for(i = 0; i < (int)(JAIL_MAX_CPUS / JAIL_MASK_BITS); i++)
+            {
+                if(jp.cpus[i] & doms[d].cpus[i])
+                {
+                    domload[d]++;
+                    break;
+                }
+            }
+        }
+    }
+
+    jails_done(&jls);
+
+    for(dom = 0, d = 1; d < ndoms; d++)
+    {
+        if(domload[d] < domload[dom])
+            dom = d;
+    }
+
+    PLACEMENT_SET(pl->domains, dom);
+
+    if(ncpus == 0)
+    {
+        memcpy(pl->cpus, doms[dom].cpus, sizeof(pl->cpus));
+        return;
+    }
+
+    if(ncpus > count_cpus(doms[dom].cpus))
+        errx(1, "memory domain %d only has %d CPUs", dom, count_cpus(doms[dom].cpus));
+
+    /* The least loaded CPUs one at a time, lowest first on a tie */
+    for(n = 0; n < ncpus; n++)
+    {
+        best = -1;
+        for(i = 0; i < JAIL_MAX_CPUS; i++)
+        {
+            if(!PLACEMENT_ISSET(doms[dom].cpus, i) || PLACEMENT_ISSET(pl->cpus, i))
+                continue;
+            if(best == -1 || load[i] < load[best])
+                best = i;
+        }
+
+        PLACEMENT_SET(pl->cpus, best);
+    }
+}
+
+int placement_resolve(const char* spec, jail_place* pl)
+{
+    const jail_backend* jb;
+    jail_place all;
+    char* end;
+    long n = 0;
+    int i;
+
+    memset(pl, 0, sizeof(*pl));
+
+    if(strncmp(spec, AUTO_SPEC, strlen(AUTO_SPEC)) == 0)
+    {
+        spec += strlen(AUTO_SPEC);
+        if(*spec == ':')
+        {
+            n = strtol(spec + 1, &end, 10);
+            if(end == spec + 1 || *end || n <= 0 || n > JAIL_MAX_CPUS)
+                errx(1, "invalid number of CPUs: %s", spec + 1);
+        }
+        else if(*spec)
+        {
+            errno = EINVAL;
+            return -1;
+        }
+
+        auto_placement((int)n, pl);
+    }
+    else if(strncmp(spec, DOMAIN_SPEC, strlen(DOMAIN_SPEC)) == 0)
+    {
+        domain_placement(spec + strlen(DOMAIN_SPEC), pl);
+    }
+    else
+    {
+        jb = placement_backend();
+        if(placement_parse_list(spec, pl->cpus, JAIL_MAX_CPUS) == -1 ||
+           mask_empty(pl->cpus, JAIL_MAX_CPUS))
+        {
+            errno = EINVAL;
+            return -1;
+        }
+
+        if(jb->domain_cpus(-1, &all) == -1)
+            err(1, "couldn't get the CPUs");
+
+        for(i = 0; i < JAIL_MAX_CPUS; i++)
+        {
+            if(PLACEMENT_ISSET(pl->cpus, i) && !PLACEMENT_ISSET(all.cpus, i))
+                errx(1, "no such CPU: %d", i);
+        }
+    }
+
+    return 0;
+}
+
+int placement_apply(int jid, const jail_place* pl)
+{
+    int ret;
+
+    ret = placement_backend()->place(jid, pl);
+
+    if(g_lockfd != -1)
+    {
+        close(g_lockfd);
+        g_lockfd = -1;
+    }
+
+    return ret;
+}
+
+void placement_format(const jail_place* pl, char* buf, size_t len)
+{
+    static jail_place all;
+    static int have_all = 0;
+    size_t at;
+
+    if(!have_all)
+    {
+        if(jail_backend_get()->domain_cpus(-1, &all) == -1)
+            memset(&all, 0, sizeof(all));
+        have_all = 1;
+    }
+
+    if(mask_empty(pl->domains, JAIL_MAX_DOMAINS) &&
+       memcmp(pl->cpus, all.cpus, sizeof(all.cpus)) == 0)
+    {
+        strlcpy(buf, "any", len);
+        return;
+    }
+
+    at = strlcpy(buf, "cpus ", len);
+    if(at < len)
+        placement_format_list(pl->cpus, JAIL_MAX_CPUS, buf + at, len - at);
+
+    if(!mask_empty(pl->domains, JAIL_MAX_DOMAINS))
+    {
+        at = strlen(buf);
+        at += snprintf(buf + at, len - at, " domains ");
+        if(at < len)
+            placement_format_list(pl->domains, JAIL_MAX_DOMAINS, buf + at, len - at);
+    }
+}
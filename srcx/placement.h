@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2004, Stef Walter
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above
+ *       copyright notice, this list of conditions and the
+ *       following disclaimer.
+ *     * Redistributions in binary form must reproduce the
+ *       above copyright notice, this list of conditions and
+ *       the following disclaimer in the documentation and/or
+ *       other materials provided with the distribution.
+ *     * The names of contributors to this software may not be
+ *       used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ *
+ *
+ * CONTRIBUTORS
+ *  Stef Walter <stef@memberwebs.com>
+ *
+ */
+
+#ifndef __PLACEMENT_H__
+#define __PLACEMENT_H__
+
+#include <sys/types.h>
+
+struct jail_place;
+
+/*
+ * Pins jails to CPUs and memory domains. A placement is given as one
+ * of:
+ *
+ *   0-3,8          a list of CPUs
+ *   domain:0[,1]   all the CPUs in some memory domains, and their memory
+ *   auto[:N]       the least used domain, or N least used CPUs in it
+ */
+
+#define PLACEMENT_SET(m, n)     ((m)[(n) / JAIL_MASK_BITS] |= 1UL << ((n) % JAIL_MASK_BITS))
+#define PLACEMENT_ISSET(m, n)   (((m)[(n) / JAIL_MASK_BITS] & (1UL << ((n) % JAIL_MASK_BITS))) != 0)
+
+/* Lists like 0-3,8 to and from bit masks of max bits */
+int placement_parse_list(const char* str, unsigned long* mask, int max);
+void placement_format_list(const unsigned long* mask, int max, char* buf, size_t len);
+
+/*
+ * Works out where a new jail goes, which needs the host's view of
+ * things so call it before creating the jail. With auto, other jails
+ * being placed wait until placement_apply() is done.
+ */
+int placement_resolve(const char* spec, struct jail_place* pl);
+
+/* Pins the jail just created */
+int placement_apply(int jid, const struct jail_place* pl);
+
+/* Something like 'cpus 0-3 domains 0', or 'any' when not pinned */
+void placement_format(const struct jail_place* pl, char* buf, size_t len);
+
+#endif /* __PLACEMENT_H__ */
@@ -0,0 +1,192 @@
+/*
+ * Copyright (c) 2004, Stef Walter
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above
+ *       copyright notice, this list of conditions and the
+ *       following disclaimer.
+ *     * Redistributions in binary form must reproduce the
+ *       above copyright notice, this list of conditions and
+ *       the following disclaimer in the documentation and/or
+ *       other materials provided with the distribution.
+ *     * The names of contributors to this software may not be
+ *       used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ *
+ *
+ * CONTRIBUTORS
+ *  Stef Walter <stef@memberwebs.com>
+ *
+ */
+
+#include <sys/types.h>
+
+#include <ctype.h>
+#include <err.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+#include "backend.h"
+#include "profile.h"
+
+#ifdef HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+#define MAX_LINE    1024
+
+static const char SIZE_UNITS[] = "KMGT";
+
+static int parse_size(const char* str, unsigned long long* val)
+{
+    const char* unit;
+    char* end;
+    int n;
+
+    errno = 0;
+    *val = strtoull(str, &end, 10);
+    if(end == str || errno != 0)
+        return -1;
+
+    if(*end)
+    {
+        unit = strchr(SIZE_UNITS, toupper((unsigned char)*end));
+        if(unit == NULL || end[1] != 0)
+            return -1;
+
+        for(n = unit - SIZE_UNITS; n >= 0; n--)
+            *val *= 1024;
+    }
+
+    return 0;
+}
+
+static int parse_number(const char* str, long* val, const char* suffix)
+{
+    char* end;
+
+    errno = 0;
+    *val = strtol(str, &end, 10);
+    if(end == str || errno != 0 || *val <= 0)
+        return -1;
+
+    if(suffix && strcmp(end, suffix) == 0)
+        return 0;
+
+    return *end ? -1 : 0;
+}
+
+static void parse_limit(const char* file, int lineno, char* word, jail_limits* lim)
+{
+    char* val;
+    long n;
+
+    val = strchr(word, '=');
+    if(val == NULL)
+        errx(1, "%s:%d: expected name=value: %s", file, lineno, word);
+    *(val++) = 0;
+
+    if(strcmp(word, "memory") == 0)
+    {
+        if(parse_size(val, &lim->memory) == -1 || lim->memory == 0)
+            errx(1, "%s:%d: invalid memory size: %s", file, lineno, val);
+    }
+    else if(strcmp(word, "cpu") == 0)
+    {
+        if(parse_number(val, &n, "%") == -1)
+            errx(1, "%s:%d: invalid CPU percentage: %s", file, lineno, val);
+        lim->cpu = (int)n;
+    }
+    else if(strcmp(word, "procs") == 0)
+    {
+        if(parse_number(val, &lim->procs, NULL) == -1)
+            errx(1, "%s:%d: invalid number of processes: %s", file, lineno, val);
+    }
+    else if(strcmp(word, "files") == 0)
+    {
+        if(parse_number(val, &lim->files, NULL) == -1)
+            errx(1, "%s:%d: invalid number of files: %s", file, lineno, val);
+    }
+    else
+    {
+        errx(1, "%s:%d: unknown limit: %s", file, lineno, word);
+    }
+}
+
+void profile_load(const char* file, const char* name, jail_limits* lim)
+{
+    char line[MAX_LINE];
+    int lineno = 0;
+    int found = 0;
+    char* t;
+    char* w;
+    FILE* f;
+
+    memset(lim, 0, sizeof(*lim));
+
+    f = fopen(file, "r");
+    if(f == NULL)
+        err(1, "couldn't open profiles file: %s", file);
+
+    while(!found && fgets(line, sizeof(line), f) != NULL)
+    {
+        lineno++;
+
+        if((t = strchr(line, '#')) != NULL)
+            *t = 0;
+
+        if((w = strtok(line, " \t\r\n")) == NULL || strcmp(w, name) != 0)
+            continue;
+
+        /* Only the one we want gets checked */
+        while((w = strtok(NULL, " \t\r\n")) != NULL)
+            parse_limit(file, lineno, w, lim);
+
+        found = 1;
+    }
+
+    if(ferror(f))
+        err(1, "couldn't read profiles file: %s", file);
+
+    fclose(f);
+
+    if(!found)
+        errx(1, "no such profile in %s: %s", file, name);
+}
+
+void profile_format_size(unsigned long long bytes, char* buf, size_t len)
+{
+    int unit = -1;
+
+    /* Keep at least two digits before dropping to the next unit */
+    while(bytes >= 10240 && SIZE_UNITS[unit + 1])
+    {
+        bytes /= 1024;
+        unit++;
+    }
+
+    if(unit < 0)
+        snprintf(buf, len, "%llu", bytes);
+    else
+        snprintf(buf, len, "%llu%c", bytes, SIZE_UNITS[unit]);
+}
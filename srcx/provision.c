@@ -0,0 +1,571 @@
+/*
+ * Copyright (c) 2004, Stef Walter
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above
+ *       copyright notice, this list of conditions and the
+ *       following disclaimer.
+ *     * Redistributions in binary form must reproduce the
+ *       above copyright notice, this list of conditions and
+ *       the following disclaimer in the documentation and/or
+ *       other materials provided with the distribution.
+ *     * The names of contributors to this software may not be
+ *       used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ *
+ *
+ * CONTRIBUTORS
+ *  Stef Walter <stef@memberwebs.com>
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/ioctl.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include <dirent.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "provision.h"
+
+#ifdef HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+/* linux/fs.h doesn't mix well with sys/mount.h */
+#if defined(__linux__) && !defined(FICLONE)
+#define FICLONE         _IOW(0x94, 9, int)
+#endif
+
+/*
+ * Hard links are shared with the template, so anything the jail
+ * writes to in place has to be copied instead. Everything else is
+ * normally only ever replaced, which leaves the template alone.
+ */
+static const char* MUTABLE_PATHS[] =
+{
+    "etc", "var", "tmp", "root", "home", "usr/local/etc", NULL
+};
+
+static const char* METHOD_NAMES[] =
+{
+    "auto", "overlay", "clone", "link", "copy", NULL
+};
+
+#define COPY_BUFF_SIZE  (64 * 1024)
+
+typedef struct walk
+{
+    int method;                 /* Tried first for every file */
+    int strict;                 /* Fail rather than fall back */
+    provision_stats* st;
+    char rel[MAXPATHLEN];       /* Path relative to the root */
+}
+walk;
+
+static char g_copybuf[COPY_BUFF_SIZE];
+
+int provision_method(const char* name)
+{
+    int i;
+
+    for(i = 0; METHOD_NAMES[i]; i++)
+    {
+        if(strcmp(METHOD_NAMES[i], name) == 0)
+            return i;
+    }
+
+    return -1;
+}
+
+const char* provision_name(int method)
+{
+    return METHOD_NAMES[method];
+}
+
+static int is_mutable(const char* rel)
+{
+    size_t len;
+    int i;
+
+    for(i = 0; MUTABLE_PATHS[i]; i++)
+    {
+        len = strlen(MUTABLE_PATHS[i]);
+        if(strncmp(rel, MUTABLE_PATHS[i], len) == 0 &&
+           (rel[len] == 0 || rel[len] == '/'))
+            return 1;
+    }
+
+    return 0;
+}
+
+static void copy_attrs(walk* w, int fd, const struct stat* sb)
+{
+    struct timespec times[2];
+
+    times[0] = sb->st_atim;
+    times[1] = sb->st_mtim;
+
+    if(fchown(fd, sb->st_uid, sb->st_gid) == -1 ||
+       fchmod(fd, sb->st_mode & 07777) == -1 ||
+       futimens(fd, times) == -1)
+        err(1, "couldn't set attributes: %s", w->rel);
+}
+
+static int clone_file(int sfd, int dfd)
+{
+#ifdef FICLONE
+    return ioctl(dfd, FICLONE, sfd);
+#else
+    errno = EOPNOTSUPP;
+    return -1;
+#endif
+}
+
+static void copy_file(walk* w, int sfd, int dfd)
+{
+    ssize_t r, l, off;
+
+    while((r = read(sfd, g_copybuf, sizeof(g_copybuf))) != 0)
+    {
+        if(r == -1)
+        {
+            if(errno == EINTR)
+                continue;
+            err(1, "couldn't read template file: %s", w->rel);
+        }
+
+        for(off = 0; off < r; off += l)
+        {
+            l = write(dfd, g_copybuf + off, r - off);
+            if(l == -1)
+            {
+                if(errno == EINTR)
+                {
+                    l = 0;
+                    continue;
+                }
+                err(1, "couldn't write file: %s", w->rel);
+            }
+        }
+
+        w->st->bytes += r;
+    }
+}
+
+/*
+ * When a cheap way doesn't work for a file, that one file is copied.
+ * The next file, maybe on another file system, gets the cheap way again.
+ */
+static void fall_back(walk* w, const char* why)
+{
+    if(w->strict)
+        errx(1, "can't %s files here: %s: %s", why, w->rel, strerror(errno));
+
+    w->st->method = PROVISION_COPY;
+}
+
+static void place_file(walk* w, int sdir, int ddir, const char* name,
+                       const struct stat* sb)
+{
+    int sfd, dfd;
+
+    if(w->method == PROVISION_LINK && !is_mutable(w->rel))
+    {
+        if(linkat(sdir, name, ddir, name, 0) == 0)
+        {
+            w->st->files++;
+            return;
+        }
+
+        /* Another file system, or links to others' files not allowed */
+        if(errno != EXDEV && errno != EPERM && errno != EMLINK)
+            err(1, "couldn't link file: %s", w->rel);
+
+        fall_back(w, "link");
+    }
+
+    sfd = openat(sdir, name, O_RDONLY | O_NOFOLLOW);
+    if(sfd == -1)
+        err(1, "couldn't open template file: %s", w->rel);
+
+    dfd = openat(ddir, name, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW, 0600);
+    if(dfd == -1)
+        err(1, "couldn't create file: %s", w->rel);
+
+    /* A failed clone leaves the new file empty, ready for copying */
+    if(w->method != PROVISION_CLONE || clone_file(sfd, dfd) == -1)
+    {
+        if(w->method == PROVISION_CLONE)
+            fall_back(w, "clone");
+        copy_file(w, sfd, dfd);
+    }
+
+    copy_attrs(w, dfd, sb);
+    w->st->files++;
+
+    close(sfd);
+    close(dfd);
+}
+
+static void place_special(walk* w, int sdir, int ddir, const char* name,
+                          const struct stat* sb)
+{
+    struct timespec times[2];
+    char target[MAXPATHLEN];
+    ssize_t len;
+
+    times[0] = sb->st_atim;
+    times[1] = sb->st_mtim;
+
+    if(S_ISLNK(sb->st_mode))
+    {
+        len = readlinkat(sdir, name, target, sizeof(target) - 1);
+        if(len == -1)
+            err(1, "couldn't read template link: %s", w->rel);
+        target[len] = 0;
+
+        if(symlinkat(target, ddir, name) == -1)
+            err(1, "couldn't create link: %s", w->rel);
+    }
+    else
+    {
+        if(mknodat(ddir, name, sb->st_mode, sb->st_rdev) == -1)
+            err(1, "couldn't create node: %s", w->rel);
+    }
+
+    if(fchownat(ddir, name, sb->st_uid, sb->st_gid, AT_SYMLINK_NOFOLLOW) == -1 ||
+       utimensat(ddir, name, times, AT_SYMLINK_NOFOLLOW) == -1)
+        err(1, "couldn't set attributes: %s", w->rel);
+
+    w->st->files++;
+}
+
+static void walk_dir(walk* w, int sdir, int ddir)
+{
+    struct dirent* de;
+    struct stat sb;
+    size_t len;
+    int sfd, dfd;
+    DIR* dir;
+
+    /* fdopendir takes over the descriptor, keep ours */
+    dir = fdopendir(dup(sdir));
+    if(dir == NULL)
+        err(1, "couldn't read template directory: /%s", w->rel);
+
+    len = strlen(w->rel);
+
+    while((de = readdir(dir)) != NULL)
+    {
+        if(strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+            continue;
+
+        snprintf(w->rel + len, sizeof(w->rel) - len, "%s%s",
+                 len ? "/" : "", de->d_name);
+
+        if(fstatat(sdir, de->d_name, &sb, AT_SYMLINK_NOFOLLOW) == -1)
+            err(1, "couldn't stat template file: %s", w->rel);
+
+        if(S_ISDIR(sb.st_mode))
+        {
+            if(mkdirat(ddir, de->d_name, 0700) == -1)
+                err(1, "couldn't create directory: %s", w->rel);
+
+            sfd = openat(sdir, de->d_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+            dfd = openat(ddir, de->d_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+            if(sfd == -1 || dfd == -1)
+                err(1, "couldn't open directory: %s", w->rel);
+
+            walk_dir(w, sfd, dfd);
+
+            /* Only once it's full, or the times would be wrong */
+            copy_attrs(w, dfd, &sb);
+            w->st->files++;
+
+            close(sfd);
+            close(dfd);
+        }
+        else if(S_ISREG(sb.st_mode))
+        {
+            place_file(w, sdir, ddir, de->d_name, &sb);
+        }
+        else
+        {
+            place_special(w, sdir, ddir, de->d_name, &sb);
+        }
+
+        w->rel[len] = 0;
+    }
+
+    closedir(dir);
+}
+
+static int mount_overlay(const char* tmpl, const char* path)
+{
+    char upper[MAXPATHLEN];
+
+    snprintf(upper, sizeof(upper), "%s.upper", path);
+    if(mkdir(upper, 0755) == -1)
+        return -1;
+
+#if defined(HAVE_NMOUNT)
+    {
+        /* The template through nullfs, and then a unionfs layer on top */
+        struct iovec iov[6];
+
+        iov[0].iov_base = "fstype";
+        iov[0].iov_len = sizeof("fstype");
+        iov[1].iov_base = "nullfs";
+        iov[1].iov_len = sizeof("nullfs");
+        iov[2].iov_base = "fspath";
+        iov[2].iov_len = sizeof("fspath");
+        iov[3].iov_base = (void*)path;
+        iov[3].iov_len = strlen(path) + 1;
+        iov[4].iov_base = "target";
+        iov[4].iov_len = sizeof("target");
+        iov[5].iov_base = (void*)tmpl;
+        iov[5].iov_len = strlen(tmpl) + 1;
+
+        if(nmount(iov, 6, MNT_RDONLY) == -1)
+            return -1;
+
+        iov[1].iov_base = "unionfs";
+        iov[1].iov_len = sizeof("unionfs");
+        iov[4].iov_base = "from";
+        iov[4].iov_len = sizeof("from");
+        iov[5].iov_base = upper;
+        iov[5].iov_len = strlen(upper) + 1;
+
+        return nmount(iov, 6, 0);
+    }
+
+#elif defined(__linux__)
+    {
+        char work[MAXPATHLEN];
+        char opts[MAXPATHLEN * 3 + 64];
+
+        snprintf(work, sizeof(work), "%s.work", path);
+        if(mkdir(work, 0755) == -1)
+            return -1;
+
+        if(snprintf(opts, sizeof(opts), "lowerdir=%s,upperdir=%s,workdir=%s",
+                    tmpl, upper, work) >= (int)sizeof(opts))
+        {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+
+        return mount("overlay", path, "overlay", 0, opts);
+    }
+
+#else
+    errno = EOPNOTSUPP;
+    return -1;
+#endif
+}
+
+int provision_root(const char* tmpl, const char* path, int method,
+                   provision_stats* st)
+{
+    struct timespec start, end;
+    struct stat sb;
+    int sfd, dfd, n;
+    walk w;
+    DIR* dir;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    memset(st, 0, sizeof(*st));
+
+    if(stat(tmpl, &sb) == -1)
+        return -1;
+
+    if(!S_ISDIR(sb.st_mode))
+    {
+        errno = ENOTDIR;
+        return -1;
+    }
+
+    /* Never on top of something that's already there */
+    if(mkdir(path, 0700) == -1)
+    {
+        if(errno != EEXIST || (dir = opendir(path)) == NULL)
+            return -1;
+
+        for(n = 0; readdir(dir) != NULL; n++)
+            ;
+        closedir(dir);
+
+        /* Only . and .. */
+        if(n > 2)
+        {
+            errno = ENOTEMPTY;
+            return -1;
+        }
+    }
+
+    if(method == PROVISION_OVERLAY)
+    {
+        if(mount_overlay(tmpl, path) == -1)
+            return -1;
+
+        st->method = PROVISION_OVERLAY;
+    }
+    else
+    {
+        memset(&w, 0, sizeof(w));
+        w.st = st;
+        w.strict = (method != PROVISION_AUTO);
+        w.method = st->method = (method == PROVISION_AUTO) ? PROVISION_CLONE : method;
+
+        sfd = open(tmpl, O_RDONLY | O_DIRECTORY);
+        dfd = open(path, O_RDONLY | O_DIRECTORY);
+        if(sfd == -1 || dfd == -1)
+            return -1;
+
+        walk_dir(&w, sfd, dfd);
+        copy_attrs(&w, dfd, &sb);
+
+        close(sfd);
+        close(dfd);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    st->msecs = (end.tv_sec - start.tv_sec) * 1000L +
+                (end.tv_nsec - start.tv_nsec) / 1000000L;
+    return 0;
+}
+
+/* Empties a directory, returns -1 when anything couldn't be removed */
+static int remove_dir(int dfd, dev_t dev)
+{
+    struct dirent* de;
+    struct stat sb;
+    int fd, ret = 0;
+    DIR* dir;
+
+    /* fdopendir takes over the descriptor, keep ours */
+    dir = fdopendir(dup(dfd));
+    if(dir == NULL)
+        return -1;
+
+    while((de = readdir(dir)) != NULL)
+    {
+        if(strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+            continue;
+
+        if(fstatat(dfd, de->d_name, &sb, AT_SYMLINK_NOFOLLOW) == -1)
+        {
+            ret = -1;
+            continue;
+        }
+
+        if(S_ISDIR(sb.st_mode))
+        {
+            if(sb.st_dev != dev)
+            {
+                errno = EXDEV;
+                ret = -1;
+                continue;
+            }
+
+            fd = openat(dfd, de->d_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+            if(fd == -1 || remove_dir(fd, dev) == -1)
+                ret = -1;
+            if(fd != -1)
+                close(fd);
+
+            if(unlinkat(dfd, de->d_name, AT_REMOVEDIR) == -1)
+                ret = -1;
+        }
+        else if(unlinkat(dfd, de->d_name, 0) == -1)
+        {
+            ret = -1;
+        }
+    }
+
+    closedir(dir);
+    return ret;
+}
+
+static int remove_tree(const char* path)
+{
+    struct stat sb;
+    int fd, ret;
+
+    fd = open(path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+    if(fd == -1)
+        return errno == ENOENT ? 0 : -1;
+
+    if(fstat(fd, &sb) == -1)
+    {
+        close(fd);
+        return -1;
+    }
+
+    ret = remove_dir(fd, sb.st_dev);
+    close(fd);
+
+    if(rmdir(path) == -1)
+        ret = -1;
+
+    return ret;
+}
+
+int provision_destroy(const char* path, int method)
+{
+    char layer[MAXPATHLEN];
+    int ret = 0;
+
+    if(method == PROVISION_OVERLAY)
+    {
+#if defined(HAVE_NMOUNT)
+        /* The unionfs layer, then the nullfs one under it */
+        if(unmount(path, 0) == -1 || unmount(path, 0) == -1)
+            return -1;
+#elif defined(__linux__)
+        if(umount(path) == -1)
+            return -1;
+#endif
+
+        snprintf(layer, sizeof(layer), "%s.upper", path);
+        if(remove_tree(layer) == -1)
+            ret = -1;
+
+        snprintf(layer, sizeof(layer), "%s.work", path);
+        if(remove_tree(layer) == -1)
+            ret = -1;
+    }
+
+    if(remove_tree(path) == -1)
+        ret = -1;
+
+    return ret;
+}
@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2004, Stef Walter
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above
+ *       copyright notice, this list of conditions and the
+ *       following disclaimer.
+ *     * Redistributions in binary form must reproduce the
+ *       above copyright notice, this list of conditions and
+ *       the following disclaimer in the documentation and/or
+ *       other materials provided with the distribution.
+ *     * The names of contributors to this software may not be
+ *       used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ *
+ *
+ * CONTRIBUTORS
+ *  Stef Walter <stef@memberwebs.com>
+ *
+ */
+
+#ifndef __PROVISION_H__
+#define __PROVISION_H__
+
+/*
+ * Builds a jail's root directory out of a read-only template, as
+ * cheaply as the file systems allow. Files are shared with the
+ * template wherever that's safe, rather than copied.
+ */
+
+#define PROVISION_AUTO      0   /* Clone, or copy if that's not supported */
+#define PROVISION_OVERLAY   1   /* Mount the template with a writable layer on top */
+#define PROVISION_CLONE     2   /* Copy on write clones of each file */
+#define PROVISION_LINK      3   /* Hard links, with copies for mutable paths */
+#define PROVISION_COPY      4   /* Plain copies */
+
+typedef struct provision_stats
+{
+    int method;                 /* Copy if any file had to be */
+    unsigned long files;
+    unsigned long long bytes;   /* File data actually written */
+    long msecs;
+}
+provision_stats;
+
+/* Returns -1 for a method name we don't know */
+int provision_method(const char* name);
+const char* provision_name(int method);
+
+/*
+ * The path must not exist yet, or be an empty directory. With an
+ * overlay the writable layer goes next to it, in path.upper.
+ */
+int provision_root(const char* tmpl, const char* path, int method,
+                   provision_stats* st);
+
+/*
+ * Removes a root provision_root() built, and an overlay's layers,
+ * once the jail is gone. Never goes into another file system, such
+ * as one mounted in the jail and left behind.
+ */
+int provision_destroy(const char* path, int method);
+
+#endif /* __PROVISION_H__ */
@@ -0,0 +1,555 @@
+/*
+ * Copyright (c) 2004, Stef Walter
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above
+ *       copyright notice, this list of conditions and the
+ *       following disclaimer.
+ *     * Redistributions in binary form must reproduce the
+ *       above copyright notice, this list of conditions and
+ *       the following disclaimer in the documentation and/or
+ *       other materials provided with the distribution.
+ *     * The names of contributors to this software may not be
+ *       used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ *
+ *
+ * CONTRIBUTORS
+ *  Stef Walter <stef@memberwebs.com>
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <dirent.h>
+#include <err.h>
+#include <errno.h>
+#include <paths.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "util.h"
+#include "rcorder.h"
+#include "timeline.h"
+
+#ifdef HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+/* Where rc.d scripts live, in the order /etc/rc runs them */
+static const char* RC_DIRS[] = { "/etc/rc.d", "/usr/local/etc/rc.d", NULL };
+
+/* The same headers that rcorder(8) looks for */
+#define PROVIDE_STR     "# PROVIDE:"
+#define REQUIRE_STR     "# REQUIRE:"
+#define REQUIRES_STR    "# REQUIRES:"
+#define BEFORE_STR      "# BEFORE:"
+#define KEYWORD_STR     "# KEYWORD:"
+#define KEYWORDS_STR    "# KEYWORDS:"
+
+#define MAX_HEADER_LINE 1024
+
+#define WORD_PROVIDE    0
+#define WORD_REQUIRE    1
+#define WORD_BEFORE     2
+
+#define SCRIPT_PENDING  0
+#define SCRIPT_RUNNING  1
+#define SCRIPT_DONE     2
+
+typedef struct rc_script
+{
+    char* path;
+    const char* name;
+    int skip;           /* Only there to keep the order */
+    int state;
+    int failed;
+    pid_t pid;
+    size_t waiting;     /* Scripts that still have to finish first */
+    size_t* next;       /* Scripts that wait for this one */
+    size_t nnext;
+}
+rc_script;
+
+typedef struct rc_word
+{
+    char* word;
+    size_t script;
+    int kind;
+}
+rc_word;
+
+typedef struct rc_graph
+{
+    rc_script* scripts;
+    size_t count;
+    size_t max;
+
+    rc_word* words;
+    size_t nwords;
+    size_t maxwords;
+
+    /* PROVIDE words sorted by name */
+    rc_word** provides;
+    size_t nprovides;
+
+    size_t* edges;
+}
+rc_graph;
+
+static void add_word(rc_graph* g, size_t script, int kind, const char* word)
+{
+    rc_word* w;
+
+    if(g->nwords >= g->maxwords)
+    {
+        g->maxwords = g->maxwords ? g->maxwords * 2 : 256;
+        g->words = (rc_word*)realloc(g->words, g->maxwords * sizeof(rc_word));
+        if(g->words == NULL)
+            errx(1, "out of memory");
+    }
+
+    w = g->words + g->nwords++;
+    w->word = strdup(word);
+    if(w->word == NULL)
+        errx(1, "out of memory");
+    w->script = script;
+    w->kind = kind;
+}
+
+/* Old copies of scripts that rc.subr won't run either */
+static int ignored_script(const char* name)
+{
+    static const char* suffixes[] = { "~", "#", ".OLD", ".bak", ".orig", ",v", NULL };
+    size_t len = strlen(name);
+    size_t slen;
+    int i;
+
+    if(name[0] == '.')
+        return 1;
+
+    for(i = 0; suffixes[i]; i++)
+    {
+        slen = strlen(suffixes[i]);
+        if(len >= slen && strcmp(name + len - slen, suffixes[i]) == 0)
+            return 1;
+    }
+
+    return 0;
+}
+
+static int skip_keyword(const char* word, int how)
+{
+    /* We're always in a jail, and jails here never have a vnet */
+    if(strcmp(word, "nojail") == 0 || strcmp(word, "nojailvnet") == 0)
+        return 1;
+
+    if(how == RC_START && strcmp(word, "nostart") == 0)
+        return 1;
+
+    return 0;
+}
+
+/*
+ * Reads the headers at the top of a script. Like rcorder(8) they
+ * end at the first line that isn't one, once they've started.
+ */
+static void read_headers(rc_graph* g, size_t script, int how)
+{
+    rc_script* rs = g->scripts + script;
+    char line[MAX_HEADER_LINE];
+    const char* header;
+    char* word;
+    char* t;
+    int started = 0;
+    int shutdown = 0;
+    int kind;
+    FILE* f;
+
+    f = fopen(rs->path, "r");
+    if(f == NULL)
+    {
+        warn("couldn't open rc.d script: %s", rs->path);
+        rs->skip = 1;
+        return;
+    }
+
+    while(fgets(line, sizeof(line), f))
+    {
+        if(strncmp(line, PROVIDE_STR, sizeof(PROVIDE_STR) - 1) == 0)
+            header = PROVIDE_STR, kind = WORD_PROVIDE;
+        else if(strncmp(line, REQUIRE_STR, sizeof(REQUIRE_STR) - 1) == 0)
+            header = REQUIRE_STR, kind = WORD_REQUIRE;
+        else if(strncmp(line, REQUIRES_STR, sizeof(REQUIRES_STR) - 1) == 0)
+            header = REQUIRES_STR, kind = WORD_REQUIRE;
+        else if(strncmp(line, BEFORE_STR, sizeof(BEFORE_STR) - 1) == 0)
+            header = BEFORE_STR, kind = WORD_BEFORE;
+        else if(strncmp(line, KEYWORD_STR, sizeof(KEYWORD_STR) - 1) == 0)
+            header = KEYWORD_STR, kind = -1;
+        else if(strncmp(line, KEYWORDS_STR, sizeof(KEYWORDS_STR) - 1) == 0)
+            header = KEYWORDS_STR, kind = -1;
+        else if(started)
+            break;
+        else
+            continue;
+
+        started = 1;
+
+        for(word = strtok_r(line + strlen(header), " \t\r\n", &t); word;
+            word = strtok_r(NULL, " \t\r\n", &t))
+        {
+            if(kind != -1)
+                add_word(g, script, kind, word);
+            else if(skip_keyword(word, how))
+                rs->skip = 1;
+            else if(strcmp(word, "shutdown") == 0)
+                shutdown = 1;
+        }
+    }
+
+    fclose(f);
+
+    /* rc.shutdown only runs the scripts that ask for it */
+    if(how == RC_STOP && !shutdown)
+        rs->skip = 1;
+}
+
+static int compare_scripts(const void* a, const void* b)
+{
+    return strcmp(((const rc_script*)a)->path, ((const rc_script*)b)->path);
+}
+
+static void load_scripts(rc_graph* g, int how)
+{
+    char path[MAXPATHLEN];
+    struct dirent* de;
+    struct stat sb;
+    rc_script* rs;
+    size_t i;
+    DIR* dir;
+    int d;
+
+    for(d = 0; RC_DIRS[d]; d++)
+    {
+        dir = opendir(RC_DIRS[d]);
+        if(dir == NULL)
+        {
+            if(errno != ENOENT)
+                warn("couldn't read rc.d directory: %s", RC_DIRS[d]);
+            continue;
+        }
+
+        while((de = readdir(dir)) != NULL)
+        {
+            if(ignored_script(de->d_name))
+                continue;
+
+            snprintf(path, sizeof(path), "%s/%s", RC_DIRS[d], de->d_name);
+
+            /* rc.subr doesn't run scripts that aren't executable */
+            if(stat(path, &sb) == -1 || !S_ISREG(sb.st_mode) ||
+               !(sb.st_mode & 0111))
+                continue;
+
+            if(g->count >= g->max)
+            {
+                g->max = g->max ? g->max * 2 : 64;
+                g->scripts = (rc_script*)realloc(g->scripts, g->max * sizeof(rc_script));
+                if(g->scripts == NULL)
+                    errx(1, "out of memory");
+            }
+
+            rs = g->scripts + g->count++;
+            memset(rs, 0, sizeof(*rs));
+            rs->path = strdup(path);
+            if(rs->path == NULL)
+                errx(1, "out of memory");
+        }
+
+        closedir(dir);
+    }
+
+    /* Directories are already in order, and sort within themselves */
+    if(g->count > 0)
+        qsort(g->scripts, g->count, sizeof(rc_script), compare_scripts);
+
+    for(i = 0; i < g->count; i++)
+    {
+        rs = g->scripts + i;
+        rs->name = strrchr(rs->path, '/') + 1;
+        read_headers(g, i, how);
+    }
+}
+
+static int compare_provides(const void* a, const void* b)
+{
+    return strcmp((*(rc_word* const*)a)->word, (*(rc_word* const*)b)->word);
+}
+
+/* Finds the first of the scripts that provide a word */
+static size_t find_provides(rc_graph* g, const char* word)
+{
+    size_t lo = 0, hi = g->nprovides, mid;
+
+    while(lo < hi)
+    {
+        mid = (lo + hi) / 2;
+        if(strcmp(g->provides[mid]->word, word) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+/* Goes over each ordering between two scripts, counting or filling them in */
+static void each_edge(rc_graph* g, int how, int fill)
+{
+    rc_word* w;
+    size_t i, p;
+    size_t from, to, t;
+
+    for(i = 0; i < g->nwords; i++)
+    {
+        w = g->words + i;
+        if(w->kind == WORD_PROVIDE)
+            continue;
+
+        /* Requirements nobody provides are ignored, as rcorder does */
+        for(p = find_provides(g, w->word);
+            p < g->nprovides && strcmp(g->provides[p]->word, w->word) == 0; p++)
+        {
+            if(g->provides[p]->script == w->script)
+                continue;
+
+            /* A script runs after what it requires, before what it's before */
+            if(w->kind == WORD_REQUIRE)
+                from = g->provides[p]->script, to = w->script;
+            else
+                from = w->script, to = g->provides[p]->script;
+
+            /* Shutdown goes the other way around */
+            if(how == RC_STOP)
+                t = from, from = to, to = t;
+
+            if(fill)
+            {
+                g->scripts[from].next[g->scripts[from].nnext++] = to;
+                g->scripts[to].waiting++;
+            }
+            else
+            {
+                g->scripts[from].nnext++;
+            }
+        }
+    }
+}
+
+static void build_graph(rc_graph* g, int how)
+{
+    size_t i, n;
+
+    g->provides = (rc_word**)malloc((g->nwords + 1) * sizeof(rc_word*));
+    if(g->provides == NULL)
+        errx(1, "out of memory");
+
+    for(i = 0; i < g->nwords; i++)
+    {
+        if(g->words[i].kind == WORD_PROVIDE)
+            g->provides[g->nprovides++] = g->words + i;
+    }
+
+    qsort(g->provides, g->nprovides, sizeof(rc_word*), compare_provides);
+
+    /* Count the edges out of each script, then lay them out in one block */
+    each_edge(g, how, 0);
+
+    for(i = 0, n = 0; i < g->count; i++)
+        n += g->scripts[i].nnext;
+
+    g->edges = (size_t*)malloc((n + 1) * sizeof(size_t));
+    if(g->edges == NULL)
+        errx(1, "out of memory");
+
+    for(i = 0, n = 0; i < g->count; i++)
+    {
+        g->scripts[i].next = g->edges + n;
+        n += g->scripts[i].nnext;
+        g->scripts[i].nnext = 0;
+    }
+
+    each_edge(g, how, 1);
+}
+
+static void finish_script(rc_graph* g, rc_script* rs)
+{
+    size_t i;
+    rc_script* next;
+
+    rs->state = SCRIPT_DONE;
+
+    for(i = 0; i < rs->nnext; i++)
+    {
+        next = g->scripts + rs->next[i];
+
+        /* Could already be zero if a loop was broken there */
+        if(next->waiting > 0)
+            next->waiting--;
+    }
+}
+
+static int run_scripts(rc_graph* g, const char* jail, int how, int width, int opts)
+{
+    char* args[4];
+    rc_script* rs;
+    size_t i, k, done = 0;
+    int running = 0;
+    int failed = 0;
+    int progress, status;
+    pid_t pid;
+
+    args[0] = _PATH_BSHELL;
+    args[2] = how == RC_START ? "quietstart" : "faststop";
+    args[3] = NULL;
+
+    while(done < g->count)
+    {
+        progress = 0;
+
+        for(k = 0; k < g->count && running < width; k++)
+        {
+            i = how == RC_START ? k : g->count - k - 1;
+            rs = g->scripts + i;
+
+            if(rs->state != SCRIPT_PENDING || rs->waiting > 0)
+                continue;
+
+            progress = 1;
+
+            if(rs->skip)
+            {
+                finish_script(g, rs);
+                done++;
+                continue;
+            }
+
+            timeline_event("script-start", "%s", rs->name);
+            fflush(stdout);
+
+            switch(pid = fork())
+            {
+            case -1:
+                err(1, "couldn't fork");
+
+            case 0:
+                args[1] = rs->path;
+                prefix_jail_output(rs->name);
+
+                /* Each held socket only goes to the script it's named for */
+                keep_jail_fds(rs->name);
+                exit(run_jail_command(rs->path, args[0], args, opts) ? 0 : 1);
+
+            default:
+                rs->pid = pid;
+                rs->state = SCRIPT_RUNNING;
+                running++;
+                break;
+            }
+        }
+
+        /* Skipped scripts may have let ones we already looked at go */
+        if(progress && running < width)
+            continue;
+
+        if(running == 0)
+        {
+            /* Nothing can run, so break the loop where rc would start */
+            for(k = 0; k < g->count; k++)
+            {
+                rs = g->scripts + (how == RC_START ? k : g->count - k - 1);
+                if(rs->state == SCRIPT_PENDING)
+                    break;
+            }
+
+            warnx("%s%src.d dependency loop at: %s", jail ? jail : "",
+                  jail ? ": " : "", rs->name);
+            rs->waiting = 0;
+            continue;
+        }
+
+        if((pid = wait(&status)) == -1)
+            err(1, "couldn't wait for rc.d script");
+
+        for(i = 0; i < g->count; i++)
+        {
+            if(g->scripts[i].state == SCRIPT_RUNNING && g->scripts[i].pid == pid)
+                break;
+        }
+
+        /* Not one of ours */
+        if(i == g->count)
+            continue;
+
+        rs = g->scripts + i;
+        rs->failed = !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+        failed += rs->failed;
+
+        timeline_event("script-end", "%s %s", rs->name, rs->failed ? "failed" : "ok");
+
+        /* rc carries on past scripts that fail, and so do we */
+        finish_script(g, rs);
+        running--;
+        done++;
+    }
+
+    return failed ? 1 : 0;
+}
+
+int rc_run_parallel(const char* jail, int how, int width, int opts)
+{
+    rc_graph g;
+    size_t i;
+    int ret;
+
+    memset(&g, 0, sizeof(g));
+
+    load_scripts(&g, how);
+    build_graph(&g, how);
+
+    ret = run_scripts(&g, jail, how, width, opts);
+
+    for(i = 0; i < g.count; i++)
+        free(g.scripts[i].path);
+    for(i = 0; i < g.nwords; i++)
+        free(g.words[i].word);
+
+    free(g.scripts);
+    free(g.words);
+    free(g.provides);
+    free(g.edges);
+
+    return ret;
+}
@@ -0,0 +1,317 @@
+/*
+ * Copyright (c) 2004, Stef Walter
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above
+ *       copyright notice, this list of conditions and the
+ *       following disclaimer.
+ *     * Redistributions in binary form must reproduce the
+ *       above copyright notice, this list of conditions and
+ *       the following disclaimer in the documentation and/or
+ *       other materials provided with the distribution.
+ *     * The names of contributors to this software may not be
+ *       used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ *
+ *
+ * CONTRIBUTORS
+ *  Stef Walter <stef@memberwebs.com>
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#include <netinet/in.h>
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <paths.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "util.h"
+#include "backend.h"
+#include "ready.h"
+
+#ifdef HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+#define CHECK_PORT      1
+#define CHECK_PIDFILE   2
+#define CHECK_PROBE     3
+
+/* Checks are tried again after this, doubling up to the most */
+#define RETRY_FIRST     10
+#define RETRY_MOST      250
+
+/* An address that's not there shouldn't eat the whole deadline */
+#define CONNECT_WAIT    250
+
+typedef struct ready_check
+{
+    int type;
+    int port;
+    const char* arg;
+    int passed;
+    struct ready_check* next;
+}
+ready_check;
+
+static ready_check* g_checks = NULL;
+static int g_nchecks = 0;
+
+void ready_add(const char* check)
+{
+    ready_check* rc;
+    ready_check** last;
+    char* end;
+
+    rc = (ready_check*)calloc(1, sizeof(ready_check));
+    if(rc == NULL)
+        errx(1, "out of memory");
+
+    if(strncmp(check, "port:", 5) == 0)
+    {
+        rc->type = CHECK_PORT;
+        rc->port = (int)strtol(check + 5, &end, 10);
+        if(end == check + 5 || *end || rc->port <= 0 || rc->port > 65535)
+            errx(1, "invalid port to wait for: %s", check + 5);
+    }
+    else if(strncmp(check, "pidfile:", 8) == 0 && check[8] == '/')
+    {
+        rc->type = CHECK_PIDFILE;
+        rc->arg = check + 8;
+    }
+    else if(strncmp(check, "probe:", 6) == 0 && check[6])
+    {
+        rc->type = CHECK_PROBE;
+        rc->arg = check + 6;
+    }
+    else
+    {
+        errx(1, "invalid readiness check: %s", check);
+    }
+
+    /* In the order given, cheap ones are usually given first */
+    for(last = &g_checks; *last; last = &((*last)->next))
+        ;
+    *last = rc;
+    g_nchecks++;
+}
+
+int ready_count()
+{
+    return g_nchecks;
+}
+
+static int port_open(const struct sockaddr* sa, socklen_t len)
+{
+    struct pollfd pfd;
+    socklen_t errlen;
+    int fd, error = 0;
+
+    fd = socket(sa->sa_family, SOCK_STREAM, 0);
+    if(fd == -1)
+        return 0;
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+
+    if(connect(fd, sa, len) == -1)
+    {
+        if(errno != EINPROGRESS)
+            error = 1;
+        else
+        {
+            pfd.fd = fd;
+            pfd.events = POLLOUT;
+            errlen = sizeof(error);
+
+            if(poll(&pfd, 1, CONNECT_WAIT) != 1 ||
+               getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &errlen) == -1)
+                error = 1;
+        }
+    }
+
+    close(fd);
+    return !error;
+}
+
+static int check_port(const jail_spec* spec, int port)
+{
+    struct sockaddr_in sin;
+    struct sockaddr_in6 sin6;
+    unsigned int i;
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(port);
+
+    memset(&sin6, 0, sizeof(sin6));
+    sin6.sin6_family = AF_INET6;
+    sin6.sin6_port = htons(port);
+
+    /* Jails without addresses have the host's */
+    if(spec->ip4s == 0 && spec->ip6s == 0)
+    {
+        sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        return port_open((struct sockaddr*)&sin, sizeof(sin));
+    }
+
+    for(i = 0; i < spec->ip4s; i++)
+    {
+        sin.sin_addr = spec->ip4[i];
+        if(!port_open((struct sockaddr*)&sin, sizeof(sin)))
+            return 0;
+    }
+
+    for(i = 0; i < spec->ip6s; i++)
+    {
+        sin6.sin6_addr = spec->ip6[i];
+        if(!port_open((struct sockaddr*)&sin6, sizeof(sin6)))
+            return 0;
+    }
+
+    return 1;
+}
+
+static int check_pidfile(const char* path)
+{
+    char buf[32];
+    ssize_t len;
+    pid_t pid;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if(fd == -1)
+        return 0;
+
+    len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if(len <= 0)
+        return 0;
+
+    buf[len] = 0;
+    pid = (pid_t)atoi(buf);
+
+    return pid > 0 && (kill(pid, 0) == 0 || errno == EPERM);
+}
+
+/* Quietly, or the output would repeat every time around */
+static int check_probe(const char* cmd)
+{
+    char* env[] = { "PATH=" _PATH_STDPATH, NULL };
+    int status, fd;
+    pid_t pid;
+
+    switch(pid = fork())
+    {
+    case -1:
+        return 0;
+
+    case 0:
+        fd = open(_PATH_DEVNULL, O_RDWR);
+        if(fd != -1)
+        {
+            dup2(fd, 0);
+            dup2(fd, 1);
+            dup2(fd, 2);
+        }
+
+        execle(_PATH_BSHELL, "sh", "-c", cmd, NULL, env);
+        _exit(127);
+    }
+
+    if(waitpid(pid, &status, 0) == -1)
+        return 0;
+
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static long elapsed_msecs(struct timespec* start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000L +
+           (now.tv_nsec - start->tv_nsec) / 1000000L;
+}
+
+int ready_wait(const jail_spec* spec, int timeout, long* msecs)
+{
+    struct timespec begin;
+    ready_check* rc;
+    long retry = RETRY_FIRST;
+    int waiting;
+
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+
+    for(;;)
+    {
+        waiting = 0;
+
+        for(rc = g_checks; rc; rc = rc->next)
+        {
+            if(rc->passed)
+                continue;
+
+            switch(rc->type)
+            {
+            case CHECK_PORT:
+                rc->passed = check_port(spec, rc->port);
+                break;
+            case CHECK_PIDFILE:
+                rc->passed = check_pidfile(rc->arg);
+                break;
+            case CHECK_PROBE:
+                rc->passed = check_probe(rc->arg);
+                break;
+            }
+
+            /* No point trying the rest yet */
+            if(!rc->passed)
+            {
+                waiting = 1;
+                break;
+            }
+        }
+
+        *msecs = elapsed_msecs(&begin);
+
+        if(!waiting)
+            return 0;
+
+        if(*msecs >= timeout * 1000L)
+            return -1;
+
+        usleep(retry * 1000);
+        if((retry *= 2) > RETRY_MOST)
+            retry = RETRY_MOST;
+    }
+}
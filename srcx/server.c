@@ -0,0 +1,365 @@
+/*
+ * Copyright (c) 2004, Stef Walter
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above
+ *       copyright notice, this list of conditions and the
+ *       following disclaimer.
+ *     * Redistributions in binary form must reproduce the
+ *       above copyright notice, this list of conditions and
+ *       the following disclaimer in the documentation and/or
+ *       other materials provided with the distribution.
+ *     * The names of contributors to this software may not be
+ *       used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ *
+ *
+ * CONTRIBUTORS
+ *  Stef Walter <stef@memberwebs.com>
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <stdio.h>
+#include <err.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "server.h"
+#include "stop.h"
+
+#ifdef HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+#define MAX_QUEUED          (SERVER_MAX_LINE * 16)
+
+typedef struct client
+{
+    int fd;
+    char buf[SERVER_MAX_LINE];
+    size_t len;
+    char out[MAX_QUEUED];       /* Replies it hasn't taken yet */
+    size_t outlen;
+}
+client;
+
+static client g_clients[SERVER_MAX_CLIENTS];
+static int g_socket = -1;
+static char* g_path = NULL;
+
+static server_line g_line = NULL;
+static server_closed g_closed = NULL;
+
+static void close_client(int cl);
+
+/* Whether something is listening on the socket, rather than it being left over */
+static int socket_in_use(const struct sockaddr_un* sun)
+{
+    int fd, r;
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd == -1)
+        err(1, "couldn't create socket");
+
+    r = connect(fd, (const struct sockaddr*)sun, sizeof(*sun));
+    close(fd);
+
+    return r == 0;
+}
+
+void server_listen(const char* path, server_line line, server_closed closed)
+{
+    struct sockaddr_un sun;
+    int i;
+
+    memset(&sun, 0, sizeof(sun));
+    sun.sun_family = AF_UNIX;
+
+    if(strlen(path) >= sizeof(sun.sun_path))
+        errx(2, "socket path too long: %s", path);
+    strcpy(sun.sun_path, path);
+
+    if(socket_in_use(&sun))
+        errx(1, "already running on socket: %s", path);
+
+    g_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(g_socket == -1)
+        err(1, "couldn't create socket");
+
+    unlink(path);
+
+    if(bind(g_socket, (struct sockaddr*)&sun, sizeof(sun)) == -1)
+        err(1, "couldn't bind to socket: %s", path);
+
+    if(chmod(path, S_IRUSR | S_IWUSR) == -1)
+        err(1, "couldn't set permissions on socket: %s", path);
+
+    if(listen(g_socket, SOMAXCONN) == -1)
+        err(1, "couldn't listen on socket: %s", path);
+
+    fcntl(g_socket, F_SETFD, FD_CLOEXEC);
+    fcntl(g_socket, F_SETFL, O_NONBLOCK);
+
+    if((g_path = strdup(path)) == NULL)
+        errx(1, "out of memory");
+
+    for(i = 0; i < SERVER_MAX_CLIENTS; i++)
+        g_clients[i].fd = -1;
+
+    g_line = line;
+    g_closed = closed;
+}
+
+void server_unlisten()
+{
+    if(g_socket == -1)
+        return;
+
+    close(g_socket);
+    g_socket = -1;
+
+    unlink(g_path);
+}
+
+static void accept_clients()
+{
+    int fd, i;
+
+    while((fd = accept(g_socket, NULL, NULL)) != -1)
+    {
+        for(i = 0; i < SERVER_MAX_CLIENTS; i++)
+        {
+            if(g_clients[i].fd == -1)
+                break;
+        }
+
+        if(i == SERVER_MAX_CLIENTS)
+        {
+            if(!g_quiet)
+                warnx("too many clients, dropping connection");
+            close(fd);
+            continue;
+        }
+
+        /* One client that doesn't read its replies mustn't hold up the rest */
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+        g_clients[i].fd = fd;
+        g_clients[i].len = 0;
+        g_clients[i].outlen = 0;
+    }
+}
+
+static void close_client(int cl)
+{
+    close(g_clients[cl].fd);
+    g_clients[cl].fd = -1;
+    g_clients[cl].len = 0;
+    g_clients[cl].outlen = 0;
+
+    (g_closed)(cl);
+}
+
+static void read_client(int cl)
+{
+    client* c = &(g_clients[cl]);
+    char* line;
+    char* e;
+    int r;
+
+    r = read(c->fd, c->buf + c->len, sizeof(c->buf) - c->len - 1);
+    if(r <= 0)
+    {
+        if(r == 0 || (errno != EAGAIN && errno != EINTR))
+            close_client(cl);
+        return;
+    }
+
+    c->len += r;
+    c->buf[c->len] = 0;
+
+    /* Handle every complete line, clients may pipeline requests */
+    line = c->buf;
+    while((e = strchr(line, '\n')) != NULL)
+    {
+        *e = 0;
+        if(e > line && e[-1] == '\r')
+            e[-1] = 0;
+
+        (g_line)(cl, line);
+
+        /* A reply may have dropped the client */
+        if(c->fd == -1)
+            return;
+
+        line = e + 1;
+    }
+
+    c->len -= (line - c->buf);
+    memmove(c->buf, line, c->len);
+
+    if(c->len >= sizeof(c->buf) - 1)
+    {
+        if(!g_quiet)
+            warnx("request line too long, dropping connection");
+        close_client(cl);
+    }
+}
+
+static void write_client(int cl)
+{
+    client* c = &(g_clients[cl]);
+    ssize_t r;
+
+    while(c->outlen > 0)
+    {
+        r = write(c->fd, c->out, c->outlen);
+        if(r == -1)
+        {
+            if(errno == EINTR)
+                continue;
+            if(errno != EAGAIN)
+                close_client(cl);
+            return;
+        }
+
+        c->outlen -= r;
+        memmove(c->out, c->out + r, c->outlen);
+    }
+}
+
+int server_poll(struct pollfd* pfd)
+{
+    int n = 0;
+    int i;
+
+    if(g_socket != -1)
+    {
+        pfd[n].fd = g_socket;
+        pfd[n].events = POLLIN;
+        pfd[n++].revents = 0;
+    }
+
+    for(i = 0; i < SERVER_MAX_CLIENTS; i++)
+    {
+        if(g_clients[i].fd == -1)
+            continue;
+        pfd[n].fd = g_clients[i].fd;
+        pfd[n].events = POLLIN | (g_clients[i].outlen ? POLLOUT : 0);
+        pfd[n++].revents = 0;
+    }
+
+    return n;
+}
+
+void server_process(const struct pollfd* pfd, int n)
+{
+    int incoming = 0;
+    int i, cl;
+
+    for(i = 0; i < n; i++)
+    {
+        if(!pfd[i].revents)
+            continue;
+
+        if(pfd[i].fd == g_socket)
+        {
+            incoming = (pfd[i].revents & POLLIN);
+            continue;
+        }
+
+        /* Clients keep their place, unless they were dropped meanwhile */
+        for(cl = 0; cl < SERVER_MAX_CLIENTS; cl++)
+        {
+            if(g_clients[cl].fd == pfd[i].fd)
+                break;
+        }
+
+        if(cl == SERVER_MAX_CLIENTS)
+            continue;
+
+        if(pfd[i].revents & POLLOUT)
+            write_client(cl);
+
+        /* Writing may have dropped it */
+        if((pfd[i].revents & ~POLLOUT) && g_clients[cl].fd != -1)
+            read_client(cl);
+    }
+
+    /* Last, so that a new client can't take the place of one above */
+    if(incoming && g_socket != -1)
+        accept_clients();
+}
+
+void server_reply(int cl, const char* tag, const char* code,
+                  const struct timespec* start, const char* detail)
+{
+    struct timespec now;
+    char buf[SERVER_MAX_LINE];
+    long usecs;
+    int len;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    usecs = (now.tv_sec - start->tv_sec) * 1000000L +
+            (now.tv_nsec - start->tv_nsec) / 1000L;
+
+    len = snprintf(buf, sizeof(buf), "%s %s %ld%s%s\n", tag, code, usecs,
+                   detail ? " " : "", detail ? detail : "");
+    if(len >= (int)sizeof(buf))
+    {
+        len = sizeof(buf) - 1;
+        buf[len - 1] = '\n';
+    }
+
+    /* Queued up behind the others, a client that lets too many pile up goes away */
+    if(g_clients[cl].outlen + len > sizeof(g_clients[cl].out))
+    {
+        if(!g_quiet)
+            warnx("client isn't reading replies, dropping connection");
+        close_client(cl);
+        return;
+    }
+
+    memcpy(g_clients[cl].out + g_clients[cl].outlen, buf, len);
+    g_clients[cl].outlen += len;
+    write_client(cl);
+}
+
+void server_close_fds()
+{
+    int i;
+
+    if(g_socket != -1)
+        close(g_socket);
+
+    for(i = 0; i < SERVER_MAX_CLIENTS; i++)
+    {
+        if(g_clients[i].fd != -1)
+            close(g_clients[i].fd);
+    }
+}
@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2004, Stef Walter
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above
+ *       copyright notice, this list of conditions and the
+ *       following disclaimer.
+ *     * Redistributions in binary form must reproduce the
+ *       above copyright notice, this list of conditions and
+ *       the following disclaimer in the documentation and/or
+ *       other materials provided with the distribution.
+ *     * The names of contributors to this software may not be
+ *       used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ *
+ *
+ * CONTRIBUTORS
+ *  Stef Walter <stef@memberwebs.com>
+ *
+ */
+
+#ifndef __SERVER_H__
+#define __SERVER_H__
+
+#include <sys/types.h>
+#include <poll.h>
+#include <time.h>
+
+/*
+ * The control socket jkilld and jpoold listen on. Clients send
+ * request lines, and may pipeline them:
+ *
+ *   <tag> <verb> [args ...]
+ *
+ * and get one reply line for each, in whatever order they complete:
+ *
+ *   <tag> <code> <usecs> [detail]
+ *
+ * Replies are queued and written as the client takes them, one that
+ * doesn't read its replies is dropped rather than hold up the rest.
+ */
+
+#define SERVER_MAX_CLIENTS  64
+#define SERVER_MAX_LINE     512
+
+/* Called for each request line, clients are indexes below SERVER_MAX_CLIENTS */
+typedef void (*server_line)(int cl, char* line);
+
+/* Called once a client is gone, its requests should be forgotten */
+typedef void (*server_closed)(int cl);
+
+/*
+ * Listens on a UNIX socket at path, only for root. Exits when
+ * something else is already listening there.
+ */
+void server_listen(const char* path, server_line line, server_closed closed);
+
+/* Stops listening and removes the socket, the clients stay */
+void server_unlisten();
+
+/*
+ * Fills in what to poll for, the listening socket and each client.
+ * Returns how many were filled in, at most SERVER_MAX_CLIENTS + 1.
+ */
+int server_poll(struct pollfd* pfd);
+
+/* Reads, writes and accepts, after polling on what server_poll() filled in */
+void server_process(const struct pollfd* pfd, int n);
+
+void server_reply(int cl, const char* tag, const char* code,
+                  const struct timespec* start, const char* detail);
+
+/* In a child, closes the descriptors it mustn't hold on to */
+void server_close_fds();
+
+#endif /* __SERVER_H__ */
@@ -0,0 +1,329 @@
+/*
+ * Copyright (c) 2004, Stef Walter
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above
+ *       copyright notice, this list of conditions and the
+ *       following disclaimer.
+ *     * Redistributions in binary form must reproduce the
+ *       above copyright notice, this list of conditions and
+ *       the following disclaimer in the documentation and/or
+ *       other materials provided with the distribution.
+ *     * The names of contributors to this software may not be
+ *       used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ *
+ *
+ * CONTRIBUTORS
+ *  Stef Walter <stef@memberwebs.com>
+ *
+ */
+
+/*
+ * Original code and ideas from FreeBSD's jail.c written by
+ *  <phk@FreeBSD.ORG>
+ */
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/wait.h>
+
+#include <paths.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <err.h>
+#include <unistd.h>
+
+#include "util.h"
+#include "backend.h"
+#include "timeline.h"
+#include "rcorder.h"
+#include "provision.h"
+#include "placement.h"
+#include "profile.h"
+#include "ready.h"
+#include "init.h"
+#include "start.h"
+
+#ifdef HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+#define START_SCRIPT "/etc/rc"
+static char* START_ARGS[] = { _PATH_BSHELL, START_SCRIPT, NULL };
+
+const char* g_trace = NULL;
+int g_rcwidth = 0;
+const char* g_template = NULL;
+int g_provision = PROVISION_AUTO;
+const char* g_place = NULL;
+const char* g_profile = NULL;
+const char* g_profiles = DEFAULT_PROFILES;
+int g_readywait = READY_WAIT;
+int g_init = 0;
+int g_supervise = 0;
+
+static int start_rc(char** argv, int opts);
+static int start_done(const jail_spec* spec, int ret);
+static int start_ready(const jail_spec* spec);
+static int start_rc_parallel(const jail_spec* spec, int opts);
+static int start_init(const jail_spec* spec, char** argv, int opts);
+
+int start_jail(const jail_spec* spec, char** argv, int printjid, int opts)
+{
+    provision_stats ps;
+    jail_place pl;
+    jail_limits lim;
+    char placed[256];
+    int jid;
+    int ret;
+
+    /* A manifest entry without a command would quietly run rc instead */
+    if(g_supervise && argv == NULL)
+        errx(1, "%s: nothing to supervise without a command", spec->hostname);
+
+    /* Before chdir, a relative path is relative to where we started */
+    if(g_trace && timeline_open(g_trace, spec->hostname) == -1)
+        err(1, "couldn't open trace file: %s", g_trace);
+
+    if(g_template)
+    {
+        timeline_event("provision", "%s", g_template);
+
+        if(provision_root(g_template, spec->path, g_provision, &ps) == -1)
+            err(1, "couldn't provision jail directory: %s", spec->path);
+
+        timeline_event("provisioned", "%s %lu files %llu bytes",
+                       provision_name(ps.method), ps.files, ps.bytes);
+
+        fprintf(stderr, "%s: provisioned %s from %s by %s in %ldms, "
+                "%lu files, %llu bytes written\n", spec->hostname,
+                spec->path, g_template, provision_name(ps.method),
+                ps.msecs, ps.files, ps.bytes);
+    }
+
+    timeline_event("create", "%s", spec->path);
+
+    /* Before we lose sight of the host */
+    if(g_profile)
+    {
+        if(jail_backend_get()->limit == NULL)
+            errx(1, "the %s backend can't limit jails", jail_backend_get()->name);
+        profile_load(g_profiles, g_profile, &lim);
+    }
+
+    if(g_place)
+    {
+        if(placement_resolve(g_place, &pl) == -1)
+            errx(1, "invalid placement: %s", g_place);
+        placement_format(&pl, placed, sizeof(placed));
+    }
+
+    /* Simulated jails don't have a directory */
+    if(!(jail_backend_get()->flags & JAIL_BACKEND_SIMULATED) &&
+       chdir(spec->path) != 0)
+        err(1, "couldn't change to jail directory: %s", spec->path);
+
+    /* Here's where we actually go into the jail */
+    jid = jail_backend_get()->create(spec);
+    if(jid == -1)
+        err(1, "couldn't create jail");
+
+    timeline_event("created", "jid %d", jid);
+
+    /* Before anything runs in the jail, so it all stays put */
+    if(g_place)
+    {
+        if(placement_apply(jid, &pl) == -1)
+            err(1, "couldn't pin jail to %s", placed);
+        timeline_event("placed", "%s", placed);
+    }
+
+    if(g_profile)
+    {
+        if(jail_backend_get()->limit(jid, &lim) == -1)
+            err(1, "couldn't apply resource limits: %s", g_profile);
+        timeline_event("limited", "%s", g_profile);
+    }
+
+    if(printjid)
+    {
+        if(printjid == 2)
+            printf("%s %d\n", spec->hostname, jid);
+        else
+            printf("%d\n", jid);
+        fflush(stdout);
+    }
+
+    /* Some jails go when their first process does, that has to be ours */
+    if(g_init || (jail_backend_get()->flags & JAIL_BACKEND_INIT))
+        return start_init(spec, argv, opts);
+
+    if(argv == NULL && g_rcwidth)
+        return start_rc_parallel(spec, opts);
+
+    ret = start_rc(argv, opts);
+    return start_done(spec, ret);
+}
+
+/* Runs the jail's rc, or its own command */
+static int start_rc(char** argv, int opts)
+{
+    int ret;
+
+    if(argv == NULL && g_rcwidth)
+    {
+        timeline_event("rc-start", "rc.d width %d", g_rcwidth);
+        ret = rc_run_parallel(NULL, RC_START, g_rcwidth, opts);
+    }
+    else
+    {
+        if(argv == NULL)
+            argv = START_ARGS;
+
+        if(!check_jail_command(NULL, argv == START_ARGS ? START_SCRIPT : argv[0]))
+            return 1;
+
+        timeline_event("rc-start", "%s", argv == START_ARGS ? START_SCRIPT : argv[0]);
+
+        ret = run_jail_command(NULL, argv[0], argv, opts) ? 0 : 1;
+    }
+
+    timeline_event("rc-end", "%s", ret == 0 ? "ok" : "failed");
+    return ret;
+}
+
+/* Waits for the jail to be ready if asked to, and finishes the timeline */
+static int start_done(const jail_spec* spec, int ret)
+{
+    if(ret == 0 && ready_count())
+        ret = start_ready(spec);
+
+    timeline_summary(5);
+    timeline_close();
+
+    return ret;
+}
+
+/*
+ * The rc exiting only means the services were started, not that
+ * they're ready to be used. Wait for that too when asked to.
+ */
+static int start_ready(const jail_spec* spec)
+{
+    long msecs;
+
+    timeline_event("ready-wait", "%d checks", ready_count());
+
+    if(ready_wait(spec, g_readywait, &msecs) == -1)
+    {
+        timeline_event("not-ready", "%ldms", msecs);
+        warnx("%s: not ready after %ldms", spec->hostname, msecs);
+        return 1;
+    }
+
+    timeline_event("ready", "%ldms", msecs);
+    fprintf(stderr, "%s: ready in %ldms\n", spec->hostname, msecs);
+    return 0;
+}
+
+/*
+ * The first process forked in a new jail can end up as its init, the
+ * way /etc/rc would. So the rc.d scripts are run from a process of
+ * their own, which also finishes off the timeline.
+ */
+static int start_rc_parallel(const jail_spec* spec, int opts)
+{
+    pid_t pid;
+    int status;
+
+    fflush(stdout);
+
+    switch(pid = fork())
+    {
+    case -1:
+        err(1, "couldn't fork");
+
+    case 0:
+        exit(start_done(spec, start_rc(NULL, opts)));
+    }
+
+    timeline_close();
+
+    if(waitpid(pid, &status, 0) == -1)
+        err(1, "couldn't wait on rc.d scripts");
+
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
+
+/*
+ * Or the first process is an init of ours, which runs everything
+ * else and stays on to reap orphans and stop the jail. It tells us
+ * how starting went over a pipe. A supervised command counts as
+ * started once it's running, and ready if there are checks.
+ */
+static int start_init(const jail_spec* spec, char** argv, int opts)
+{
+    unsigned char status = 1;
+    int fds[2];
+    pid_t pid;
+
+    if(pipe(fds) == -1)
+        err(1, "couldn't create pipe");
+
+    fflush(stdout);
+
+    switch(pid = fork())
+    {
+    case -1:
+        err(1, "couldn't fork");
+
+    case 0:
+        close(fds[0]);
+        init_begin();
+        timeline_event("init", "pid %d", (int)getpid());
+
+        /* The timeline stays open to follow the command's restarts */
+        if(g_supervise && argv != NULL)
+        {
+            init_supervise(spec->hostname, argv, opts);
+            status = ready_count() ? start_ready(spec) : 0;
+        }
+        else
+        {
+            status = (unsigned char)start_done(spec, start_rc(argv, opts));
+        }
+        write(fds[1], &status, 1);
+        close(fds[1]);
+
+        init_serve();
+        exit(1);
+    }
+
+    close(fds[1]);
+    timeline_close();
+
+    /* Nothing means it died on the way */
+    if(read(fds[0], &status, 1) != 1)
+        status = 1;
+
+    close(fds[0]);
+    return status;
+}
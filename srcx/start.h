@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2004, Stef Walter
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above
+ *       copyright notice, this list of conditions and the
+ *       following disclaimer.
+ *     * Redistributions in binary form must reproduce the
+ *       above copyright notice, this list of conditions and
+ *       the following disclaimer in the documentation and/or
+ *       other materials provided with the distribution.
+ *     * The names of contributors to this software may not be
+ *       used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ *
+ *
+ * CONTRIBUTORS
+ *  Stef Walter <stef@memberwebs.com>
+ *
+ */
+
+#ifndef __START_H__
+#define __START_H__
+
+struct jail_spec;
+
+extern const char* g_trace;     /* Where to write a startup timeline, if anywhere */
+extern int g_rcwidth;           /* Run this many rc.d scripts at once instead of /etc/rc */
+extern const char* g_template;  /* Build the jail directory from this first */
+extern int g_provision;         /* And how, see provision.h */
+extern const char* g_place;     /* Pin the jail here, see placement.h */
+extern const char* g_profile;   /* Limit the jail like this, see profile.h */
+extern const char* g_profiles;  /* And where the profiles are */
+extern int g_readywait;         /* Seconds to wait for the checks in ready.h */
+extern int g_init;              /* Run an init of our own in the jail, see init.h */
+extern int g_supervise;         /* And have it restart the jail's command */
+
+/*
+ * Create the jail and run its command, which is /etc/rc when argv
+ * is NULL. Like jail(2) itself this leaves us in the jail. When
+ * printjid is 2, the hostname goes along with the jail id. With a
+ * template the jail's directory is provisioned from it first. With
+ * readiness checks, the rc exiting isn't the end of it.
+ */
+int start_jail(const struct jail_spec* spec, char** argv, int printjid, int opts);
+
+#endif /* __START_H__ */
@@ -0,0 +1,644 @@
+/*
+ * Copyright (c) 2004, Stef Walter
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above
+ *       copyright notice, this list of conditions and the
+ *       following disclaimer.
+ *     * Redistributions in binary form must reproduce the
+ *       above copyright notice, this list of conditions and
+ *       the following disclaimer in the documentation and/or
+ *       other materials provided with the distribution.
+ *     * The names of contributors to this software may not be
+ *       used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ *
+ *
+ * CONTRIBUTORS
+ *  Stef Walter <stef@memberwebs.com>
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+
+#include <netinet/in.h>
+#include <netdb.h>
+
+#include <paths.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <err.h>
+#include <errno.h>
+#include <unistd.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "util.h"
+#include "stop.h"
+#include "backend.h"
+#include "rcorder.h"
+#include "init.h"
+
+#ifdef HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+int g_timeout = DEFAULT_TIMEOUT;
+
+int g_quiet = 0;        /* Supress warnings */
+int g_verbose = 0;      /* Print output from scripts */
+int g_force = 0;        /* Use SIGKILL after if processes don't exit */
+int g_usescripts = 1;   /* Call startup and shutdown scripts */
+int g_restart = 0;      /* Restart jail after stop */
+int g_listen = 0;       /* Hold listening sockets across restart */
+int g_parallel = 0;     /* Run this many rc.d scripts at once */
+
+/* Listening sockets held open while the jail restarts */
+#define MAX_HANDOFF     64
+
+/* How often the holder tries for addresses that are still in use */
+#define HANDOFF_RETRY   5
+
+typedef struct handoff
+{
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+    const char* spec;
+    const char* name;           /* For LISTEN_FDNAMES, or NULL */
+    int fd;
+}
+handoff;
+
+static handoff g_handoff[MAX_HANDOFF];
+static int g_nhandoff = 0;
+
+/* Keeps trying for the addresses from outside the jail, 0 if none */
+static pid_t g_holder = 0;
+static int g_holdfd = -1;
+
+static void kill_jail_processes(const jail_backend* jb, int sig);
+static void stop_progress(const char* msg, void* arg);
+static int check_running_processes(const jail_backend* jb);
+
+static int bind_handoff();
+static void collect_handoff();
+static void pass_handoff();
+static void close_handoff();
+
+#define SHUTDOWN_SCRIPT "/etc/rc.shutdown"
+static char* SHUTDOWN_ARGS[] = { _PATH_BSHELL, SHUTDOWN_SCRIPT, NULL };
+
+#define START_SCRIPT "/etc/rc"
+static char* START_ARGS[] = { _PATH_BSHELL, START_SCRIPT, NULL };
+
+int stop_jail(const char* jail)
+{
+    const jail_backend* jb = jail_backend_get();
+    int pass = 0;
+    int timeout = 0;
+    int ret = 0;
+    int r;
+    int cmdargs = JAIL_RUN_CONSOLE;
+
+    if(g_verbose)
+        cmdargs |= JAIL_RUN_STDERR;
+
+    /*
+     * Grab the listening addresses before anything shuts down, so
+     * that connections queue up on our sockets instead of being
+     * refused while the jail restarts. Usually stop_jail_hold() has
+     * got them already.
+     */
+    if(g_restart)
+        bind_handoff();
+
+    /*
+     * Multiple passes are used to do different things.
+     * Each time the jails processes are listed.
+     */
+    while(1)
+    {
+        while(timeout > 0)
+        {
+            sleep(1);
+            timeout--;
+
+            bind_handoff();
+
+            if(!check_running_processes(jb))
+                goto done;
+        }
+
+        switch(pass)
+        {
+        /* First pass is an orderly shutdown */
+        case 0:
+
+            /* Check if we have an executable shutdown script */
+            if(g_usescripts && g_parallel)
+                rc_run_parallel(jail, RC_STOP, g_parallel, cmdargs);
+            else if(g_usescripts && check_jail_command(jail, SHUTDOWN_SCRIPT))
+                run_jail_command(jail, SHUTDOWN_ARGS[0], SHUTDOWN_ARGS, cmdargs);
+
+            bind_handoff();
+
+            /*
+             * A jail started with an init of ours can be stopped in one
+             * go by asking it, it knows when everything has gone.
+             */
+            r = init_stop(g_timeout * 2, g_force ? g_timeout : 0, g_restart,
+                          stop_progress, (void*)jail);
+            if(r == 0)
+                goto done;
+            if(r > 0)
+            {
+                if(!g_quiet)
+                    warnx("%s: couldn't stop jail, processes wouldn't die", jail);
+                ret = 1;
+                goto done;
+            }
+            break;
+
+        /* Okay now quit all processes in jail */
+        case 1:
+            kill_jail_processes(jb, SIGTERM);
+            timeout = g_timeout;
+            break;
+
+        /* ... and again ... */
+        case 2:
+            kill_jail_processes(jb, SIGTERM);
+            timeout = g_timeout;
+            break;
+
+        /* Okay now we force kill the processes if necessary */
+        case 3:
+
+            if(g_force)
+            {
+                /* If we get here, jailer looks like it's really irresponsive */
+                if(!g_quiet)
+                    warnx("%s: jail won't stop. forcing jail termination...", jail);
+
+                kill_jail_processes(jb, SIGKILL);
+                timeout = g_timeout;
+            }
+
+            break;
+
+        case 4:
+
+            /* And if that didn't do it, well then give up */
+            if(!g_quiet)
+                warnx("%s: couldn't stop jail, processes wouldn't die", jail);
+
+            ret = 1;
+            goto done;
+        }
+
+        pass++;
+
+        if(!check_running_processes(jb))
+            goto done;
+    }
+
+done:
+    if(g_restart)
+    {
+        collect_handoff();
+
+        /* Services that didn't hold on to their address are gone now */
+        if(bind_handoff() > 0 && !g_quiet)
+            warnx("%s: couldn't hold all listening addresses", jail);
+
+        pass_handoff();
+
+        /* Check if we have an executable shutdown script */
+        if(g_parallel)
+            rc_run_parallel(jail, RC_START, g_parallel, cmdargs);
+        else if(check_jail_command(jail, START_SCRIPT))
+            run_jail_command(jail, START_ARGS[0], START_ARGS, cmdargs);
+
+        close_handoff();
+    }
+
+    return ret;
+}
+
+static void stop_progress(const char* msg, void* arg)
+{
+    if(g_verbose)
+        warnx("%s: %s", (const char*)arg, msg);
+}
+
+static void kill_jail_processes(const jail_backend* jb, int sig)
+{
+    jail_proc* procs;
+    size_t nprocs, i;
+    pid_t cur;
+
+    cur = getpid();
+
+    if(jb->kill_all)
+    {
+        if(jb->kill_all(sig) == -1)
+            err(1, "couldn't signal processes");
+        return;
+    }
+
+    /* Get a process listing */
+    if(jb->list_procs(&procs, &nprocs) == -1)
+        err(1, "couldn't list processes");
+
+    /* Okay now loop and look at each process' jail */
+    for(i = 0; i < nprocs; i++)
+    {
+        if(procs[i].pid == cur)
+            continue;
+
+        if(jb->signal(procs[i].pid, sig) == -1)
+        {
+            if(errno != ESRCH)
+                errx(1, "couldn't signal process: %d", (int)procs[i].pid);
+        }
+    }
+}
+
+static int check_running_processes(const jail_backend* jb)
+{
+    jail_proc* procs;
+    size_t nprocs, i;
+    pid_t cur;
+
+    cur = getpid();
+
+    /* Get a process listing */
+    if(jb->list_procs(&procs, &nprocs) == -1)
+        err(1, "couldn't list processes");
+
+    /* Anything other than us still around? */
+    for(i = 0; i < nprocs; i++)
+    {
+        if(procs[i].pid != cur)
+            return 1;
+    }
+
+    return 0;
+}
+
+void stop_jail_listen(char* arg)
+{
+    struct addrinfo hints, *res;
+    handoff* ho;
+    char* spec;
+    char* host;
+    char* port;
+    int error;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_family = PF_UNSPEC;
+    hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV | AI_PASSIVE;
+
+    for(spec = strtok(arg, ","); spec; spec = strtok(NULL, ","))
+    {
+        if(g_nhandoff >= MAX_HANDOFF)
+            errx(2, "too many listening addresses: %s", spec);
+
+        ho = &(g_handoff[g_nhandoff]);
+        ho->fd = -1;
+        ho->name = NULL;
+
+        /* Named like www=1.2.3.4:80, a name can't have a colon */
+        if((host = strchr(spec, '=')) != NULL)
+        {
+            *(host++) = 0;
+            if(!*spec || strchr(spec, ':'))
+                errx(2, "invalid listening address name: %s", spec);
+            ho->name = spec;
+            spec = host;
+        }
+
+        ho->spec = spec;
+
+        /* Addresses look like 1.2.3.4:80 or [::1]:80 */
+        host = strdup(spec);
+        if(host == NULL)
+            errx(1, "out of memory");
+
+        port = strrchr(host, ':');
+        if(port == NULL)
+            errx(2, "invalid listening address: %s", spec);
+        *(port++) = 0;
+
+        if(host[0] == '[' && host[strlen(host) - 1] == ']')
+        {
+            host[strlen(host) - 1] = 0;
+            error = getaddrinfo(host + 1, port, &hints, &res);
+        }
+        else
+        {
+            error = getaddrinfo(host, port, &hints, &res);
+        }
+
+        if(error != 0)
+            errx(2, "invalid listening address: %s", spec);
+
+        memcpy(&(ho->addr), res->ai_addr, res->ai_addrlen);
+        ho->addrlen = res->ai_addrlen;
+
+        freeaddrinfo(res);
+        free(host);
+
+        g_nhandoff++;
+    }
+
+    g_listen = 1;
+}
+
+/* Sends a socket we got to the other end, along with its index */
+static int send_handoff(int fd, int i, int sock)
+{
+    char control[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr* cmsg;
+    struct msghdr msg;
+    struct iovec iov;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(control, 0, sizeof(control));
+    iov.iov_base = &i;
+    iov.iov_len = sizeof(i);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &sock, sizeof(int));
+
+    return sendmsg(fd, &msg, 0) == sizeof(i) ? 0 : -1;
+}
+
+/* Returns the index, or -1 once there are no more */
+static int recv_handoff(int fd, int* sock)
+{
+    char control[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr* cmsg;
+    struct msghdr msg;
+    struct iovec iov;
+    int i;
+
+    memset(&msg, 0, sizeof(msg));
+    iov.iov_base = &i;
+    iov.iov_len = sizeof(i);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    if(recvmsg(fd, &msg, 0) != sizeof(i))
+        return -1;
+
+    cmsg = CMSG_FIRSTHDR(&msg);
+    if(cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET ||
+       cmsg->cmsg_type != SCM_RIGHTS)
+        return -1;
+
+    memcpy(sock, CMSG_DATA(cmsg), sizeof(int));
+    fcntl(*sock, F_SETFD, FD_CLOEXEC);
+    return i;
+}
+
+/*
+ * In the holder, outside the jail. Tries for the addresses every few
+ * milliseconds and sends each one over as soon as it has it, until
+ * it has them all or stop_jail() is done with it.
+ */
+static void run_holder(int fd)
+{
+    struct pollfd pfd;
+    char c;
+    int i;
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+
+    for(;;)
+    {
+        bind_handoff();
+
+        for(i = 0; i < g_nhandoff; i++)
+        {
+            if(g_handoff[i].fd == -1)
+                continue;
+            if(send_handoff(fd, i, g_handoff[i].fd) == -1)
+                _exit(1);
+            close(g_handoff[i].fd);
+            g_handoff[i].fd = -2;
+        }
+
+        for(i = 0; i < g_nhandoff; i++)
+        {
+            if(g_handoff[i].fd == -1)
+                break;
+        }
+
+        if(i == g_nhandoff)
+            _exit(0);
+
+        /* Anything from the other end means it's done waiting */
+        if(poll(&pfd, 1, HANDOFF_RETRY) > 0 && read(fd, &c, 1) <= 0)
+            _exit(0);
+    }
+}
+
+void stop_jail_hold(const jail_info* ji)
+{
+    const jail_backend* jb = jail_backend_get();
+    int fds[2];
+    handoff* ho;
+    int i;
+
+    if(!g_listen)
+        return;
+
+    /*
+     * Best of all is the service's own socket. Nothing changes for
+     * anyone connecting, it just has one more owner for a while.
+     */
+    for(i = 0; jb->take_listener && i < g_nhandoff; i++)
+    {
+        ho = &(g_handoff[i]);
+        ho->fd = jb->take_listener(ji, (struct sockaddr*)&(ho->addr), ho->addrlen);
+        if(ho->fd != -1)
+            fcntl(ho->fd, F_SETFD, FD_CLOEXEC);
+    }
+
+    /* A service that set SO_REUSEPORT lets us in right away */
+    if(bind_handoff() == 0)
+        return;
+
+    /* Otherwise we get in as soon as the service lets go */
+    if(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds) == -1)
+        err(1, "couldn't create socket");
+
+    switch(g_holder = fork())
+    {
+    case -1:
+        err(1, "couldn't fork");
+
+    case 0:
+        signal(SIGTERM, SIG_DFL);
+        close(fds[0]);
+
+        /* Only the ones we haven't got */
+        for(i = 0; i < g_nhandoff; i++)
+        {
+            if(g_handoff[i].fd != -1)
+            {
+                close(g_handoff[i].fd);
+                g_handoff[i].fd = -2;
+            }
+        }
+
+        run_holder(fds[1]);
+        _exit(0);
+    }
+
+    close(fds[1]);
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    g_holdfd = fds[0];
+}
+
+/* Takes whatever the holder got, and sends it on its way */
+static void collect_handoff()
+{
+    int i, sock;
+
+    if(g_holder == 0)
+        return;
+
+    shutdown(g_holdfd, SHUT_WR);
+
+    while((i = recv_handoff(g_holdfd, &sock)) != -1)
+    {
+        if(i >= 0 && i < g_nhandoff && g_handoff[i].fd == -1)
+            g_handoff[i].fd = sock;
+        else
+            close(sock);
+    }
+
+    close(g_holdfd);
+    g_holdfd = -1;
+
+    waitpid(g_holder, NULL, 0);
+    g_holder = 0;
+}
+
+static int bind_handoff()
+{
+    handoff* ho;
+    int pending = 0;
+    int on = 1;
+    int i;
+
+    /*
+     * Returns the number of addresses we still couldn't bind to. While
+     * the holder is trying, a second socket of ours on the same address
+     * would just split the connections between them.
+     */
+    if(g_holder != 0)
+        return 0;
+
+    for(i = 0; i < g_nhandoff; i++)
+    {
+        ho = &(g_handoff[i]);
+        if(ho->fd != -1)
+            continue;
+
+        ho->fd = socket(ho->addr.ss_family, SOCK_STREAM, 0);
+        if(ho->fd == -1)
+            err(1, "couldn't create socket");
+
+        /* Don't leak these into the shutdown scripts */
+        fcntl(ho->fd, F_SETFD, FD_CLOEXEC);
+
+        setsockopt(ho->fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+#ifdef SO_REUSEPORT
+        setsockopt(ho->fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on));
+#endif
+
+        if(bind(ho->fd, (struct sockaddr*)&(ho->addr), ho->addrlen) == -1 ||
+           listen(ho->fd, SOMAXCONN) == -1)
+        {
+            if(errno != EADDRINUSE)
+                warn("couldn't listen on: %s", ho->spec);
+
+            close(ho->fd);
+            ho->fd = -1;
+            pending++;
+        }
+    }
+
+    return pending;
+}
+
+static void pass_handoff()
+{
+    const char* names[MAX_HANDOFF];
+    int fds[MAX_HANDOFF];
+    int i, n;
+
+    for(i = 0, n = 0; i < g_nhandoff; i++)
+    {
+        if(g_handoff[i].fd != -1)
+        {
+            names[n] = g_handoff[i].name;
+            fds[n++] = g_handoff[i].fd;
+        }
+    }
+
+    if(n > 0)
+        pass_jail_fds(fds, names, n);
+}
+
+static void close_handoff()
+{
+    int i;
+
+    pass_jail_fds(NULL, NULL, 0);
+
+    for(i = 0; i < g_nhandoff; i++)
+    {
+        if(g_handoff[i].fd != -1)
+            close(g_handoff[i].fd);
+        g_handoff[i].fd = -1;
+    }
+}
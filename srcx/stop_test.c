@@ -0,0 +1,207 @@
+/*
+ * Copyright (c) 2004, Stef Walter
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above
+ *       copyright notice, this list of conditions and the
+ *       following disclaimer.
+ *     * Redistributions in binary form must reproduce the
+ *       above copyright notice, this list of conditions and
+ *       the following disclaimer in the documentation and/or
+ *       other materials provided with the distribution.
+ *     * The names of contributors to this software may not be
+ *       used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ *
+ *
+ * CONTRIBUTORS
+ *  Stef Walter <stef@memberwebs.com>
+ *
+ */
+
+/*
+ * Tests for stop_jail() on the fixture backend. Each case stops a
+ * made up jail whose processes take a while to exit after a SIGTERM,
+ * some of them not at all, and checks what's left and how long it
+ * took against the timeouts.
+ */
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include <stdio.h>
+#include <err.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "util.h"
+#include "stop.h"
+#include "backend.h"
+
+#ifdef HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+typedef struct stop_case
+{
+    const char* name;
+    const char* fixture;        /* For JAILUTILS_FIXTURE */
+    int force;
+    int timeout;
+    int ret;                    /* What stop_jail() should return */
+    int left;                   /* Whether processes should be left */
+    long least;                 /* Shortest and longest it may take, in ms */
+    long most;
+}
+stop_case;
+
+/*
+ * The latency is how long a process takes to exit after SIGTERM, each
+ * between half and one and a half times that. Checks for processes
+ * that are left are a second apart.
+ */
+static const stop_case CASES[] =
+{
+    /* Everything goes on the first SIGTERM, by the first check */
+    { "latency", "jails=2,procs=64,latency=300", 0, 2, 0, 0, 900, 1500 },
+
+    /* Slower than the timeout, gone during the second SIGTERM round */
+    { "slow", "jails=2,procs=16,latency=1600", 0, 2, 0, 0, 1900, 3500 },
+
+    /* Ignore SIGTERM, and without -f they stay */
+    { "stubborn", "jails=2,procs=32,latency=10,stubborn=25", 0, 1, 1, 1, 1900, 3000 },
+
+    /* With -f they get a SIGKILL after both SIGTERM rounds */
+    { "forced", "jails=2,procs=32,latency=10,stubborn=25", 1, 1, 0, 0, 1900, 3500 },
+
+    /* All of them, and still nothing's left */
+    { "all-stubborn", "jails=2,procs=8,stubborn=100", 1, 1, 0, 0, 1900, 3500 },
+
+    { NULL }
+};
+
+static long elapsed(struct timeval* start)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return (now.tv_sec - start->tv_sec) * 1000L +
+           (now.tv_usec - start->tv_usec) / 1000L;
+}
+
+/* In a child of its own, the fixture is set up once per process */
+static int run_case(const stop_case* sc)
+{
+    const jail_backend* jb;
+    struct timeval start;
+    jail_proc* procs;
+    size_t nprocs;
+    jail_info* ji;
+    jails jls;
+    long ms;
+    int ret;
+
+    setenv("JAILUTILS_FIXTURE", sc->fixture, 1);
+    jb = jail_backend_get();
+
+    jails_load(&jls);
+    if((ji = jails_find(&jls, "fixture2.example.com")) == NULL)
+        errx(1, "%s: no jail in the fixture", sc->name);
+
+    if(jb->attach(ji) == -1)
+        err(1, "%s: couldn't attach to jail", sc->name);
+
+    g_force = sc->force;
+    g_timeout = sc->timeout;
+
+    gettimeofday(&start, NULL);
+    ret = stop_jail(ji->host);
+    ms = elapsed(&start);
+
+    if(jb->list_procs(&procs, &nprocs) == -1)
+        err(1, "%s: couldn't list processes", sc->name);
+
+    printf("%s: returned %d in %ld ms, %d processes left\n", sc->name,
+           ret, ms, (int)nprocs);
+
+    if(ret != sc->ret)
+    {
+        warnx("%s: stop_jail() returned %d, expected %d", sc->name, ret, sc->ret);
+        return 1;
+    }
+
+    if((nprocs > 0) != sc->left)
+    {
+        warnx("%s: %s processes left", sc->name, nprocs ? "there were" : "there were no");
+        return 1;
+    }
+
+    if(ms < sc->least || ms > sc->most)
+    {
+        warnx("%s: took %ld ms, expected %ld to %ld", sc->name, ms,
+              sc->least, sc->most);
+        return 1;
+    }
+
+    jails_done(&jls);
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    const stop_case* sc;
+    int status, ret = 0;
+    pid_t pid;
+
+    setenv("JAILUTILS_BACKEND", "fixture", 1);
+
+    /* Just the killing, and no noise from it */
+    g_usescripts = 0;
+    g_quiet = 1;
+
+    for(sc = CASES; sc->name; sc++)
+    {
+        if(argc > 1 && strcmp(argv[1], sc->name) != 0)
+            continue;
+
+        fflush(stdout);
+
+        switch((pid = fork()))
+        {
+        case -1:
+            err(1, "couldn't fork");
+
+        case 0:
+            status = run_case(sc);
+            fflush(stdout);
+            _exit(status);
+        }
+
+        if(waitpid(pid, &status, 0) == -1)
+            err(1, "couldn't wait for test");
+
+        if(!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            ret = 1;
+    }
+
+    return ret;
+}
@@ -0,0 +1,299 @@
+/*
+ * Copyright (c) 2004, Stef Walter
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ *     * Redistributions of source code must retain the above
+ *       copyright notice, this list of conditions and the
+ *       following disclaimer.
+ *     * Redistributions in binary form must reproduce the
+ *       above copyright notice, this list of conditions and
+ *       the following disclaimer in the documentation and/or
+ *       other materials provided with the distribution.
+ *     * The names of contributors to this software may not be
+ *       used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS
+ * FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE
+ * COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS
+ * OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF
+ * THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ *
+ *
+ * CONTRIBUTORS
+ *  Stef Walter <stef@memberwebs.com>
+ *
+ */
+
+#include <sys/types.h>
+#include <sys/param.h>
+
+#include <err.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "util.h"
+#include "timeline.h"
+
+#ifdef HAVE_CONFIG_H
+#include "../config.h"
+#endif
+
+#define MAX_LINE        1024
+#define MAX_SERVICE     64
+
+/* rc.subr announces each service with this */
+#define START_PREFIX    "Starting "
+
+typedef struct service
+{
+    char name[MAX_SERVICE];
+    double start;
+    double secs;
+}
+service;
+
+static int g_tracefd = -1;
+static char g_hostname[MAXHOSTNAMELEN];
+
+/* A partial line from the last lot of output, and when it began */
+static char g_line[MAX_LINE];
+static size_t g_linelen = 0;
+static double g_linestart = 0;
+
+static service* g_services = NULL;
+static size_t g_nservices = 0;
+static size_t g_maxservices = 0;
+
+static double now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+int timeline_open(const char* file, const char* hostname)
+{
+    /* Several jails can write to one file, appends keep lines whole */
+    g_tracefd = open(file, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if(g_tracefd == -1)
+        return -1;
+
+    /* This is opened before going into the jail, keep it out of there */
+    fcntl(g_tracefd, F_SETFD, FD_CLOEXEC);
+
+    strlcpy(g_hostname, hostname, sizeof(g_hostname));
+    return 0;
+}
+
+int timeline_active(void)
+{
+    return g_tracefd != -1;
+}
+
+static void write_line(double when, const char* event, const char* text)
+{
+    char buf[MAX_LINE + MAXHOSTNAMELEN + 64];
+    int len;
+
+    len = snprintf(buf, sizeof(buf), "%.6f %s %s%s%s\n", when, g_hostname,
+                   event, text && text[0] ? " " : "", text ? text : "");
+    if(len >= (int)sizeof(buf))
+    {
+        len = sizeof(buf);
+        buf[len - 1] = '\n';
+    }
+
+    /* One write per line, so they don't get mixed up with other jails' */
+    write(g_tracefd, buf, len);
+}
+
+static void end_service(double when)
+{
+    if(g_nservices > 0 && g_services[g_nservices - 1].secs < 0)
+        g_services[g_nservices - 1].secs = when - g_services[g_nservices - 1].start;
+}
+
+static void add_service(double when, const char* name, size_t len)
+{
+    service* svc;
+
+    if(g_nservices >= g_maxservices)
+    {
+        g_maxservices = g_maxservices ? g_maxservices * 2 : 32;
+        g_services = (service*)realloc(g_services, g_maxservices * sizeof(service));
+        if(g_services == NULL)
+            errx(1, "out of memory");
+    }
+
+    svc = g_services + g_nservices++;
+    if(len >= sizeof(svc->name))
+        len = sizeof(svc->name) - 1;
+    memcpy(svc->name, name, len);
+    svc->name[len] = 0;
+    svc->start = when;
+    svc->secs = -1;
+}
+
+/*
+ * There's no telling exactly when a service finishes starting, so
+ * each one gets the time until the next one is announced.
+ */
+static void check_service(double when, const char* line)
+{
+    size_t len;
+
+    if(strncmp(line, START_PREFIX, sizeof(START_PREFIX) - 1) != 0)
+        return;
+
+    line += sizeof(START_PREFIX) - 1;
+    len = strcspn(line, ". \t");
+    if(len == 0)
+        return;
+
+    end_service(when);
+    add_service(when, line, len);
+}
+
+/* Scripts run side by side say exactly when each one is done */
+static void end_script(double when, const char* text)
+{
+    size_t len = strcspn(text, " ");
+    size_t i;
+
+    for(i = g_nservices; i > 0; i--)
+    {
+        if(g_services[i - 1].secs < 0 && strlen(g_services[i - 1].name) == len &&
+           strncmp(g_services[i - 1].name, text, len) == 0)
+        {
+            g_services[i - 1].secs = when - g_services[i - 1].start;
+            break;
+        }
+    }
+}
+
+static void flush_line()
+{
+    g_line[g_linelen] = 0;
+    g_linelen = 0;
+
+    write_line(g_linestart, "out", g_line);
+    check_service(g_linestart, g_line);
+}
+
+void timeline_event(const char* event, const char* fmt, ...)
+{
+    char text[MAX_LINE];
+    va_list ap;
+    double when;
+
+    if(g_tracefd == -1)
+        return;
+
+    when = now();
+    text[0] = 0;
+
+    /* Whatever was left without a newline */
+    if(g_linelen > 0)
+        flush_line();
+
+    if(fmt)
+    {
+        va_start(ap, fmt);
+        vsnprintf(text, sizeof(text), fmt, ap);
+        va_end(ap);
+    }
+
+    /* The last service is done once the command is */
+    if(strcmp(event, "rc-end") == 0)
+        end_service(when);
+    else if(strcmp(event, "script-start") == 0)
+        add_service(when, text, strlen(text));
+    else if(strcmp(event, "script-end") == 0)
+        end_script(when, text);
+
+    write_line(when, event, text);
+}
+
+void timeline_output(const char* buf, size_t len)
+{
+    double when;
+    size_t i;
+
+    if(g_tracefd == -1)
+        return;
+
+    when = now();
+
+    for(i = 0; i < len; i++)
+    {
+        /* Over long lines just get split */
+        if(g_linelen >= sizeof(g_line) - 1)
+            flush_line();
+
+        if(g_linelen == 0)
+            g_linestart = when;
+
+        if(buf[i] == '\n')
+            flush_line();
+        else
+            g_line[g_linelen++] = buf[i];
+    }
+}
+
+static int compare_services(const void* a, const void* b)
+{
+    double sa = ((const service*)a)->secs;
+    double sb = ((const service*)b)->secs;
+    return sa < sb ? 1 : (sa > sb ? -1 : 0);
+}
+
+void timeline_summary(int top)
+{
+    size_t i;
+
+    if(g_tracefd == -1 || g_nservices == 0)
+        return;
+
+    qsort(g_services, g_nservices, sizeof(service), compare_services);
+
+    fprintf(stderr, "%s: slowest services:", g_hostname);
+    for(i = 0; i < g_nservices && i < (size_t)top; i++)
+    {
+        if(g_services[i].secs < 0)
+            break;
+        fprintf(stderr, " %s %.2fs", g_services[i].name, g_services[i].secs);
+    }
+    fprintf(stderr, "\n");
+}
+
+void timeline_close(void)
+{
+    if(g_tracefd != -1 && g_linelen > 0)
+        flush_line();
+
+    if(g_tracefd != -1)
+        close(g_tracefd);
+
+    g_tracefd = -1;
+    free(g_services);
+    g_services = NULL;
+    g_nservices = g_maxservices = 0;
+}
@@ -40,142 +40,97 @@
 
 #include <sys/types.h>
 #include <sys/param.h>
-#include <sys/proc.h>
-#include <sys/user.h>
 #include <sys/stat.h>
-#include <sys/jail.h>
-#include <sys/sysctl.h>
-#include <sys/file.h>
+#include <sys/time.h>
 #include <sys/wait.h>
+#include <sys/socket.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
 
 #include <err.h>
+#include <fcntl.h>
 #include <errno.h>
+#include <ctype.h>
 #include <stdlib.h>
 #include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <kvm.h>
 #include <paths.h>
+#include <signal.h>
 #include <string.h>
 #include <unistd.h>
 
-#include <netinet/in.h>
+#ifdef HAVE_ALLOCA_H
+#include <alloca.h>
+#endif
 
 #include "util.h"
+#include "backend.h"
+#include "timeline.h"
 
 extern char** environ;
 
-void
-jails_load (jails *jls)
-{
-	struct xprison *xp;
+/* Descriptors handed to commands run in the jail, see pass_jail_fds() */
+static int* g_passfds = NULL;
+static const char** g_passnames = NULL;
+static int g_npassfds = 0;
 
-	memset (jls, 0, sizeof (jails));
+/* Filled in by the child, it's only for the process we run */
+static char g_listenpid[32];
 
-	if(sysctlbyname("security.jail.list", NULL, &jls->length, NULL, 0) == -1)
-		err(1, "couldn't list jails");
+/* Put in front of each line of command output, if set */
+static const char* g_prefix = NULL;
 
-retry:
+/* How the last command we forked went */
+static int g_status = 0;
 
-	if(jls->length <= 0)
-	{
-		jls->data = NULL;
-		jls->last = NULL;
-		return;
-	}
-
-	jls->data = calloc(jls->length, 1);
-	if(jls->data == NULL)
-		err(1, "out of memory");
+static void setup_passed_fds(void);
 
-	if(sysctlbyname("security.jail.list", jls->data, &jls->length, NULL, 0) == -1)
-	{
-		if(errno == ENOMEM)
-		{
-			free(jls->data);
-			jls->data = NULL;
-			goto retry;
-		}
+void
+jails_load (jails *jls)
+{
+	memset (jls, 0, sizeof (jails));
 
+	if(jail_backend_get()->list_jails(&jls->list, &jls->count) == -1)
 		err(1, "couldn't list jails");
-	}
-
-	xp = jls->data;
-	if(jls->length < sizeof(*xp) || xp->pr_version != XPRISON_VERSION)
-		errx(1, "kernel and userland out of sync");
 }
 
-struct xprison*
+jail_info*
 jails_next (jails *jls)
 {
-	struct xprison *xp = jls->last;
-	unsigned char *data, *next, *end;
-
-	if(xp == NULL)
-	{
-		xp = jls->data;
-	}
-	else
-	{
-		switch(xp->pr_version)
-		{
-		case 1:
-		case 2:
-			xp = xp + 1;
-			break;
-#ifdef JAIL_MULTIADDR
-		case 3:
-			data = (unsigned char*)(xp + 1);
-			data += (xp->pr_ip4s * sizeof(struct in_addr));
-			data += (xp->pr_ip6s * sizeof(struct in6_addr));
-			xp = (struct xprison*)data;
-			break;
-#endif
-		default:
-			errx(1, "unknown version of jail structure: %d", xp->pr_version);
-			break;
-		}
-	}
-
-	if(xp == NULL)
+	if(jls->next >= jls->count)
 		return NULL;
 
-	next = (unsigned char*)(xp + 1);
-	end = ((unsigned char*)jls->data) + jls->length;
-	if (next > end)
-		return NULL;
-
-	if(xp->pr_version != XPRISON_VERSION)
-		errx(1, "kernel and userland out of sync");
-
-	jls->last = xp;
-	return xp;
+	return &(jls->list[jls->next++]);
 }
 
 void
 jails_done(jails *jls)
 {
-	memset(jls->data, 0, jls->length);
-	free(jls->data);
-	jls->data = NULL;
-	jls->length = 0;
-	jls->last = NULL;
+	if(jls->list)
+		memset(jls->list, 0, sizeof(jail_info) * jls->count);
+	free(jls->list);
+	jls->list = NULL;
+	jls->count = 0;
+	jls->next = 0;
 }
 
-struct xprison*
+jail_info*
 jails_find(jails *jls, const char* str)
 {
-	struct xprison *xp;
+	jail_info *ji;
 	char *e;
 	int jid;
 
 	jid = strtol(str, &e, 10);
-	jls->last = NULL;
+	jls->next = 0;
 
 	for(;;)
 	{
-		xp = jails_next(jls);
-		if(xp == NULL)
+		ji = jails_next(jls);
+		if(ji == NULL)
 			return NULL;
 
 		/* If it was all a number ... */
@@ -183,15 +138,15 @@ jails_find(jails *jls, const char* str)
 		{
 			if(jid <= 0)
 				errx(1, "invalid jail id: %s", str);
-			if(jid == xp->pr_id)
-				return xp;
+			if(jid == ji->jid)
+				return ji;
 		}
 
 		/* A host name? */
 		else
 		{
-			if(strcmp(xp->pr_host, str) == 0)
-				return xp;
+			if(strcmp(ji->host, str) == 0)
+				return ji;
 		}
 	}
 
@@ -200,124 +155,96 @@ jails_find(jails *jls, const char* str)
 
 int translate_jail_name(const char* str)
 {
-	struct xprison* xp;
+	jail_info* ji;
 	int jid = -1;
 	jails jls;
 
 	jails_load(&jls);
-	xp = jails_find(&jls, str);
-	if(xp != NULL)
-		jid = xp->pr_id;
+	ji = jails_find(&jls, str);
+	if(ji != NULL)
+		jid = ji->jid;
 	jails_done(&jls);
 
 	return jid;
 }
 
-int kvm_prepare_jail(struct xprison* xp)
-{
-    /*
-     * Basically the kvm routines won't work in a jail unless there's
-     * a /dev/null device for us to use as the file names. If it's
-     * missing we have to create it.
-     */
+/*
+ * A process can't leave its jail, so these only need to be
+ * looked up once.
+ */
+static int g_jailed = -2;
+static int g_jailid = -2;
+static char g_jailname[MAXHOSTNAMELEN];
 
-    struct stat sb;
-    char* path;
-    int nodir = 0;
-    int nonull = 0;
+int running_in_jail()
+{
+    if(g_jailed == -2)
+        g_jailed = jail_backend_get()->jailed();
 
-    path = (char*)alloca(strlen(_PATH_DEVNULL) + 2 + strlen(xp->pr_path));
+    return g_jailed;
+}
 
-    strcpy(path, xp->pr_path);
-    strcat(path, _PATH_DEVNULL);
+int current_jail_id()
+{
+    if(g_jailid != -2)
+        return g_jailid;
 
-    if(stat(path, &sb) == -1)
+    switch(running_in_jail())
     {
-        if(errno == ENOTDIR)
-        {
-            nodir = 1;
-            nonull = 1;
-        }
-
-        else if(errno == ENOENT)
-        {
-            nonull = 1;
-        }
-
-        else
-        {
-            err(1, "couldn't stat file: %s", path);
-        }
-    }
+    case -1:
+        g_jailid = -1;
+        break;
 
-    if(nodir)
-    {
-        strcpy(path, xp->pr_path);
-        strcat(path, _PATH_DEV);
+    case 0:
+        g_jailid = 0;
+        break;
 
-        if(mkdir(path, 0) == -1 ||
-           chmod(path, S_IRWXU | S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH) == -1)
-        {
-            warn("couldn't create %s directory", path);
-            return -1;
-        }
+    default:
+        g_jailid = jail_backend_get()->jail_id();
+        break;
     }
 
-    if(nonull)
-    {
-        mode_t mode = 0666 | S_IFCHR;
-        dev_t dev = makedev(2, 2);
+    return g_jailid;
+}
 
-        strcpy(path, xp->pr_path);
-        strcat(path, _PATH_DEVNULL);
+const char* current_jail_name()
+{
+    if(g_jailname[0])
+        return g_jailname;
 
-        warnx("creating %s device in jail.", path);
+    /* In a jail the host name is the jail's own */
+    if(running_in_jail() != 1)
+        return NULL;
 
-        if(mknod(path, mode, dev) == -1)
-        {
-            warn("couldn't create %s device", path);
-            return -1;
-        }
+    if(gethostname(g_jailname, sizeof(g_jailname)) == -1)
+    {
+        g_jailname[0] = 0;
+        return NULL;
     }
 
-    return 0;
+    g_jailname[sizeof(g_jailname) - 1] = 0;
+    return g_jailname;
 }
 
-/*
- * in_jail
- * This code was written by James E. Quick mailto:jq@quick.com
- * The code may be freely re-used under the terms of the BSD copyright,
- * as long as this comment remains intact.
- */
-
-int running_in_jail()
+int have_privileges()
 {
-    int count;
-    kvm_t* kd = 0;
-    struct kinfo_proc* kp;
-    int  result = -1;
-
-    kd = kvm_open(_PATH_DEVNULL, _PATH_DEVNULL, NULL, O_RDONLY, NULL);
-    if(kd == NULL)
-        return -1;
-
-    kp = kvm_getprocs(kd, KERN_PROC_PID, getpid(), &count);
-
-    if(kp == NULL)
-        result = -1;
-    else
-        result = (kp->ki_flag & P_JAILED) ? 1 : 0;
-
-    kvm_close(kd);
-
-    return result;
+    /* Simulated jails don't need root */
+    return getuid() == 0 ||
+           (jail_backend_get()->flags & JAIL_BACKEND_SIMULATED);
 }
 
-
 int check_jail_command(const char* jail, const char* cmd)
 {
     struct stat sb;
 
+    /* Simulated jails have no file system of their own */
+    if(jail_backend_get()->flags & JAIL_BACKEND_SIMULATED)
+    {
+        warnx("%s%snot running in simulated jail: %s", jail ? jail : "",
+              jail ? ": " : "", cmd);
+        return 0;
+    }
+
     if(stat(cmd, &sb) == -1)
     {
         if(errno == EACCES || errno == ELOOP || errno == ENAMETOOLONG ||
@@ -352,6 +279,8 @@ int check_jail_command(const char* jail, const char* cmd)
 int run_overlay_command(const char* jail, const char* cmd, char* env[],
                         char* args[])
 {
+    setup_passed_fds();
+
     if(args)
         execve(cmd, args, env);
     else
@@ -380,6 +309,7 @@ int run_simple_command(const char* jail, const char* cmd, char* env[],
     /* This is the child here */
     case 0:
         unignore_signals ();
+        setup_passed_fds ();
         if(args)
             execve(cmd, args, env);
         else
@@ -395,6 +325,8 @@ int run_simple_command(const char* jail, const char* cmd, char* env[],
         if(waitpid(pid, &status, 0) == -1)
             err(1, "couldn't wait on child process");
 
+        g_status = status;
+
         /* Return any status codes */
         if(WEXITSTATUS(status) != 0)
         {
@@ -418,6 +350,47 @@ int run_simple_command(const char* jail, const char* cmd, char* env[],
 #define  STDOUT  1
 #define  STDERR  2
 
+#define  MAX_OUTPUT_LINE  1024
+
+static void write_output(const char* buff, size_t len, int opts, int console)
+{
+    timeline_output(buff, len);
+
+    if(opts & JAIL_RUN_STDOUT)
+        write(STDOUT, buff, len);
+
+    if(opts & JAIL_RUN_STDERR)
+        write(STDERR, buff, len);
+
+    if(console != -1)
+        write(console, buff, len);
+}
+
+/*
+ * Collects output into whole lines behind the prefix. Each line
+ * goes out in one write, so that lines from commands running side
+ * by side don't get mixed together.
+ */
+static void write_prefixed(char* line, size_t* linelen, size_t prefixlen,
+                           const char* buff, size_t len, int opts, int console)
+{
+    size_t i;
+
+    for(i = 0; i < len; i++)
+    {
+        line[(*linelen)++] = buff[i];
+
+        if(buff[i] == '\n' || *linelen >= MAX_OUTPUT_LINE - 1)
+        {
+            if(line[*linelen - 1] != '\n')
+                line[(*linelen)++] = '\n';
+
+            write_output(line, *linelen, opts, console);
+            *linelen = prefixlen;
+        }
+    }
+}
+
 int run_dup_command(const char* jail, const char* cmd, char* env[],
                     char* args[], int opts)
 {
@@ -454,6 +427,8 @@ int run_dup_command(const char* jail, const char* cmd, char* env[],
                dup2(outpipe[WRITE_END], STDERR) < 0)
                 exit(errno);
 
+            setup_passed_fds ();
+
             /* Okay, now run whatever command it was */
             if(args)
                 execve(cmd, args, env ? env : environ);
@@ -480,10 +455,19 @@ int run_dup_command(const char* jail, const char* cmd, char* env[],
             int waited = 0;
             fd_set readmask;
             char buff[256];
-            struct timeval timeout = { 0, 10000 };
+            char line[MAX_OUTPUT_LINE];
+            size_t linelen = 0;
+            size_t prefixlen = 0;
+            struct timeval timeout;
 
             FD_ZERO(&readmask);
 
+            if(g_prefix)
+            {
+                snprintf(line, MAX_OUTPUT_LINE / 2, "%s: ", g_prefix);
+                prefixlen = linelen = strlen(line);
+            }
+
             /* Open the console file and write the header */
             if(opts & JAIL_RUN_CONSOLE)
                 console = open(_PATH_CONSOLE, O_WRONLY | O_APPEND);
@@ -496,6 +480,10 @@ int run_dup_command(const char* jail, const char* cmd, char* env[],
             {
                 FD_SET(outpipe[READ_END], &readmask);
 
+                /* Linux select() counts this down, so each time around */
+                timeout.tv_sec = 0;
+                timeout.tv_usec = 10000;
+
                 if(select(FD_SETSIZE, &readmask, NULL, NULL, &timeout) == -1)
                     err(1, "couldn't select");
 
@@ -504,14 +492,11 @@ int run_dup_command(const char* jail, const char* cmd, char* env[],
                     /* Read text */
                     while((ret = read(outpipe[READ_END], buff, 256)) > 0)
                     {
-                        if(opts & JAIL_RUN_STDOUT)
-                            write(STDOUT, buff, ret);
-
-                        if(opts & JAIL_RUN_STDERR)
-                            write(STDERR, buff, ret);
-
-                        if(console != -1)
-                            write(console, buff, ret);
+                        if(g_prefix)
+                            write_prefixed(line, &linelen, prefixlen, buff,
+                                           ret, opts, console);
+                        else
+                            write_output(buff, ret, opts, console);
                     }
                 }
 
@@ -520,16 +505,23 @@ int run_dup_command(const char* jail, const char* cmd, char* env[],
                     break;
 
                 /* If the processes exited then break out */
+                if(waited)
+                    break;
+
+                /* But go around once more for what it wrote last */
                 if(waitpid(pid, &status, WNOHANG) == pid)
-                {
                     waited = 1;
-                    break;
-                }
             }
 
             if(!waited)
                 waitpid(pid, &status, 0);
 
+            g_status = status;
+
+            /* The last line may not have had a newline */
+            if(linelen > prefixlen)
+                write_prefixed(line, &linelen, prefixlen, "\n", 1, opts, console);
+
             /* Return any status codes */
             if(WEXITSTATUS(status) != 0)
             {
@@ -553,9 +545,10 @@ int run_dup_command(const char* jail, const char* cmd, char* env[],
 
 int run_jail_command(const char* jail, const char* cmd, char* args[], int opts)
 {
-    char* env[5];
+    char* env[8];
     char* t;
-    int j;
+    size_t len;
+    int i, j;
 
     memset(env, 0, sizeof(env));
 
@@ -576,12 +569,415 @@ int run_jail_command(const char* jail, const char* cmd, char* args[], int opts)
     MAKE_ENV_VAR("COLUMNS");
     MAKE_ENV_VAR("LINES");
 
+    /* Tell the command about any descriptors we're passing along */
+    if(g_npassfds > 0)
+    {
+        env[j] = alloca(32);
+        sprintf(env[j], "LISTEN_FDS=%d", g_npassfds);
+        j++;
+
+        env[j++] = g_listenpid;
+
+        for(i = 0, len = sizeof("LISTEN_FDNAMES="); i < g_npassfds; i++)
+            len += strlen(g_passnames[i] ? g_passnames[i] : "unknown") + 1;
+
+        env[j] = alloca(len);
+        strcpy(env[j], "LISTEN_FDNAMES=");
+        for(i = 0; i < g_npassfds; i++)
+        {
+            if(i > 0)
+                strcat(env[j], ":");
+            strcat(env[j], g_passnames[i] ? g_passnames[i] : "unknown");
+        }
+        j++;
+    }
+
     if(opts & JAIL_RUN_OUTPUT)
         return run_dup_command(jail, cmd, env, args, opts);
     else
         return run_simple_command(jail, cmd, env, args, opts);
 }
 
+void pass_jail_fds(const int* fds, const char** names, int nfds)
+{
+    /*
+     * Commands run after this inherit these descriptors, starting
+     * at descriptor 3, and find their number in LISTEN_FDS. This is
+     * the same convention as systemd socket activation: LISTEN_PID
+     * is the command's own pid, and a script hands the descriptors
+     * on by setting it to its daemon's before exec'ing it.
+     */
+    free(g_passfds);
+    free(g_passnames);
+    g_passfds = NULL;
+    g_passnames = NULL;
+    g_npassfds = 0;
+
+    if(fds == NULL || nfds <= 0)
+        return;
+
+    g_passfds = (int*)malloc(sizeof(int) * nfds);
+    g_passnames = (const char**)malloc(sizeof(char*) * nfds);
+    if(!g_passfds || !g_passnames)
+        errx(1, "out of memory");
+
+    memcpy(g_passfds, fds, sizeof(int) * nfds);
+    memcpy(g_passnames, names, sizeof(char*) * nfds);
+    g_npassfds = nfds;
+}
+
+void keep_jail_fds(const char* name)
+{
+    int i, n;
+
+    for(i = 0, n = 0; i < g_npassfds; i++)
+    {
+        if(g_passnames[i] && strcmp(g_passnames[i], name) == 0)
+        {
+            g_passfds[n] = g_passfds[i];
+            g_passnames[n] = g_passnames[i];
+            n++;
+        }
+    }
+
+    g_npassfds = n;
+}
+
+void prefix_jail_output(const char* prefix)
+{
+    g_prefix = prefix;
+}
+
+int jail_command_status(void)
+{
+    return g_status;
+}
+
+static void setup_passed_fds(void)
+{
+    int* tmp;
+    int i;
+
+    if(g_npassfds <= 0)
+        return;
+
+    snprintf(g_listenpid, sizeof(g_listenpid), "LISTEN_PID=%d", (int)getpid());
+
+    /*
+     * Move everything out of the way first, so that we don't
+     * clobber one passed descriptor with another.
+     */
+    tmp = (int*)alloca(sizeof(int) * g_npassfds);
+    for(i = 0; i < g_npassfds; i++)
+    {
+        tmp[i] = fcntl(g_passfds[i], F_DUPFD, 3 + g_npassfds);
+        if(tmp[i] == -1)
+            exit(errno);
+    }
+
+    for(i = 0; i < g_npassfds; i++)
+    {
+        if(dup2(tmp[i], 3 + i) == -1)
+            exit(errno);
+        close(tmp[i]);
+    }
+}
+
+/* Reads a list of addresses from a file, or stdin for '-' */
+static char* read_addresses(const char* file)
+{
+    char* data = NULL;
+    size_t len = 0;
+    size_t size = 0;
+    size_t r;
+    FILE* f;
+
+    if(strcmp(file, "-") == 0)
+        f = stdin;
+    else if((f = fopen(file, "r")) == NULL)
+        err(1, "couldn't open address file: %s", file);
+
+    do
+    {
+        if(len + 1 >= size)
+        {
+            size = size ? size * 2 : 16384;
+            if((data = (char*)realloc(data, size)) == NULL)
+                errx(1, "out of memory");
+        }
+
+        r = fread(data + len, 1, size - len - 1, f);
+        len += r;
+    }
+    while(r > 0);
+
+    if(ferror(f))
+        err(1, "couldn't read address file: %s", file);
+
+    if(f != stdin)
+        fclose(f);
+
+    data[len] = 0;
+    return data;
+}
+
+/* For anything inet_pton() doesn't do, like scoped addresses */
+static int resolve_address(const char* ip, int family, void* addr)
+{
+    struct addrinfo hints, *res;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_protocol = IPPROTO_TCP;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_family = family;
+    hints.ai_flags = AI_NUMERICHOST;
+
+    if(getaddrinfo(ip, NULL, &hints, &res) != 0)
+        return 0;
+
+    if(family == AF_INET)
+        memcpy(addr, &((struct sockaddr_in*)res->ai_addr)->sin_addr,
+               sizeof(struct in_addr));
+#ifdef HAVE_INET6
+    else
+        memcpy(addr, &((struct sockaddr_in6*)res->ai_addr)->sin6_addr,
+               sizeof(struct in6_addr));
+#endif
+
+    freeaddrinfo(res);
+    return 1;
+}
+
+/* Plain dotted quads, the common case, without going through libc */
+static int parse_ip4(const char* s, struct in_addr* addr)
+{
+    u_int32_t ip = 0;
+    u_int32_t part;
+    int dots = 0;
+    int digits;
+
+    for(;;)
+    {
+        for(part = 0, digits = 0; *s >= '0' && *s <= '9'; s++, digits++)
+            part = part * 10 + (*s - '0');
+
+        if(digits == 0 || digits > 3 || part > 255)
+            return 0;
+
+        ip = (ip << 8) | part;
+
+        if(*s == 0)
+            break;
+
+        if(*s++ != '.' || ++dots > 3)
+            return 0;
+    }
+
+    if(dots != 3)
+        return 0;
+
+    addr->s_addr = htonl(ip);
+    return 1;
+}
+
+static int compare_ip4(const void* a, const void* b)
+{
+    return memcmp(a, b, sizeof(struct in_addr));
+}
+
+/*
+ * There can be thousands of these, so rather than qsort() do a
+ * radix sort, a byte at a time starting with the last one.
+ */
+static void sort_ip4(struct in_addr* addrs, unsigned int n)
+{
+    struct in_addr* tmp;
+    struct in_addr* from;
+    struct in_addr* to;
+    struct in_addr* swap;
+    unsigned int count[256];
+    unsigned int i, sum, c;
+    int byte;
+
+    if(n < 64)
+    {
+        qsort(addrs, n, sizeof(struct in_addr), compare_ip4);
+        return;
+    }
+
+    if((tmp = (struct in_addr*)malloc(n * sizeof(struct in_addr))) == NULL)
+        errx(1, "out of memory");
+
+    from = addrs;
+    to = tmp;
+
+    for(byte = 3; byte >= 0; byte--)
+    {
+        memset(count, 0, sizeof(count));
+        for(i = 0; i < n; i++)
+            count[((unsigned char*)&from[i].s_addr)[byte]]++;
+
+        for(i = 0, sum = 0; i < 256; i++)
+        {
+            c = count[i];
+            count[i] = sum;
+            sum += c;
+        }
+
+        for(i = 0; i < n; i++)
+            to[count[((unsigned char*)&from[i].s_addr)[byte]]++] = from[i];
+
+        swap = from;
+        from = to;
+        to = swap;
+    }
+
+    /* An even number of passes, so it's back where it started */
+    free(tmp);
+}
+
+#ifdef HAVE_INET6
+static int compare_ip6(const void* a, const void* b)
+{
+    return memcmp(a, b, sizeof(struct in6_addr));
+}
+#endif
+
+/*
+ * The first address is the jail's primary one and stays put. The
+ * rest get sorted, which is also the order the kernel wants them
+ * in, and any duplicates dropped.
+ */
+static unsigned int unique_addresses(void* addrs, unsigned int n, size_t size,
+                                     int (*compare)(const void*, const void*))
+{
+    char* base = (char*)addrs;
+    unsigned int i, out;
+
+    if(n < 2)
+        return n;
+
+    if(size == sizeof(struct in_addr))
+        sort_ip4((struct in_addr*)(base + size), n - 1);
+    else
+        qsort(base + size, n - 1, size, compare);
+
+    for(i = 1, out = 1; i < n; i++)
+    {
+        if(compare(base + i * size, base) == 0)
+            continue;
+        if(out > 1 && compare(base + i * size, base + (out - 1) * size) == 0)
+            continue;
+        if(out != i)
+            memcpy(base + out * size, base + i * size, size);
+        out++;
+    }
+
+    return out;
+}
+
+/* Returns the first address that isn't valid, or NULL when they all are */
+static char* parse_addresses(char* arg, jail_spec* j)
+{
+    char* ip;
+    char* p;
+    size_t max = 1;
+
+    /* Size the arrays for the worst case up front */
+    for(p = arg; *p; p++)
+    {
+        if(*p == ',' || isspace((unsigned char)*p))
+            max++;
+    }
+
+    j->ip4 = (struct in_addr*)malloc(max * sizeof(struct in_addr));
+    if(j->ip4 == NULL)
+        errx(1, "out of memory");
+
+#ifdef HAVE_INET6
+    j->ip6 = (struct in6_addr*)malloc(max * sizeof(struct in6_addr));
+    if(j->ip6 == NULL)
+        errx(1, "out of memory");
+#endif
+
+    for(ip = strtok(arg, ", \t\r\n"); ip; ip = strtok(NULL, ", \t\r\n"))
+    {
+        if(strchr(ip, ':') == NULL)
+        {
+            if(!parse_ip4(ip, j->ip4 + j->ip4s) &&
+               inet_pton(AF_INET, ip, j->ip4 + j->ip4s) != 1 &&
+               !resolve_address(ip, AF_INET, j->ip4 + j->ip4s))
+                return ip;
+            j->ip4s++;
+        }
+        else
+        {
+#ifdef HAVE_INET6
+            if(inet_pton(AF_INET6, ip, j->ip6 + j->ip6s) != 1 &&
+               !resolve_address(ip, AF_INET6, j->ip6 + j->ip6s))
+                return ip;
+            j->ip6s++;
+#else
+            return ip;
+#endif
+        }
+    }
+
+    j->ip4s = unique_addresses(j->ip4, j->ip4s, sizeof(struct in_addr), compare_ip4);
+#ifdef HAVE_INET6
+    j->ip6s = unique_addresses(j->ip6, j->ip6s, sizeof(struct in6_addr), compare_ip6);
+#endif
+
+    return NULL;
+}
+
+void jail_addresses(char* arg, jail_spec* j)
+{
+    char* data = NULL;
+    char* bad;
+
+    j->ip4s = j->ip6s = 0;
+    j->ip4 = NULL;
+    j->ip6 = NULL;
+
+    /* Lots of addresses come from a file */
+    if(arg[0] == '@')
+        arg = data = read_addresses(arg + 1);
+
+    bad = parse_addresses(arg, j);
+    if(bad != NULL)
+        errx(1, "invalid ip address: %s", bad);
+
+    free(data);
+}
+
+int jail_addresses_parse(char* arg, jail_spec* j)
+{
+    j->ip4s = j->ip6s = 0;
+    j->ip4 = NULL;
+    j->ip6 = NULL;
+
+    /* No files, they're only for whoever runs us */
+    if(arg[0] == '@' || parse_addresses(arg, j) != NULL ||
+       j->ip4s + j->ip6s == 0)
+    {
+        jail_addresses_free(j);
+        j->ip4s = j->ip6s = 0;
+        errno = EINVAL;
+        return -1;
+    }
+
+    return 0;
+}
+
+void jail_addresses_free(jail_spec* j)
+{
+    free(j->ip4);
+    free(j->ip6);
+    j->ip4 = NULL;
+    j->ip6 = NULL;
+}
+
 void ignore_signals(void)
 {
     signal(SIGHUP, SIG_IGN);
@@ -596,3 +992,24 @@ void unignore_signals(void)
     signal(SIGTERM, SIG_DFL);
 }
 
+#ifndef HAVE_STRLCPY
+
+size_t strlcpy(char* dst, const char* src, size_t len)
+{
+    size_t ret = strlen(src);
+
+    if(len > 0)
+    {
+        if(ret < len)
+            memcpy(dst, src, ret + 1);
+        else
+        {
+            memcpy(dst, src, len - 1);
+            dst[len - 1] = 0;
+        }
+    }
+
+    return ret;
+}
+
+#endif /* HAVE_STRLCPY */
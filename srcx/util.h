@@ -39,20 +39,26 @@
 #ifndef __UTIL_H__
 #define __UTIL_H__
 
-struct xprison;
+#include <sys/types.h>
+
+struct jail_info;
+struct jail_spec;
 
 int translate_jail_name(const char* str);
 int running_in_jail();
+int current_jail_id();
+const char* current_jail_name();
+int have_privileges();
 
 typedef struct jails {
-	void *data;
-	size_t length;
-	struct xprison *last;
+	struct jail_info *list;
+	size_t count;
+	size_t next;
 } jails;
 
 void jails_load(jails *jls);
-struct xprison* jails_next(jails *jls);
-struct xprison* jails_find(jails *jls, const char *str);
+struct jail_info* jails_next(jails *jls);
+struct jail_info* jails_find(jails *jls, const char *str);
 void jails_done(jails *jls);
 
 #define JAIL_RUN_CONSOLE	0x00000001	/* Output stuff to the jail console if available */
@@ -64,11 +70,37 @@ void jails_done(jails *jls);
 
 int run_jail_command(const char* jail, const char* cmd, char* args[], int opts);
 int check_jail_command(const char* jail, const char* cmd);
+void pass_jail_fds(const int* fds, const char** names, int nfds);
+
+/* Only pass on the descriptors with this name, in a child about to run it */
+void keep_jail_fds(const char* name);
+
+/* Put 'prefix: ' in front of each line of output from commands run */
+void prefix_jail_output(const char* prefix);
+
+/* The wait(2) status of the last command run_jail_command() forked */
+int jail_command_status(void);
+
+/*
+ * Parses comma separated addresses into the spec, or reads them
+ * from a file when given as @file, or stdin for @-.
+ */
+void jail_addresses(char* arg, struct jail_spec* j);
+void jail_addresses_free(struct jail_spec* j);
+
+/*
+ * The same for addresses from someone else, such as a client. Only
+ * numeric addresses, and at least one. Returns -1 when any isn't
+ * valid, with nothing to free.
+ */
+int jail_addresses_parse(char* arg, struct jail_spec* j);
 
 void ignore_signals(void);
 void unignore_signals(void);
 
-int kvm_prepare_jail(struct xprison* xp);
+#ifndef HAVE_STRLCPY
+size_t strlcpy(char* dst, const char* src, size_t len);
+#endif
 
 #endif /* __UTIL_H__ */
 